@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Types.hpp"
+#include "Matrix.hpp"
+#include "Gemm.hpp"
+#include "Dataset.hpp"
+#include "ModelContext.hpp"
+#include "ModelTrainingDesc.hpp"
+#include "MnistModel.hpp"
+#include "Optimizer.hpp"
+#include "PRNG.hpp"
+#include "ThreadPool.hpp"
+#include "VecMath.hpp"
+
+// Kernel and end-to-end throughput as JSON, for tracking regressions between
+// versions. Everything runs on synthetic data, so no dataset files are needed.
+//
+// Each kernel entry has its shape ([m, n, k] for products, [rows, cols]
+// otherwise), the best time per call, and the GFLOP/s and GB/s that implies.
+// Bytes are the minimum traffic: every operand read once, every result
+// written once (read too when it is accumulated into). An exp or log counts
+// as one flop.
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    struct BenchOptions {
+        double min_time = 0.5;   // seconds spent measuring each benchmark
+        u32 samples = 5;         // the fastest of this many runs is reported
+        bool quick = false;
+        const char* data_dir = ".";
+    };
+
+    // Seconds per call of fn. The repeat count is calibrated so each of the
+    // opts.samples runs takes about min_time / samples.
+    template <typename Fn>
+    double time_per_call(const BenchOptions& opts, Fn fn) {
+        fn();
+
+        double target = opts.min_time / opts.samples;
+        u64 iters = 1;
+        for (;;) {
+            auto start = Clock::now();
+            for (u64 i = 0; i < iters; i++) fn();
+            double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            if (elapsed >= target) break;
+            u64 scaled = (elapsed > 0.0) ? static_cast<u64>(iters * target / elapsed * 1.1) : iters * 10;
+            iters = std::max(iters * 2, scaled);
+        }
+
+        double best = 1e30;
+        for (u32 s = 0; s < opts.samples; s++) {
+            auto start = Clock::now();
+            for (u64 i = 0; i < iters; i++) fn();
+            double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            best = std::min(best, elapsed / iters);
+        }
+        return best;
+    }
+
+    // Entries of the JSON output, already formatted
+    struct Report {
+        std::vector<std::string> kernels;
+        std::vector<std::string> end_to_end;
+    };
+
+    std::string shape_json(std::initializer_list<u32> dims) {
+        std::string s = "[";
+        for (u32 d : dims) {
+            if (s.size() > 1) s += ", ";
+            s += std::to_string(d);
+        }
+        return s + "]";
+    }
+
+    void add_kernel(Report& report, const char* name, const char* dtype, const std::string& shape,
+        double seconds, double flops, double bytes) {
+        char buf[512];
+        std::snprintf(buf, sizeof(buf),
+            "{\"name\": \"%s\", \"dtype\": \"%s\", \"shape\": %s, \"ns_per_call\": %.1f, "
+            "\"gflops\": %.3f, \"gbps\": %.3f}",
+            name, dtype, shape.c_str(), seconds * 1e9, flops / seconds * 1e-9, bytes / seconds * 1e-9);
+        report.kernels.push_back(buf);
+        std::fprintf(stderr, "  %-32s %-5s %-18s %10.1f ns  %8.2f GFLOP/s  %8.2f GB/s\n",
+            name, dtype, shape.c_str(), seconds * 1e9, flops / seconds * 1e-9, bytes / seconds * 1e-9);
+    }
+
+    template <typename T>
+    MatrixT<T> random_matrix(u32 rows, u32 cols, f32 lower, f32 upper) {
+        MatrixT<T> m(rows, cols);
+        m.fill_rand(lower, upper);
+        return m;
+    }
+
+    // ------------------------------------------------------------------------
+    // Kernels
+    // ------------------------------------------------------------------------
+
+    struct MulShape {
+        u32 m, n, k;
+    };
+
+    template <typename T>
+    void bench_mul(Report& report, const BenchOptions& opts, const char* dtype, MulShape s,
+        bool transpose_a, bool transpose_b, const char* name) {
+        // Operands as stored, before the transpose
+        auto a = random_matrix<T>(transpose_a ? s.k : s.m, transpose_a ? s.m : s.k, -1.0f, 1.0f);
+        auto b = random_matrix<T>(transpose_b ? s.n : s.k, transpose_b ? s.k : s.n, -1.0f, 1.0f);
+        MatrixT<T> out(s.m, s.n);
+
+        double t = time_per_call(opts, [&]() { MatOps::mul(out, a, b, true, transpose_a, transpose_b); });
+        double flops = 2.0 * s.m * s.n * s.k;
+        double bytes = static_cast<double>(a.size() + b.size() + out.size()) * sizeof(T);
+        add_kernel(report, name, dtype, shape_json({ s.m, s.n, s.k }), t, flops, bytes);
+    }
+
+    void bench_products(Report& report, const BenchOptions& opts) {
+        // MNIST layer shapes at batch 256, then square sizes
+        std::vector<MulShape> shapes = {
+            { 16, 256, 784 }, { 16, 256, 16 }, { 10, 256, 16 },
+            { 64, 64, 64 }, { 128, 128, 128 }, { 256, 256, 256 },
+        };
+        if (!opts.quick) {
+            shapes.push_back({ 512, 512, 512 });
+            shapes.push_back({ 1024, 1024, 1024 });
+        }
+
+        for (const MulShape& s : shapes) {
+            bench_mul<f32>(report, opts, "f32", s, false, false, "mul_nn");
+            bench_mul<f32>(report, opts, "f32", s, false, true, "mul_nt");
+            bench_mul<f32>(report, opts, "f32", s, true, false, "mul_tn");
+            bench_mul<f32>(report, opts, "f32", s, true, true, "mul_tt");
+            bench_mul<bf16>(report, opts, "bf16", s, false, false, "mul_nn");
+        }
+    }
+
+    template <typename T>
+    void bench_elementwise(Report& report, const BenchOptions& opts, const char* dtype, u32 rows, u32 cols) {
+        double n = static_cast<double>(rows) * cols;
+        double size = sizeof(T);
+        std::string shape = shape_json({ rows, cols });
+
+        auto x = random_matrix<T>(rows, cols, -1.0f, 1.0f);
+        MatrixT<T> y(rows, cols);
+        MatrixT<T> probs(rows, cols);
+        MatOps::softmax(probs, x);
+        auto targets = random_matrix<T>(rows, cols, 0.0f, 1.0f);
+
+        MatrixT<T> labels(1, cols);
+        // Class indices stay below 256, where bf16 holds every integer exactly
+        u32 classes = std::min(rows, 256u);
+        for (u32 c = 0; c < cols; c++) labels.data[c] = from_f32<T>(static_cast<f32>(prng_rand() % classes));
+        MatrixT<T> losses(1, cols);
+        MatOps::softmax_cross_entropy(losses, x, labels);
+
+        // Gradients are always f32
+        auto grad = random_matrix<f32>(rows, cols, -1.0f, 1.0f);
+        auto loss_grad = random_matrix<f32>(1, cols, 0.0f, 1.0f);
+        Matrix in_grad(rows, cols);
+        Matrix other_grad(rows, cols);
+        double g = sizeof(f32);
+
+        double t = time_per_call(opts, [&]() { MatOps::relu(y, x); });
+        add_kernel(report, "relu", dtype, shape, t, n, n * 2 * size);
+
+        t = time_per_call(opts, [&]() { MatOps::softmax(y, x); });
+        add_kernel(report, "softmax", dtype, shape, t, n * 5, n * 2 * size);
+
+        t = time_per_call(opts, [&]() { MatOps::cross_entropy(y, targets, probs); });
+        add_kernel(report, "cross_entropy", dtype, shape, t, n * 3, n * 3 * size);
+
+        t = time_per_call(opts, [&]() { MatOps::softmax_cross_entropy(losses, x, labels); });
+        add_kernel(report, "softmax_cross_entropy", dtype, shape, t, n * 4, n * size + cols * 2 * size);
+
+        t = time_per_call(opts, [&]() { MatOps::relu_add_grad(in_grad, x, grad); });
+        add_kernel(report, "relu_add_grad", dtype, shape, t, n, n * (size + 3 * g));
+
+        t = time_per_call(opts, [&]() { MatOps::softmax_add_grad(in_grad, probs, grad); });
+        add_kernel(report, "softmax_add_grad", dtype, shape, t, n * 5, n * (size + 3 * g));
+
+        t = time_per_call(opts, [&]() {
+            MatOps::cross_entropy_add_grad(&in_grad, &other_grad, targets, probs, grad);
+        });
+        add_kernel(report, "cross_entropy_add_grad", dtype, shape, t, n * 6, n * (2 * size + 5 * g));
+
+        t = time_per_call(opts, [&]() {
+            MatOps::softmax_cross_entropy_add_grad(in_grad, x, labels, losses, loss_grad);
+        });
+        add_kernel(report, "softmax_cross_entropy_add_grad", dtype, shape, t, n * 4,
+            n * (size + 2 * g) + cols * (2 * size + g));
+    }
+
+    // VecMath and the PRNG's bulk fills over n contiguous floats; one flop
+    // per element
+    void bench_vecmath(Report& report, const BenchOptions& opts, u32 n) {
+        std::string shape = shape_json({ n });
+        auto x = random_matrix<f32>(1, n, -10.0f, 10.0f);
+        auto positive = random_matrix<f32>(1, n, 1e-6f, 10.0f);
+        Matrix y(1, n);
+
+        double t = time_per_call(opts, [&]() { VecMath::exp(x.data, y.data, n); });
+        add_kernel(report, "exp", "f32", shape, t, n, n * 2.0 * sizeof(f32));
+        t = time_per_call(opts, [&]() { VecMath::log(positive.data, y.data, n); });
+        add_kernel(report, "log", "f32", shape, t, n, n * 2.0 * sizeof(f32));
+
+        PRNG prng(1);
+        t = time_per_call(opts, [&]() { prng.fill_uniform(y.data, n, -1.0f, 1.0f); });
+        add_kernel(report, "prng_uniform", "f32", shape, t, n, n * 1.0 * sizeof(f32));
+        t = time_per_call(opts, [&]() { prng.fill_normal(y.data, n); });
+        add_kernel(report, "prng_normal", "f32", shape, t, n, n * 1.0 * sizeof(f32));
+    }
+
+    // One optimizer step over a (1 x n) slab. Flops per element: 3 for SGD,
+    // 7 for momentum, 16 for Adam (sqrt and divide one each).
+    void bench_optimizers(Report& report, const BenchOptions& opts, u32 n) {
+        struct Variant {
+            OptimizerKind kind;
+            const char* name;
+            double flops;
+        };
+        const Variant variants[] = {
+            { OptimizerKind::SGD, "optimizer_sgd", 3 },
+            { OptimizerKind::Momentum, "optimizer_momentum", 7 },
+            { OptimizerKind::Adam, "optimizer_adam", 16 },
+            { OptimizerKind::AdamW, "optimizer_adamw", 16 },
+        };
+
+        auto params = random_matrix<f32>(1, n, -1.0f, 1.0f);
+        auto grads = random_matrix<f32>(1, n, -1.0f, 1.0f);
+        for (const Variant& v : variants) {
+            OptimizerDesc desc;
+            desc.kind = v.kind;
+            auto optimizer = Optimizer::create(desc, n);
+
+            double t = time_per_call(opts, [&]() { optimizer->step(params, grads, 1e-6f, 1.0f); });
+            double bytes = (3.0 + 2.0 * optimizer->num_state_slabs()) * n * sizeof(f32);
+            add_kernel(report, v.name, "f32", shape_json({ 1, n }), t, v.flops * n, bytes);
+        }
+    }
+
+    void bench_kernels(Report& report, const BenchOptions& opts) {
+        std::fprintf(stderr, "Kernels (GEMM: %s)\n", Gemm::isa_name(Gemm::isa()));
+        bench_products(report, opts);
+
+        std::vector<std::pair<u32, u32>> shapes = { { 10, 256 }, { 16, 256 }, { 784, 256 } };
+        if (!opts.quick) shapes.push_back({ 1024, 1024 });
+        for (const auto& s : shapes) {
+            bench_elementwise<f32>(report, opts, "f32", s.first, s.second);
+            bench_elementwise<bf16>(report, opts, "bf16", s.first, s.second);
+        }
+
+        bench_vecmath(report, opts, 2560);
+        if (!opts.quick) bench_vecmath(report, opts, 1u << 20);
+
+        // The MNIST model's parameter slab, then one well past the caches
+        ModelContext model;
+        create_mnist_model(model);
+        bench_optimizers(report, opts, static_cast<u32>(model.param_slab().size()));
+        if (!opts.quick) bench_optimizers(report, opts, 1u << 22);
+    }
+
+    // ------------------------------------------------------------------------
+    // End to end
+    // ------------------------------------------------------------------------
+
+    void add_end_to_end(Report& report, const char* name, const char* storage, u32 batch_size,
+        u32 num_threads, double seconds, double samples) {
+        char buf[512];
+        std::snprintf(buf, sizeof(buf),
+            "{\"name\": \"%s\", \"storage\": \"%s\", \"batch_size\": %u, \"threads\": %u, "
+            "\"seconds\": %.6f, \"samples_per_sec\": %.1f}",
+            name, storage, batch_size, num_threads, seconds, samples / seconds);
+        report.end_to_end.push_back(buf);
+        std::fprintf(stderr, "  %-26s %-5s batch %5u  threads %2u  %12.0f samples/s\n",
+            name, storage, batch_size, num_threads, samples / seconds);
+    }
+
+    void fill_batch(ModelContext& model) {
+        model.input->val.fill_rand(0.0f, 1.0f);
+        u32 classes = model.output->val.rows;
+        for (u32 c = 0; c < model.batch_size; c++) {
+            model.desired_output->val.data[c] = static_cast<f32>(prng_rand() % classes);
+        }
+    }
+
+    // Forward (forward_prog) and forward + backward (cost_prog and its
+    // gradient schedule) on one batch, in the calling thread
+    void bench_passes(Report& report, const BenchOptions& opts, bool bf16_storage) {
+        const char* storage = bf16_storage ? "bf16" : "f32";
+        for (u32 batch_size : { 1u, 50u, 256u }) {
+            ModelContext model;
+            create_mnist_model(model);
+            ModelCompileDesc desc;
+            desc.bf16_storage = bf16_storage;
+            model.compile(desc);
+            model.set_batch_size(batch_size);
+            fill_batch(model);
+
+            double t = time_per_call(opts, [&]() { model.feedforward(); });
+            add_end_to_end(report, "forward", storage, batch_size, 1, t, batch_size);
+
+            t = time_per_call(opts, [&]() { model.compute_gradients(); });
+            add_end_to_end(report, "forward_backward", storage, batch_size, 1, t, batch_size);
+
+            // Backprop recomputing dropped activations instead of holding them
+            desc.recompute = true;
+            model.compile(desc);
+            model.set_batch_size(batch_size);
+            fill_batch(model);
+            t = time_per_call(opts, [&]() { model.compute_gradients(); });
+            add_end_to_end(report, "forward_backward_recompute", storage, batch_size, 1, t, batch_size);
+            desc.recompute = false;
+
+            // The same forward pass on the shape-specialized kernels
+            if (bf16_storage) continue;
+            desc.static_kernels = true;
+            model.compile(desc);
+            if (!model.uses_static_kernels()) continue;
+            model.set_batch_size(batch_size);
+            fill_batch(model);
+            t = time_per_call(opts, [&]() { model.feedforward(); });
+            add_end_to_end(report, "forward_static", storage, batch_size, 1, t, batch_size);
+        }
+    }
+
+    // Writes a (rows x cols) f32 .mat file and converts it like the real
+    // MNIST files are, so training reads the same u8 datasets
+    std::unique_ptr<Dataset> synthetic_dataset(const BenchOptions& opts, const char* name,
+        u32 rows, u32 cols, bool labels, std::vector<std::string>& files) {
+        std::string base = std::string(opts.data_dir) + "/mnist_bench_" + name;
+        std::string mat_path = base + ".mat";
+        std::string path = base + ".mnds";
+
+        // Images are about 80% zeros, like MNIST digits
+        std::vector<f32> values(static_cast<u64>(rows) * cols);
+        for (f32& v : values) {
+            if (labels) v = static_cast<f32>(prng_rand() % 10);
+            else v = prng_randf() < 0.2f ? prng_randf() : 0.0f;
+        }
+        {
+            std::ofstream out(mat_path, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(f32));
+        }
+        files.push_back(mat_path);
+
+        f32 scale = labels ? 1.0f : 1.0f / 255.0f;
+        if (!Dataset::convert_mat(mat_path.c_str(), path.c_str(), rows, cols, DatasetType::U8, scale, 0.0f)) {
+            return nullptr;
+        }
+        files.push_back(path);
+        return Dataset::open(path.c_str());
+    }
+
+    bool bench_epochs(Report& report, const BenchOptions& opts) {
+        u32 num_train = opts.quick ? 6000 : 30000;
+        u32 num_test = 1000;
+        std::vector<std::string> files;
+        bool ok = true;
+
+        {
+            auto train_images = synthetic_dataset(opts, "train_images", num_train, 784, false, files);
+            auto train_labels = synthetic_dataset(opts, "train_labels", num_train, 1, true, files);
+            auto test_images = synthetic_dataset(opts, "test_images", num_test, 784, false, files);
+            auto test_labels = synthetic_dataset(opts, "test_labels", num_test, 1, true, files);
+            ok = train_images && train_labels && test_images && test_labels;
+
+            std::vector<u32> thread_counts = { 1 };
+            if (ThreadPool::hardware_threads() > 1) thread_counts.push_back(ThreadPool::hardware_threads());
+
+            for (u32 threads : thread_counts) {
+                if (!ok) break;
+                // f32 with and without the sparse first layer, bf16, then
+                // Hogwild where there are threads to run it on
+                for (u32 config = 0; config < 4; config++) {
+                    bool bf16_storage = config == 2;
+                    bool sparse_input = config != 1;
+                    bool hogwild = config == 3;
+                    if (hogwild && threads == 1) continue;
+                    ModelContext model;
+                    create_mnist_model(model);
+                    ModelCompileDesc compile_desc;
+                    compile_desc.bf16_storage = bf16_storage;
+                    compile_desc.sparse_input = sparse_input;
+                    model.compile(compile_desc);
+
+                    // One epoch: every training batch, then the test set
+                    ModelTrainingDesc desc;
+                    desc.train_images = train_images.get();
+                    desc.train_labels = train_labels.get();
+                    desc.test_images = test_images.get();
+                    desc.test_labels = test_labels.get();
+                    desc.epochs = 1;
+                    desc.batch_size = 50;
+                    desc.num_threads = threads;
+                    desc.hogwild = hogwild;
+                    desc.verbose = false;
+
+                    auto start = Clock::now();
+                    model.train(desc);
+                    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+                    const char* name = hogwild ? "epoch_hogwild" : sparse_input ? "epoch" : "epoch_dense_input";
+                    add_end_to_end(report, name,
+                        bf16_storage ? "bf16" : "f32", desc.batch_size, threads, seconds, num_train);
+                }
+            }
+        }
+
+        for (const std::string& file : files) std::remove(file.c_str());
+        return ok;
+    }
+
+    void write_json(std::FILE* out, const Report& report) {
+        auto write_list = [&](const char* key, const std::vector<std::string>& entries, bool last) {
+            std::fprintf(out, "  \"%s\": [\n", key);
+            for (size_t i = 0; i < entries.size(); i++) {
+                std::fprintf(out, "    %s%s\n", entries[i].c_str(), i + 1 < entries.size() ? "," : "");
+            }
+            std::fprintf(out, "  ]%s\n", last ? "" : ",");
+        };
+
+        std::fprintf(out, "{\n");
+        std::fprintf(out, "  \"format_version\": 1,\n");
+#if defined(__VERSION__)
+        std::fprintf(out, "  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+        std::fprintf(out, "  \"gemm_isa\": \"%s\",\n", Gemm::isa_name(Gemm::isa()));
+        std::fprintf(out, "  \"hardware_threads\": %u,\n", ThreadPool::hardware_threads());
+        write_list("kernels", report.kernels, false);
+        write_list("end_to_end", report.end_to_end, true);
+        std::fprintf(out, "}\n");
+    }
+
+    void print_usage() {
+        std::fprintf(stderr,
+            "Usage: mnist_bench [--quick] [--min-time SECONDS] [--out FILE] [--data-dir DIR]\n"
+            "  --quick           smaller shape sweep and a shorter epoch\n"
+            "  --min-time S      seconds spent measuring each benchmark (default 0.5)\n"
+            "  --out FILE        write the JSON there instead of stdout\n"
+            "  --data-dir DIR    where the synthetic datasets are written (default .)\n"
+            "  --kernels-only    skip the end-to-end benchmarks\n"
+        );
+    }
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchOptions opts;
+    const char* out_path = nullptr;
+    bool kernels_only = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--quick") == 0) {
+            opts.quick = true;
+            opts.min_time = 0.1;
+        } else if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            opts.min_time = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--data-dir") == 0 && i + 1 < argc) {
+            opts.data_dir = argv[++i];
+        } else if (std::strcmp(argv[i], "--kernels-only") == 0) {
+            kernels_only = true;
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    // Every run measures the same synthetic data
+    PRNG::set_seed(1);
+
+    Report report;
+    bench_kernels(report, opts);
+
+    if (!kernels_only) {
+        std::fprintf(stderr, "End to end\n");
+        bench_passes(report, opts, false);
+        bench_passes(report, opts, true);
+        if (!bench_epochs(report, opts)) {
+            std::fprintf(stderr, "Failed to create synthetic datasets in %s\n", opts.data_dir);
+            return 1;
+        }
+    }
+
+    std::FILE* out = stdout;
+    if (out_path != nullptr) {
+        out = std::fopen(out_path, "w");
+        if (out == nullptr) {
+            std::fprintf(stderr, "Failed to create file: %s\n", out_path);
+            return 1;
+        }
+    }
+    write_json(out, report);
+    if (out != stdout) std::fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "Types.hpp"
+#include "Matrix.hpp"
+#include "Dataset.hpp"
+#include "PRNG.hpp"
+#include "Socket.hpp"
+
+// Closed-loop load for mnist --serve. Every connection keeps depth requests in
+// flight, sending the next as soon as one is answered, and the client-side
+// latency of every request is kept for the percentiles printed at the end.
+// Images come from a dataset file, or are random sparse noise.
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    constexpr u32 INPUT_SIZE = 784;
+    constexpr u32 OUTPUT_SIZE = 10;
+    constexpr u32 MAX_SAMPLES = 1000;
+
+    struct LoadOptions {
+        const char* address = nullptr;
+        u32 connections = 4;
+        u32 depth = 1;
+        double seconds = 5.0;
+        const char* images = nullptr;
+    };
+
+    struct ConnectionResult {
+        std::vector<u32> latencies_us;
+        bool ok = true;
+    };
+
+    void print_usage() {
+        std::printf(
+            "Usage: mnist_loadgen ADDRESS [--connections N] [--depth D] [--seconds S]\n"
+            "                     [--images FILE]\n"
+            "  ADDRESS          where mnist --serve listens, unix:PATH or tcp:HOST:PORT\n"
+            "  --connections N  concurrent clients (default 4)\n"
+            "  --depth D        requests each keeps in flight (default 1)\n"
+            "  --seconds S      how long to send for (default 5)\n"
+            "  --images FILE    send rows of a dataset file (default random pixels)\n"
+        );
+    }
+
+    bool load_samples(const char* path, std::vector<f32>& samples) {
+        if (path == nullptr) {
+            // Roughly as sparse as MNIST: a fifth of the pixels lit
+            samples.resize(static_cast<u64>(MAX_SAMPLES) * INPUT_SIZE);
+            for (f32& pixel : samples) {
+                pixel = prng_randf() < 0.2f ? prng_randf() : 0.0f;
+            }
+            return true;
+        }
+
+        auto dataset = Dataset::open(path);
+        if (!dataset) return false;
+        if (dataset->cols != INPUT_SIZE || dataset->rows == 0) {
+            std::fprintf(stderr, "%s: expected rows of %u pixels\n", path, INPUT_SIZE);
+            return false;
+        }
+        u32 count = std::min(MAX_SAMPLES, dataset->rows);
+        samples.resize(static_cast<u64>(count) * INPUT_SIZE);
+        for (u32 i = 0; i < count; i++) {
+            // A single column is laid out like a row
+            Matrix column = Matrix::view(INPUT_SIZE, 1, samples.data() + static_cast<u64>(i) * INPUT_SIZE);
+            dataset->copy_rows_to_columns(column, i, 1);
+        }
+        return true;
+    }
+
+    // Request ids are slots: a response frees its slot for the next request
+    void run_connection(const LoadOptions& opts, const std::vector<f32>& samples, u32 index,
+        Clock::time_point end, ConnectionResult& result) {
+        Socket::Endpoint ep;
+        Socket::parse_address(opts.address, ep);
+        int fd = -1;
+        auto connect_deadline = Clock::now() + std::chrono::seconds(5);
+        while ((fd = Socket::connect_to(ep)) < 0 && Clock::now() < connect_deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (fd < 0) {
+            std::perror("mnist_loadgen: connect");
+            result.ok = false;
+            return;
+        }
+
+        u32 num_samples = static_cast<u32>(samples.size() / INPUT_SIZE);
+        u32 next_sample = index * 7919 % num_samples;
+        std::vector<u8> request(4 + INPUT_SIZE * sizeof(f32));
+        std::vector<u8> response(4 * (2 + OUTPUT_SIZE));
+        std::vector<Clock::time_point> sent(opts.depth);
+
+        auto send_request = [&](u32 slot) {
+            std::memcpy(request.data(), &slot, sizeof(u32));
+            std::memcpy(request.data() + 4, samples.data() + static_cast<u64>(next_sample) * INPUT_SIZE,
+                INPUT_SIZE * sizeof(f32));
+            next_sample = (next_sample + 1) % num_samples;
+            sent[slot] = Clock::now();
+            return Socket::send_all(fd, request.data(), request.size());
+        };
+
+        u32 in_flight = 0;
+        for (u32 slot = 0; slot < opts.depth && result.ok; slot++) {
+            result.ok = send_request(slot);
+            in_flight++;
+        }
+        while (result.ok && in_flight > 0) {
+            if (!Socket::recv_all(fd, response.data(), response.size())) {
+                std::fprintf(stderr, "mnist_loadgen: connection %u lost\n", index);
+                result.ok = false;
+                break;
+            }
+            u32 slot;
+            std::memcpy(&slot, response.data(), sizeof(u32));
+            if (slot >= opts.depth) {
+                std::fprintf(stderr, "mnist_loadgen: unknown response id %u\n", slot);
+                result.ok = false;
+                break;
+            }
+            auto now = Clock::now();
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - sent[slot]).count();
+            result.latencies_us.push_back(static_cast<u32>(elapsed));
+            in_flight--;
+
+            if (now < end) {
+                result.ok = send_request(slot);
+                in_flight++;
+            }
+        }
+#ifndef _WIN32
+        ::close(fd);
+#endif
+    }
+
+} // namespace
+
+int main(int argc, char** argv) {
+    LoadOptions opts;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--connections") == 0 && i + 1 < argc) {
+            opts.connections = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            opts.depth = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            opts.seconds = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--images") == 0 && i + 1 < argc) {
+            opts.images = argv[++i];
+        } else if (argv[i][0] != '-' && opts.address == nullptr) {
+            opts.address = argv[i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    Socket::Endpoint ep;
+    if (opts.address == nullptr || !Socket::parse_address(opts.address, ep)) {
+        print_usage();
+        return 1;
+    }
+
+    std::vector<f32> samples;
+    if (!load_samples(opts.images, samples)) {
+        return 1;
+    }
+
+    std::vector<ConnectionResult> results(opts.connections);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opts.seconds));
+    for (u32 c = 0; c < opts.connections; c++) {
+        threads.emplace_back([&, c]() { run_connection(opts, samples, c, end, results[c]); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<u32> latencies;
+    bool ok = true;
+    for (const ConnectionResult& result : results) {
+        latencies.insert(latencies.end(), result.latencies_us.begin(), result.latencies_us.end());
+        ok = ok && result.ok;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](u32 p) {
+        return latencies.empty() ? 0u : latencies[std::min(latencies.size() - 1, latencies.size() * p / 100)];
+    };
+
+    std::printf("%u connections x %u in flight, %.1f s: %zu requests, %.0f requests/s\n",
+        opts.connections, opts.depth, seconds, latencies.size(), latencies.size() / seconds);
+    std::printf("Latency: p50 %u us, p90 %u us, p99 %u us, max %u us\n",
+        percentile(50), percentile(90), percentile(99), latencies.empty() ? 0u : latencies.back());
+    return ok ? 0 : 1;
+}
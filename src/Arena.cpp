@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Arena.hpp"
+
+namespace {
+
+    constexpr u64 HUGE_PAGE_SIZE = 2ull << 20;
+
+    u64 align_up(u64 x, u64 align) {
+        return (x + align - 1) & ~(align - 1);
+    }
+
+} // namespace
+
+Arena::Arena(u64 reserve_bytes, bool huge_pages) {
+    // Over-reserve so the usable range can start on a huge page boundary
+    u64 align = huge_pages ? HUGE_PAGE_SIZE : ALIGNMENT;
+    mapping_size = reserve_bytes + align;
+
+#ifdef _WIN32
+    mapping = static_cast<u8*>(VirtualAlloc(nullptr, mapping_size, MEM_RESERVE, PAGE_READWRITE));
+#else
+    void* p = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    mapping = (p == MAP_FAILED) ? nullptr : static_cast<u8*>(p);
+#endif
+
+    if (mapping == nullptr) {
+        std::fprintf(stderr, "Arena: failed to reserve %llu bytes\n",
+            static_cast<unsigned long long>(mapping_size));
+        std::abort();
+    }
+
+    memory = reinterpret_cast<u8*>(align_up(reinterpret_cast<u64>(mapping), align));
+    capacity = reserve_bytes;
+
+#if defined(MADV_HUGEPAGE)
+    if (huge_pages) {
+        madvise(memory, capacity, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+Arena::~Arena() {
+#ifdef _WIN32
+    VirtualFree(mapping, 0, MEM_RELEASE);
+#else
+    munmap(mapping, mapping_size);
+#endif
+}
+
+void* Arena::push(u64 bytes, u64 align) {
+    u64 start = align_up(pos, align);
+    u64 end = start + bytes;
+
+    if (end > capacity) {
+        std::fprintf(stderr, "Arena: out of reserved memory (%llu of %llu bytes)\n",
+            static_cast<unsigned long long>(end), static_cast<unsigned long long>(capacity));
+        std::abort();
+    }
+
+    // Memory past the high-water mark is still fresh (zero) from the OS
+    if (start < committed) {
+        std::memset(memory + start, 0, std::min(end, committed) - start);
+    }
+
+    if (end > committed) {
+#ifdef _WIN32
+        u64 new_committed = std::min(align_up(end, 1ull << 16), capacity);
+        VirtualAlloc(memory + committed, new_committed - committed, MEM_COMMIT, PAGE_READWRITE);
+        committed = new_committed;
+#else
+        committed = end;
+#endif
+    }
+
+    pos = end;
+    return memory + start;
+}
+
+void Arena::protect(bool read_only) {
+    if (pos == 0) return;
+
+#ifdef _WIN32
+    DWORD old_protect;
+    VirtualProtect(memory, pos, read_only ? PAGE_READONLY : PAGE_READWRITE, &old_protect);
+#else
+    u64 page_size = static_cast<u64>(sysconf(_SC_PAGESIZE));
+    u64 length = align_up(pos, page_size);
+    if (mprotect(memory, length, read_only ? PROT_READ : (PROT_READ | PROT_WRITE)) != 0) {
+        std::perror("Arena: mprotect");
+    }
+#endif
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "Types.hpp"
+
+// Bump allocator over one reserved range of address space. Everything pushed
+// stays contiguous and never moves, and the OS only commits pages once they
+// are touched, so the reservation can be generous. Pushed memory is zeroed.
+class Arena {
+public:
+    static constexpr u64 ALIGNMENT = 64;
+
+    explicit Arena(u64 reserve_bytes, bool huge_pages = false);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* push(u64 bytes, u64 align = ALIGNMENT);
+    f32* push_f32(u64 count) { return static_cast<f32*>(push(count * sizeof(f32))); }
+
+    // Pops everything; the memory is reused by the next pushes
+    void reset() { pos = 0; }
+
+    // Makes the pages holding everything pushed so far read-only, or writable
+    // again. Nothing may be pushed while they are read-only.
+    void protect(bool read_only);
+
+    u8* base() const { return memory; }
+    u64 used() const { return pos; }
+    u64 reserved() const { return capacity; }
+
+private:
+    u8* memory = nullptr;
+    u8* mapping = nullptr;
+    u64 mapping_size = 0;
+    u64 capacity = 0;
+    u64 committed = 0;
+    u64 pos = 0;
+};
@@ -0,0 +1,104 @@
+#include "Cpu.hpp"
+#include "BFloat16.hpp"
+
+#if MNIST_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace BF16 {
+
+namespace {
+
+    // Each returns how many leading elements it converted; the scalar tail
+    // does the rest
+#if MNIST_X86_SIMD
+
+    MNIST_TARGET("avx512f")
+    u64 to_f32_avx512(const bf16* src, f32* dst, u64 count) {
+        u64 i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m512i w = _mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16);
+            _mm512_storeu_ps(dst + i, _mm512_castsi512_ps(w));
+        }
+        return i;
+    }
+
+    MNIST_TARGET("avx512f")
+    u64 from_f32_avx512(const f32* src, bf16* dst, u64 count) {
+        const __m512i abs_mask = _mm512_set1_epi32(0x7FFFFFFF);
+        const __m512i inf = _mm512_set1_epi32(0x7F800000);
+        const __m512i quiet = _mm512_set1_epi32(0x00400000);
+        const __m512i bias = _mm512_set1_epi32(0x7FFF);
+        const __m512i one = _mm512_set1_epi32(1);
+
+        u64 i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m512i u = _mm512_castps_si512(_mm512_loadu_ps(src + i));
+            __m512i lsb = _mm512_and_si512(_mm512_srli_epi32(u, 16), one);
+            __m512i rounded = _mm512_add_epi32(u, _mm512_add_epi32(bias, lsb));
+            __mmask16 nan = _mm512_cmpgt_epi32_mask(_mm512_and_si512(u, abs_mask), inf);
+            rounded = _mm512_mask_mov_epi32(rounded, nan, _mm512_or_si512(u, quiet));
+            __m256i h = _mm512_cvtepi32_epi16(_mm512_srli_epi32(rounded, 16));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), h);
+        }
+        return i;
+    }
+
+    MNIST_TARGET("avx2")
+    u64 to_f32_avx2(const bf16* src, f32* dst, u64 count) {
+        u64 i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m256i w = _mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16);
+            _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(w));
+        }
+        return i;
+    }
+
+    MNIST_TARGET("avx2")
+    u64 from_f32_avx2(const f32* src, bf16* dst, u64 count) {
+        const __m256i abs_mask = _mm256_set1_epi32(0x7FFFFFFF);
+        const __m256i inf = _mm256_set1_epi32(0x7F800000);
+        const __m256i quiet = _mm256_set1_epi32(0x00400000);
+        const __m256i bias = _mm256_set1_epi32(0x7FFF);
+        const __m256i one = _mm256_set1_epi32(1);
+
+        u64 i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256i u = _mm256_castps_si256(_mm256_loadu_ps(src + i));
+            __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(u, 16), one);
+            __m256i rounded = _mm256_add_epi32(u, _mm256_add_epi32(bias, lsb));
+            __m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(u, abs_mask), inf);
+            rounded = _mm256_blendv_epi8(rounded, _mm256_or_si256(u, quiet), nan);
+            rounded = _mm256_srli_epi32(rounded, 16);
+            // packus works per 128-bit lane; the permute puts the halves back in order
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(rounded, rounded), 0x08);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(packed));
+        }
+        return i;
+    }
+
+#endif
+
+} // namespace
+
+void to_f32(const bf16* src, f32* dst, u64 count) {
+    u64 i = 0;
+#if MNIST_X86_SIMD
+    if (Cpu::has_avx512f()) i = to_f32_avx512(src, dst, count);
+    else if (Cpu::has_avx2_fma()) i = to_f32_avx2(src, dst, count);
+#endif
+    for (; i < count; i++) dst[i] = ::to_f32(src[i]);
+}
+
+void from_f32(const f32* src, bf16* dst, u64 count) {
+    u64 i = 0;
+#if MNIST_X86_SIMD
+    if (Cpu::has_avx512f()) i = from_f32_avx512(src, dst, count);
+    else if (Cpu::has_avx2_fma()) i = from_f32_avx2(src, dst, count);
+#endif
+    for (; i < count; i++) dst[i] = ::from_f32<bf16>(src[i]);
+}
+
+} // namespace BF16
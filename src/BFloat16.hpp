@@ -0,0 +1,43 @@
+#pragma once
+#include <cstring>
+
+#include "Types.hpp"
+
+// bfloat16: the upper half of an f32 (same exponent range, 8 bits of
+// mantissa). It is only a storage type; kernels widen it to f32 on load and
+// do all their arithmetic in f32.
+struct bf16 {
+    u16 bits;
+};
+
+inline f32 to_f32(f32 x) { return x; }
+
+inline f32 to_f32(bf16 x) {
+    u32 u = static_cast<u32>(x.bits) << 16;
+    f32 f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+// Narrowing rounds to nearest even; NaNs stay NaN
+template <typename T> T from_f32(f32 x);
+
+template <> inline f32 from_f32<f32>(f32 x) { return x; }
+
+template <> inline bf16 from_f32<bf16>(f32 x) {
+    u32 u;
+    std::memcpy(&u, &x, sizeof(u));
+    if ((u & 0x7FFFFFFFu) > 0x7F800000u) {
+        return bf16{ static_cast<u16>((u >> 16) | 0x40u) };
+    }
+    u += 0x7FFFu + ((u >> 16) & 1u);
+    return bf16{ static_cast<u16>(u >> 16) };
+}
+
+namespace BF16 {
+
+    // Bulk conversions, vectorized where the CPU allows
+    void to_f32(const bf16* src, f32* dst, u64 count);
+    void from_f32(const f32* src, bf16* dst, u64 count);
+
+} // namespace BF16
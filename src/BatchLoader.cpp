@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cstring>
+
+#include "BatchLoader.hpp"
+#include "Dataset.hpp"
+#include "PRNG.hpp"
+
+namespace {
+
+    constexpr u64 NOT_READY = ~0ull;
+
+    u32 shard_size(u32 batch_size, u32 num_shards, u32 shard) {
+        return batch_size / num_shards + (shard < batch_size % num_shards ? 1 : 0);
+    }
+
+    u32 ring_depth(const BatchLoaderDesc& desc) {
+        return desc.depth ? desc.depth : std::max(1u, desc.num_workers) + 1;
+    }
+
+    // Every shard of every slot, each rounded up to the arena alignment
+    u64 ring_bytes(const Dataset& images, const Dataset& labels, const BatchLoaderDesc& desc) {
+        u64 per_sample = static_cast<u64>(images.cols + labels.cols) * sizeof(f32);
+        u64 padding = 2 * static_cast<u64>(desc.num_shards) * Arena::ALIGNMENT;
+        return ring_depth(desc) * (per_sample * desc.batch_size + padding);
+    }
+
+} // namespace
+
+BatchLoader::BatchLoader(const Dataset& images, const Dataset& labels, const BatchLoaderDesc& desc)
+    : images(images), labels(labels), desc(desc),
+    arena(ring_bytes(images, labels, desc), desc.huge_pages) {
+    this->desc.num_workers = std::max(1u, desc.num_workers);
+    this->desc.num_shards = std::max(1u, std::min(desc.num_shards, desc.batch_size));
+    if (this->desc.seed == 0) {
+        this->desc.seed = PRNG::for_thread().next();
+    }
+    this->desc.first_row = std::min(desc.first_row, images.rows);
+    u32 available = images.rows - this->desc.first_row;
+    this->desc.num_rows = desc.num_rows ? std::min(desc.num_rows, available) : available;
+    num_batches = this->desc.num_rows / desc.batch_size;
+
+    u32 depth = ring_depth(this->desc);
+    slots.resize(depth);
+    slot_ready.assign(depth, NOT_READY);
+    for (LoadedBatch& slot : slots) {
+        slot.size = desc.batch_size;
+        slot.images.reserve(this->desc.num_shards);
+        slot.labels.reserve(this->desc.num_shards);
+        if (desc.sparse_images) slot.sparse_images.resize(this->desc.num_shards);
+        for (u32 s = 0; s < this->desc.num_shards; s++) {
+            u32 n = shard_size(desc.batch_size, this->desc.num_shards, s);
+            slot.images.push_back(Matrix::view(images.cols, n, arena.push_f32(static_cast<u64>(images.cols) * n)));
+            slot.labels.push_back(Matrix::view(labels.cols, n, arena.push_f32(static_cast<u64>(labels.cols) * n)));
+        }
+    }
+    // Fault every page in now rather than on the first pass through the ring
+    std::memset(arena.base(), 0, arena.used());
+
+    if (num_batches == 0) return;
+    for (u32 w = 0; w < this->desc.num_workers; w++) {
+        workers.emplace_back([this, w]() { worker_loop(w); });
+    }
+}
+
+BatchLoader::~BatchLoader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    free_cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+const LoadedBatch& BatchLoader::next() {
+    u64 seq;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // The batch handed out last time is done with; its slot may be refilled
+        seq = consumed++;
+        if (seq > 0) free_cv.notify_all();
+
+        u64 slot = seq % slots.size();
+        ready_cv.wait(lock, [&]() { return slot_ready[slot] == seq; });
+    }
+    return slots[seq % slots.size()];
+}
+
+void BatchLoader::worker_loop(u32 worker) {
+    std::vector<u32> order(desc.num_rows);
+    u32 order_epoch = ~0u;
+
+    // Worker w produces batches w, w + num_workers, ...
+    for (u64 seq = worker;; seq += desc.num_workers) {
+        u64 slot = seq % slots.size();
+        {
+            // The slot's previous batch, seq - depth, must have been released:
+            // every batch before the one last handed out is
+            std::unique_lock<std::mutex> lock(mutex);
+            free_cv.wait(lock, [&]() {
+                return stopping || seq < slots.size() + (consumed ? consumed - 1 : 0);
+            });
+            if (stopping) return;
+        }
+
+        u32 epoch = static_cast<u32>(seq / num_batches);
+        if (epoch != order_epoch) {
+            shuffle(order, epoch);
+            order_epoch = epoch;
+        }
+
+        LoadedBatch& batch = slots[slot];
+        batch.epoch = epoch;
+        batch.index = static_cast<u32>(seq % num_batches);
+        fill(batch, order, batch.index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot_ready[slot] = seq;
+        }
+        ready_cv.notify_all();
+    }
+}
+
+void BatchLoader::fill(LoadedBatch& batch, const std::vector<u32>& order, u32 index) const {
+    const u32* rows = order.data() + static_cast<u64>(index) * desc.batch_size;
+    for (u32 s = 0; s < desc.num_shards; s++) {
+        u32 n = batch.images[s].cols;
+        images.gather_columns(batch.images[s], rows, n);
+        labels.gather_columns(batch.labels[s], rows, n);
+        if (desc.sparse_images) batch.sparse_images[s].assign(batch.images[s]);
+        rows += n;
+    }
+}
+
+void BatchLoader::shuffle(std::vector<u32>& order, u32 epoch) const {
+    // Epoch e reads the seed's stream e jumps in
+    PRNG gen(desc.seed);
+    gen.jump(epoch);
+
+    // Fisher-Yates: every permutation equally likely
+    auto fisher_yates = [&](u32* first, u32 count) {
+        for (u32 i = count; i > 1; i--) {
+            u32 j = gen.below(i);
+            std::swap(first[i - 1], first[j]);
+        }
+    };
+
+    u32 count = static_cast<u32>(order.size());
+    if (desc.shuffle_block <= 1) {
+        for (u32 i = 0; i < count; i++) order[i] = desc.first_row + i;
+        fisher_yates(order.data(), count);
+        return;
+    }
+
+    // Shuffle the order of the blocks, then the samples within each block
+    u32 block = desc.shuffle_block;
+    u32 num_blocks = (count + block - 1) / block;
+    std::vector<u32> blocks(num_blocks);
+    for (u32 b = 0; b < num_blocks; b++) blocks[b] = b;
+    fisher_yates(blocks.data(), num_blocks);
+
+    u32 pos = 0;
+    for (u32 b : blocks) {
+        u32 first = pos;
+        for (u32 row = b * block; row < std::min(count, (b + 1) * block); row++) order[pos++] = row;
+        fisher_yates(order.data() + first, pos - first);
+    }
+    for (u32& row : order) row += desc.first_row;
+}
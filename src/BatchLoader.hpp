@@ -0,0 +1,98 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Types.hpp"
+#include "Arena.hpp"
+#include "Matrix.hpp"
+#include "SparseMatrix.hpp"
+
+class Dataset;
+
+struct BatchLoaderDesc {
+    u32 batch_size = 50;
+
+    // Each batch is laid out as this many contiguous (features x n) shards,
+    // the first (batch_size % num_shards) one sample larger, so every
+    // data-parallel replica can read its shard in place
+    u32 num_shards = 1;
+
+    // Background threads gathering batches, and batches buffered ahead of
+    // the one being computed (0 = num_workers + 1)
+    u32 num_workers = 1;
+    u32 depth = 0;
+
+    // 0 shuffles each epoch with a plain Fisher-Yates permutation. Otherwise
+    // runs of shuffle_block consecutive samples are shuffled as units, and
+    // samples within each run; batches then read a few contiguous stretches
+    // of the dataset instead of scattered rows, at some cost in randomness.
+    u32 shuffle_block = 0;
+
+    // Rows [first_row, first_row + num_rows) are the training set (0 = up to
+    // the end), e.g. one process's shard for distributed training
+    u32 first_row = 0;
+    u32 num_rows = 0;
+
+    // The permutation of an epoch only depends on seed and the epoch number
+    u64 seed = 0;
+
+    // Also build a SparseMatrix of each image shard
+    bool sparse_images = false;
+
+    bool huge_pages = false;
+};
+
+// Minibatches gathered in the graph layout (one sample per column), ready to
+// bind to a ModelContext's input and desired_output
+struct LoadedBatch {
+    u32 epoch = 0;
+    u32 index = 0;      // within the epoch
+    u32 size = 0;
+    std::vector<Matrix> images;  // per shard: (image cols x n)
+    std::vector<Matrix> labels;  // per shard: (label cols x n)
+    std::vector<SparseMatrix> sparse_images;  // per shard, with BatchLoaderDesc::sparse_images
+};
+
+// Gathers, normalizes and lays out upcoming minibatches on background
+// threads, into a ring of buffers allocated once up front, while the current
+// one is computed. Epochs follow each other endlessly; only the remainder of
+// the dataset that does not fill a whole batch is skipped each epoch.
+class BatchLoader {
+public:
+    BatchLoader(const Dataset& images, const Dataset& labels, const BatchLoaderDesc& desc);
+    ~BatchLoader();
+
+    BatchLoader(const BatchLoader&) = delete;
+    BatchLoader& operator=(const BatchLoader&) = delete;
+
+    u32 batches_per_epoch() const { return num_batches; }
+
+    // Blocks until the next batch is ready. It stays valid until the
+    // following call, which hands its buffer back to the workers.
+    const LoadedBatch& next();
+
+private:
+    void worker_loop(u32 worker);
+    void fill(LoadedBatch& batch, const std::vector<u32>& order, u32 index) const;
+    void shuffle(std::vector<u32>& order, u32 epoch) const;
+
+    const Dataset& images;
+    const Dataset& labels;
+    BatchLoaderDesc desc;
+    u32 num_batches = 0;
+
+    Arena arena;
+    std::vector<LoadedBatch> slots;
+    // Sequence number of the batch each slot holds once it is filled
+    std::vector<u64> slot_ready;
+
+    std::mutex mutex;
+    std::condition_variable ready_cv;
+    std::condition_variable free_cv;
+    u64 consumed = 0;   // batches handed out by next()
+    bool stopping = false;
+
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,44 @@
+#include "Cpu.hpp"
+
+namespace Cpu {
+
+#if MNIST_X86_SIMD
+
+    bool has_sse2() {
+        static const bool supported = __builtin_cpu_supports("sse2");
+        return supported;
+    }
+
+    bool has_avx2_fma() {
+        static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        return supported;
+    }
+
+    bool has_avx512f() {
+        static const bool supported = __builtin_cpu_supports("avx512f");
+        return supported;
+    }
+
+    bool has_avx512_vnni() {
+        static const bool supported = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+            && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512vnni");
+        return supported;
+    }
+
+    bool has_avx512_vbmi() {
+        static const bool supported = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+            && __builtin_cpu_supports("avx512vbmi");
+        return supported;
+    }
+
+#else
+
+    bool has_sse2() { return false; }
+    bool has_avx2_fma() { return false; }
+    bool has_avx512f() { return false; }
+    bool has_avx512_vnni() { return false; }
+    bool has_avx512_vbmi() { return false; }
+
+#endif
+
+} // namespace Cpu
@@ -0,0 +1,24 @@
+#pragma once
+#include "Types.hpp"
+
+// SIMD kernels are compiled per function with target attributes and picked at
+// runtime, so the binary still runs on CPUs without AVX2/AVX-512.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MNIST_X86_SIMD 1
+#define MNIST_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MNIST_X86_SIMD 0
+#define MNIST_TARGET(isa)
+#endif
+
+namespace Cpu {
+
+    bool has_sse2();
+    bool has_avx2_fma();
+    bool has_avx512f();
+    // AVX-512 VNNI with the BW/VL subsets its 8-bit kernels also use
+    bool has_avx512_vnni();
+    // AVX-512 VBMI (byte permutes) with BW
+    bool has_avx512_vbmi();
+
+} // namespace Cpu
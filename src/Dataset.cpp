@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "Dataset.hpp"
+
+namespace {
+
+    const char DATASET_MAGIC[4] = { 'M', 'N', 'D', 'S' };
+
+    // Samples transposed per pass when gathering a batch
+    constexpr u32 GATHER_BLOCK = 16;
+
+    u32 dtype_size(DatasetType dtype) {
+        switch (dtype) {
+        case DatasetType::U8: return 1;
+        case DatasetType::F32: return 4;
+        }
+        return 0;
+    }
+
+} // namespace
+
+std::unique_ptr<Dataset> Dataset::open(const char* filename) {
+    auto file = MappedFile::open(filename);
+    if (!file) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return nullptr;
+    }
+
+    DatasetHeader header;
+    if (file->size() < sizeof(header)) {
+        std::cerr << "Not a dataset file: " << filename << std::endl;
+        return nullptr;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+
+    if (std::memcmp(header.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC)) != 0) {
+        std::cerr << "Not a dataset file: " << filename << std::endl;
+        return nullptr;
+    }
+    if (header.version != VERSION) {
+        std::cerr << "Unsupported dataset version " << header.version << ": " << filename << std::endl;
+        return nullptr;
+    }
+
+    u32 elem_size = dtype_size(header.dtype);
+    if (elem_size == 0) {
+        std::cerr << "Unknown dataset element type: " << filename << std::endl;
+        return nullptr;
+    }
+
+    // Rows are read as elem_size values in place, so they must be aligned
+    if (header.data_offset < sizeof(header) || header.data_offset % elem_size != 0) {
+        std::cerr << "Corrupt dataset " << filename << ": bad data offset " << header.data_offset << std::endl;
+        return nullptr;
+    }
+
+    // Checked by division, so no size in the header can wrap the product
+    u64 row_bytes = static_cast<u64>(header.cols) * elem_size;
+    if (header.data_offset > file->size()
+        || (row_bytes != 0 && header.rows > (file->size() - header.data_offset) / row_bytes)) {
+        std::cerr << "Truncated dataset " << filename << ": " << header.rows << " rows of " << row_bytes
+            << " bytes from offset " << header.data_offset << ", found " << file->size() << " bytes" << std::endl;
+        return nullptr;
+    }
+
+    std::unique_ptr<Dataset> dataset(new Dataset());
+    dataset->rows = header.rows;
+    dataset->cols = header.cols;
+    dataset->dtype = header.dtype;
+    dataset->scale = header.scale;
+    dataset->offset = header.offset;
+    dataset->row_bytes = row_bytes;
+    dataset->data = file->data() + header.data_offset;
+    dataset->file = std::move(file);
+
+    return dataset;
+}
+
+bool Dataset::convert_mat(const char* mat_filename, const char* filename,
+    u32 rows, u32 cols, DatasetType dtype, f32 scale, f32 offset) {
+    std::ifstream in(mat_filename, std::ios::binary | std::ios::ate);
+    if (!in.is_open()) {
+        std::cerr << "Failed to open file: " << mat_filename << std::endl;
+        return false;
+    }
+
+    u64 count = static_cast<u64>(rows) * cols;
+    u64 size = static_cast<u64>(in.tellg());
+    if (size != count * sizeof(f32)) {
+        std::cerr << "Unexpected size for " << mat_filename << ": expected " << count * sizeof(f32)
+            << " bytes, found " << size << std::endl;
+        return false;
+    }
+
+    std::vector<f32> values(count);
+    in.seekg(0, std::ios::beg);
+    in.read(reinterpret_cast<char*>(values.data()), size);
+
+    DatasetHeader header = {};
+    std::memcpy(header.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC));
+    header.version = VERSION;
+    header.dtype = dtype;
+    header.rows = rows;
+    header.cols = cols;
+    header.scale = scale;
+    header.offset = offset;
+    header.data_offset = sizeof(DatasetHeader);
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Failed to create file: " << filename << std::endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    if (dtype == DatasetType::U8) {
+        std::vector<u8> quantized(count);
+        for (u64 i = 0; i < count; i++) {
+            f32 q = std::round((values[i] - offset) / scale);
+            quantized[i] = static_cast<u8>(std::min(255.0f, std::max(0.0f, q)));
+        }
+        out.write(reinterpret_cast<const char*>(quantized.data()), count);
+    } else {
+        for (u64 i = 0; i < count; i++) {
+            values[i] = (values[i] - offset) / scale;
+        }
+        out.write(reinterpret_cast<const char*>(values.data()), count * sizeof(f32));
+    }
+
+    return out.good();
+}
+
+f32 Dataset::value(u32 row, u32 col) const {
+    const u8* src = row_data(row);
+    if (dtype == DatasetType::U8) {
+        return src[col] * scale + offset;
+    }
+    return reinterpret_cast<const f32*>(src)[col] * scale + offset;
+}
+
+u32 Dataset::label(u32 row) const {
+    if (cols == 1) {
+        return static_cast<u32>(value(row, 0));
+    }
+
+    u32 best = 0;
+    for (u32 c = 1; c < cols; c++) {
+        if (value(row, c) > value(row, best)) best = c;
+    }
+    return best;
+}
+
+bool Dataset::valid_labels(u32 num_classes) const {
+    if (cols != 1) return cols == num_classes;
+    for (u32 row = 0; row < rows; row++) {
+        f32 l = value(row, 0);
+        if (!(l >= 0.0f && l < static_cast<f32>(num_classes) && l == std::floor(l))) return false;
+    }
+    return true;
+}
+
+void Dataset::rows_to_columns(Matrix& out, const u32* row_indices, u32 col, u32 count) const {
+    // A block of samples at a time, so every pass over the features writes
+    // contiguous runs of out instead of one float per cache line
+    u64 stride = out.cols;
+    for (u32 c0 = 0; c0 < count; c0 += GATHER_BLOCK) {
+        u32 n = std::min(GATHER_BLOCK, count - c0);
+        f32* dst = out.data + col + c0;
+
+        if (dtype == DatasetType::U8) {
+            const u8* src[GATHER_BLOCK];
+            for (u32 j = 0; j < n; j++) src[j] = row_data(row_indices[c0 + j]);
+            for (u32 k = 0; k < cols; k++) {
+                for (u32 j = 0; j < n; j++) dst[k * stride + j] = src[j][k] * scale + offset;
+            }
+        } else {
+            const f32* src[GATHER_BLOCK];
+            for (u32 j = 0; j < n; j++) src[j] = reinterpret_cast<const f32*>(row_data(row_indices[c0 + j]));
+            for (u32 k = 0; k < cols; k++) {
+                for (u32 j = 0; j < n; j++) dst[k * stride + j] = src[j][k] * scale + offset;
+            }
+        }
+    }
+}
+
+void Dataset::gather_columns(Matrix& out, const u32* row_indices, u32 count) const {
+    rows_to_columns(out, row_indices, 0, count);
+}
+
+void Dataset::copy_rows_to_columns(Matrix& out, u32 first, u32 count) const {
+    u32 rows[GATHER_BLOCK];
+    for (u32 c0 = 0; c0 < count; c0 += GATHER_BLOCK) {
+        u32 n = std::min(GATHER_BLOCK, count - c0);
+        for (u32 j = 0; j < n; j++) rows[j] = first + c0 + j;
+        rows_to_columns(out, rows, c0, n);
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <memory>
+
+#include "Types.hpp"
+#include "Matrix.hpp"
+#include "MappedFile.hpp"
+
+enum class DatasetType : u32 {
+    U8 = 1,
+    F32 = 2,
+};
+
+// On-disk layout: this header, then rows * cols elements of dtype, row-major,
+// starting at data_offset. Stored values map to f32 as stored * scale + offset.
+struct DatasetHeader {
+    char magic[4];
+    u32 version;
+    DatasetType dtype;
+    u32 rows;
+    u32 cols;
+    f32 scale;
+    f32 offset;
+    u32 reserved0;
+    u64 data_offset;
+    u8 reserved[24];
+};
+static_assert(sizeof(DatasetHeader) == 64, "DatasetHeader must stay 64 bytes");
+
+// Memory-mapped (samples x features) dataset. Rows are read in place, and
+// conversion to f32 happens only when a batch is gathered.
+class Dataset {
+public:
+    static constexpr u32 VERSION = 1;
+
+    static std::unique_ptr<Dataset> open(const char* filename);
+
+    // Converts a raw f32 .mat file (as written by mnist_download.py) into a
+    // dataset file, quantizing to dtype with the given normalization
+    static bool convert_mat(const char* mat_filename, const char* filename,
+        u32 rows, u32 cols, DatasetType dtype, f32 scale, f32 offset);
+
+    u32 rows = 0;
+    u32 cols = 0;
+    DatasetType dtype = DatasetType::U8;
+    f32 scale = 1.0f;
+    f32 offset = 0.0f;
+
+    const u8* row_data(u32 row) const { return data + static_cast<u64>(row) * row_bytes; }
+    f32 value(u32 row, u32 col) const;
+
+    // Class index of a row: the value itself for (samples x 1) label sets,
+    // the argmax for one-hot rows. Only meaningful where valid_labels() holds.
+    u32 label(u32 row) const;
+    // Whether every row is a class index below num_classes: an integer in
+    // [0, num_classes) for (samples x 1) sets, num_classes wide if one-hot
+    bool valid_labels(u32 num_classes) const;
+
+    // Writes the given rows, normalized to f32, into the columns of out
+    // (cols x count); the batched graph layout is one sample per column
+    void gather_columns(Matrix& out, const u32* row_indices, u32 count) const;
+    void copy_rows_to_columns(Matrix& out, u32 first, u32 count) const;
+
+private:
+    Dataset() = default;
+    void rows_to_columns(Matrix& out, const u32* row_indices, u32 col, u32 count) const;
+
+    std::unique_ptr<MappedFile> file;
+    const u8* data = nullptr;
+    u64 row_bytes = 0;
+};
@@ -0,0 +1,336 @@
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "Cpu.hpp"
+#include "Gemm.hpp"
+
+#if MNIST_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Goto-style GEMM: op(B) is packed into k-major panels of NR columns and op(A)
+// into k-major panels of MR rows, so the micro-kernel streams both operands
+// contiguously whatever the transpose flags were. The MR x NR accumulator tile
+// stays in registers for the whole KC-deep inner loop.
+
+namespace Gemm {
+
+namespace {
+
+    using KernelFn = void (*)(u64 kc, const f32* a, const f32* b, f32* c, u64 ldc);
+
+    struct Kernel {
+        Isa isa;
+        u32 mr;
+        u32 nr;
+        KernelFn fn;
+    };
+
+    constexpr u32 KC = 256;
+    constexpr u32 MC_PANELS = 16;
+    constexpr u32 NC = 2048;
+    constexpr u32 MAX_MR = 8;
+    constexpr u32 MAX_NR = 32;
+
+    template <u32 MR, u32 NR>
+    void kernel_scalar(u64 kc, const f32* a, const f32* b, f32* c, u64 ldc) {
+        f32 acc[MR][NR] = {};
+        for (u64 p = 0; p < kc; p++) {
+            for (u32 i = 0; i < MR; i++) {
+                f32 ai = a[i];
+                for (u32 j = 0; j < NR; j++) {
+                    acc[i][j] += ai * b[j];
+                }
+            }
+            a += MR;
+            b += NR;
+        }
+        for (u32 i = 0; i < MR; i++) {
+            for (u32 j = 0; j < NR; j++) {
+                c[j + i * ldc] += acc[i][j];
+            }
+        }
+    }
+
+#if MNIST_X86_SIMD
+
+    MNIST_TARGET("sse2")
+    void kernel_sse_4x8(u64 kc, const f32* a, const f32* b, f32* c, u64 ldc) {
+        __m128 acc[4][2];
+        for (u32 i = 0; i < 4; i++) {
+            acc[i][0] = _mm_setzero_ps();
+            acc[i][1] = _mm_setzero_ps();
+        }
+        for (u64 p = 0; p < kc; p++) {
+            __m128 b0 = _mm_loadu_ps(b);
+            __m128 b1 = _mm_loadu_ps(b + 4);
+            for (u32 i = 0; i < 4; i++) {
+                __m128 ai = _mm_set1_ps(a[i]);
+                acc[i][0] = _mm_add_ps(acc[i][0], _mm_mul_ps(ai, b0));
+                acc[i][1] = _mm_add_ps(acc[i][1], _mm_mul_ps(ai, b1));
+            }
+            a += 4;
+            b += 8;
+        }
+        for (u32 i = 0; i < 4; i++) {
+            f32* row = c + i * ldc;
+            _mm_storeu_ps(row, _mm_add_ps(_mm_loadu_ps(row), acc[i][0]));
+            _mm_storeu_ps(row + 4, _mm_add_ps(_mm_loadu_ps(row + 4), acc[i][1]));
+        }
+    }
+
+    MNIST_TARGET("avx2,fma")
+    void kernel_avx2_6x16(u64 kc, const f32* a, const f32* b, f32* c, u64 ldc) {
+        __m256 acc[6][2];
+        for (u32 i = 0; i < 6; i++) {
+            acc[i][0] = _mm256_setzero_ps();
+            acc[i][1] = _mm256_setzero_ps();
+        }
+        for (u64 p = 0; p < kc; p++) {
+            __m256 b0 = _mm256_loadu_ps(b);
+            __m256 b1 = _mm256_loadu_ps(b + 8);
+            for (u32 i = 0; i < 6; i++) {
+                __m256 ai = _mm256_broadcast_ss(a + i);
+                acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+                acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+            }
+            a += 6;
+            b += 16;
+        }
+        for (u32 i = 0; i < 6; i++) {
+            f32* row = c + i * ldc;
+            _mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row), acc[i][0]));
+            _mm256_storeu_ps(row + 8, _mm256_add_ps(_mm256_loadu_ps(row + 8), acc[i][1]));
+        }
+    }
+
+    MNIST_TARGET("avx512f")
+    void kernel_avx512_8x32(u64 kc, const f32* a, const f32* b, f32* c, u64 ldc) {
+        __m512 acc[8][2];
+        for (u32 i = 0; i < 8; i++) {
+            acc[i][0] = _mm512_setzero_ps();
+            acc[i][1] = _mm512_setzero_ps();
+        }
+        for (u64 p = 0; p < kc; p++) {
+            __m512 b0 = _mm512_loadu_ps(b);
+            __m512 b1 = _mm512_loadu_ps(b + 16);
+            for (u32 i = 0; i < 8; i++) {
+                __m512 ai = _mm512_set1_ps(a[i]);
+                acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+                acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+            }
+            a += 8;
+            b += 32;
+        }
+        for (u32 i = 0; i < 8; i++) {
+            f32* row = c + i * ldc;
+            _mm512_storeu_ps(row, _mm512_add_ps(_mm512_loadu_ps(row), acc[i][0]));
+            _mm512_storeu_ps(row + 16, _mm512_add_ps(_mm512_loadu_ps(row + 16), acc[i][1]));
+        }
+    }
+
+#endif
+
+    const Kernel KERNELS[] = {
+        { Isa::Scalar, 4, 4, kernel_scalar<4, 4> },
+#if MNIST_X86_SIMD
+        { Isa::SSE, 4, 8, kernel_sse_4x8 },
+        { Isa::AVX2, 6, 16, kernel_avx2_6x16 },
+        { Isa::AVX512, 8, 32, kernel_avx512_8x32 },
+#endif
+    };
+
+    Isa detect_isa() {
+        if (Cpu::has_avx512f()) return Isa::AVX512;
+        if (Cpu::has_avx2_fma()) return Isa::AVX2;
+        if (Cpu::has_sse2()) return Isa::SSE;
+        return Isa::Scalar;
+    }
+
+    // Read once per call, so a set_isa() from another thread switches between
+    // calls and never within one
+    std::atomic<Isa>& active_isa() {
+        static std::atomic<Isa> active{ detect_isa() };
+        return active;
+    }
+
+    const Kernel& active_kernel() {
+        Isa active = active_isa().load(std::memory_order_relaxed);
+        for (const Kernel& kernel : KERNELS) {
+            if (kernel.isa == active) return kernel;
+        }
+        return KERNELS[0];
+    }
+
+    // Packs op(A)[i0 : i0 + mc, p0 : p0 + kc] into zero-padded panels of mr
+    // rows. Packing is where bf16 operands are widened, so the kernels only
+    // ever see f32.
+    template <typename TA>
+    void pack_a(f32* dst, const TA* a, u64 lda, bool transpose_a,
+        u32 i0, u32 mc, u32 p0, u32 kc, u32 mr) {
+        for (u32 ip = 0; ip < mc; ip += mr) {
+            u32 rows = std::min(mr, mc - ip);
+            for (u32 i = 0; i < rows; i++) {
+                u64 r = i0 + ip + i;
+                if (transpose_a) {
+                    for (u32 p = 0; p < kc; p++) dst[i + p * mr] = to_f32(a[r + (p0 + p) * lda]);
+                } else {
+                    const TA* src = a + r * lda + p0;
+                    for (u32 p = 0; p < kc; p++) dst[i + p * mr] = to_f32(src[p]);
+                }
+            }
+            for (u32 i = rows; i < mr; i++) {
+                for (u32 p = 0; p < kc; p++) dst[i + p * mr] = 0.0f;
+            }
+            dst += static_cast<u64>(mr) * kc;
+        }
+    }
+
+    // Packs op(B)[p0 : p0 + kc, j0 : j0 + nc] into zero-padded panels of nr columns
+    template <typename TB>
+    void pack_b(f32* dst, const TB* b, u64 ldb, bool transpose_b,
+        u32 p0, u32 kc, u32 j0, u32 nc, u32 nr) {
+        for (u32 jp = 0; jp < nc; jp += nr) {
+            u32 cols = std::min(nr, nc - jp);
+            for (u32 p = 0; p < kc; p++) {
+                f32* out = dst + p * nr;
+                u64 row = p0 + p;
+                if (transpose_b) {
+                    for (u32 j = 0; j < cols; j++) out[j] = to_f32(b[row + (j0 + jp + j) * ldb]);
+                } else {
+                    const TB* src = b + row * ldb + j0 + jp;
+                    for (u32 j = 0; j < cols; j++) out[j] = to_f32(src[j]);
+                }
+                for (u32 j = cols; j < nr; j++) out[j] = 0.0f;
+            }
+            dst += static_cast<u64>(nr) * kc;
+        }
+    }
+
+    // Matrix-vector shapes would be mostly padding once packed
+    template <typename TA, typename TB>
+    void gemm_small(bool transpose_a, bool transpose_b, u32 m, u32 n, u32 k,
+        const TA* a, u64 lda, const TB* b, u64 ldb, f32* c, u64 ldc) {
+        for (u64 i = 0; i < m; i++) {
+            for (u64 p = 0; p < k; p++) {
+                f32 av = to_f32(transpose_a ? a[i + p * lda] : a[p + i * lda]);
+                f32* out = c + i * ldc;
+                if (transpose_b) {
+                    for (u64 j = 0; j < n; j++) out[j] += av * to_f32(b[p + j * ldb]);
+                } else {
+                    const TB* row = b + p * ldb;
+                    for (u64 j = 0; j < n; j++) out[j] += av * to_f32(row[j]);
+                }
+            }
+        }
+    }
+
+} // namespace
+
+template <typename TA, typename TB>
+void gemm(bool transpose_a, bool transpose_b, u32 m, u32 n, u32 k,
+    const TA* a, u64 lda, const TB* b, u64 ldb, f32* c, u64 ldc) {
+    if (m == 0 || n == 0 || k == 0) return;
+
+    if (m == 1 || n == 1) {
+        gemm_small(transpose_a, transpose_b, m, n, k, a, lda, b, ldb, c, ldc);
+        return;
+    }
+
+    const Kernel& kernel = active_kernel();
+    const u32 mr = kernel.mr;
+    const u32 nr = kernel.nr;
+    const u32 mc_max = mr * MC_PANELS;
+
+    thread_local std::vector<f32> a_pack;
+    thread_local std::vector<f32> b_pack;
+    a_pack.resize(static_cast<u64>(mc_max) * KC);
+    b_pack.resize(static_cast<u64>(NC) * KC);
+
+    f32 tile[MAX_MR * MAX_NR];
+
+    for (u32 jc = 0; jc < n; jc += NC) {
+        u32 nc = std::min(NC, n - jc);
+
+        for (u32 pc = 0; pc < k; pc += KC) {
+            u32 kc = std::min(KC, k - pc);
+            pack_b(b_pack.data(), b, ldb, transpose_b, pc, kc, jc, nc, nr);
+
+            for (u32 ic = 0; ic < m; ic += mc_max) {
+                u32 mc = std::min(mc_max, m - ic);
+                pack_a(a_pack.data(), a, lda, transpose_a, ic, mc, pc, kc, mr);
+
+                for (u32 jr = 0; jr < nc; jr += nr) {
+                    u32 nb = std::min(nr, nc - jr);
+                    const f32* bp = b_pack.data() + static_cast<u64>(jr) * kc;
+
+                    for (u32 ir = 0; ir < mc; ir += mr) {
+                        u32 mb = std::min(mr, mc - ir);
+                        const f32* ap = a_pack.data() + static_cast<u64>(ir) * kc;
+                        f32* cp = c + (ic + ir) * ldc + jc + jr;
+
+                        if (mb == mr && nb == nr) {
+                            kernel.fn(kc, ap, bp, cp, ldc);
+                            continue;
+                        }
+
+                        // Edge tile: compute the full tile aside, keep the valid part
+                        std::memset(tile, 0, sizeof(f32) * mr * nr);
+                        kernel.fn(kc, ap, bp, tile, nr);
+                        for (u32 i = 0; i < mb; i++) {
+                            for (u32 j = 0; j < nb; j++) {
+                                cp[j + i * ldc] += tile[j + i * nr];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+template void gemm(bool, bool, u32, u32, u32, const f32*, u64, const f32*, u64, f32*, u64);
+template void gemm(bool, bool, u32, u32, u32, const f32*, u64, const bf16*, u64, f32*, u64);
+template void gemm(bool, bool, u32, u32, u32, const bf16*, u64, const f32*, u64, f32*, u64);
+template void gemm(bool, bool, u32, u32, u32, const bf16*, u64, const bf16*, u64, f32*, u64);
+
+void sgemm(bool transpose_a, bool transpose_b, u32 m, u32 n, u32 k,
+    const f32* a, u64 lda, const f32* b, u64 ldb, f32* c, u64 ldc) {
+    gemm(transpose_a, transpose_b, m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+Isa isa() {
+    return active_isa().load(std::memory_order_relaxed);
+}
+
+bool set_isa(Isa isa) {
+    if (!isa_supported(isa)) return false;
+    active_isa().store(isa, std::memory_order_relaxed);
+    return true;
+}
+
+bool isa_supported(Isa isa) {
+    switch (isa) {
+    case Isa::Scalar: return true;
+#if MNIST_X86_SIMD
+    case Isa::SSE: return Cpu::has_sse2();
+    case Isa::AVX2: return Cpu::has_avx2_fma();
+    case Isa::AVX512: return Cpu::has_avx512f();
+#endif
+    default: return false;
+    }
+}
+
+const char* isa_name(Isa isa) {
+    switch (isa) {
+    case Isa::Scalar: return "scalar";
+    case Isa::SSE: return "sse";
+    case Isa::AVX2: return "avx2";
+    case Isa::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+} // namespace Gemm
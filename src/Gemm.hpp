@@ -0,0 +1,35 @@
+#pragma once
+#include "Types.hpp"
+#include "BFloat16.hpp"
+
+namespace Gemm {
+
+    enum class Isa : u32 {
+        Scalar = 0,
+        SSE,
+        AVX2,
+        AVX512,
+    };
+
+    // C (m x n) += op(A) * op(B), where op(A) is m x k and op(B) is k x n.
+    // All matrices are row-major; lda/ldb/ldc are the row strides of the
+    // matrices as stored, i.e. before any transpose.
+    void sgemm(bool transpose_a, bool transpose_b, u32 m, u32 n, u32 k,
+        const f32* a, u64 lda, const f32* b, u64 ldb, f32* c, u64 ldc);
+
+    // The same for any mix of f32 and bf16 operands (instantiated for both).
+    // bf16 elements are widened while packing; C and the accumulation are f32.
+    template <typename TA, typename TB>
+    void gemm(bool transpose_a, bool transpose_b, u32 m, u32 n, u32 k,
+        const TA* a, u64 lda, const TB* b, u64 ldb, f32* c, u64 ldc);
+
+    // The best supported kernel is selected on first use; set_isa overrides it
+    // (e.g. for benchmarking) and fails if the CPU lacks the instructions. It
+    // may be called while other threads multiply; each call to sgemm or gemm
+    // runs entirely on the kernel that was active when it started.
+    Isa isa();
+    bool set_isa(Isa isa);
+    bool isa_supported(Isa isa);
+    const char* isa_name(Isa isa);
+
+} // namespace Gemm
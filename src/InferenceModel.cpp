@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <unordered_map>
+
+#include "InferenceModel.hpp"
+#include "Dataset.hpp"
+#include "QuantizedLinear.hpp"
+
+namespace {
+
+    constexpr u32 CALIBRATION_BATCH_SIZE = 256;
+
+    // W x products whose W is a parameter; x is inputs[1]
+    bool is_quantizable(const ModelVar* var) {
+        bool linear = var->op == ModelVarOp::Matmul || var->op == ModelVarOp::LinearBias
+            || var->op == ModelVarOp::LinearBiasRelu || var->op == ModelVarOp::LinearBiasReluAdd;
+        return linear && !var->quant && (var->inputs[0]->flags & MV_FLAG_PARAMETER) != 0;
+    }
+
+} // namespace
+
+InferenceModel::InferenceModel(std::unique_ptr<ModelContext> model)
+    : model(std::move(model)) {}
+
+const f32* InferenceModel::predict(const f32* sample) {
+    model->set_batch_size(1);
+
+    // A (features x 1) column has the same layout as one sample row. The
+    // input never writes through the pointer and is pointed back at its own
+    // buffer right after, before any batched call could fill it.
+    Matrix& input = model->input->val;
+    f32* own = input.data;
+    input.bind(input.rows, 1, const_cast<f32*>(sample));
+    model->feedforward();
+    input.bind(input.rows, 1, own);
+
+    return model->output->val.data;
+}
+
+u32 InferenceModel::predict_label(const f32* sample) {
+    predict(sample);
+    return model->output->val.argmax_col(0);
+}
+
+void InferenceModel::predict(const Matrix& images, u32* out_labels, f32* out_probs, u32 num_threads) {
+    model->predict(images, out_labels, out_probs, num_threads);
+}
+
+void InferenceModel::predict(const Dataset& images, u32* out_labels, f32* out_probs, u32 num_threads) {
+    model->predict(images, out_labels, out_probs, num_threads);
+}
+
+std::unique_ptr<InferenceModel> InferenceModel::quantized(const Dataset& calibration, u32 num_samples) const {
+    // Calibrated on a scratch copy; the model handed out is frozen from it
+    // once the products are quantized, without their f32 weights
+    auto copy = model->clone();
+
+    // Quantized products, and the calibration below, read f32 activations,
+    // and the static kernels would bypass them
+    if (copy->compile_options().bf16_storage || copy->compile_options().static_kernels) {
+        ModelCompileDesc desc = copy->compile_options();
+        desc.bf16_storage = false;
+        desc.static_kernels = false;
+        copy->compile(desc);
+    }
+
+    std::unordered_map<const ModelVar*, std::pair<f32, f32>> ranges;
+    for (ModelVar* var : copy->forward_prog.vars) {
+        if (is_quantizable(var)) ranges[var] = { 0.0f, 0.0f };
+    }
+
+    // Min/max of every quantized product's input over the calibration rows
+    num_samples = std::min(num_samples, calibration.rows);
+    for (u32 start = 0; start < num_samples; start += CALIBRATION_BATCH_SIZE) {
+        u32 n = std::min(CALIBRATION_BATCH_SIZE, num_samples - start);
+        copy->set_batch_size(n);
+        calibration.copy_rows_to_columns(copy->input->val, start, n);
+
+        copy->feedforward([&](const ModelVar* var) {
+            auto it = ranges.find(var);
+            if (it == ranges.end()) return;
+
+            const Matrix& x = var->inputs[1]->val;
+            for (u64 i = 0; i < x.size(); i++) {
+                it->second.first = std::min(it->second.first, x.data[i]);
+                it->second.second = std::max(it->second.second, x.data[i]);
+            }
+        });
+    }
+
+    for (ModelVar* var : copy->forward_prog.vars) {
+        auto it = ranges.find(var);
+        if (it == ranges.end()) continue;
+        var->quant = std::make_shared<QuantizedLinear>(
+            Quant::quantize(var->inputs[0]->val, it->second.first, it->second.second));
+    }
+
+    return copy->freeze();
+}
+
+std::unique_ptr<InferenceModel> InferenceModel::replica() const {
+    auto copy = model->clone(true);
+    copy->set_batch_size(1);
+    return std::unique_ptr<InferenceModel>(new InferenceModel(std::move(copy)));
+}
+
+bool InferenceModel::is_quantized() const {
+    for (const ModelVar* var : model->forward_prog.vars) {
+        if (var->quant) return true;
+    }
+    return false;
+}
+
+u64 InferenceModel::weight_bytes() const {
+    // A quantized product stands in for its W; anything else reads its f32
+    // master or, with bf16 storage, its bf16 copy
+    std::vector<bool> replaced(model->num_vars(), false);
+    u64 bytes = 0;
+    for (const ModelVar* var : model->forward_prog.vars) {
+        if (var->quant) {
+            replaced[var->inputs[0]->index] = true;
+            bytes += var->quant->bytes();
+        }
+    }
+    for (const ModelVar* var : model->forward_prog.vars) {
+        if ((var->flags & MV_FLAG_PARAMETER) && !replaced[var->index]) {
+            bool half = var->storage == ModelVarStorage::BF16;
+            bytes += var->val.size() * (half ? sizeof(bf16) : sizeof(f32));
+        }
+    }
+    return bytes;
+}
+
+u64 InferenceModel::memory_bytes() const {
+    // f32 masters stay resident next to their bf16 copies, and static
+    // kernels hold a copy of their own
+    u64 bytes = model->activation_bytes();
+    for (const ModelVar* var : model->forward_prog.vars) {
+        if (var->quant) bytes += var->quant->bytes();
+        if (!(var->flags & MV_FLAG_PARAMETER)) continue;
+        if (var->val.data) bytes += var->val.size() * sizeof(f32);
+        if (var->val_bf16.data) bytes += var->val_bf16.size() * sizeof(bf16);
+    }
+    return bytes + model->static_kernel_bytes();
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <memory>
+
+#include "Types.hpp"
+#include "ModelContext.hpp"
+
+// Forward-only copy of a trained ModelContext, made by ModelContext::freeze().
+// It keeps just the vars the output depends on, has no gradient buffers, cost
+// or label vars, and its parameters sit in read-only pages.
+class InferenceModel {
+public:
+    // Loads a checkpoint with read-only parameters mapped from the file
+    static std::unique_ptr<InferenceModel> load(const char* path);
+
+    u32 input_size() const { return model->input->val.rows; }
+    u32 output_size() const { return model->output->val.rows; }
+
+    // Single-sample path: the input var is bound straight to sample (input_size
+    // floats), nothing is copied. Returns the output vector, valid until the
+    // next call.
+    const f32* predict(const f32* sample);
+    u32 predict_label(const f32* sample);
+
+    // Batched inference, as ModelContext::predict
+    void predict(const Matrix& images, u32* out_labels, f32* out_probs = nullptr, u32 num_threads = 0);
+    void predict(const Dataset& images, u32* out_labels, f32* out_probs = nullptr, u32 num_threads = 0);
+
+    // Post-training quantization: returns a frozen copy whose W x products
+    // (W a parameter) run on int8 weights, see QuantizedLinear; a W read by
+    // nothing else keeps no f32 copy. Activation ranges are calibrated on
+    // the first num_samples rows of calibration.
+    std::unique_ptr<InferenceModel> quantized(const Dataset& calibration, u32 num_samples = 1000) const;
+    bool is_quantized() const;
+
+    // Another model over the same read-only weights with activations of its
+    // own, so that several threads can predict at once
+    std::unique_ptr<InferenceModel> replica() const;
+
+    // Per-op timings of predict calls, see ModelContext::set_profiler
+    void set_profiler(class Profiler* profiler) { model->set_profiler(profiler); }
+
+    // Bytes of the weights the forward pass reads (int8 where quantized)
+    u64 weight_bytes() const;
+    // Everything resident at batch size 1: weights in every form kept
+    // (f32 masters under bf16 copies too) plus activations
+    u64 memory_bytes() const;
+
+private:
+    friend class ModelContext;
+    explicit InferenceModel(std::unique_ptr<ModelContext> model);
+
+    std::unique_ptr<ModelContext> model;
+};
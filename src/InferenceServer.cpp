@@ -0,0 +1,393 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "InferenceServer.hpp"
+#include "InferenceModel.hpp"
+#include "Socket.hpp"
+#include "ThreadPool.hpp"
+
+namespace {
+
+    // Stop reading from a client that is owed this much while it does not
+    // read its responses
+    constexpr u64 MAX_OUTPUT_BYTES = 1 << 20;
+
+    u64 now_ns() {
+        auto since = std::chrono::steady_clock::now().time_since_epoch();
+        return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(since).count());
+    }
+
+} // namespace
+
+InferenceServerStats InferenceServer::take_stats() {
+    std::vector<u32> latencies;
+    InferenceServerStats stats;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        latencies.swap(latencies_us);
+        stats.batches = batches;
+        batches = 0;
+        u64 now = now_ns();
+        stats.seconds = (now - stats_start_ns) * 1e-9;
+        stats_start_ns = now;
+    }
+
+    stats.requests = latencies.size();
+    if (latencies.empty()) return stats;
+    std::sort(latencies.begin(), latencies.end());
+    stats.p50_us = latencies[latencies.size() / 2];
+    stats.p99_us = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+    stats.max_us = latencies.back();
+    return stats;
+}
+
+#ifndef _WIN32
+
+// A connection stays in the poll set while the client may send more
+// requests or is still owed responses. Workers never block on it: responses
+// go into output, which whoever holds write_mutex sends as far as the socket
+// takes it, and the poll thread waits for room for the rest. Its socket
+// closes when the last request holding it is answered.
+struct InferenceServer::Connection {
+    explicit Connection(int fd) : fd(fd) {}
+    ~Connection() { ::close(fd); }
+
+    int fd;
+    // Poll thread only: the start of a request still arriving (always less
+    // than one request), and whether the client may still send
+    std::vector<u8> pending;
+    bool reading = true;
+    // Set with reading = false, for the workers
+    std::atomic<bool> eof{ false };
+
+    std::mutex write_mutex;
+    std::vector<u8> output;     // responses the socket has not taken yet
+    u64 in_flight = 0;          // requests read and not answered yet
+    // False once the socket failed; nothing more is read or written
+    std::atomic<bool> open{ true };
+};
+
+std::unique_ptr<InferenceServer> InferenceServer::start(const InferenceModel& model, const char* address,
+    const InferenceServerDesc& desc) {
+    Socket::Endpoint ep;
+    if (!Socket::parse_address(address, ep)) {
+        std::fprintf(stderr, "InferenceServer: bad address %s (expected unix:PATH or tcp:HOST:PORT)\n", address);
+        return nullptr;
+    }
+
+    std::unique_ptr<InferenceServer> server(new InferenceServer());
+    server->desc = desc;
+    server->desc.max_batch = std::max(1u, desc.max_batch);
+    if (server->desc.num_workers == 0) server->desc.num_workers = ThreadPool::hardware_threads();
+    server->input_size = model.input_size();
+    server->output_size = model.output_size();
+    for (u32 w = 0; w < server->desc.num_workers; w++) {
+        server->replicas.push_back(model.replica());
+    }
+
+    server->listen_fd = Socket::listen_on(ep, 64, true);
+    if (server->listen_fd < 0) {
+        std::perror("InferenceServer: listen");
+        return nullptr;
+    }
+    Socket::set_nonblocking(server->listen_fd);
+    if (ep.unix_socket) server->socket_path = ep.path;
+    if (pipe(server->wake_fds) != 0) {
+        std::perror("InferenceServer: pipe");
+        return nullptr;
+    }
+    Socket::set_nonblocking(server->wake_fds[0]);
+    Socket::set_nonblocking(server->wake_fds[1]);
+
+    server->stats_start_ns = now_ns();
+    server->io_thread = std::thread([s = server.get()]() { s->io_loop(); });
+    for (u32 w = 0; w < server->desc.num_workers; w++) {
+        server->workers.emplace_back([s = server.get(), w]() { s->worker_loop(w); });
+    }
+    return server;
+}
+
+InferenceServer::~InferenceServer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queue_cv.notify_all();
+    if (io_thread.joinable()) {
+        wake_io();
+        io_thread.join();
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if (listen_fd >= 0) ::close(listen_fd);
+    if (!socket_path.empty()) ::unlink(socket_path.c_str());
+    for (int fd : wake_fds) {
+        if (fd >= 0) ::close(fd);
+    }
+}
+
+// Sends as much of conn.output as the socket takes without blocking; call
+// with write_mutex held
+void InferenceServer::flush_output(Connection& conn) {
+    u64 sent_total = 0;
+    while (sent_total < conn.output.size()) {
+        ssize_t sent = ::send(conn.fd, conn.output.data() + sent_total, conn.output.size() - sent_total,
+            MSG_NOSIGNAL);
+        if (sent > 0) {
+            sent_total += static_cast<u64>(sent);
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        conn.open = false;
+        conn.output.clear();
+        return;
+    }
+    conn.output.erase(conn.output.begin(), conn.output.begin() + sent_total);
+}
+
+void InferenceServer::wake_io() {
+    // A full pipe already wakes the poll thread
+    char wake = 0;
+    while (::write(wake_fds[1], &wake, 1) < 0 && errno == EINTR) {}
+}
+
+// Appends every complete request that has arrived on conn to out. Clears
+// conn->reading at the client's end of stream and conn->open on an error.
+void InferenceServer::read_requests(const std::shared_ptr<Connection>& conn, std::vector<Request>& out) {
+    std::vector<u8>& pending = conn->pending;
+    u64 request_size = request_bytes();
+    u64 first = out.size();
+    u64 received = now_ns();
+    u8 chunk[1 << 16];
+
+    auto add_request = [&](const u8* data) {
+        Request request;
+        request.conn = conn;
+        std::memcpy(&request.id, data, sizeof(u32));
+        request.received_ns = received;
+        request.input.resize(input_size);
+        std::memcpy(request.input.data(), data + sizeof(u32), input_size * sizeof(f32));
+        out.push_back(std::move(request));
+    };
+
+    for (;;) {
+        ssize_t got = ::recv(conn->fd, chunk, sizeof(chunk), 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (got == 0) {
+            conn->reading = false;
+            conn->eof = true;
+            break;
+        }
+        if (got < 0) {
+            conn->open = false;
+            break;
+        }
+
+        // Complete pending first, then take whole requests straight from the
+        // chunk; only the start of the next one is kept
+        const u8* data = chunk;
+        u64 size = static_cast<u64>(got);
+        if (!pending.empty()) {
+            u64 take = std::min(size, request_size - pending.size());
+            pending.insert(pending.end(), data, data + take);
+            data += take;
+            size -= take;
+            if (pending.size() < request_size) continue;
+            add_request(pending.data());
+            pending.clear();
+        }
+        for (; size >= request_size; data += request_size, size -= request_size) {
+            add_request(data);
+        }
+        pending.assign(data, data + size);
+    }
+
+    if (out.size() > first) {
+        std::lock_guard<std::mutex> lock(conn->write_mutex);
+        conn->in_flight += out.size() - first;
+    }
+}
+
+void InferenceServer::io_loop() {
+    std::vector<std::shared_ptr<Connection>> conns;
+    std::vector<pollfd> fds;
+    std::vector<Request> arrived;
+
+    for (;;) {
+        fds.clear();
+        fds.push_back({ wake_fds[0], POLLIN, 0 });
+        fds.push_back({ listen_fd, POLLIN, 0 });
+        for (const auto& conn : conns) {
+            short events = 0;
+            {
+                std::lock_guard<std::mutex> lock(conn->write_mutex);
+                if (!conn->output.empty()) events |= POLLOUT;
+                if (conn->reading && conn->output.size() < MAX_OUTPUT_BYTES) events |= POLLIN;
+            }
+            // A negative fd is skipped, so a hung-up socket waiting on its
+            // last responses does not keep poll returning
+            fds.push_back({ events != 0 ? conn->fd : -1, events, 0 });
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            std::perror("InferenceServer: poll");
+            break;
+        }
+        if (fds[0].revents != 0) {
+            char drain[64];
+            while (::read(wake_fds[0], drain, sizeof(drain)) > 0) {}
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) break;
+        }
+
+        if (fds[1].revents != 0) {
+            int fd;
+            while ((fd = Socket::accept_on(listen_fd)) >= 0) {
+                conns.push_back(std::make_shared<Connection>(fd));
+            }
+        }
+
+        // Connections accepted just now were not polled yet
+        u32 num_polled = static_cast<u32>(fds.size()) - 2;
+        for (u32 i = 0; i < num_polled; i++) {
+            short revents = fds[i + 2].revents;
+            if (revents == 0) continue;
+            Connection& conn = *conns[i];
+            if (revents & (POLLOUT | POLLERR | POLLHUP)) {
+                std::lock_guard<std::mutex> lock(conn.write_mutex);
+                flush_output(conn);
+            }
+            if (conn.open && conn.reading && (revents & (POLLIN | POLLERR | POLLHUP))) {
+                read_requests(conns[i], arrived);
+            }
+        }
+
+        // Kept until the client has stopped sending and has every response
+        conns.erase(std::remove_if(conns.begin(), conns.end(),
+            [](const std::shared_ptr<Connection>& conn) {
+                if (!conn->open) return true;
+                if (conn->reading) return false;
+                std::lock_guard<std::mutex> lock(conn->write_mutex);
+                return conn->in_flight == 0 && conn->output.empty();
+            }), conns.end());
+
+        if (arrived.empty()) continue;
+        bool several = arrived.size() > desc.max_batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Request& request : arrived) {
+                queue.push_back(std::move(request));
+            }
+        }
+        arrived.clear();
+        if (several) queue_cv.notify_all();
+        else queue_cv.notify_one();
+    }
+
+    for (const auto& conn : conns) {
+        conn->open = false;
+        ::shutdown(conn->fd, SHUT_RDWR);
+    }
+}
+
+void InferenceServer::worker_loop(u32 worker) {
+    InferenceModel& model = *replicas[worker];
+    u32 max_batch = desc.max_batch;
+    u64 max_wait_ns = static_cast<u64>(desc.max_wait_us) * 1000;
+
+    std::vector<Request> batch;
+    std::vector<f32> images(static_cast<u64>(max_batch) * input_size);
+    std::vector<u32> labels(max_batch);
+    std::vector<f32> outputs(static_cast<u64>(max_batch) * output_size);
+    std::vector<u8> response(response_bytes());
+    std::vector<u32> latencies;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queue_cv.wait(lock, [&]() { return stopping || !queue.empty(); });
+
+            // Give the batch until its oldest request's deadline to fill up
+            u64 deadline = stopping ? 0 : queue.front().received_ns + max_wait_ns;
+            while (!stopping && !queue.empty() && queue.size() < max_batch) {
+                u64 now = now_ns();
+                if (now >= deadline) break;
+                queue_cv.wait_for(lock, std::chrono::nanoseconds(deadline - now));
+            }
+            if (stopping) return;
+            if (queue.empty()) continue;
+
+            u32 n = std::min(max_batch, static_cast<u32>(queue.size()));
+            for (u32 i = 0; i < n; i++) {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+            if (!queue.empty()) queue_cv.notify_one();
+        }
+
+        // One sample per row, as predict() takes them
+        u32 n = static_cast<u32>(batch.size());
+        for (u32 i = 0; i < n; i++) {
+            std::memcpy(images.data() + static_cast<u64>(i) * input_size, batch[i].input.data(),
+                input_size * sizeof(f32));
+        }
+        Matrix rows = Matrix::view(n, input_size, images.data());
+        model.predict(rows, labels.data(), outputs.data(), 1);
+
+        for (u32 i = 0; i < n; i++) {
+            Connection& conn = *batch[i].conn;
+            std::memcpy(response.data(), &batch[i].id, sizeof(u32));
+            std::memcpy(response.data() + 4, &labels[i], sizeof(u32));
+            std::memcpy(response.data() + 8, outputs.data() + static_cast<u64>(i) * output_size,
+                output_size * sizeof(f32));
+            bool wake = false;
+            {
+                std::lock_guard<std::mutex> lock(conn.write_mutex);
+                conn.in_flight--;
+                if (conn.open) {
+                    bool was_idle = conn.output.empty();
+                    conn.output.insert(conn.output.end(), response.begin(), response.end());
+                    flush_output(conn);
+                    // The poll thread sends the rest, and drops a finished connection
+                    wake = (was_idle && !conn.output.empty()) || (conn.eof && conn.in_flight == 0);
+                }
+            }
+            if (wake) wake_io();
+            latencies.push_back(static_cast<u32>(std::min<u64>((now_ns() - batch[i].received_ns) / 1000, UINT32_MAX)));
+        }
+        batch.clear();
+
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        latencies_us.insert(latencies_us.end(), latencies.begin(), latencies.end());
+        batches++;
+        latencies.clear();
+    }
+}
+
+#else
+
+struct InferenceServer::Connection {};
+
+std::unique_ptr<InferenceServer> InferenceServer::start(const InferenceModel&, const char*,
+    const InferenceServerDesc&) {
+    std::fprintf(stderr, "InferenceServer: not supported on this platform\n");
+    return nullptr;
+}
+
+InferenceServer::~InferenceServer() {}
+
+#endif
@@ -0,0 +1,102 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Types.hpp"
+
+class InferenceModel;
+
+struct InferenceServerDesc {
+    // Queued requests go through the graph together, up to max_batch at a
+    // time; a batch goes early once its oldest request has waited max_wait_us
+    u32 max_batch = 64;
+    u32 max_wait_us = 200;
+
+    // Threads running batches, each on its own replica of the model (0 = all
+    // hardware threads)
+    u32 num_workers = 0;
+};
+
+// Counters since the previous InferenceServer::take_stats(). Latency runs
+// from a request being read to its response being written.
+struct InferenceServerStats {
+    u64 requests = 0;
+    u64 batches = 0;
+    double seconds = 0.0;
+    u32 p50_us = 0;
+    u32 p99_us = 0;
+    u32 max_us = 0;
+};
+
+// Serves an InferenceModel over a stream socket, "unix:PATH" or
+// "tcp:HOST:PORT" (TCP on 127.0.0.1 only). One thread reads requests from
+// every connection into a queue; worker threads take micro-batches off it.
+//
+// Wire format, in host byte order. A request is a u32 id followed by
+// input_size() f32 values. Its response is the same id, the u32 predicted
+// label and output_size() f32 outputs. A client may keep any number of
+// requests in flight; responses come back as their batches finish. While a
+// client leaves more than about 1 MiB of responses unread, no more of its
+// requests are read. After the client shuts down its sending side, the
+// responses it is owed are still written.
+// POSIX only.
+class InferenceServer {
+public:
+    // Starts serving at once; nullptr if the address is bad or taken. The
+    // model is only read while starting.
+    static std::unique_ptr<InferenceServer> start(const InferenceModel& model, const char* address,
+        const InferenceServerDesc& desc = InferenceServerDesc());
+    // Stops accepting and reading, drops queued requests and closes every
+    // connection once the batches running finish
+    ~InferenceServer();
+
+    InferenceServer(const InferenceServer&) = delete;
+    InferenceServer& operator=(const InferenceServer&) = delete;
+
+    u32 request_bytes() const { return 4 * (1 + input_size); }
+    u32 response_bytes() const { return 4 * (2 + output_size); }
+
+    InferenceServerStats take_stats();
+
+private:
+    struct Connection;
+    struct Request {
+        std::shared_ptr<Connection> conn;
+        u32 id;
+        u64 received_ns;
+        std::vector<f32> input;
+    };
+
+    InferenceServer() = default;
+    void io_loop();
+    void worker_loop(u32 worker);
+    void read_requests(const std::shared_ptr<Connection>& conn, std::vector<Request>& out);
+    void wake_io();
+    static void flush_output(Connection& conn);
+
+    InferenceServerDesc desc;
+    u32 input_size = 0;
+    u32 output_size = 0;
+    std::vector<std::unique_ptr<InferenceModel>> replicas;
+
+    int listen_fd = -1;
+    int wake_fds[2] = { -1, -1 };
+    std::string socket_path;
+
+    std::thread io_thread;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable queue_cv;
+    std::deque<Request> queue;
+    bool stopping = false;
+
+    std::mutex stats_mutex;
+    std::vector<u32> latencies_us;
+    u64 batches = 0;
+    u64 stats_start_ns = 0;
+};
@@ -0,0 +1,59 @@
+#include <cstdio>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "MappedFile.hpp"
+
+std::unique_ptr<MappedFile> MappedFile::open(const char* path, bool copy_on_write) {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    file->writable = copy_on_write;
+
+#ifndef _WIN32
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    file->length = static_cast<u64>(st.st_size);
+    if (file->length > 0) {
+        int prot = copy_on_write ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        void* p = mmap(nullptr, file->length, prot, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            return nullptr;
+        }
+        file->bytes = static_cast<const u8*>(p);
+        file->mapped = true;
+    }
+    ::close(fd);
+#else
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in.is_open()) return nullptr;
+
+    file->length = static_cast<u64>(in.tellg());
+    in.seekg(0, std::ios::beg);
+    file->fallback.resize(file->length);
+    in.read(reinterpret_cast<char*>(file->fallback.data()), file->length);
+    file->bytes = file->fallback.data();
+#endif
+
+    return file;
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+    if (mapped) {
+        munmap(const_cast<u8*>(bytes), length);
+    }
+#endif
+}
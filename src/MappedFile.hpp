@@ -0,0 +1,32 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "Types.hpp"
+
+// Read-only view of a whole file. On POSIX systems the file is mmap'd, so
+// pages are shared with the page cache and only read in when touched.
+class MappedFile {
+public:
+    // With copy_on_write the mapping is also writable; written pages become
+    // private copies and the file itself is never modified
+    static std::unique_ptr<MappedFile> open(const char* path, bool copy_on_write = false);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const u8* data() const { return bytes; }
+    u64 size() const { return length; }
+    // Only valid for copy-on-write mappings
+    u8* writable_data() const { return writable ? const_cast<u8*>(bytes) : nullptr; }
+
+private:
+    MappedFile() = default;
+
+    const u8* bytes = nullptr;
+    u64 length = 0;
+    bool mapped = false;
+    bool writable = false;
+    std::vector<u8> fallback;
+};
@@ -1,156 +1,335 @@
 #include <cstring>
+#include <cmath>
 #include <vector>
 #include <memory>
 #include <random>
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <type_traits>
 
 #include "PRNG.hpp"
 #include "Types.hpp"
 #include "Matrix.hpp"
+#include "Gemm.hpp"
+#include "VecMath.hpp"
 
-Matrix::Matrix(u32 r, u32 c) : rows(r), cols(c), data(static_cast<u64>(r)* c, 0.0f) {}
+template <typename T>
+MatrixT<T>::MatrixT(u32 r, u32 c) : rows(r), cols(c), storage(static_cast<u64>(r)* c, T()) {
+    data = storage.data();
+}
 
-std::unique_ptr<Matrix> Matrix::create(u32 rows, u32 cols) {
-    return std::make_unique<Matrix>(rows, cols);
+template <typename T>
+MatrixT<T>::MatrixT(const MatrixT& other)
+    : rows(other.rows), cols(other.cols), storage(other.data, other.data + other.size()) {
+    data = storage.data();
 }
 
-std::unique_ptr<Matrix> Matrix::load(u32 rows, u32 cols, const char* filename) {
-    auto mat = create(rows, cols);
+template <typename T>
+MatrixT<T>::MatrixT(MatrixT&& other) noexcept
+    : rows(other.rows), cols(other.cols), data(other.data), storage(std::move(other.storage)) {
+    other.rows = 0;
+    other.cols = 0;
+    other.data = nullptr;
+}
 
+template <typename T>
+MatrixT<T>& MatrixT<T>::operator=(const MatrixT& other) {
+    if (this != &other) {
+        rows = other.rows;
+        cols = other.cols;
+        storage.assign(other.data, other.data + other.size());
+        data = storage.data();
+    }
+    return *this;
+}
+
+template <typename T>
+MatrixT<T>& MatrixT<T>::operator=(MatrixT&& other) noexcept {
+    if (this != &other) {
+        rows = other.rows;
+        cols = other.cols;
+        data = other.data;
+        storage = std::move(other.storage);
+        other.rows = 0;
+        other.cols = 0;
+        other.data = nullptr;
+    }
+    return *this;
+}
+
+template <typename T>
+std::unique_ptr<MatrixT<T>> MatrixT<T>::create(u32 rows, u32 cols) {
+    return std::make_unique<MatrixT>(rows, cols);
+}
+
+template <typename T>
+MatrixT<T> MatrixT<T>::view(u32 rows, u32 cols, T* data) {
+    MatrixT mat;
+    mat.bind(rows, cols, data);
+    return mat;
+}
+
+template <typename T>
+void MatrixT<T>::bind(u32 r, u32 c, T* external) {
+    std::vector<T>().swap(storage);
+    rows = r;
+    cols = c;
+    data = external;
+}
+
+template <typename T>
+std::unique_ptr<MatrixT<T>> MatrixT<T>::load(u32 rows, u32 cols, const char* filename) {
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Failed to open file: " << filename << std::endl;
-        return mat;
+        return nullptr;
     }
 
     std::streamsize size = file.tellg();
     file.seekg(0, std::ios::beg);
 
-    size = std::min(size, static_cast<std::streamsize>(sizeof(f32) * rows * cols));
-    file.read(reinterpret_cast<char*>(mat->data.data()), size);
+    std::streamsize expected = static_cast<std::streamsize>(sizeof(T) * rows * cols);
+    if (size < expected) {
+        std::cerr << "File " << filename << " is too short: expected " << expected
+            << " bytes, found " << size << std::endl;
+        return nullptr;
+    }
 
+    auto mat = create(rows, cols);
+    if (!file.read(reinterpret_cast<char*>(mat->data), expected)) {
+        std::cerr << "Failed to read file: " << filename << std::endl;
+        return nullptr;
+    }
     return mat;
 }
 
-bool Matrix::copy_from(const Matrix& src) {
+template <typename T>
+bool MatrixT<T>::copy_from(const MatrixT& src) {
     if (rows != src.rows || cols != src.cols) return false;
-    data = src.data;
+    std::copy(src.data, src.data + src.size(), data);
     return true;
 }
 
-void Matrix::clear() {
-    std::fill(data.begin(), data.end(), 0.0f);
+template <typename T>
+void MatrixT<T>::clear() {
+    std::fill(data, data + size(), T());
 }
 
-void Matrix::fill(f32 x) {
-    std::fill(data.begin(), data.end(), x);
+template <typename T>
+void MatrixT<T>::fill(f32 x) {
+    std::fill(data, data + size(), from_f32<T>(x));
 }
 
-void Matrix::fill_rand(f32 lower, f32 upper) {
-    for (auto& v : data) {
-        v = prng_randf() * (upper - lower) + lower;
+template <typename T>
+void MatrixT<T>::fill_rand(f32 lower, f32 upper) {
+    PRNG& prng = PRNG::for_thread();
+    if (std::is_same<T, f32>::value) {
+        prng.fill_uniform(reinterpret_cast<f32*>(data), size(), lower, upper);
+        return;
+    }
+
+    f32 values[1024];
+    for (u64 first = 0; first < size(); first += 1024) {
+        u64 n = std::min<u64>(1024, size() - first);
+        prng.fill_uniform(values, n, lower, upper);
+        for (u64 i = 0; i < n; i++) data[first + i] = from_f32<T>(values[i]);
     }
 }
 
-void Matrix::scale(f32 s) {
-    for (auto& v : data) v *= s;
+template <typename T>
+void MatrixT<T>::scale(f32 s) {
+    for (u64 i = 0; i < size(); i++) data[i] = from_f32<T>(to_f32(data[i]) * s);
 }
 
-f32 Matrix::sum() const {
+template <typename T>
+f32 MatrixT<T>::sum() const {
     f32 s = 0.0f;
-    for (auto v : data) s += v;
+    for (u64 i = 0; i < size(); i++) s += to_f32(data[i]);
     return s;
 }
 
-u64 Matrix::argmax() const {
+template <typename T>
+u64 MatrixT<T>::argmax() const {
     u64 max_i = 0;
-    for (u64 i = 1; i < data.size(); i++) {
-        if (data[i] > data[max_i]) max_i = i;
+    for (u64 i = 1; i < size(); i++) {
+        if (to_f32(data[i]) > to_f32(data[max_i])) max_i = i;
     }
     return max_i;
 }
 
-u64 Matrix::size() const { return static_cast<u64>(rows) * cols; }
+template <typename T>
+u32 MatrixT<T>::argmax_col(u32 c) const {
+    u32 max_r = 0;
+    for (u32 r = 1; r < rows; r++) {
+        if (to_f32(at(r, c)) > to_f32(at(max_r, c))) max_r = r;
+    }
+    return max_r;
+}
+
+template <typename T>
+u64 MatrixT<T>::size() const { return static_cast<u64>(rows) * cols; }
+
+template <typename T>
+T& MatrixT<T>::at(u32 r, u32 c) { return data[c + r * cols]; }
+template <typename T>
+const T& MatrixT<T>::at(u32 r, u32 c) const { return data[c + r * cols]; }
 
-f32& Matrix::at(u32 r, u32 c) { return data[c + r * cols]; }
-const f32& Matrix::at(u32 r, u32 c) const { return data[c + r * cols]; }
+template class MatrixT<f32>;
+template class MatrixT<bf16>;
 
 
 
 
 namespace MatOps {
 
-    bool add(Matrix& out, const Matrix& a, const Matrix& b) {
+namespace {
+
+    // f32 results are accumulated in place. Anything else goes through an
+    // f32 scratch that store_accumulator rounds into out once at the end.
+    Matrix& accumulator(Matrix& out, bool) {
+        return out;
+    }
+
+    Matrix& accumulator(MatrixBF16& out, bool load) {
+        thread_local std::vector<f32> storage;
+        thread_local Matrix scratch;
+        storage.resize(out.size());
+        if (load) BF16::to_f32(out.data, storage.data(), out.size());
+        scratch.bind(out.rows, out.cols, storage.data());
+        return scratch;
+    }
+
+    void store_accumulator(Matrix&, const Matrix&) {}
+
+    void store_accumulator(MatrixBF16& out, const Matrix& acc) {
+        BF16::from_f32(acc.data, out.data, out.size());
+    }
+
+    // Max of each column, scanning whole rows
+    template <typename T>
+    void column_max(const MatrixT<T>& in, std::vector<f32>& max) {
+        max.resize(in.cols);
+        for (u32 c = 0; c < in.cols; c++) max[c] = to_f32(in.data[c]);
+        for (u32 r = 1; r < in.rows; r++) {
+            const T* x = in.data + static_cast<u64>(r) * in.cols;
+            for (u32 c = 0; c < in.cols; c++) max[c] = std::max(max[c], to_f32(x[c]));
+        }
+    }
+
+    // logs[i] = log(in.data[i]) for every element
+    template <typename T>
+    void log_values(const MatrixT<T>& in, std::vector<f32>& logs) {
+        logs.resize(in.size());
+        for (u64 i = 0; i < in.size(); i++) logs[i] = to_f32(in.data[i]);
+        VecMath::log(logs.data(), logs.data(), in.size());
+    }
+
+    // A (1 x batch) row of class indices below num_classes. Checked on the
+    // f32 value: converting a negative, fractional or NaN label to u32 is
+    // undefined or picks the wrong class.
+    template <typename T>
+    bool valid_labels(const MatrixT<T>& labels, u32 num_classes) {
+        for (u32 c = 0; c < labels.cols; c++) {
+            f32 l = to_f32(labels.data[c]);
+            if (!(l >= 0.0f && l < static_cast<f32>(num_classes) && l == std::floor(l))) return false;
+        }
+        return true;
+    }
+
+    // Only after valid_labels()
+    template <typename T>
+    u32 class_index(const MatrixT<T>& labels, u32 c) {
+        return static_cast<u32>(to_f32(labels.data[c]));
+    }
+
+} // namespace
+
+    template <typename TO, typename TA, typename TB>
+    bool add(MatrixT<TO>& out, const MatrixT<TA>& a, const MatrixT<TB>& b) {
         if (a.rows != b.rows || a.cols != b.cols) return false;
         if (out.rows != a.rows || out.cols != a.cols) return false;
 
         for (u64 i = 0; i < out.size(); i++) {
-            out.data[i] = a.data[i] + b.data[i];
+            out.data[i] = from_f32<TO>(to_f32(a.data[i]) + to_f32(b.data[i]));
         }
         return true;
     }
 
-    bool sub(Matrix& out, const Matrix& a, const Matrix& b) {
+    template <typename TO, typename TA, typename TB>
+    bool sub(MatrixT<TO>& out, const MatrixT<TA>& a, const MatrixT<TB>& b) {
         if (a.rows != b.rows || a.cols != b.cols) return false;
         if (out.rows != a.rows || out.cols != a.cols) return false;
 
         for (u64 i = 0; i < out.size(); i++) {
-            out.data[i] = a.data[i] - b.data[i];
+            out.data[i] = from_f32<TO>(to_f32(a.data[i]) - to_f32(b.data[i]));
         }
         return true;
     }
 
-    void mul_nn(Matrix& out, const Matrix& a, const Matrix& b) {
-        for (u64 i = 0; i < out.rows; i++) {
-            for (u64 k = 0; k < a.cols; k++) {
-                for (u64 j = 0; j < out.cols; j++) {
-                    out.data[j + i * out.cols] +=
-                        a.data[k + i * a.cols] *
-                        b.data[j + k * b.cols];
-                }
-            }
+    bool axpy(Matrix& y, f32 alpha, const Matrix& x) {
+        if (y.rows != x.rows || y.cols != x.cols) return false;
+
+        for (u64 i = 0; i < y.size(); i++) {
+            y.data[i] += alpha * x.data[i];
         }
+        return true;
     }
 
-    void mul_nt(Matrix& out, const Matrix& a, const Matrix& b) {
-        for (u64 i = 0; i < out.rows; i++) {
-            for (u64 j = 0; j < out.cols; j++) {
-                for (u64 k = 0; k < a.cols; k++) {
-                    out.data[j + i * out.cols] +=
-                        a.data[k + i * a.cols] *
-                        b.data[k + j * b.cols];
-                }
+    template <typename TO, typename TA, typename TC>
+    bool add_col(MatrixT<TO>& out, const MatrixT<TA>& a, const MatrixT<TC>& col) {
+        if (col.rows != a.rows || col.cols != 1) return false;
+        if (out.rows != a.rows || out.cols != a.cols) return false;
+
+        for (u32 r = 0; r < out.rows; r++) {
+            f32 v = to_f32(col.data[r]);
+            for (u32 c = 0; c < out.cols; c++) {
+                out.at(r, c) = from_f32<TO>(to_f32(a.at(r, c)) + v);
             }
         }
+        return true;
     }
 
-    void mul_tn(Matrix& out, const Matrix& a, const Matrix& b) {
-        for (u64 k = 0; k < a.rows; k++) {
-            for (u64 i = 0; i < out.rows; i++) {
-                for (u64 j = 0; j < out.cols; j++) {
-                    out.data[j + i * out.cols] +=
-                        a.data[i + k * a.cols] *
-                        b.data[j + k * b.cols];
-                }
+    bool add_col_sum(Matrix& out, const Matrix& in) {
+        if (out.rows != in.rows || out.cols != 1) return false;
+
+        for (u32 r = 0; r < in.rows; r++) {
+            f32 s = 0.0f;
+            for (u32 c = 0; c < in.cols; c++) {
+                s += in.at(r, c);
             }
+            out.data[r] += s;
         }
+        return true;
     }
 
-    void mul_tt(Matrix& out, const Matrix& a, const Matrix& b) {
-        for (u64 i = 0; i < out.rows; i++) {
-            for (u64 j = 0; j < out.cols; j++) {
-                for (u64 k = 0; k < a.rows; k++) {
-                    out.data[j + i * out.cols] +=
-                        a.data[i + k * a.cols] *
-                        b.data[k + j * b.cols];
-                }
-            }
-        }
+    // The transpose variants only differ in how Gemm packs its operands
+    template <typename TA, typename TB>
+    void mul_nn(Matrix& out, const MatrixT<TA>& a, const MatrixT<TB>& b) {
+        Gemm::gemm(false, false, out.rows, out.cols, a.cols,
+            a.data, a.cols, b.data, b.cols, out.data, out.cols);
     }
 
-    bool mul(Matrix& out, const Matrix& a, const Matrix& b,
+    template <typename TA, typename TB>
+    void mul_nt(Matrix& out, const MatrixT<TA>& a, const MatrixT<TB>& b) {
+        Gemm::gemm(false, true, out.rows, out.cols, a.cols,
+            a.data, a.cols, b.data, b.cols, out.data, out.cols);
+    }
+
+    template <typename TA, typename TB>
+    void mul_tn(Matrix& out, const MatrixT<TA>& a, const MatrixT<TB>& b) {
+        Gemm::gemm(true, false, out.rows, out.cols, a.rows,
+            a.data, a.cols, b.data, b.cols, out.data, out.cols);
+    }
+
+    template <typename TA, typename TB>
+    void mul_tt(Matrix& out, const MatrixT<TA>& a, const MatrixT<TB>& b) {
+        Gemm::gemm(true, true, out.rows, out.cols, a.rows,
+            a.data, a.cols, b.data, b.cols, out.data, out.cols);
+    }
+
+    template <typename TO, typename TA, typename TB>
+    bool mul(MatrixT<TO>& out, const MatrixT<TA>& a, const MatrixT<TB>& b,
         bool zero_out, bool transpose_a, bool transpose_b) {
         u32 a_rows = transpose_a ? a.cols : a.rows;
         u32 a_cols = transpose_a ? a.rows : a.cols;
@@ -160,101 +339,300 @@ namespace MatOps {
         if (a_cols != b_rows) return false;
         if (out.rows != a_rows || out.cols != b_cols) return false;
 
+        Matrix& acc = accumulator(out, !zero_out);
         if (zero_out) {
-            out.clear();
+            acc.clear();
         }
 
         u32 transpose = (static_cast<u32>(transpose_a) << 1) | static_cast<u32>(transpose_b);
         switch (transpose) {
-        case 0b00: mul_nn(out, a, b); break;
-        case 0b01: mul_nt(out, a, b); break;
-        case 0b10: mul_tn(out, a, b); break;
-        case 0b11: mul_tt(out, a, b); break;
+        case 0b00: mul_nn(acc, a, b); break;
+        case 0b01: mul_nt(acc, a, b); break;
+        case 0b10: mul_tn(acc, a, b); break;
+        case 0b11: mul_tt(acc, a, b); break;
         }
 
+        store_accumulator(out, acc);
         return true;
     }
 
-    bool relu(Matrix& out, const Matrix& in) {
-        if (out.rows != in.rows || out.cols != in.cols) return false;
+    template <typename TO, typename TW, typename TX>
+    bool linear(MatrixT<TO>& out, const MatrixT<TW>& w, const MatrixT<TX>& x, const Matrix& bias) {
+        if (w.cols != x.rows) return false;
+        if (out.rows != w.rows || out.cols != x.cols) return false;
+        if (bias.rows != out.rows || bias.cols != 1) return false;
+
+        Matrix& acc = accumulator(out, false);
+        for (u32 r = 0; r < acc.rows; r++) {
+            std::fill(acc.data + static_cast<u64>(r) * acc.cols,
+                acc.data + static_cast<u64>(r + 1) * acc.cols, bias.data[r]);
+        }
+        mul_nn(acc, w, x);
+        store_accumulator(out, acc);
+        return true;
+    }
+
+    template <typename TO, typename TR>
+    bool relu_residual(MatrixT<TO>& out, MatrixT<TO>& h, const MatrixT<TR>& residual) {
+        if (h.rows != out.rows || h.cols != out.cols) return false;
+        if (residual.rows != out.rows || residual.cols != out.cols) return false;
 
         for (u64 i = 0; i < out.size(); i++) {
-            out.data[i] = std::max(0.0f, in.data[i]);
+            f32 v = std::max(0.0f, to_f32(out.data[i]));
+            h.data[i] = from_f32<TO>(v);
+            out.data[i] = from_f32<TO>(to_f32(residual.data[i]) + v);
         }
         return true;
     }
 
-    bool softmax(Matrix& out, const Matrix& in) {
+    template <typename TO, typename TI>
+    bool relu(MatrixT<TO>& out, const MatrixT<TI>& in) {
         if (out.rows != in.rows || out.cols != in.cols) return false;
 
-        f32 sum = 0.0f;
         for (u64 i = 0; i < out.size(); i++) {
-            out.data[i] = std::exp(in.data[i]);
-            sum += out.data[i];
+            out.data[i] = from_f32<TO>(std::max(0.0f, to_f32(in.data[i])));
+        }
+        return true;
+    }
+
+    template <typename TO, typename TI>
+    bool softmax(MatrixT<TO>& out, const MatrixT<TI>& in) {
+        if (out.rows != in.rows || out.cols != in.cols) return false;
+
+        // Row vectors are a single distribution, otherwise each column is one.
+        // Subtracting the max keeps exp from overflowing on large logits. The
+        // exps are kept in f32 until they are normalized.
+        thread_local std::vector<f32> exps;
+        exps.resize(out.size());
+        if (in.rows == 1) {
+            f32 max = to_f32(in.data[in.argmax()]);
+            for (u64 i = 0; i < out.size(); i++) exps[i] = to_f32(in.data[i]) - max;
+            VecMath::exp(exps.data(), exps.data(), out.size());
+            f32 sum = 0.0f;
+            for (u64 i = 0; i < out.size(); i++) sum += exps[i];
+            f32 inv = 1.0f / sum;
+            for (u64 i = 0; i < out.size(); i++) {
+                out.data[i] = from_f32<TO>(exps[i] * inv);
+            }
+            return true;
+        }
+
+        // Whole rows at a time, so exp runs over contiguous columns
+        thread_local std::vector<f32> max;
+        thread_local std::vector<f32> sum;
+        column_max(in, max);
+        sum.assign(out.cols, 0.0f);
+        for (u32 r = 0; r < out.rows; r++) {
+            const TI* x = in.data + static_cast<u64>(r) * in.cols;
+            f32* e = exps.data() + static_cast<u64>(r) * out.cols;
+            for (u32 c = 0; c < out.cols; c++) e[c] = to_f32(x[c]) - max[c];
+            VecMath::exp(e, e, out.cols);
+            for (u32 c = 0; c < out.cols; c++) sum[c] += e[c];
+        }
+        for (u32 c = 0; c < out.cols; c++) sum[c] = 1.0f / sum[c];
+        for (u32 r = 0; r < out.rows; r++) {
+            TO* y = out.data + static_cast<u64>(r) * out.cols;
+            const f32* e = exps.data() + static_cast<u64>(r) * out.cols;
+            for (u32 c = 0; c < out.cols; c++) y[c] = from_f32<TO>(e[c] * sum[c]);
         }
-        out.scale(1.0f / sum);
 
         return true;
     }
 
-    bool cross_entropy(Matrix& out, const Matrix& p, const Matrix& q) {
+    template <typename TO, typename TP, typename TQ>
+    bool cross_entropy(MatrixT<TO>& out, const MatrixT<TP>& p, const MatrixT<TQ>& q) {
         if (p.rows != q.rows || p.cols != q.cols) return false;
         if (out.rows != p.rows || out.cols != p.cols) return false;
 
+        thread_local std::vector<f32> logs;
+        log_values(q, logs);
         for (u64 i = 0; i < out.size(); i++) {
-            out.data[i] = (p.data[i] == 0.0f) ? 0.0f : p.data[i] * -std::log(q.data[i]);
+            f32 pv = to_f32(p.data[i]);
+            out.data[i] = from_f32<TO>((pv == 0.0f) ? 0.0f : pv * -logs[i]);
+        }
+        return true;
+    }
+
+    template <typename TO, typename TL, typename TY>
+    bool softmax_cross_entropy(MatrixT<TO>& out, const MatrixT<TL>& logits, const MatrixT<TY>& labels) {
+        if (labels.rows != 1 || labels.cols != logits.cols) return false;
+        if (out.rows != 1 || out.cols != logits.cols) return false;
+
+        if (!valid_labels(labels, logits.rows)) return false;
+
+        // -log(softmax(x)[label]) = log(sum(exp(x - max))) + max - x[label],
+        // a row of logits at a time
+        thread_local std::vector<f32> max;
+        thread_local std::vector<f32> sum;
+        thread_local std::vector<f32> e;
+        column_max(logits, max);
+        sum.assign(logits.cols, 0.0f);
+        e.resize(logits.cols);
+        for (u32 r = 0; r < logits.rows; r++) {
+            const TL* x = logits.data + static_cast<u64>(r) * logits.cols;
+            for (u32 c = 0; c < logits.cols; c++) e[c] = to_f32(x[c]) - max[c];
+            VecMath::exp(e.data(), e.data(), logits.cols);
+            for (u32 c = 0; c < logits.cols; c++) sum[c] += e[c];
+        }
+        VecMath::log(sum.data(), sum.data(), logits.cols);
+
+        for (u32 c = 0; c < logits.cols; c++) {
+            u32 label = class_index(labels, c);
+            out.data[c] = from_f32<TO>(sum[c] + max[c] - to_f32(logits.at(label, c)));
         }
         return true;
     }
 
-    bool relu_add_grad(Matrix& out, const Matrix& in, const Matrix& grad) {
+    template <typename TI>
+    bool relu_add_grad(Matrix& out, const MatrixT<TI>& in, const Matrix& grad) {
         if (out.rows != in.rows || out.cols != in.cols) return false;
         if (out.rows != grad.rows || out.cols != grad.cols) return false;
 
         for (u64 i = 0; i < out.size(); i++) {
-            out.data[i] += (in.data[i] > 0.0f) ? grad.data[i] : 0.0f;
+            out.data[i] += (to_f32(in.data[i]) > 0.0f) ? grad.data[i] : 0.0f;
         }
         return true;
     }
 
-    bool softmax_add_grad(Matrix& out, const Matrix& softmax_out, const Matrix& grad) {
-        if (softmax_out.rows != 1 && softmax_out.cols != 1) return false;
+    template <typename TY>
+    bool relu_mask(Matrix& grad, const MatrixT<TY>& relu_out, Matrix* bias_grad) {
+        if (grad.rows != relu_out.rows || grad.cols != relu_out.cols) return false;
+        if (bias_grad != nullptr && (bias_grad->rows != grad.rows || bias_grad->cols != 1)) return false;
+
+        for (u32 r = 0; r < grad.rows; r++) {
+            f32* g = grad.data + static_cast<u64>(r) * grad.cols;
+            const TY* y = relu_out.data + static_cast<u64>(r) * grad.cols;
+            f32 s = 0.0f;
+            for (u32 c = 0; c < grad.cols; c++) {
+                g[c] = (to_f32(y[c]) > 0.0f) ? g[c] : 0.0f;
+                s += g[c];
+            }
+            if (bias_grad != nullptr) bias_grad->data[r] += s;
+        }
+        return true;
+    }
 
-        u32 size = std::max(softmax_out.rows, softmax_out.cols);
-        Matrix jacobian(size, size);
+    template <typename TS>
+    bool softmax_add_grad(Matrix& out, const MatrixT<TS>& softmax_out, const Matrix& grad) {
+        if (out.rows != softmax_out.rows || out.cols != softmax_out.cols) return false;
+        if (grad.rows != softmax_out.rows || grad.cols != softmax_out.cols) return false;
 
-        for (u32 i = 0; i < size; i++) {
-            for (u32 j = 0; j < size; j++) {
-                jacobian.data[j + i * size] =
-                    softmax_out.data[i] * ((i == j ? 1.0f : 0.0f) - softmax_out.data[j]);
+        // J^T g for J = diag(s) - s s^T, i.e. s * (g - dot(s, g)), per distribution
+        if (softmax_out.rows == 1) {
+            f32 dot = 0.0f;
+            for (u64 i = 0; i < softmax_out.size(); i++) {
+                dot += to_f32(softmax_out.data[i]) * grad.data[i];
+            }
+            for (u64 i = 0; i < softmax_out.size(); i++) {
+                out.data[i] += to_f32(softmax_out.data[i]) * (grad.data[i] - dot);
             }
+            return true;
         }
 
-        mul(out, jacobian, grad, false, false, false);
+        for (u32 c = 0; c < softmax_out.cols; c++) {
+            f32 dot = 0.0f;
+            for (u32 r = 0; r < softmax_out.rows; r++) {
+                dot += to_f32(softmax_out.at(r, c)) * grad.at(r, c);
+            }
+            for (u32 r = 0; r < softmax_out.rows; r++) {
+                out.at(r, c) += to_f32(softmax_out.at(r, c)) * (grad.at(r, c) - dot);
+            }
+        }
         return true;
     }
 
+    template <typename TP, typename TQ>
     bool cross_entropy_add_grad(Matrix* p_grad, Matrix* q_grad,
-        const Matrix& p, const Matrix& q, const Matrix& grad) {
+        const MatrixT<TP>& p, const MatrixT<TQ>& q, const Matrix& grad) {
         if (p.rows != q.rows || p.cols != q.cols) return false;
 
         u64 size = p.size();
 
         if (p_grad != nullptr) {
             if (p_grad->rows != p.rows || p_grad->cols != p.cols) return false;
+            thread_local std::vector<f32> logs;
+            log_values(q, logs);
             for (u64 i = 0; i < size; i++) {
-                p_grad->data[i] += -std::log(q.data[i]) * grad.data[i];
+                p_grad->data[i] += -logs[i] * grad.data[i];
             }
         }
 
         if (q_grad != nullptr) {
             if (q_grad->rows != q.rows || q_grad->cols != q.cols) return false;
             for (u64 i = 0; i < size; i++) {
-                q_grad->data[i] += -p.data[i] / q.data[i] * grad.data[i];
+                q_grad->data[i] += -to_f32(p.data[i]) / to_f32(q.data[i]) * grad.data[i];
             }
         }
 
         return true;
     }
 
+    template <typename TL, typename TY, typename TLoss>
+    bool softmax_cross_entropy_add_grad(Matrix& logits_grad, const MatrixT<TL>& logits,
+        const MatrixT<TY>& labels, const MatrixT<TLoss>& loss, const Matrix& grad) {
+        if (logits_grad.rows != logits.rows || logits_grad.cols != logits.cols) return false;
+        if (labels.rows != 1 || labels.cols != logits.cols) return false;
+        if (loss.cols != logits.cols || grad.cols != logits.cols) return false;
+
+        if (!valid_labels(labels, logits.rows)) return false;
+
+        // d/dx = softmax(x) - onehot(label). The forward loss already holds the
+        // log-sum-exp (loss + x[label]), so each probability is a single exp.
+        thread_local std::vector<f32> lse;
+        thread_local std::vector<f32> e;
+        lse.resize(logits.cols);
+        e.resize(logits.cols);
+        for (u32 c = 0; c < logits.cols; c++) {
+            u32 label = class_index(labels, c);
+            lse[c] = to_f32(loss.data[c]) + to_f32(logits.at(label, c));
+        }
+        for (u32 r = 0; r < logits.rows; r++) {
+            const TL* x = logits.data + static_cast<u64>(r) * logits.cols;
+            f32* dx = logits_grad.data + static_cast<u64>(r) * logits.cols;
+            for (u32 c = 0; c < logits.cols; c++) e[c] = to_f32(x[c]) - lse[c];
+            VecMath::exp(e.data(), e.data(), logits.cols);
+            for (u32 c = 0; c < logits.cols; c++) dx[c] += e[c] * grad.data[c];
+        }
+        for (u32 c = 0; c < logits.cols; c++) {
+            u32 label = class_index(labels, c);
+            logits_grad.at(label, c) -= grad.data[c];
+        }
+        return true;
+    }
+
+    // Every mix of f32 and bf16 operands
+#define MATOPS_EACH_1(X) X(f32) X(bf16)
+#define MATOPS_EACH_2(X) X(f32, f32) X(f32, bf16) X(bf16, f32) X(bf16, bf16)
+#define MATOPS_EACH_3(X) \
+    X(f32, f32, f32) X(f32, f32, bf16) X(f32, bf16, f32) X(f32, bf16, bf16) \
+    X(bf16, f32, f32) X(bf16, f32, bf16) X(bf16, bf16, f32) X(bf16, bf16, bf16)
+
+#define MATOPS_BINARY(O, A, B) \
+    template bool add(MatrixT<O>&, const MatrixT<A>&, const MatrixT<B>&); \
+    template bool sub(MatrixT<O>&, const MatrixT<A>&, const MatrixT<B>&); \
+    template bool add_col(MatrixT<O>&, const MatrixT<A>&, const MatrixT<B>&); \
+    template bool mul(MatrixT<O>&, const MatrixT<A>&, const MatrixT<B>&, bool, bool, bool); \
+    template bool linear(MatrixT<O>&, const MatrixT<A>&, const MatrixT<B>&, const Matrix&); \
+    template bool cross_entropy(MatrixT<O>&, const MatrixT<A>&, const MatrixT<B>&); \
+    template bool softmax_cross_entropy(MatrixT<O>&, const MatrixT<A>&, const MatrixT<B>&); \
+    template bool softmax_cross_entropy_add_grad(Matrix&, const MatrixT<O>&, \
+        const MatrixT<A>&, const MatrixT<B>&, const Matrix&);
+#define MATOPS_UNARY(O, I) \
+    template void mul_nn(Matrix&, const MatrixT<O>&, const MatrixT<I>&); \
+    template void mul_nt(Matrix&, const MatrixT<O>&, const MatrixT<I>&); \
+    template void mul_tn(Matrix&, const MatrixT<O>&, const MatrixT<I>&); \
+    template void mul_tt(Matrix&, const MatrixT<O>&, const MatrixT<I>&); \
+    template bool relu_residual(MatrixT<O>&, MatrixT<O>&, const MatrixT<I>&); \
+    template bool relu(MatrixT<O>&, const MatrixT<I>&); \
+    template bool softmax(MatrixT<O>&, const MatrixT<I>&); \
+    template bool cross_entropy_add_grad(Matrix*, Matrix*, const MatrixT<O>&, const MatrixT<I>&, const Matrix&);
+#define MATOPS_GRAD(I) \
+    template bool relu_add_grad(Matrix&, const MatrixT<I>&, const Matrix&); \
+    template bool relu_mask(Matrix&, const MatrixT<I>&, Matrix*); \
+    template bool softmax_add_grad(Matrix&, const MatrixT<I>&, const Matrix&);
+
+    MATOPS_EACH_3(MATOPS_BINARY)
+    MATOPS_EACH_2(MATOPS_UNARY)
+    MATOPS_EACH_1(MATOPS_GRAD)
+
 } // namespace MatOps
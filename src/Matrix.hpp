@@ -9,54 +9,117 @@
 #include <random>
 
 #include "Types.hpp"
+#include "BFloat16.hpp"
 
-class Matrix {
+// Row-major matrix of T, either f32 or bf16. It either owns its storage or
+// is a view into memory owned elsewhere (e.g. a ModelContext arena); copies
+// always own their data. Element values go in and out as f32.
+template <typename T>
+class MatrixT {
 public:
     u32 rows = 0;
     u32 cols = 0;
-    std::vector<f32> data;
+    T* data = nullptr;
 
-    Matrix() = default;
-    Matrix(u32 r, u32 c);
+    MatrixT() = default;
+    MatrixT(u32 r, u32 c);
+    MatrixT(const MatrixT& other);
+    MatrixT(MatrixT&& other) noexcept;
+    MatrixT& operator=(const MatrixT& other);
+    MatrixT& operator=(MatrixT&& other) noexcept;
 
-    static std::unique_ptr<Matrix> create(u32 rows, u32 cols);
-    static std::unique_ptr<Matrix> load(u32 rows, u32 cols, const char* filename);
+    static std::unique_ptr<MatrixT> create(u32 rows, u32 cols);
+    // Raw rows * cols elements; nullptr if the file is missing or too short
+    static std::unique_ptr<MatrixT> load(u32 rows, u32 cols, const char* filename);
+    static MatrixT view(u32 rows, u32 cols, T* data);
 
-    bool copy_from(const Matrix& src);
+    // Turns this matrix into a view of external memory, dropping any storage
+    void bind(u32 rows, u32 cols, T* data);
+    bool owns_data() const { return !storage.empty(); }
+
+    bool copy_from(const MatrixT& src);
     void clear();
     void fill(f32 x);
     void fill_rand(f32 lower, f32 upper);
     void scale(f32 s);
     f32 sum() const;
     u64 argmax() const;
+    u32 argmax_col(u32 c) const;
     u64 size() const;
 
-    f32& at(u32 r, u32 c);
-    const f32& at(u32 r, u32 c) const;
+    T& at(u32 r, u32 c);
+    const T& at(u32 r, u32 c) const;
+
+private:
+    std::vector<T> storage;
 };
 
+using Matrix = MatrixT<f32>;
+using MatrixBF16 = MatrixT<bf16>;
+
 
 namespace MatOps {
 
-    bool add(Matrix& out, const Matrix& a, const Matrix& b);
-    bool sub(Matrix& out, const Matrix& a, const Matrix& b);
+    // Operands given as MatrixT<T> may be stored as f32 or bf16 in any mix:
+    // elements are widened on load, arithmetic and accumulation are f32, and
+    // bf16 results are rounded once on store. Gradients are always f32.
 
-    void mul_nn(Matrix& out, const Matrix& a, const Matrix& b);
-    void mul_nt(Matrix& out, const Matrix& a, const Matrix& b);
-    void mul_tn(Matrix& out, const Matrix& a, const Matrix& b);
-    void mul_tt(Matrix& out, const Matrix& a, const Matrix& b);
+    template <typename TO, typename TA, typename TB>
+    bool add(MatrixT<TO>& out, const MatrixT<TA>& a, const MatrixT<TB>& b);
+    template <typename TO, typename TA, typename TB>
+    bool sub(MatrixT<TO>& out, const MatrixT<TA>& a, const MatrixT<TB>& b);
+    bool axpy(Matrix& y, f32 alpha, const Matrix& x);
 
-    bool mul(Matrix& out, const Matrix& a, const Matrix& b,
-        bool zero_out = true, bool transpose_a = false, bool transpose_b = false);
+    // Broadcasting helpers for batched execution, where each column is a sample
+    template <typename TO, typename TA, typename TC>
+    bool add_col(MatrixT<TO>& out, const MatrixT<TA>& a, const MatrixT<TC>& col);
+    bool add_col_sum(Matrix& out, const Matrix& in);
 
-    bool relu(Matrix& out, const Matrix& in);
-    bool softmax(Matrix& out, const Matrix& in);
-    bool cross_entropy(Matrix& out, const Matrix& p, const Matrix& q);
+    template <typename TA, typename TB> void mul_nn(Matrix& out, const MatrixT<TA>& a, const MatrixT<TB>& b);
+    template <typename TA, typename TB> void mul_nt(Matrix& out, const MatrixT<TA>& a, const MatrixT<TB>& b);
+    template <typename TA, typename TB> void mul_tn(Matrix& out, const MatrixT<TA>& a, const MatrixT<TB>& b);
+    template <typename TA, typename TB> void mul_tt(Matrix& out, const MatrixT<TA>& a, const MatrixT<TB>& b);
 
-    bool relu_add_grad(Matrix& out, const Matrix& in, const Matrix& grad);
-    bool softmax_add_grad(Matrix& out, const Matrix& softmax_out, const Matrix& grad);
+    template <typename TO, typename TA, typename TB>
+    bool mul(MatrixT<TO>& out, const MatrixT<TA>& a, const MatrixT<TB>& b,
+        bool zero_out = true, bool transpose_a = false, bool transpose_b = false);
+
+    // Fused layer pieces. linear computes out = w x + bias with the bias
+    // broadcast over columns; it seeds the GEMM accumulator, so out is only
+    // written by the GEMM itself.
+    template <typename TO, typename TW, typename TX>
+    bool linear(MatrixT<TO>& out, const MatrixT<TW>& w, const MatrixT<TX>& x, const Matrix& bias);
+    // h = relu(out), out = residual + h in a single pass
+    template <typename TO, typename TR>
+    bool relu_residual(MatrixT<TO>& out, MatrixT<TO>& h, const MatrixT<TR>& residual);
+
+    template <typename TO, typename TI>
+    bool relu(MatrixT<TO>& out, const MatrixT<TI>& in);
+    template <typename TO, typename TI>
+    bool softmax(MatrixT<TO>& out, const MatrixT<TI>& in);
+    template <typename TO, typename TP, typename TQ>
+    bool cross_entropy(MatrixT<TO>& out, const MatrixT<TP>& p, const MatrixT<TQ>& q);
+
+    // Fused softmax + cross-entropy over the columns of logits; labels is a
+    // (1 x cols) row of class indices and out receives one loss per column.
+    // It and its gradient return false, touching nothing, if a label is not
+    // an integer in [0, logits.rows).
+    template <typename TO, typename TL, typename TY>
+    bool softmax_cross_entropy(MatrixT<TO>& out, const MatrixT<TL>& logits, const MatrixT<TY>& labels);
+
+    template <typename TI>
+    bool relu_add_grad(Matrix& out, const MatrixT<TI>& in, const Matrix& grad);
+    // In place: grad = 0 wherever relu_out <= 0. With bias_grad, the masked
+    // row sums are added to it in the same pass.
+    template <typename TY>
+    bool relu_mask(Matrix& grad, const MatrixT<TY>& relu_out, Matrix* bias_grad);
+    template <typename TS>
+    bool softmax_add_grad(Matrix& out, const MatrixT<TS>& softmax_out, const Matrix& grad);
+    template <typename TP, typename TQ>
     bool cross_entropy_add_grad(Matrix* p_grad, Matrix* q_grad,
-        const Matrix& p, const Matrix& q, const Matrix& grad);
+        const MatrixT<TP>& p, const MatrixT<TQ>& q, const Matrix& grad);
+    template <typename TL, typename TY, typename TLoss>
+    bool softmax_cross_entropy_add_grad(Matrix& logits_grad, const MatrixT<TL>& logits,
+        const MatrixT<TY>& labels, const MatrixT<TLoss>& loss, const Matrix& grad);
 
 } // namespace MatOps
-
@@ -0,0 +1,40 @@
+#include <cmath>
+
+#include "MnistModel.hpp"
+
+void create_mnist_model(ModelContext& model) {
+    ModelVar* input = model.create_var(784, 1, MV_FLAG_INPUT);
+
+    ModelVar* W0 = model.create_var(16, 784, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
+    ModelVar* W1 = model.create_var(16, 16, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
+    ModelVar* W2 = model.create_var(10, 16, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
+
+    f32 bound0 = std::sqrt(6.0f / (784 + 16));
+    f32 bound1 = std::sqrt(6.0f / (16 + 16));
+    f32 bound2 = std::sqrt(6.0f / (16 + 10));
+    W0->val.fill_rand(-bound0, bound0);
+    W1->val.fill_rand(-bound1, bound1);
+    W2->val.fill_rand(-bound2, bound2);
+
+    ModelVar* b0 = model.create_var(16, 1, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
+    ModelVar* b1 = model.create_var(16, 1, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
+    ModelVar* b2 = model.create_var(10, 1, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
+
+    ModelVar* z0_a = model.matmul(W0, input, 0);
+    ModelVar* z0_b = model.add(z0_a, b0, 0);
+    ModelVar* a0 = model.relu(z0_b, 0);
+
+    ModelVar* z1_a = model.matmul(W1, a0, 0);
+    ModelVar* z1_b = model.add(z1_a, b1, 0);
+    ModelVar* z1_c = model.relu(z1_b, 0);
+    ModelVar* a1 = model.add(a0, z1_c, 0);
+
+    ModelVar* z2_a = model.matmul(W2, a1, 0);
+    ModelVar* z2_b = model.add(z2_a, b2, 0);
+    model.softmax(z2_b, MV_FLAG_OUTPUT);
+
+    // Class index per sample; the cost works on the logits directly
+    ModelVar* y = model.create_var(1, 1, MV_FLAG_DESIRED_OUTPUT);
+
+    model.softmax_cross_entropy(z2_b, y, MV_FLAG_COST);
+}
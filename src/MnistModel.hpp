@@ -0,0 +1,7 @@
+#pragma once
+#include "ModelContext.hpp"
+
+// The 784 -> 16 -> 16 (residual) -> 10 classifier trained by mnist and timed
+// by mnist_bench. Weights get Glorot-uniform initial values; the cost is
+// softmax cross-entropy against a (1 x batch) row of class indices.
+void create_mnist_model(ModelContext& model);
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "ModelContext.hpp"
+#include "ModelCheckpoint.hpp"
+#include "InferenceModel.hpp"
+#include "MappedFile.hpp"
+
+namespace {
+
+    const char CHECKPOINT_MAGIC[4] = { 'M', 'N', 'C', 'K' };
+
+    u64 align_up(u64 x, u64 align) {
+        return (x + align - 1) & ~(align - 1);
+    }
+
+    // Whether [offset, offset + count * elem_size) lies within size bytes,
+    // without overflowing on hostile values
+    bool fits(u64 offset, u64 count, u64 elem_size, u64 size) {
+        return offset <= size && count <= (size - offset) / elem_size;
+    }
+
+    // Applies the shape rules of the graph builders (and of set_batch_size
+    // and the fusion pass) to a loaded var: its inputs must be compatible
+    // and its shape the one they imply. Shapes are otherwise trusted by every
+    // kernel, so a mismatch would read or write out of bounds.
+    bool valid_shape(const CheckpointVar& rec, ModelVarOp op, ModelVar* const* inputs, u32 batch_size) {
+        const Matrix* a = inputs[0] ? &inputs[0]->val : nullptr;
+        const Matrix* b = inputs[1] ? &inputs[1]->val : nullptr;
+        u32 rows = 0;
+        u32 cols = 0;
+
+        switch (op) {
+        case ModelVarOp::Create:
+            if (rec.flags & (MV_FLAG_INPUT | MV_FLAG_DESIRED_OUTPUT)) return rec.cols == batch_size;
+            return true;
+        case ModelVarOp::Relu:
+        case ModelVarOp::Softmax:
+            rows = a->rows;
+            cols = a->cols;
+            break;
+        case ModelVarOp::Add:
+            if (a->rows != b->rows || (a->cols != b->cols && a->cols != 1 && b->cols != 1)) return false;
+            rows = a->rows;
+            cols = std::max(a->cols, b->cols);
+            break;
+        case ModelVarOp::Sub:
+        case ModelVarOp::CrossEntropy:
+            if (a->rows != b->rows || a->cols != b->cols) return false;
+            rows = a->rows;
+            cols = a->cols;
+            break;
+        case ModelVarOp::Matmul:
+            if (a->cols != b->rows) return false;
+            rows = a->rows;
+            cols = b->cols;
+            break;
+        case ModelVarOp::SoftmaxCrossEntropy:
+            if (b->rows != 1 || b->cols != a->cols) return false;
+            rows = 1;
+            cols = a->cols;
+            break;
+        case ModelVarOp::LinearBias:
+        case ModelVarOp::LinearBiasRelu:
+        case ModelVarOp::LinearBiasReluAdd: {
+            const Matrix& bias = inputs[2]->val;
+            if (a->cols != b->rows || bias.rows != a->rows || bias.cols != 1) return false;
+            rows = a->rows;
+            cols = b->cols;
+            if (op == ModelVarOp::LinearBiasReluAdd) {
+                const Matrix& residual = inputs[3]->val;
+                if (residual.rows != rows || residual.cols != cols) return false;
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+        return rec.rows == rows && rec.cols == cols;
+    }
+
+} // namespace
+
+bool ModelContext::save(const char* path) const {
+    Matrix params = param_slab();
+    const u8* slab = reinterpret_cast<const u8*>(params.data);
+    u64 params_bytes = params.size() * sizeof(f32);
+
+    auto index_of = [](const ModelVar* var) {
+        return var ? var->index : CHECKPOINT_NONE;
+    };
+
+    CheckpointHeader header = {};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version = CHECKPOINT_VERSION;
+    header.num_vars = num_vars();
+    header.batch_size = batch_size;
+    header.input = index_of(input);
+    header.output = index_of(output);
+    header.desired_output = index_of(desired_output);
+    header.cost = index_of(cost);
+    header.vars_offset = sizeof(CheckpointHeader);
+    header.params_offset = align_up(header.vars_offset + sizeof(CheckpointVar) * num_vars(), CHECKPOINT_ALIGNMENT);
+    header.params_bytes = params_bytes;
+
+    std::vector<CheckpointVar> records(num_vars());
+    for (u32 i = 0; i < num_vars(); i++) {
+        const ModelVar* var = all_vars[i].get();
+        CheckpointVar& rec = records[i];
+        rec = {};
+        rec.op = static_cast<u32>(var->op);
+        rec.flags = var->flags;
+        rec.rows = var->val.rows;
+        rec.cols = var->val.cols;
+        for (u32 j = 0; j < MODEL_VAR_MAX_INPUTS; j++) {
+            rec.inputs[j] = (j < mv_num_inputs(var->op)) ? var->inputs[j]->index : CHECKPOINT_NONE;
+        }
+
+        if (var->flags & MV_FLAG_PARAMETER) {
+            const u8* p = reinterpret_cast<const u8*>(var->val.data);
+            if (p < slab || p + var->val.size() * sizeof(f32) > slab + params_bytes) {
+                std::cerr << "Cannot save " << path << ": parameter " << i
+                    << " is not in this context's parameter slab" << std::endl;
+                return false;
+            }
+            rec.param_offset = static_cast<u64>(p - slab);
+        }
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Failed to create file: " << path << std::endl;
+        return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(records.data()), sizeof(CheckpointVar) * records.size());
+
+    std::vector<char> padding(header.params_offset - header.vars_offset - sizeof(CheckpointVar) * records.size(), 0);
+    out.write(padding.data(), padding.size());
+    out.write(reinterpret_cast<const char*>(slab), params_bytes);
+
+    return out.good();
+}
+
+std::unique_ptr<ModelContext> ModelContext::load(const char* path, bool writable_params, bool huge_pages) {
+    std::shared_ptr<MappedFile> file = MappedFile::open(path, writable_params);
+    if (!file) {
+        std::cerr << "Failed to open file: " << path << std::endl;
+        return nullptr;
+    }
+
+    CheckpointHeader header;
+    if (file->size() < sizeof(header)) {
+        std::cerr << "Not a checkpoint file: " << path << std::endl;
+        return nullptr;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) {
+        std::cerr << "Not a checkpoint file: " << path << std::endl;
+        return nullptr;
+    }
+    if (header.version != CHECKPOINT_VERSION) {
+        std::cerr << "Unsupported checkpoint version " << header.version << ": " << path << std::endl;
+        return nullptr;
+    }
+    if (!fits(header.vars_offset, header.num_vars, sizeof(CheckpointVar), file->size())
+        || !fits(header.params_offset, header.params_bytes, 1, file->size())
+        || header.params_offset % Arena::ALIGNMENT != 0
+        || header.batch_size == 0) {
+        std::cerr << "Truncated or corrupt checkpoint: " << path << std::endl;
+        return nullptr;
+    }
+
+    u8* base = writable_params ? file->writable_data() : const_cast<u8*>(file->data());
+    u8* slab = base + header.params_offset;
+
+    auto model = std::make_unique<ModelContext>(huge_pages);
+    model->batch_size = header.batch_size;
+
+    for (u32 i = 0; i < header.num_vars; i++) {
+        CheckpointVar rec;
+        std::memcpy(&rec, file->data() + header.vars_offset + sizeof(CheckpointVar) * i, sizeof(rec));
+
+        auto var = std::make_unique<ModelVar>();
+        var->index = i;
+        var->flags = rec.flags;
+        var->op = static_cast<ModelVarOp>(rec.op);
+
+        bool valid = rec.op > static_cast<u32>(ModelVarOp::Null)
+            && rec.op <= static_cast<u32>(ModelVarOp::LinearBiasReluAdd)
+            && var->op != ModelVarOp::UnaryStart
+            && var->op != ModelVarOp::BinaryStart
+            && var->op != ModelVarOp::FusedStart;
+        bool input_grad = false;
+        for (u32 j = 0; valid && j < mv_num_inputs(var->op); j++) {
+            valid = rec.inputs[j] < i;
+            if (valid) {
+                var->inputs[j] = model->all_vars[rec.inputs[j]].get();
+                input_grad = input_grad || (var->inputs[j]->flags & MV_FLAG_REQUIRES_GRAD);
+            }
+        }
+        // Backprop writes the gradient of every var whose inputs need one
+        valid = valid && valid_shape(rec, var->op, var->inputs, header.batch_size)
+            && (!input_grad || (rec.flags & MV_FLAG_REQUIRES_GRAD));
+
+        if (valid && (rec.flags & MV_FLAG_PARAMETER)) {
+            valid = var->op == ModelVarOp::Create
+                && rec.param_offset % Arena::ALIGNMENT == 0
+                && fits(rec.param_offset, static_cast<u64>(rec.rows) * rec.cols, sizeof(f32), header.params_bytes);
+        }
+        if (!valid) {
+            std::cerr << "Corrupt checkpoint " << path << ": bad var " << i << std::endl;
+            return nullptr;
+        }
+
+        if (rec.flags & MV_FLAG_PARAMETER) {
+            // Bound to the mapping, nothing is read until the first pass touches it
+            var->val.bind(rec.rows, rec.cols, reinterpret_cast<f32*>(slab + rec.param_offset));
+            if (rec.flags & MV_FLAG_REQUIRES_GRAD) {
+                var->grad.bind(rec.rows, rec.cols, model->grad_arena.push_f32(var->val.size()));
+            }
+        } else {
+            model->bind_storage(var.get(), rec.rows, rec.cols);
+        }
+
+        model->all_vars.push_back(std::move(var));
+    }
+
+    // Each role is absent or a var flagged for it
+    bool roles_valid = true;
+    auto var_at = [&](u32 index, u32 flag) -> ModelVar* {
+        if (index == CHECKPOINT_NONE) return nullptr;
+        if (index >= model->num_vars() || !(model->all_vars[index]->flags & flag)) {
+            roles_valid = false;
+            return nullptr;
+        }
+        return model->all_vars[index].get();
+    };
+    model->input = var_at(header.input, MV_FLAG_INPUT);
+    model->output = var_at(header.output, MV_FLAG_OUTPUT);
+    model->desired_output = var_at(header.desired_output, MV_FLAG_DESIRED_OUTPUT);
+    model->cost = var_at(header.cost, MV_FLAG_COST);
+    if (!roles_valid) {
+        std::cerr << "Corrupt checkpoint " << path << ": bad input, output, label or cost var" << std::endl;
+        return nullptr;
+    }
+
+    model->param_file = file;
+    model->param_file_writable = writable_params;
+    model->file_params = reinterpret_cast<f32*>(slab);
+    model->file_param_count = header.params_bytes / sizeof(f32);
+
+    model->compile();
+    return model;
+}
+
+std::unique_ptr<InferenceModel> InferenceModel::load(const char* path) {
+    auto model = ModelContext::load(path, false);
+    if (!model) return nullptr;
+    return model->freeze();
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "Types.hpp"
+
+// On-disk layout of a ModelContext checkpoint: this header, num_vars
+// CheckpointVar records at vars_offset, then the parameter slab at
+// params_offset. The slab is a byte copy of the parameter arena, so every
+// parameter stays 64-byte aligned and the offsets are page aligned, which
+// lets a loader bind parameters straight to the mapped file.
+struct CheckpointHeader {
+    char magic[4];
+    u32 version;
+    u32 num_vars;
+    u32 batch_size;
+    // Var indices; CHECKPOINT_NONE when the graph has no such var
+    u32 input;
+    u32 output;
+    u32 desired_output;
+    u32 cost;
+    u64 vars_offset;
+    u64 params_offset;
+    u64 params_bytes;
+    u8 reserved[8];
+};
+static_assert(sizeof(CheckpointHeader) == 64, "CheckpointHeader must stay 64 bytes");
+
+// One var in creation order; inputs always refer to earlier vars. Shapes are
+// those at the saved batch size.
+struct CheckpointVar {
+    u32 op;
+    u32 flags;
+    u32 rows;
+    u32 cols;
+    u32 inputs[4];
+    // Byte offset into the parameter slab, parameters only
+    u64 param_offset;
+    u64 reserved;
+};
+static_assert(sizeof(CheckpointVar) == 48, "CheckpointVar must stay 48 bytes");
+
+constexpr u32 CHECKPOINT_VERSION = 1;
+constexpr u32 CHECKPOINT_NONE = 0xFFFFFFFFu;
+constexpr u64 CHECKPOINT_ALIGNMENT = 4096;
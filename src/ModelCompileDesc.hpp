@@ -0,0 +1,52 @@
+#pragma once
+#include "Types.hpp"
+
+struct ModelCompileDesc {
+    // Intermediate values and gradients share activation buffers once their
+    // lifetimes are over, and Relu/Add/Sub write over a dying input in place.
+    // Only vars flagged INPUT, OUTPUT, DESIRED_OUTPUT or COST keep their own.
+    bool plan_memory = true;
+
+    // Rewrites matmul -> bias add [-> relu [-> residual add]] chains into
+    // single LinearBias* ops. The rewrite is in place, so a graph compiled
+    // with fusion stays fused; compile a fresh graph with false for the
+    // unfused reference.
+    bool fuse_ops = true;
+
+    // Activations are stored as bf16 and matrix products read bf16 copies of
+    // their parameter weights; kernels widen on load and accumulate in f32.
+    // Gradients and the f32 master parameters the update writes are kept as
+    // they are, and train() refreshes the copies after every update. Vars
+    // the caller reads or writes (INPUT, OUTPUT, ...) stay f32.
+    bool bf16_storage = false;
+
+    // If the fused forward program has a topology with a shape-specialized
+    // implementation (StaticModel.cpp, so far the MNIST residual MLP), feedforward()
+    // and predict() run that instead of the graph. compile() checks it against
+    // the graph on a probe batch and warns and falls back if they disagree.
+    // Needs fuse_ops; ignored with bf16_storage.
+    bool static_kernels = false;
+
+    // Products whose x is the input var (the first layer) run on a CSR copy
+    // of the batch when at most half its values are nonzero, skipping the
+    // zero pixels in the forward product and the weight gradient. train()
+    // has the batch loader build the copies in the background; predict()
+    // builds one per chunk.
+    bool sparse_input = true;
+
+    // Activation recomputation (gradient checkpointing). Backprop normally
+    // reads values held since the forward pass; with this on, only
+    // checkpoints are held: vars flagged MV_FLAG_CHECKPOINT, Create vars,
+    // vars the caller reads and values read across a checkpoint. The values
+    // between two checkpoints are dropped once the forward pass is done with
+    // them and computed again, a segment at a time, just before backprop
+    // needs them: at most one more forward pass for less activation memory.
+    // Needs plan_memory.
+    bool recompute = false;
+
+    // With recompute and no MV_FLAG_CHECKPOINT in the cost graph, the
+    // checkpoints are picked, again on every batch size change: the fewest
+    // recomputed ops whose activations fit in this many bytes, or the
+    // smallest activation layout if none fits (or with 0).
+    u64 activation_budget = 0;
+};
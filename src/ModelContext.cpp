@@ -1,6 +1,66 @@
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
 #include "ModelContext.hpp"
 #include "ModelTrainingDesc.hpp"
-#include "PRNG.hpp"
+#include "InferenceModel.hpp"
+#include "Dataset.hpp"
+#include "BatchLoader.hpp"
+#include "QuantizedLinear.hpp"
+#include "Profiler.hpp"
+#include "StaticModel.hpp"
+#include "RingAllReduce.hpp"
+
+namespace {
+
+    // Address space reserved per arena; pages are only committed when used
+    constexpr u64 PARAM_ARENA_RESERVE = 4ull << 30;
+    constexpr u64 ACTIVATION_ARENA_RESERVE = 16ull << 30;
+
+    // Values the caller reads or writes between passes
+    constexpr u32 PINNED_FLAGS = MV_FLAG_INPUT | MV_FLAG_OUTPUT | MV_FLAG_DESIRED_OUTPUT | MV_FLAG_COST;
+    constexpr u32 BUFFERS_PER_VAR = static_cast<u32>(ModelVarBuffer::Count);
+
+    u32 buffer_id(const ModelVar* var, ModelVarBuffer which) {
+        return var->index * BUFFERS_PER_VAR + static_cast<u32>(which);
+    }
+
+}
+
+ModelContext::ModelContext(bool huge_pages)
+    : huge_pages(huge_pages),
+    param_arena(PARAM_ARENA_RESERVE, huge_pages),
+    grad_arena(PARAM_ARENA_RESERVE, huge_pages),
+    activation_arena(ACTIVATION_ARENA_RESERVE, huge_pages),
+    weight_copy_arena(PARAM_ARENA_RESERVE, huge_pages) {}
+
+Matrix ModelContext::param_slab() const {
+    if (param_file) {
+        return Matrix::view(1, static_cast<u32>(file_param_count), file_params);
+    }
+    u32 count = static_cast<u32>(param_arena.used() / sizeof(f32));
+    return Matrix::view(1, count, reinterpret_cast<f32*>(param_arena.base()));
+}
+
+Matrix ModelContext::grad_slab() const {
+    u32 count = static_cast<u32>(grad_arena.used() / sizeof(f32));
+    return Matrix::view(1, count, reinterpret_cast<f32*>(grad_arena.base()));
+}
+
+void ModelContext::bind_storage(ModelVar* var, u32 rows, u32 cols) {
+    u64 count = static_cast<u64>(rows) * cols;
+    bool is_param = (var->flags & MV_FLAG_PARAMETER) != 0;
+
+    var->val.bind(rows, cols, (is_param ? param_arena : activation_arena).push_f32(count));
+    if (var->flags & MV_FLAG_REQUIRES_GRAD) {
+        var->grad.bind(rows, cols, (is_param ? grad_arena : activation_arena).push_f32(count));
+    }
+    if (mv_has_aux(var->op)) {
+        var->aux.bind(rows, cols, activation_arena.push_f32(count));
+    }
+}
 
 ModelVar* ModelContext::create_var(u32 rows, u32 cols, u32 flags) {
     auto var = std::make_unique<ModelVar>();
@@ -8,11 +68,7 @@ ModelVar* ModelContext::create_var(u32 rows, u32 cols, u32 flags) {
     var->index = num_vars();
     var->flags = flags;
     var->op = ModelVarOp::Create;
-    var->val = Matrix::create(rows, cols);
-
-    if (flags & MV_FLAG_REQUIRES_GRAD) {
-        var->grad = Matrix::create(rows, cols);
-    }
+    bind_storage(var.get(), rows, cols);
 
     ModelVar* ptr = var.get();
     all_vars.push_back(std::move(var));
@@ -51,42 +107,616 @@ ModelVar* ModelContext::binary_impl(ModelVar* a, ModelVar* b, u32 rows, u32 cols
 }
 
 ModelVar* ModelContext::relu(ModelVar* input_var, u32 flags) {
-    return unary_impl(input_var, input_var->val->rows, input_var->val->cols, flags, ModelVarOp::Relu);
+    return unary_impl(input_var, input_var->val.rows, input_var->val.cols, flags, ModelVarOp::Relu);
 }
 
 ModelVar* ModelContext::softmax(ModelVar* input_var, u32 flags) {
-    return unary_impl(input_var, input_var->val->rows, input_var->val->cols, flags, ModelVarOp::Softmax);
+    return unary_impl(input_var, input_var->val.rows, input_var->val.cols, flags, ModelVarOp::Softmax);
 }
 
 ModelVar* ModelContext::add(ModelVar* a, ModelVar* b, u32 flags) {
-    if (a->val->rows != b->val->rows || a->val->cols != b->val->cols) {
+    // Either side may be a column vector (e.g. a bias) broadcast across the batch
+    if (a->val.rows != b->val.rows) {
+        return nullptr;
+    }
+    if (a->val.cols != b->val.cols && a->val.cols != 1 && b->val.cols != 1) {
         return nullptr;
     }
-    return binary_impl(a, b, a->val->rows, a->val->cols, flags, ModelVarOp::Add);
+    return binary_impl(a, b, a->val.rows, a->val.cols, flags, ModelVarOp::Add);
 }
 
 ModelVar* ModelContext::sub(ModelVar* a, ModelVar* b, u32 flags) {
-    if (a->val->rows != b->val->rows || a->val->cols != b->val->cols) {
+    if (a->val.rows != b->val.rows || a->val.cols != b->val.cols) {
         return nullptr;
     }
-    return binary_impl(a, b, a->val->rows, a->val->cols, flags, ModelVarOp::Sub);
+    return binary_impl(a, b, a->val.rows, a->val.cols, flags, ModelVarOp::Sub);
 }
 
 ModelVar* ModelContext::matmul(ModelVar* a, ModelVar* b, u32 flags) {
-    if (a->val->cols != b->val->rows) {
+    if (a->val.cols != b->val.rows) {
         return nullptr;
     }
-    return binary_impl(a, b, a->val->rows, b->val->cols, flags, ModelVarOp::Matmul);
+    return binary_impl(a, b, a->val.rows, b->val.cols, flags, ModelVarOp::Matmul);
 }
 
 ModelVar* ModelContext::cross_entropy(ModelVar* p, ModelVar* q, u32 flags) {
-    if (p->val->rows != q->val->rows || p->val->cols != q->val->cols) {
+    if (p->val.rows != q->val.rows || p->val.cols != q->val.cols) {
+        return nullptr;
+    }
+    return binary_impl(p, q, p->val.rows, p->val.cols, flags, ModelVarOp::CrossEntropy);
+}
+
+namespace {
+
+    template <typename TO, typename TA, typename TB>
+    void add_broadcast(MatrixT<TO>& out, const MatrixT<TA>& a, const MatrixT<TB>& b) {
+        if (a.cols == out.cols && b.cols == out.cols) {
+            MatOps::add(out, a, b);
+        } else if (b.cols != out.cols) {
+            MatOps::add_col(out, a, b);
+        } else {
+            MatOps::add_col(out, b, a);
+        }
+    }
+
+    // A broadcast operand receives the gradient summed over the batch
+    void add_broadcast_grad(Matrix& grad, const Matrix& out_grad) {
+        if (grad.cols == out_grad.cols) {
+            MatOps::add(grad, grad, out_grad);
+        } else {
+            MatOps::add_col_sum(grad, out_grad);
+        }
+    }
+
+    // Copies the rows [first, first + count) of a (samples x features) matrix
+    // into the columns of a (features x count) batch matrix, a block of rows
+    // at a time so the writes to out stay contiguous
+    void copy_rows_to_columns(Matrix& out, const Matrix& src, u32 first, u32 count) {
+        constexpr u32 BLOCK = 16;
+        for (u32 c0 = 0; c0 < count; c0 += BLOCK) {
+            u32 n = std::min(BLOCK, count - c0);
+            const f32* rows = src.data + static_cast<u64>(first + c0) * src.cols;
+            f32* dst = out.data + c0;
+            for (u32 r = 0; r < src.cols; r++) {
+                for (u32 j = 0; j < n; j++) {
+                    dst[static_cast<u64>(r) * out.cols + j] = rows[static_cast<u64>(j) * src.cols + r];
+                }
+            }
+        }
+    }
+
+    void copy_rows_to_columns(Matrix& out, const Dataset& src, u32 first, u32 count) {
+        src.copy_rows_to_columns(out, first, count);
+    }
+
+    // The rows [first, first + count) of a u8 dataset as they are stored
+    bool byte_rows_of(ByteRows&, const Matrix&, u32, u32) {
+        return false;
+    }
+
+    bool byte_rows_of(ByteRows& rows, const Dataset& src, u32 first, u32 count) {
+        if (src.dtype != DatasetType::U8) return false;
+        rows.data = src.row_data(first);
+        rows.stride = src.cols;
+        rows.cols = src.cols;
+        rows.count = count;
+        rows.scale = src.scale;
+        rows.offset = src.offset;
+        return true;
+    }
+
+    constexpr u32 PREDICT_BATCH_SIZE = 256;
+
+    // Above this fraction of nonzeros the dense product is as fast
+    constexpr f32 SPARSE_MAX_DENSITY = 0.5f;
+
+    // compile() checks static kernels against the graph on this many samples
+    constexpr u32 STATIC_CHECK_BATCH_SIZE = 37;
+    constexpr f32 STATIC_CHECK_TOLERANCE = 1e-4f;
+
+
+    bool requires_grad(const ModelVar* var) {
+        return (var->flags & MV_FLAG_REQUIRES_GRAD) != 0;
+    }
+
+    // Whether var's value is also at hand as a CSR copy
+    bool has_sparse(const ModelVar* var) {
+        return var->sparse != nullptr && var->sparse->rows == var->val.rows && var->sparse->cols == var->val.cols;
+    }
+
+    // Calls fn with the matrix var's value is read from and written to: the
+    // bf16 one for BF16 storage. The overloads visit several vars at once.
+    template <typename Fn>
+    void with_val(ModelVar* var, Fn fn) {
+        if (var->storage == ModelVarStorage::BF16) fn(var->val_bf16);
+        else fn(var->val);
+    }
+
+    template <typename Fn>
+    void with_val(ModelVar* a, ModelVar* b, Fn fn) {
+        with_val(a, [&](auto& x) { with_val(b, [&](auto& y) { fn(x, y); }); });
+    }
+
+    template <typename Fn>
+    void with_val(ModelVar* a, ModelVar* b, ModelVar* c, Fn fn) {
+        with_val(a, [&](auto& x) { with_val(b, c, [&](auto& y, auto& z) { fn(x, y, z); }); });
+    }
+
+    // aux is stored like val
+    Matrix& aux_of(ModelVar* var, const Matrix&) { return var->aux; }
+    MatrixBF16& aux_of(ModelVar* var, const MatrixBF16&) { return var->aux_bf16; }
+
+    void compute_var(ModelVar* cur) {
+        ModelVar* a = cur->inputs[0];
+        ModelVar* b = cur->inputs[1];
+
+        switch (cur->op) {
+        case ModelVarOp::Null:
+        case ModelVarOp::Create:
+        case ModelVarOp::UnaryStart:
+        case ModelVarOp::BinaryStart:
+        case ModelVarOp::FusedStart:
+            break;
+
+        case ModelVarOp::Relu:
+            with_val(cur, a, [](auto& out, auto& x) { MatOps::relu(out, x); });
+            break;
+        case ModelVarOp::Softmax:
+            with_val(cur, a, [](auto& out, auto& x) { MatOps::softmax(out, x); });
+            break;
+        case ModelVarOp::Add:
+            with_val(cur, a, b, [](auto& out, auto& x, auto& y) { add_broadcast(out, x, y); });
+            break;
+        case ModelVarOp::Sub:
+            with_val(cur, a, b, [](auto& out, auto& x, auto& y) { MatOps::sub(out, x, y); });
+            break;
+        case ModelVarOp::Matmul:
+            if (cur->quant && b->byte_rows)
+                Quant::linear(*cur->quant, *b->byte_rows, cur->val, nullptr);
+            else if (cur->quant)
+                Quant::linear(*cur->quant, b->val, cur->val, nullptr);
+            else if (has_sparse(b))
+                with_val(cur, a, [&](auto& out, auto& w) { MatOps::linear_sparse(out, w, *b->sparse, nullptr); });
+            else
+                with_val(cur, a, b, [](auto& out, auto& x, auto& y) { MatOps::mul(out, x, y, true, false, false); });
+            break;
+        case ModelVarOp::CrossEntropy:
+            with_val(cur, a, b, [](auto& out, auto& x, auto& y) { MatOps::cross_entropy(out, x, y); });
+            break;
+        case ModelVarOp::SoftmaxCrossEntropy:
+            // Labels come from data: one that is not a class index makes the
+            // loss NaN rather than leave the last batch's in place
+            with_val(cur, a, b, [](auto& out, auto& x, auto& y) {
+                if (!MatOps::softmax_cross_entropy(out, x, y)) out.fill(NAN);
+            });
+            break;
+
+        // The bias is a parameter, whose val is always the f32 master
+        case ModelVarOp::LinearBias:
+        case ModelVarOp::LinearBiasRelu:
+        case ModelVarOp::LinearBiasReluAdd: {
+            const Matrix& bias = cur->inputs[2]->val;
+            if (cur->quant && b->byte_rows)
+                Quant::linear(*cur->quant, *b->byte_rows, cur->val, &bias);
+            else if (cur->quant)
+                Quant::linear(*cur->quant, b->val, cur->val, &bias);
+            else if (has_sparse(b))
+                with_val(cur, a, [&](auto& out, auto& w) { MatOps::linear_sparse(out, w, *b->sparse, &bias); });
+            else
+                with_val(cur, a, b, [&](auto& out, auto& w, auto& x) { MatOps::linear(out, w, x, bias); });
+
+            if (cur->op == ModelVarOp::LinearBiasRelu) {
+                with_val(cur, [](auto& out) { MatOps::relu(out, out); });
+            } else if (cur->op == ModelVarOp::LinearBiasReluAdd) {
+                with_val(cur, cur->inputs[3], [&](auto& out, auto& residual) {
+                    MatOps::relu_residual(out, aux_of(cur, out), residual);
+                });
+            }
+            break;
+        }
+        }
+    }
+
+    void backward_var(ModelVar* cur) {
+        ModelVar* a = cur->inputs[0];
+        ModelVar* b = cur->inputs[1];
+
+        switch (cur->op) {
+        case ModelVarOp::Null:
+        case ModelVarOp::Create:
+        case ModelVarOp::UnaryStart:
+        case ModelVarOp::BinaryStart:
+        case ModelVarOp::FusedStart:
+            break;
+
+        case ModelVarOp::Relu:
+            // relu(x) > 0 exactly where x > 0, so the input may already be overwritten
+            with_val(cur, [&](auto& y) { MatOps::relu_add_grad(a->grad, y, cur->grad); });
+            break;
+
+        case ModelVarOp::Softmax:
+            with_val(cur, [&](auto& y) { MatOps::softmax_add_grad(a->grad, y, cur->grad); });
+            break;
+
+        case ModelVarOp::Add:
+            if (requires_grad(a))
+                add_broadcast_grad(a->grad, cur->grad);
+            if (requires_grad(b))
+                add_broadcast_grad(b->grad, cur->grad);
+            break;
+
+        case ModelVarOp::Sub:
+            if (requires_grad(a))
+                MatOps::add(a->grad, a->grad, cur->grad);
+            if (requires_grad(b))
+                MatOps::sub(b->grad, b->grad, cur->grad);
+            break;
+
+        case ModelVarOp::Matmul:
+            if (requires_grad(a) && has_sparse(b))
+                MatOps::mul_sparse_add_grad(a->grad, cur->grad, *b->sparse);
+            else if (requires_grad(a))
+                with_val(b, [&](auto& x) { MatOps::mul(a->grad, cur->grad, x, false, false, true); });
+            if (requires_grad(b))
+                with_val(a, [&](auto& w) { MatOps::mul(b->grad, w, cur->grad, false, true, false); });
+            break;
+
+        case ModelVarOp::CrossEntropy:
+            with_val(a, b, [&](auto& p, auto& q) {
+                MatOps::cross_entropy_add_grad(
+                    requires_grad(a) ? &a->grad : nullptr,
+                    requires_grad(b) ? &b->grad : nullptr,
+                    p, q, cur->grad
+                );
+            });
+            break;
+
+        case ModelVarOp::SoftmaxCrossEntropy:
+            if (requires_grad(a)) {
+                with_val(a, b, cur, [&](auto& logits, auto& labels, auto& loss) {
+                    if (!MatOps::softmax_cross_entropy_add_grad(a->grad, logits, labels, loss, cur->grad)) {
+                        a->grad.fill(NAN);
+                    }
+                });
+            }
+            break;
+
+        // a = W, b = x. The relu mask is applied to cur->grad in place (nothing
+        // else reads it), folding the bias gradient into the same pass.
+        case ModelVarOp::LinearBias:
+        case ModelVarOp::LinearBiasRelu:
+        case ModelVarOp::LinearBiasReluAdd: {
+            ModelVar* bias = cur->inputs[2];
+            Matrix* bias_grad = requires_grad(bias) ? &bias->grad : nullptr;
+
+            if (cur->op == ModelVarOp::LinearBiasReluAdd) {
+                ModelVar* residual = cur->inputs[3];
+                if (requires_grad(residual))
+                    MatOps::add(residual->grad, residual->grad, cur->grad);
+                with_val(cur, [&](auto& out) { MatOps::relu_mask(cur->grad, aux_of(cur, out), bias_grad); });
+            } else if (cur->op == ModelVarOp::LinearBiasRelu) {
+                with_val(cur, [&](auto& out) { MatOps::relu_mask(cur->grad, out, bias_grad); });
+            } else if (bias_grad != nullptr) {
+                MatOps::add_col_sum(*bias_grad, cur->grad);
+            }
+
+            if (requires_grad(a) && has_sparse(b))
+                MatOps::mul_sparse_add_grad(a->grad, cur->grad, *b->sparse);
+            else if (requires_grad(a))
+                with_val(b, [&](auto& x) { MatOps::mul(a->grad, cur->grad, x, false, false, true); });
+            if (requires_grad(b))
+                with_val(a, [&](auto& w) { MatOps::mul(b->grad, w, cur->grad, false, true, false); });
+            break;
+        }
+        }
+    }
+
+    // Calls use(var, buffer) for every buffer compute_var(cur) reads or writes
+    template <typename Fn>
+    void forward_uses(const ModelVar* cur, Fn use) {
+        if (cur->op == ModelVarOp::Create) return;
+
+        use(cur, ModelVarBuffer::Val);
+        if (mv_has_aux(cur->op)) use(cur, ModelVarBuffer::Aux);
+        for (u32 i = 0; i < mv_num_inputs(cur->op); i++) {
+            use(cur->inputs[i], ModelVarBuffer::Val);
+        }
+    }
+
+    // Calls use(var, buffer) for every buffer backward_var(cur) reads or writes
+    template <typename Fn>
+    void backward_uses(const ModelVar* cur, Fn use) {
+        const ModelVarBuffer VAL = ModelVarBuffer::Val;
+        const ModelVarBuffer GRAD = ModelVarBuffer::Grad;
+        ModelVar* a = cur->inputs[0];
+        ModelVar* b = cur->inputs[1];
+
+        use(cur, GRAD);
+        switch (cur->op) {
+        case ModelVarOp::Relu:
+        case ModelVarOp::Softmax:
+            use(cur, VAL);
+            use(a, GRAD);
+            break;
+        case ModelVarOp::Add:
+        case ModelVarOp::Sub:
+            if (requires_grad(a)) use(a, GRAD);
+            if (requires_grad(b)) use(b, GRAD);
+            break;
+        case ModelVarOp::Matmul:
+            if (requires_grad(a)) { use(a, GRAD); use(b, VAL); }
+            if (requires_grad(b)) { use(b, GRAD); use(a, VAL); }
+            break;
+        case ModelVarOp::CrossEntropy:
+            use(a, VAL);
+            use(b, VAL);
+            if (requires_grad(a)) use(a, GRAD);
+            if (requires_grad(b)) use(b, GRAD);
+            break;
+        case ModelVarOp::SoftmaxCrossEntropy:
+            use(cur, VAL);
+            use(a, VAL);
+            use(b, VAL);
+            if (requires_grad(a)) use(a, GRAD);
+            break;
+        case ModelVarOp::LinearBias:
+        case ModelVarOp::LinearBiasRelu:
+        case ModelVarOp::LinearBiasReluAdd:
+            if (cur->op == ModelVarOp::LinearBiasRelu) use(cur, VAL);
+            if (cur->op == ModelVarOp::LinearBiasReluAdd) {
+                use(cur, ModelVarBuffer::Aux);
+                if (requires_grad(cur->inputs[3])) use(cur->inputs[3], GRAD);
+            }
+            if (requires_grad(cur->inputs[2])) use(cur->inputs[2], GRAD);
+            if (requires_grad(a)) { use(a, GRAD); use(b, VAL); }
+            if (requires_grad(b)) { use(b, GRAD); use(a, VAL); }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Reverse pass over prog. Each non-parameter gradient is cleared right
+    // before its first accumulation rather than all up front, so its buffer
+    // only has to be live from there on.
+    std::vector<ModelStep> create_grad_steps(const ModelProgram& prog) {
+        std::vector<ModelStep> steps;
+        if (prog.vars.empty()) return steps;
+
+        ModelVar* last = prog.vars.back();
+        steps.push_back({ ModelStepKind::SeedGrad, last });
+
+        std::vector<bool> cleared;
+        for (ModelVar* var : prog.vars) {
+            if (var->index >= cleared.size()) cleared.resize(var->index + 1, false);
+        }
+        cleared[last->index] = true;
+
+        for (i64 i = static_cast<i64>(prog.size()) - 1; i >= 0; i--) {
+            ModelVar* cur = prog.vars[i];
+            if (!requires_grad(cur)) continue;
+
+            u32 num_inputs = mv_num_inputs(cur->op);
+            bool any_input_grad = false;
+            for (u32 j = 0; j < num_inputs; j++) {
+                any_input_grad |= requires_grad(cur->inputs[j]);
+            }
+            if (!any_input_grad) continue;
+
+            for (u32 j = 0; j < num_inputs; j++) {
+                ModelVar* in = cur->inputs[j];
+                if (!requires_grad(in) || (in->flags & MV_FLAG_PARAMETER)) continue;
+                if (cleared[in->index]) continue;
+                cleared[in->index] = true;
+                steps.push_back({ ModelStepKind::ClearGrad, in });
+            }
+            steps.push_back({ ModelStepKind::Backward, cur });
+        }
+
+        return steps;
+    }
+
+    // Inserts recompute steps into the backprop schedule steps of prog. Its
+    // vars are cut into segments after each checkpoint; checkpoints, Create
+    // and pinned vars and values read from another segment are kept. Every
+    // other value backprop reads, and what it is computed from, is computed
+    // again right before the first step that reads its segment.
+    std::vector<ModelStep> add_recompute_steps(const ModelProgram& prog, const std::vector<ModelStep>& steps,
+        const std::vector<bool>& checkpoint) {
+        std::vector<u32> segment(checkpoint.size(), 0);
+        std::vector<bool> kept(checkpoint.size(), false);
+        u32 num_segments = 1;
+        for (ModelVar* var : prog.vars) {
+            segment[var->index] = num_segments - 1;
+            kept[var->index] = checkpoint[var->index] || var->op == ModelVarOp::Create || (var->flags & PINNED_FLAGS);
+            if (checkpoint[var->index]) num_segments++;
+        }
+        for (ModelVar* var : prog.vars) {
+            for (u32 i = 0; i < mv_num_inputs(var->op); i++) {
+                const ModelVar* in = var->inputs[i];
+                if (segment[in->index] != segment[var->index]) kept[in->index] = true;
+            }
+        }
+
+        std::vector<bool> needed(checkpoint.size(), false);
+        for (const ModelStep& s : steps) {
+            if (s.kind != ModelStepKind::Backward) continue;
+            backward_uses(s.var, [&](const ModelVar* var, ModelVarBuffer which) {
+                if (which != ModelVarBuffer::Grad && !kept[var->index]) needed[var->index] = true;
+            });
+        }
+        for (i64 i = static_cast<i64>(prog.size()) - 1; i >= 0; i--) {
+            const ModelVar* var = prog.vars[i];
+            if (!needed[var->index]) continue;
+            for (u32 j = 0; j < mv_num_inputs(var->op); j++) {
+                const ModelVar* in = var->inputs[j];
+                if (!kept[in->index]) needed[in->index] = true;
+            }
+        }
+
+        std::vector<ModelStep> out;
+        std::vector<bool> recomputed(num_segments, false);
+        for (const ModelStep& s : steps) {
+            if (s.kind == ModelStepKind::Backward) {
+                backward_uses(s.var, [&](const ModelVar* var, ModelVarBuffer which) {
+                    if (which == ModelVarBuffer::Grad || kept[var->index]) return;
+                    u32 seg = segment[var->index];
+                    if (recomputed[seg]) return;
+                    recomputed[seg] = true;
+                    for (ModelVar* v : prog.vars) {
+                        if (needed[v->index] && segment[v->index] == seg) out.push_back({ ModelStepKind::Recompute, v });
+                    }
+                });
+            }
+            out.push_back(s);
+        }
+        return out;
+    }
+
+    // Bytes of one of var's buffers as the kernels see it: bf16 storage for
+    // values and weight copies, int8 for quantized weights, f32 gradients
+    u64 buffer_bytes(const ModelVar* reader, const ModelVar* var, ModelVarBuffer which) {
+        u64 elems = var->val.size();
+        if (which == ModelVarBuffer::Grad) return elems * sizeof(f32);
+        if (reader->quant && var == reader->inputs[0]) return elems;
+        return elems * (var->storage == ModelVarStorage::BF16 ? sizeof(bf16) : sizeof(f32));
+    }
+
+    // Flops of compute_var(cur) or backward_var(cur), counted like mnist_bench
+    // counts the kernels: 2mnk per product, one per exp or log
+    u64 op_flops(const ModelVar* cur, bool backward) {
+        const ModelVar* a = cur->inputs[0];
+        const ModelVar* b = cur->inputs[1];
+        u64 n = cur->val.size();
+
+        switch (cur->op) {
+        case ModelVarOp::Relu:
+            return n;
+        case ModelVarOp::Softmax:
+            return 5 * n;
+        case ModelVarOp::Add:
+        case ModelVarOp::Sub:
+            return backward ? n * (requires_grad(a) + requires_grad(b)) : n;
+        case ModelVarOp::CrossEntropy:
+            return backward ? 6 * n : 3 * n;
+        case ModelVarOp::SoftmaxCrossEntropy:
+            return 4 * a->val.size();
+        case ModelVarOp::Matmul:
+        case ModelVarOp::LinearBias:
+        case ModelVarOp::LinearBiasRelu:
+        case ModelVarOp::LinearBiasReluAdd: {
+            // Plus one flop per element for each fused bias add, relu and
+            // residual add, or for each of their gradients
+            u64 product = 2 * n * a->val.cols;
+            u64 fused = 0;
+            if (cur->op == ModelVarOp::LinearBias) fused = 1;
+            else if (cur->op == ModelVarOp::LinearBiasRelu) fused = 2;
+            else if (cur->op == ModelVarOp::LinearBiasReluAdd) fused = 3;
+
+            if (backward) {
+                return product * (requires_grad(a) + requires_grad(b)) + fused * n;
+            }
+            return product + fused * n;
+        }
+        default:
+            return 0;
+        }
+    }
+
+    template <typename Uses>
+    void record_op(Profiler& profiler, u32 track, const ModelVar* cur, ProfilePhase phase, u64 start, Uses uses) {
+        u64 end = Profiler::now_ns();
+        u64 bytes = 0;
+        uses(cur, [&](const ModelVar* var, ModelVarBuffer which) { bytes += buffer_bytes(cur, var, which); });
+
+        profiler.record(track, { mv_op_name(cur->op), cur->index, phase, cur->val.rows, cur->val.cols,
+            start, end - start, op_flops(cur, phase == ProfilePhase::Backward), bytes });
+    }
+
+    void record_other(Profiler* profiler, u32 track, const char* name, u32 rows, u32 cols, u64 start, u64 bytes) {
+        if (profiler == nullptr) return;
+        u64 end = Profiler::now_ns();
+        profiler->record(track, { name, Profiler::NO_VAR, ProfilePhase::Other, rows, cols,
+            start, end - start, 0, bytes });
+    }
+
+    // With a profiler every op is timed; without, the only cost is one branch
+    // per pass
+    void compute_program(ModelProgram& prog, Profiler* profiler, u32 track) {
+        if (profiler == nullptr) {
+            for (ModelVar* cur : prog.vars) {
+                compute_var(cur);
+            }
+            return;
+        }
+
+        for (ModelVar* cur : prog.vars) {
+            if (cur->op == ModelVarOp::Create) continue;
+            u64 start = Profiler::now_ns();
+            compute_var(cur);
+            record_op(*profiler, track, cur, ProfilePhase::Forward, start,
+                [](const ModelVar* var, auto use) { forward_uses(var, use); });
+        }
+    }
+
+    void compute_grad_step(const ModelStep& step) {
+        switch (step.kind) {
+        case ModelStepKind::SeedGrad:
+            step.var->grad.fill(1.0f);
+            break;
+        case ModelStepKind::ClearGrad:
+            step.var->grad.clear();
+            break;
+        case ModelStepKind::Backward:
+            backward_var(step.var);
+            break;
+        case ModelStepKind::Recompute:
+            compute_var(step.var);
+            break;
+        }
+    }
+
+    void compute_grads(ModelProgram& prog, Profiler* profiler, u32 track, const std::function<void(u32)>& step_done) {
+        if (profiler == nullptr) {
+            for (u32 i = 0; i < prog.grad_steps.size(); i++) {
+                compute_grad_step(prog.grad_steps[i]);
+                if (step_done) step_done(i);
+            }
+            return;
+        }
+
+        for (u32 i = 0; i < prog.grad_steps.size(); i++) {
+            const ModelStep& step = prog.grad_steps[i];
+            u64 start = Profiler::now_ns();
+            compute_grad_step(step);
+
+            if (step.kind == ModelStepKind::Backward) {
+                record_op(*profiler, track, step.var, ProfilePhase::Backward, start,
+                    [](const ModelVar* var, auto use) { backward_uses(var, use); });
+            } else if (step.kind == ModelStepKind::Recompute) {
+                record_op(*profiler, track, step.var, ProfilePhase::Recompute, start,
+                    [](const ModelVar* var, auto use) { forward_uses(var, use); });
+            } else {
+                const Matrix& grad = step.var->grad;
+                profiler->record(track, {
+                    step.kind == ModelStepKind::SeedGrad ? "SeedGrad" : "ClearGrad",
+                    Profiler::NO_VAR, ProfilePhase::Backward, grad.rows, grad.cols,
+                    start, Profiler::now_ns() - start, 0, grad.size() * sizeof(f32) });
+            }
+            if (step_done) step_done(i);
+        }
+    }
+
+}
+
+ModelVar* ModelContext::softmax_cross_entropy(ModelVar* logits, ModelVar* labels, u32 flags) {
+    if (labels->val.rows != 1 || labels->val.cols != logits->val.cols) {
         return nullptr;
     }
-    return binary_impl(p, q, p->val->rows, p->val->cols, flags, ModelVarOp::CrossEntropy);
+    return binary_impl(logits, labels, 1, logits->val.cols, flags, ModelVarOp::SoftmaxCrossEntropy);
 }
 
-ModelProgram ModelContext::create_program(ModelVar* out_var) {
+ModelProgram ModelContext::create_program(ModelVar* out_var) const {
     // This is the autograd approach!
     // You order in topological order to get autograd running
     // essentially follow depth first of variable inputs 
@@ -135,270 +765,1175 @@ ModelProgram ModelContext::create_program(ModelVar* out_var) {
     return prog;
 }
 
-void ModelContext::compile() {
-    if (output != nullptr) {
-        forward_prog = create_program(output);
+void ModelContext::compile(const ModelCompileDesc& desc) {
+    // Laying the activations out again, and the static kernel probe, write
+    // over the vars the caller fills; what they held is put back at the end
+    auto save = [](const ModelVar* var) {
+        return (var && var->val.data) ? var->val : Matrix();
+    };
+    Matrix saved_input = save(input);
+    Matrix saved_labels = save(desired_output);
+
+    compile_desc = desc;
+    compiled = true;
+
+    // Replicas were cloned under the previous options (storage, bf16 copies,
+    // static kernels); the next train() or predict() clones them again
+    replicas.clear();
+
+    if (desc.fuse_ops) {
+        fuse_ops();
+    }
+
+    forward_prog = (output != nullptr) ? create_program(output) : ModelProgram();
+    cost_prog = (cost != nullptr) ? create_program(cost) : ModelProgram();
+
+    // One forward order serves both programs: cost_prog, then whatever only
+    // the output needs. forward_prog runs the matching subsequence, so a plan
+    // made for the whole order also holds when it runs alone.
+    std::vector<bool> in_order(num_vars(), false);
+    std::vector<bool> in_forward(num_vars(), false);
+    std::vector<ModelVar*> order = cost_prog.vars;
+    for (ModelVar* var : order) in_order[var->index] = true;
+    for (ModelVar* var : forward_prog.vars) {
+        in_forward[var->index] = true;
+        if (!in_order[var->index]) order.push_back(var);
     }
-    if (cost != nullptr) {
-        cost_prog = create_program(cost);
+    forward_prog.vars.clear();
+    for (ModelVar* var : order) {
+        if (in_forward[var->index]) forward_prog.vars.push_back(var);
     }
+    compiled_order = std::move(order);
+
+    quantized_input = input != nullptr && input != output;
+    for (ModelVar* var : compiled_order) {
+        for (u32 i = 0; i < mv_num_inputs(var->op); i++) {
+            if (var->inputs[i] == input && (i != 1 || !var->quant)) quantized_input = false;
+        }
+    }
+
+    assign_storage();
+    plan_backprop();
+    layout_activations();
+    match_static_forward();
+    sync_weight_copies();
+
+    if (input) input->val.copy_from(saved_input);
+    if (desired_output) desired_output->val.copy_from(saved_labels);
 }
 
-void ModelContext::feedforward() {
-    for (u32 i = 0; i < forward_prog.size(); i++) {
-        ModelVar* cur = forward_prog.vars[i];
-        ModelVar* a = cur->inputs[0];
-        ModelVar* b = cur->inputs[1];
+void ModelContext::match_static_forward() {
+    static_forward.reset();
+    static_forward_shared = false;
+    if (!compile_desc.static_kernels || compile_desc.bf16_storage || input == nullptr) return;
+    std::unique_ptr<StaticModel> candidate = StaticModel::match(*this);
+    if (!candidate) return;
+
+    // Probe batch with whole SIMD tiles and a tail, deterministic pseudo-random pixels
+    u32 prev_batch_size = batch_size;
+    set_batch_size(STATIC_CHECK_BATCH_SIZE);
+    Matrix& x = input->val;
+    u32 state = 12345;
+    for (u64 i = 0; i < x.size(); i++) {
+        state = state * 1664525u + 1013904223u;
+        x.data[i] = static_cast<f32>(state >> 8) / static_cast<f32>(1u << 24);
+    }
 
-        switch (cur->op) {
-        case ModelVarOp::Null:
+    compute_program(forward_prog, nullptr, 0);
+    Matrix expected = output->val;
+    Matrix actual(output->val.rows, output->val.cols);
+    candidate->forward(x, actual);
+    set_batch_size(prev_batch_size);
+
+    f32 max_diff = 0.0f;
+    for (u64 i = 0; i < expected.size(); i++) {
+        max_diff = std::max(max_diff, std::fabs(expected.data[i] - actual.data[i]));
+    }
+    if (!(max_diff <= STATIC_CHECK_TOLERANCE)) {
+        fprintf(stderr, "Static kernels differ from the graph by %g, running the graph\n", max_diff);
+        return;
+    }
+    static_forward = std::move(candidate);
+}
+
+u64 ModelContext::static_kernel_bytes() const {
+    return static_forward ? static_forward->weight_bytes() : 0;
+}
+
+void ModelContext::run_forward() {
+    if (!static_forward) {
+        compute_program(forward_prog, profiler, profile_track);
+        return;
+    }
+
+    u64 start = profiler ? Profiler::now_ns() : 0;
+    static_forward->forward(input->val, output->val);
+    if (profiler) {
+        u64 end = Profiler::now_ns();
+        u32 n = input->val.cols;
+        profiler->record(profile_track, { "StaticForward", output->index, ProfilePhase::Forward,
+            output->val.rows, n, start, end - start, static_forward->flops_per_sample() * n,
+            (input->val.size() + output->val.size()) * sizeof(f32) });
+    }
+}
+
+void ModelContext::assign_storage() {
+    // Parameters only get a bf16 copy if a matrix product reads them as W
+    std::vector<bool> is_weight(num_vars(), false);
+    for (auto& var : all_vars) {
+        switch (var->op) {
+        case ModelVarOp::Matmul:
+        case ModelVarOp::LinearBias:
+        case ModelVarOp::LinearBiasRelu:
+        case ModelVarOp::LinearBiasReluAdd:
+            is_weight[var->inputs[0]->index] = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (auto& var : all_vars) {
+        bool is_param = (var->flags & MV_FLAG_PARAMETER) != 0;
+        bool half = compile_desc.bf16_storage && (is_param
+            ? is_weight[var->index]
+            : var->op != ModelVarOp::Create && !(var->flags & PINNED_FLAGS));
+        var->storage = half ? ModelVarStorage::BF16 : ModelVarStorage::F32;
+
+        // Copies already bound (e.g. shared from the context this one was
+        // cloned from) are kept
+        if (!is_param) continue;
+        if (!half) {
+            var->val_bf16.bind(var->val.rows, var->val.cols, nullptr);
+        } else if (var->val_bf16.data == nullptr) {
+            bf16* copy = static_cast<bf16*>(weight_copy_arena.push(var->val.size() * sizeof(bf16)));
+            var->val_bf16.bind(var->val.rows, var->val.cols, copy);
+        }
+    }
+}
+
+void ModelContext::sync_weight_copies() {
+    sync_weight_copies(0, 1);
+
+    // A static model shared by a replica is refreshed by the context it came from
+    if (static_forward && !static_forward_shared) static_forward->refresh();
+}
+
+void ModelContext::sync_weight_copies(u32 part, u32 num_parts) {
+    const u8* begin = weight_copy_arena.base();
+    const u8* end = begin + weight_copy_arena.used();
+    for (auto& var : all_vars) {
+        if (!(var->flags & MV_FLAG_PARAMETER) || var->storage != ModelVarStorage::BF16) continue;
+
+        // Copies shared from another context are that context's to refresh
+        const u8* copy = reinterpret_cast<const u8*>(var->val_bf16.data);
+        if (copy < begin || copy >= end) continue;
+        u64 size = var->val.size();
+        u64 first = size * part / num_parts;
+        u64 last = size * (part + 1) / num_parts;
+        BF16::from_f32(var->val.data + first, var->val_bf16.data + first, last - first);
+    }
+}
+
+void ModelContext::fuse_ops() {
+    // Whether a var's shape follows the batch size; a bias only fuses if it
+    // is broadcast at every batch size
+    std::vector<bool> batched(num_vars(), false);
+    for (auto& var : all_vars) {
+        ModelVar* a = var->inputs[0];
+        ModelVar* b = var->inputs[1];
+        switch (var->op) {
         case ModelVarOp::Create:
-        case ModelVarOp::UnaryStart:
-        case ModelVarOp::BinaryStart:
+            batched[var->index] = (var->flags & (MV_FLAG_INPUT | MV_FLAG_DESIRED_OUTPUT)) != 0;
+            break;
+        case ModelVarOp::Matmul:
+        case ModelVarOp::LinearBias:
+        case ModelVarOp::LinearBiasRelu:
+        case ModelVarOp::LinearBiasReluAdd:
+            batched[var->index] = batched[b->index];
             break;
+        default:
+            batched[var->index] = batched[a->index] || (b != nullptr && batched[b->index]);
+            break;
+        }
+    }
 
-        case ModelVarOp::Relu:
-            MatOps::relu(*cur->val, *a->val);
+    // One rewrite at a time; consumer counts only include vars still
+    // reachable from the output or the cost
+    for (bool changed = true; changed; ) {
+        changed = false;
+
+        std::vector<u32> consumers(num_vars(), 0);
+        std::vector<bool> live(num_vars(), false);
+        for (ModelVar* root : { output, cost }) {
+            if (root == nullptr) continue;
+            for (ModelVar* var : create_program(root).vars) live[var->index] = true;
+        }
+        for (auto& var : all_vars) {
+            if (!live[var->index]) continue;
+            for (u32 i = 0; i < mv_num_inputs(var->op); i++) {
+                consumers[var->inputs[i]->index]++;
+            }
+        }
+        auto fusable = [&](const ModelVar* var, ModelVarOp op) {
+            return var->op == op && consumers[var->index] == 1 && !(var->flags & (PINNED_FLAGS | MV_FLAG_CHECKPOINT));
+        };
+
+        for (auto& ptr : all_vars) {
+            ModelVar* var = ptr.get();
+            if (!live[var->index]) continue;
+
+            if (var->op == ModelVarOp::Relu && fusable(var->inputs[0], ModelVarOp::LinearBias)) {
+                ModelVar* linear = var->inputs[0];
+                var->op = ModelVarOp::LinearBiasRelu;
+                for (u32 i = 0; i < 3; i++) var->inputs[i] = linear->inputs[i];
+                changed = true;
+            } else if (var->op == ModelVarOp::Add) {
+                for (u32 side = 0; side < 2 && !changed; side++) {
+                    ModelVar* x = var->inputs[side];
+                    ModelVar* other = var->inputs[1 - side];
+
+                    if (fusable(x, ModelVarOp::Matmul) && !batched[other->index]
+                        && other->val.cols == 1 && other->val.rows == x->val.rows) {
+                        var->op = ModelVarOp::LinearBias;
+                        var->inputs[0] = x->inputs[0];
+                        var->inputs[1] = x->inputs[1];
+                        var->inputs[2] = other;
+                        changed = true;
+                    } else if (fusable(x, ModelVarOp::LinearBiasRelu) && batched[other->index] == batched[x->index]
+                        && other->val.rows == x->val.rows && other->val.cols == x->val.cols) {
+                        var->op = ModelVarOp::LinearBiasReluAdd;
+                        for (u32 i = 0; i < 3; i++) var->inputs[i] = x->inputs[i];
+                        var->inputs[3] = other;
+                        var->aux.bind(var->val.rows, var->val.cols, nullptr);
+                        changed = true;
+                    }
+                }
+            }
+            if (changed) break;
+        }
+    }
+}
+
+void ModelContext::plan_backprop() {
+    std::vector<ModelStep> steps = create_grad_steps(cost_prog);
+    if (!compile_desc.recompute || !compile_desc.plan_memory) {
+        cost_prog.grad_steps = std::move(steps);
+        plan_buffers(compiled_order);
+        return;
+    }
+
+    std::vector<bool> checkpoint(num_vars(), false);
+    bool marked = false;
+    for (ModelVar* var : cost_prog.vars) {
+        if (!(var->flags & MV_FLAG_CHECKPOINT)) continue;
+        checkpoint[var->index] = true;
+        marked = true;
+    }
+    if (marked) {
+        cost_prog.grad_steps = add_recompute_steps(cost_prog, steps, checkpoint);
+        plan_buffers(compiled_order);
+        return;
+    }
+
+    // k evenly spaced checkpoints among the values that could be dropped,
+    // for every k; with all of them nothing is recomputed
+    std::vector<ModelVar*> candidates;
+    for (ModelVar* var : cost_prog.vars) {
+        if (var->op != ModelVarOp::Create && !(var->flags & PINNED_FLAGS)) candidates.push_back(var);
+    }
+    u32 n = static_cast<u32>(candidates.size());
+    auto plan = [&](u32 k) {
+        checkpoint.assign(num_vars(), false);
+        for (u32 i = 0; i < k; i++) {
+            checkpoint[candidates[static_cast<u64>(i + 1) * (n + 1) / (k + 1) - 1]->index] = true;
+        }
+        cost_prog.grad_steps = add_recompute_steps(cost_prog, steps, checkpoint);
+        plan_buffers(compiled_order);
+    };
+
+    u64 budget = compile_desc.activation_budget;
+    u32 best = n;
+    u64 best_bytes = UINT64_MAX;
+    u32 best_ops = UINT32_MAX;
+    std::vector<u32> ids, slot_of;
+    std::vector<u64> slot_bytes;
+    for (u32 k = 0; k <= n; k++) {
+        plan(k);
+        u64 bytes = pack_activations(ids, slot_of, slot_bytes);
+        u32 ops = recomputed_ops();
+        bool fits = budget != 0 && bytes <= budget;
+        bool best_fits = budget != 0 && best_bytes <= budget;
+        bool better = fits
+            ? !best_fits || ops < best_ops || (ops == best_ops && bytes < best_bytes)
+            : !best_fits && (bytes < best_bytes || (bytes == best_bytes && ops < best_ops));
+        if (better) {
+            best = k;
+            best_bytes = bytes;
+            best_ops = ops;
+        }
+    }
+    plan(best);
+}
+
+u32 ModelContext::recomputed_ops() const {
+    u32 count = 0;
+    for (const ModelStep& s : cost_prog.grad_steps) {
+        count += s.kind == ModelStepKind::Recompute;
+    }
+    return count;
+}
+
+void ModelContext::plan_buffers(const std::vector<ModelVar*>& order) {
+    buffer_lives.assign(static_cast<u64>(num_vars()) * BUFFERS_PER_VAR, BufferLife());
+
+    u32 step = 0;
+    auto use = [&](const ModelVar* var, ModelVarBuffer which) {
+        BufferLife& life = buffer_lives[buffer_id(var, which)];
+        life.first = std::min(life.first, step);
+        life.last = std::max(life.last, step);
+    };
+
+    for (ModelVar* cur : order) {
+        forward_uses(cur, use);
+        step++;
+    }
+    for (const ModelStep& s : cost_prog.grad_steps) {
+        if (s.kind == ModelStepKind::Backward) {
+            backward_uses(s.var, use);
+        } else if (s.kind == ModelStepKind::Recompute) {
+            // What the forward pass left in the var's buffers died at its last use
+            for (ModelVarBuffer which : { ModelVarBuffer::Val, ModelVarBuffer::Aux }) {
+                BufferLife& life = buffer_lives[buffer_id(s.var, which)];
+                if (life.first != UINT32_MAX && life.last + 1 < step) {
+                    life.gap_first = life.last + 1;
+                    life.gap_last = step - 1;
+                }
+            }
+            forward_uses(s.var, use);
+        } else {
+            use(s.var, ModelVarBuffer::Grad);
+        }
+        step++;
+    }
+
+    // Values the caller reads or writes between passes keep a buffer of their own
+    for (auto& var : all_vars) {
+        if (var->op == ModelVarOp::Create || (var->flags & PINNED_FLAGS)) {
+            buffer_lives[buffer_id(var.get(), ModelVarBuffer::Val)].pinned = true;
+        }
+    }
+
+    // Elementwise ops may write over an input whose last use is this op.
+    // Recomputed values are left out, their second life would have to fit too.
+    step = 0;
+    for (ModelVar* cur : order) {
+        bool recomputed = buffer_lives[buffer_id(cur, ModelVarBuffer::Val)].gap_first != UINT32_MAX;
+        if (!recomputed && (cur->op == ModelVarOp::Relu || cur->op == ModelVarOp::Add || cur->op == ModelVarOp::Sub)) {
+            for (u32 i = 0; i < mv_num_inputs(cur->op); i++) {
+                u32 src = buffer_id(cur->inputs[i], ModelVarBuffer::Val);
+                const BufferLife& life = buffer_lives[src];
+                if (!life.pinned && life.last == step && life.gap_first == UINT32_MAX) {
+                    buffer_lives[buffer_id(cur, ModelVarBuffer::Val)].in_place_of.push_back(src);
+                }
+            }
+        }
+        step++;
+    }
+}
+
+bool ModelContext::is_bf16_buffer(u32 id) const {
+    // Gradients are always f32; val and aux follow the var's storage
+    const ModelVar* var = all_vars[id / BUFFERS_PER_VAR].get();
+    return var->storage == ModelVarStorage::BF16
+        && static_cast<ModelVarBuffer>(id % BUFFERS_PER_VAR) != ModelVarBuffer::Grad;
+}
+
+u64 ModelContext::stored_bytes(u32 id) const {
+    const Matrix& m = all_vars[id / BUFFERS_PER_VAR]->buffer(static_cast<ModelVarBuffer>(id % BUFFERS_PER_VAR));
+    return m.size() * (is_bf16_buffer(id) ? sizeof(bf16) : sizeof(f32));
+}
+
+bool ModelContext::is_activation_buffer(u32 id) const {
+    const ModelVar* var = all_vars[id / BUFFERS_PER_VAR].get();
+    if (var->flags & MV_FLAG_PARAMETER) return false;
+    switch (static_cast<ModelVarBuffer>(id % BUFFERS_PER_VAR)) {
+    case ModelVarBuffer::Grad: return (var->flags & MV_FLAG_REQUIRES_GRAD) != 0;
+    case ModelVarBuffer::Aux: return mv_has_aux(var->op);
+    default: return true;
+    }
+}
+
+u64 ModelContext::pack_activations(std::vector<u32>& ids, std::vector<u32>& slot_of, std::vector<u64>& slot_bytes) const {
+    // Greedy interval packing in order of first use. A buffer fits a slot if
+    // none of the steps it holds a value overlaps one of the slot's; pinned
+    // buffers live for the whole timeline and so never share.
+    struct Span {
+        u32 first;
+        u32 last;
+    };
+    struct Slot {
+        u64 bytes;
+        std::vector<Span> busy;
+        u32 owner;
+    };
+    auto spans_of = [&](u32 id) {
+        const BufferLife& life = buffer_lives[id];
+        std::vector<Span> spans;
+        if (life.pinned) {
+            spans.push_back({ 0, UINT32_MAX });
+        } else if (life.gap_first != UINT32_MAX) {
+            spans.push_back({ life.first, life.gap_first - 1 });
+            spans.push_back({ life.gap_last + 1, life.last });
+        } else {
+            spans.push_back({ life.first, life.last });
+        }
+        return spans;
+    };
+    auto is_free = [](const Slot& slot, const std::vector<Span>& spans) {
+        for (const Span& b : slot.busy) {
+            for (const Span& s : spans) {
+                if (b.first <= s.last && s.first <= b.last) return false;
+            }
+        }
+        return true;
+    };
+
+    u32 num_buffers = num_vars() * BUFFERS_PER_VAR;
+    std::vector<Slot> slots;
+    slot_of.assign(num_buffers, UINT32_MAX);
+
+    ids.clear();
+    for (u32 id = 0; id < num_buffers; id++) {
+        if (!is_activation_buffer(id)) continue;
+        if (buffer_lives[id].pinned || buffer_lives[id].first != UINT32_MAX) ids.push_back(id);
+    }
+    std::stable_sort(ids.begin(), ids.end(), [&](u32 x, u32 y) {
+        const BufferLife& lx = buffer_lives[x];
+        const BufferLife& ly = buffer_lives[y];
+        u32 fx = lx.pinned ? 0 : lx.first;
+        u32 fy = ly.pinned ? 0 : ly.first;
+        return fx < fy;
+    });
+
+    for (u32 id : ids) {
+        const BufferLife& life = buffer_lives[id];
+        std::vector<Span> spans = spans_of(id);
+        u64 bytes = stored_bytes(id);
+        u32 chosen = UINT32_MAX;
+
+        if (!life.pinned) {
+            for (u32 src : life.in_place_of) {
+                u32 s = slot_of[src];
+                if (s != UINT32_MAX && slots[s].owner == src && stored_bytes(src) == bytes
+                    && is_bf16_buffer(src) == is_bf16_buffer(id)) {
+                    chosen = s;
+                    break;
+                }
+            }
+
+            // Best fit among free slots: the smallest that is large enough,
+            // otherwise the largest, which then grows
+            if (chosen == UINT32_MAX) {
+                for (u32 s = 0; s < slots.size(); s++) {
+                    if (!is_free(slots[s], spans)) continue;
+                    if (chosen == UINT32_MAX) {
+                        chosen = s;
+                        continue;
+                    }
+                    u64 best = slots[chosen].bytes;
+                    u64 cand = slots[s].bytes;
+                    bool fits = cand >= bytes;
+                    bool best_fits = best >= bytes;
+                    if ((fits && (!best_fits || cand < best)) || (!fits && !best_fits && cand > best)) {
+                        chosen = s;
+                    }
+                }
+            }
+        }
+
+        if (chosen == UINT32_MAX) {
+            slots.push_back({ bytes, {}, id });
+            chosen = static_cast<u32>(slots.size() - 1);
+        }
+        Slot& slot = slots[chosen];
+        slot.bytes = std::max(slot.bytes, bytes);
+        slot.busy.insert(slot.busy.end(), spans.begin(), spans.end());
+        slot.owner = id;
+        slot_of[id] = chosen;
+    }
+
+    u64 total = 0;
+    slot_bytes.clear();
+    for (const Slot& slot : slots) {
+        slot_bytes.push_back(slot.bytes);
+        total += (slot.bytes + Arena::ALIGNMENT - 1) & ~(Arena::ALIGNMENT - 1);
+    }
+    return total;
+}
+
+void ModelContext::layout_activations() {
+    activation_arena.reset();
+    unshared_bytes = 0;
+
+    auto bind = [&](u32 id, void* data) {
+        ModelVar* var = all_vars[id / BUFFERS_PER_VAR].get();
+        ModelVarBuffer which = static_cast<ModelVarBuffer>(id % BUFFERS_PER_VAR);
+        Matrix& m = var->buffer(which);
+        if (is_bf16_buffer(id)) {
+            MatrixBF16& half = (which == ModelVarBuffer::Aux) ? var->aux_bf16 : var->val_bf16;
+            half.bind(m.rows, m.cols, static_cast<bf16*>(data));
+            m.bind(m.rows, m.cols, nullptr);
+        } else {
+            m.bind(m.rows, m.cols, static_cast<f32*>(data));
+        }
+    };
+    auto aligned_bytes = [](u64 bytes) {
+        return (bytes + Arena::ALIGNMENT - 1) & ~(Arena::ALIGNMENT - 1);
+    };
+
+    u32 num_buffers = num_vars() * BUFFERS_PER_VAR;
+    for (u32 id = 0; id < num_buffers; id++) {
+        if (is_activation_buffer(id)) unshared_bytes += aligned_bytes(stored_bytes(id));
+    }
+
+    if (!compiled || !compile_desc.plan_memory) {
+        for (u32 id = 0; id < num_buffers; id++) {
+            if (!is_activation_buffer(id)) continue;
+            bind(id, activation_arena.push(stored_bytes(id)));
+        }
+        return;
+    }
+
+    std::vector<u32> ids;
+    std::vector<u32> slot_of;
+    std::vector<u64> slot_bytes;
+    pack_activations(ids, slot_of, slot_bytes);
+
+    // Buffers no step touches get no memory
+    for (u32 id = 0; id < num_buffers; id++) {
+        if (is_activation_buffer(id) && slot_of[id] == UINT32_MAX) bind(id, nullptr);
+    }
+    std::vector<void*> slot_data(slot_bytes.size());
+    for (u32 s = 0; s < slot_bytes.size(); s++) {
+        slot_data[s] = activation_arena.push(slot_bytes[s]);
+    }
+    for (u32 id : ids) {
+        bind(id, slot_data[slot_of[id]]);
+    }
+}
+
+void ModelContext::set_batch_size(u32 new_batch_size) {
+    if (new_batch_size == 0 || new_batch_size == batch_size) return;
+    batch_size = new_batch_size;
+
+    // Vars are always created after their inputs, so a single pass in
+    // creation order propagates the batch dimension through the graph
+    for (auto& var : all_vars) {
+        if (var->flags & MV_FLAG_PARAMETER) continue;
+
+        ModelVar* a = var->inputs[0];
+        ModelVar* b = var->inputs[1];
+        u32 rows = var->val.rows;
+        u32 cols = var->val.cols;
+
+        switch (var->op) {
+        case ModelVarOp::Create:
+            if (var->flags & (MV_FLAG_INPUT | MV_FLAG_DESIRED_OUTPUT)) {
+                cols = batch_size;
+            }
             break;
+        case ModelVarOp::Relu:
         case ModelVarOp::Softmax:
-            MatOps::softmax(*cur->val, *a->val);
+        case ModelVarOp::Sub:
+        case ModelVarOp::CrossEntropy:
+            rows = a->val.rows;
+            cols = a->val.cols;
             break;
         case ModelVarOp::Add:
-            MatOps::add(*cur->val, *a->val, *b->val);
-            break;
-        case ModelVarOp::Sub:
-            MatOps::sub(*cur->val, *a->val, *b->val);
+            rows = a->val.rows;
+            cols = std::max(a->val.cols, b->val.cols);
             break;
         case ModelVarOp::Matmul:
-            MatOps::mul(*cur->val, *a->val, *b->val, true, false, false);
+            rows = a->val.rows;
+            cols = b->val.cols;
             break;
-        case ModelVarOp::CrossEntropy:
-            MatOps::cross_entropy(*cur->val, *a->val, *b->val);
+        case ModelVarOp::SoftmaxCrossEntropy:
+            rows = 1;
+            cols = a->val.cols;
+            break;
+        case ModelVarOp::LinearBias:
+        case ModelVarOp::LinearBiasRelu:
+        case ModelVarOp::LinearBiasReluAdd:
+            rows = a->val.rows;
+            cols = b->val.cols;
             break;
+        default:
+            break;
+        }
+
+        var->val.bind(rows, cols, nullptr);
+        if (var->flags & MV_FLAG_REQUIRES_GRAD) {
+            var->grad.bind(rows, cols, nullptr);
+        }
+        if (mv_has_aux(var->op)) {
+            var->aux.bind(rows, cols, nullptr);
         }
     }
-}
 
+    // Everything but the parameters is laid out again for the new shapes; a
+    // budget for recomputation may now call for other checkpoints
+    if (compiled && compile_desc.recompute) plan_backprop();
+    layout_activations();
+}
 
+std::unique_ptr<ModelContext> ModelContext::clone(bool share_parameters) const {
+    auto copy = std::make_unique<ModelContext>(huge_pages);
 
+    for (const auto& var : all_vars) {
+        auto dup = std::make_unique<ModelVar>();
+        dup->index = var->index;
+        dup->flags = var->flags;
+        dup->op = var->op;
+        dup->quant = var->quant;
 
-namespace {
+        u32 num_inputs = mv_num_inputs(var->op);
+        for (u32 i = 0; i < num_inputs; i++) {
+            dup->inputs[i] = copy->all_vars[var->inputs[i]->index].get();
+        }
 
-    void compute_program(ModelProgram& prog) {
-        for (u32 i = 0; i < prog.size(); i++) {
-            ModelVar* cur = prog.vars[i];
-            ModelVar* a = cur->inputs[0];
-            ModelVar* b = cur->inputs[1];
-
-            switch (cur->op) {
-            case ModelVarOp::Null:
-            case ModelVarOp::Create:
-            case ModelVarOp::UnaryStart:
-            case ModelVarOp::BinaryStart:
-                break;
-
-            case ModelVarOp::Relu:
-                MatOps::relu(*cur->val, *a->val);
-                break;
-            case ModelVarOp::Softmax:
-                MatOps::softmax(*cur->val, *a->val);
-                break;
-            case ModelVarOp::Add:
-                MatOps::add(*cur->val, *a->val, *b->val);
-                break;
-            case ModelVarOp::Sub:
-                MatOps::sub(*cur->val, *a->val, *b->val);
-                break;
-            case ModelVarOp::Matmul:
-                MatOps::mul(*cur->val, *a->val, *b->val, true, false, false);
-                break;
-            case ModelVarOp::CrossEntropy:
-                MatOps::cross_entropy(*cur->val, *a->val, *b->val);
-                break;
-            }
-        }
-    }
-
-    void compute_grads(ModelProgram& prog) {
-        // Clear non-parameter gradients
-        for (u32 i = 0; i < prog.size(); i++) {
-            ModelVar* cur = prog.vars[i];
-            if (!(cur->flags & MV_FLAG_REQUIRES_GRAD)) continue;
-            if (cur->flags & MV_FLAG_PARAMETER) continue;
-            cur->grad->clear();
+        if ((var->flags & MV_FLAG_PARAMETER) && var->val.data == nullptr) {
+            // Not stored, see freeze()
+            dup->val.bind(var->val.rows, var->val.cols, nullptr);
+        } else if (share_parameters && (var->flags & MV_FLAG_PARAMETER)) {
+            dup->val = Matrix::view(var->val.rows, var->val.cols, var->val.data);
+            dup->val_bf16 = MatrixBF16::view(var->val_bf16.rows, var->val_bf16.cols, var->val_bf16.data);
+            if (var->flags & MV_FLAG_REQUIRES_GRAD) {
+                dup->grad.bind(var->grad.rows, var->grad.cols, copy->grad_arena.push_f32(var->grad.size()));
+            }
+        } else {
+            copy->bind_storage(dup.get(), var->val.rows, var->val.cols);
+            if (var->flags & MV_FLAG_PARAMETER) {
+                dup->val.copy_from(var->val);
+            }
         }
 
-        // Initialize output gradient
-        prog.vars[prog.size() - 1]->grad->fill(1.0f);
+        copy->all_vars.push_back(std::move(dup));
+    }
 
-        // Backprop
-        for (i64 i = static_cast<i64>(prog.size()) - 1; i >= 0; i--) {
-            ModelVar* cur = prog.vars[i];
+    auto remap = [&](const ModelVar* var) {
+        return var ? copy->all_vars[var->index].get() : nullptr;
+    };
+    copy->input = remap(input);
+    copy->output = remap(output);
+    copy->desired_output = remap(desired_output);
+    copy->cost = remap(cost);
+    copy->batch_size = batch_size;
+
+    if (compiled) {
+        copy->compile(compile_desc);
+    }
+    if (share_parameters && copy->static_forward) {
+        copy->static_forward = static_forward;
+        copy->static_forward_shared = true;
+    }
 
-            if ((cur->flags & MV_FLAG_REQUIRES_GRAD) == 0) continue;
+    return copy;
+}
 
-            ModelVar* a = cur->inputs[0];
-            ModelVar* b = cur->inputs[1];
+std::unique_ptr<InferenceModel> ModelContext::freeze() const {
+    if (input == nullptr || output == nullptr) return nullptr;
+    auto frozen = std::make_unique<ModelContext>(huge_pages);
+
+    // Parameters already mapped read-only from a checkpoint are shared as they
+    // are; otherwise they are packed in forward order, the order they are read in
+    bool share_file = param_file && !param_file_writable;
+    if (share_file) {
+        frozen->param_file = param_file;
+        frozen->file_params = file_params;
+        frozen->file_param_count = file_param_count;
+    }
+    // A parameter only read as the W of quantized products (see
+    // InferenceModel::quantized) is not stored at all
+    ModelProgram prog = create_program(output);
+    std::vector<bool> read_as_f32(num_vars(), false);
+    for (ModelVar* var : prog.vars) {
+        for (u32 i = 0; i < mv_num_inputs(var->op); i++) {
+            if (i != 0 || !var->quant) read_as_f32[var->inputs[i]->index] = true;
+        }
+    }
 
-            u32 num_inputs = mv_num_inputs(cur->op);
+    std::vector<ModelVar*> remap(num_vars(), nullptr);
+    for (ModelVar* var : prog.vars) {
+        auto dup = std::make_unique<ModelVar>();
+        dup->index = frozen->num_vars();
+        dup->flags = var->flags & ~(MV_FLAG_REQUIRES_GRAD | MV_FLAG_DESIRED_OUTPUT | MV_FLAG_COST);
+        dup->op = var->op;
+        dup->quant = var->quant;
+        for (u32 i = 0; i < mv_num_inputs(var->op); i++) {
+            dup->inputs[i] = remap[var->inputs[i]->index];
+        }
 
-            if (num_inputs == 1 && !(a->flags & MV_FLAG_REQUIRES_GRAD)) continue;
-            if (num_inputs == 2 && !(a->flags & MV_FLAG_REQUIRES_GRAD) && !(b->flags & MV_FLAG_REQUIRES_GRAD)) continue;
-
-            switch (cur->op) {
-            case ModelVarOp::Null:
-            case ModelVarOp::Create:
-            case ModelVarOp::UnaryStart:
-            case ModelVarOp::BinaryStart:
-                break;
-
-            case ModelVarOp::Relu:
-                MatOps::relu_add_grad(*a->grad, *a->val, *cur->grad);
-                break;
-
-            case ModelVarOp::Softmax:
-                MatOps::softmax_add_grad(*a->grad, *cur->val, *cur->grad);
-                break;
-
-            case ModelVarOp::Add:
-                if (a->flags & MV_FLAG_REQUIRES_GRAD)
-                    MatOps::add(*a->grad, *a->grad, *cur->grad);
-                if (b->flags & MV_FLAG_REQUIRES_GRAD)
-                    MatOps::add(*b->grad, *b->grad, *cur->grad);
-                break;
-
-            case ModelVarOp::Sub:
-                if (a->flags & MV_FLAG_REQUIRES_GRAD)
-                    MatOps::add(*a->grad, *a->grad, *cur->grad);
-                if (b->flags & MV_FLAG_REQUIRES_GRAD)
-                    MatOps::sub(*b->grad, *b->grad, *cur->grad);
-                break;
-
-            case ModelVarOp::Matmul:
-                if (a->flags & MV_FLAG_REQUIRES_GRAD)
-                    MatOps::mul(*a->grad, *cur->grad, *b->val, false, false, true);
-                if (b->flags & MV_FLAG_REQUIRES_GRAD)
-                    MatOps::mul(*b->grad, *a->val, *cur->grad, false, true, false);
-                break;
-
-            case ModelVarOp::CrossEntropy:
-                MatOps::cross_entropy_add_grad(
-                    (a->flags & MV_FLAG_REQUIRES_GRAD) ? a->grad.get() : nullptr,
-                    (b->flags & MV_FLAG_REQUIRES_GRAD) ? b->grad.get() : nullptr,
-                    *a->val, *b->val, *cur->grad
-                );
-                break;
+        if ((var->flags & MV_FLAG_PARAMETER) && !read_as_f32[var->index]) {
+            dup->val.bind(var->val.rows, var->val.cols, nullptr);
+        } else if ((var->flags & MV_FLAG_PARAMETER) && share_file) {
+            dup->val.bind(var->val.rows, var->val.cols, var->val.data);
+        } else {
+            frozen->bind_storage(dup.get(), var->val.rows, var->val.cols);
+            if (var->flags & MV_FLAG_PARAMETER) {
+                dup->val.copy_from(var->val);
             }
         }
+
+        remap[var->index] = dup.get();
+        frozen->all_vars.push_back(std::move(dup));
     }
 
+    frozen->input = remap[input->index];
+    frozen->output = remap[output->index];
+    frozen->batch_size = batch_size;
+    frozen->compile(compile_desc);
+    frozen->set_batch_size(1);
+    frozen->param_arena.protect(true);
+    frozen->weight_copy_arena.protect(true);
+
+    return std::unique_ptr<InferenceModel>(new InferenceModel(std::move(frozen)));
 }
 
+void ModelContext::feedforward() {
+    run_forward();
+}
 
-void ModelContext::train(const ModelTrainingDesc& desc) {
-    Matrix* train_images = desc.train_images;
-    Matrix* train_labels = desc.train_labels;
-    Matrix* test_images = desc.test_images;
-    Matrix* test_labels = desc.test_labels;
+void ModelContext::feedforward(const std::function<void(const ModelVar*)>& observe) {
+    for (ModelVar* var : forward_prog.vars) {
+        compute_var(var);
+        observe(var);
+    }
+}
 
-    u32 num_examples = train_images->rows;
-    u32 input_size = train_images->cols;
-    u32 output_size = train_labels->cols;
-    u32 num_tests = test_images->rows;
+f32 ModelContext::compute_gradients() {
+    return compute_gradients(std::function<void(u32)>());
+}
+
+f32 ModelContext::compute_gradients(const std::function<void(u32)>& step_done) {
+    grad_slab().clear();
+
+    // The cost is summed over the batch, so parameter gradients are too
+    compute_program(cost_prog, profiler, profile_track);
+    compute_grads(cost_prog, profiler, profile_track, step_done);
+
+    return cost->val.sum();
+}
 
-    u32 num_batches = num_examples / desc.batch_size;
+// Only ever grows the pool and the replica set: train() keeps indexing
+// replicas by its own shard count after a predict() with fewer threads has
+// been through here.
+void ModelContext::ensure_workers(u32 num_threads) {
+    if (!replicas.empty() && replicas[0]->num_vars() != num_vars()) {
+        replicas.clear();
+    }
+    if (pool && pool->size() >= num_threads && replicas.size() >= num_threads) return;
 
-    std::vector<u32> training_order(num_examples);
-    for (u32 i = 0; i < num_examples; i++) {
-        training_order[i] = i;
+    if (!pool || pool->size() < num_threads) {
+        pool = std::make_unique<ThreadPool>(num_threads);
     }
+    while (replicas.size() < num_threads) {
+        replicas.push_back(clone(true));
+    }
+    set_profiler(profiler);
+}
 
-    for (u32 epoch = 0; epoch < desc.epochs; epoch++) {
-        // Shuffle training order
-        for (u32 i = 0; i < num_examples; i++) {
-            u32 a = prng_rand() % num_examples;
-            u32 b = prng_rand() % num_examples;
-            std::swap(training_order[a], training_order[b]);
+void ModelContext::set_profiler(Profiler* new_profiler) {
+    profiler = new_profiler;
+    profile_track = 0;
+    if (profiler != nullptr) {
+        profiler->ensure_tracks(1 + static_cast<u32>(replicas.size()));
+    }
+    for (u32 i = 0; i < replicas.size(); i++) {
+        replicas[i]->profiler = profiler;
+        replicas[i]->profile_track = i + 1;
+    }
+}
+
+f32 ModelContext::compute_shard(const Matrix& images, const Matrix& labels, const SparseMatrix* sparse_images,
+    const std::function<void(u32)>& step_done) {
+    set_batch_size(images.cols);
+
+    // The loader already laid the shard out in graph layout, so input and
+    // desired_output read it in place. Nothing writes through them, and they
+    // are pointed back at their own buffers before anything else can run.
+    f32* own_input = input->val.data;
+    f32* own_labels = desired_output->val.data;
+    input->val.bind(images.rows, images.cols, images.data);
+    desired_output->val.bind(labels.rows, labels.cols, labels.data);
+    if (sparse_images != nullptr && sparse_images->density() <= SPARSE_MAX_DENSITY) {
+        input->sparse = sparse_images;
+    }
+
+    f32 batch_cost = compute_gradients(step_done);
+
+    input->sparse = nullptr;
+    input->val.bind(images.rows, images.cols, own_input);
+    desired_output->val.bind(labels.rows, labels.cols, own_labels);
+    return batch_cost;
+}
+
+// step_done only applies to a batch computed in one shard
+f32 ModelContext::compute_batch(const LoadedBatch& batch, const std::function<void(u32)>& step_done) {
+    u32 num_shards = static_cast<u32>(batch.images.size());
+    auto sparse_images = [&](u32 shard) {
+        return batch.sparse_images.empty() ? nullptr : &batch.sparse_images[shard];
+    };
+    if (num_shards == 1) {
+        return compute_shard(batch.images[0], batch.labels[0], sparse_images(0), step_done);
+    }
+
+    std::vector<f32> shard_costs(num_shards, 0.0f);
+    pool->run(num_shards, [&](u32 shard) {
+        shard_costs[shard] = replicas[shard]->compute_shard(batch.images[shard], batch.labels[shard],
+            sparse_images(shard), std::function<void(u32)>());
+    });
+
+    // Pairwise tree reduction into replica 0; the order only depends on num_shards
+    u64 start = profiler ? Profiler::now_ns() : 0;
+    for (u32 stride = 1; stride < num_shards; stride *= 2) {
+        u32 num_pairs = (num_shards - stride + 2 * stride - 1) / (2 * stride);
+        pool->run(num_pairs, [&](u32 pair) {
+            Matrix dst = replicas[pair * 2 * stride]->grad_slab();
+            Matrix src = replicas[pair * 2 * stride + stride]->grad_slab();
+            MatOps::add(dst, dst, src);
+        });
+    }
+    u64 grad_bytes = grad_slab().size() * sizeof(f32);
+    record_other(profiler, profile_track, "reduce_grads", 1, grad_slab().cols, start,
+        3 * grad_bytes * (num_shards - 1));
+
+    f32 total_cost = 0.0f;
+    for (f32 c : shard_costs) total_cost += c;
+    return total_cost;
+}
+
+template <typename Source>
+void ModelContext::predict_range(const Source& images, u32 first, u32 count, u32* out_labels, f32* out_probs) {
+    for (u32 start = first; start < first + count; start += PREDICT_BATCH_SIZE) {
+        u32 n = std::min(PREDICT_BATCH_SIZE, first + count - start);
+        set_batch_size(n);
+
+        // Quantized products pack u8 rows themselves, straight from the file
+        ByteRows rows;
+        if (quantized_input && byte_rows_of(rows, images, start, n)) {
+            input->byte_rows = &rows;
+            run_forward();
+            input->byte_rows = nullptr;
+        } else {
+            u64 gather_start = profiler ? Profiler::now_ns() : 0;
+            copy_rows_to_columns(input->val, images, start, n);
+            record_other(profiler, profile_track, "gather", input->val.rows, n, gather_start,
+                input->val.size() * sizeof(f32));
+
+            if (compile_desc.sparse_input && !static_forward && !quantized_input) {
+                u64 sparse_start = profiler ? Profiler::now_ns() : 0;
+                input_csr.assign(input->val);
+                record_other(profiler, profile_track, "sparse_input", input->val.rows, n, sparse_start,
+                    input->val.size() * sizeof(f32));
+                if (input_csr.density() <= SPARSE_MAX_DENSITY) input->sparse = &input_csr;
+            }
+            run_forward();
+            input->sparse = nullptr;
         }
 
-        for (u32 batch = 0; batch < num_batches; batch++) {
-            // Clear parameter gradients
-            for (auto& var : all_vars) {
-                if (var->flags & MV_FLAG_PARAMETER) {
-                    var->grad->clear();
+        const Matrix& out = output->val;
+        for (u32 c = 0; c < n; c++) {
+            out_labels[start + c] = out.argmax_col(c);
+        }
+
+        if (out_probs != nullptr) {
+            for (u32 c = 0; c < n; c++) {
+                f32* probs = out_probs + static_cast<u64>(start + c) * out.rows;
+                for (u32 r = 0; r < out.rows; r++) {
+                    probs[r] = out.at(r, c);
                 }
             }
+        }
+    }
+}
 
-            f32 avg_cost = 0.0f;
-            for (u32 i = 0; i < desc.batch_size; i++) {
-                u32 order_index = batch * desc.batch_size + i;
-                u32 index = training_order[order_index];
+template <typename Source>
+void ModelContext::predict_impl(const Source& images, u32* out_labels, f32* out_probs, u32 num_threads) {
+    u32 num_samples = images.rows;
+    if (num_samples == 0) return;
 
-                std::memcpy(
-                    input->val->data.data(),
-                    train_images->data.data() + index * input_size,
-                    sizeof(f32) * input_size
-                );
+    if (num_threads == 0) {
+        num_threads = ThreadPool::hardware_threads();
+    }
+    num_threads = std::min(num_threads, (num_samples + PREDICT_BATCH_SIZE - 1) / PREDICT_BATCH_SIZE);
 
-                std::memcpy(
-                    desired_output->val->data.data(),
-                    train_labels->data.data() + index * output_size,
-                    sizeof(f32) * output_size
-                );
+    if (num_threads <= 1) {
+        u32 prev_batch_size = batch_size;
+        predict_range(images, 0, num_samples, out_labels, out_probs);
+        set_batch_size(prev_batch_size);
+        return;
+    }
 
-                compute_program(cost_prog);
-                compute_grads(cost_prog);
+    ensure_workers(num_threads);
 
-                avg_cost += cost->val->sum();
-            }
-            avg_cost /= static_cast<f32>(desc.batch_size);
+    pool->run(num_threads, [&](u32 shard) {
+        u32 base = num_samples / num_threads;
+        u32 extra = num_samples % num_threads;
+        u32 begin = shard * base + std::min(shard, extra);
+        u32 shard_size = base + (shard < extra ? 1 : 0);
+
+        replicas[shard]->predict_range(images, begin, shard_size, out_labels, out_probs);
+    });
+}
+
+void ModelContext::predict(const Matrix& images, u32* out_labels, f32* out_probs, u32 num_threads) {
+    predict_impl(images, out_labels, out_probs, num_threads);
+}
+
+void ModelContext::predict(const Dataset& images, u32* out_labels, f32* out_probs, u32 num_threads) {
+    predict_impl(images, out_labels, out_probs, num_threads);
+}
+
+// One epoch of Hogwild: every worker steps through its own loader's batches,
+// updating the shared parameters with no locking, reduction or barrier. Two
+// workers may update the same weight at once and one of the writes is lost;
+// with gradients this sparse that costs little, and nobody waits. With bf16
+// storage each worker refreshes its own share of the weight copies after a
+// step, so together they make one pass per step instead of one each; a full
+// refresh follows the epoch.
+void ModelContext::hogwild_epoch(const ModelTrainingDesc& desc, std::vector<std::unique_ptr<BatchLoader>>& loaders,
+    std::vector<std::unique_ptr<Optimizer>>& optimizers) {
+    u32 num_workers = static_cast<u32>(loaders.size());
+    std::vector<u64> elapsed_ns(num_workers, 0);
+    std::vector<f32> costs(num_workers, 0.0f);
+    bool refresh_copies = compile_desc.bf16_storage;
+    u64 epoch_start = Profiler::now_ns();
+
+    pool->run(num_workers, [&](u32 w) {
+        ModelContext& replica = *replicas[w];
+        BatchLoader& loader = *loaders[w];
+        u32 track = replica.profile_track;
+        Matrix params = param_slab();
+        u64 start = Profiler::now_ns();
+
+        for (u32 batch = 0; batch < loader.batches_per_epoch(); batch++) {
+            const LoadedBatch& loaded = loader.next();
+            const SparseMatrix* sparse_images = loaded.sparse_images.empty() ? nullptr : &loaded.sparse_images[0];
+            costs[w] += replica.compute_shard(loaded.images[0], loaded.labels[0], sparse_images,
+                std::function<void(u32)>());
+
+            u64 update_start = profiler ? Profiler::now_ns() : 0;
+            Matrix grads = replica.grad_slab();
+            optimizers[w]->step(params, grads, desc.learning_rate, 1.0f / desc.batch_size);
+            if (refresh_copies) sync_weight_copies(w, num_workers);
+            record_other(profiler, track, "update", 1, params.cols, update_start,
+                (3 + 2 * optimizers[w]->num_state_slabs()) * params.size() * sizeof(f32));
+        }
+        elapsed_ns[w] = Profiler::now_ns() - start;
+    });
+    u64 epoch_ns = Profiler::now_ns() - epoch_start;
+    sync_weight_copies();
+
+    if (!desc.verbose) return;
+    u64 total_samples = 0;
+    for (u32 w = 0; w < num_workers; w++) {
+        u32 samples = loaders[w]->batches_per_epoch() * desc.batch_size;
+        double rate = elapsed_ns[w] ? samples * 1e9 / elapsed_ns[w] : 0.0;
+        total_samples += samples;
+        std::printf("Thread %2u: %6u samples, %8.0f samples/s, Average Cost: %.4f\n",
+            w, samples, rate, samples ? costs[w] / samples : 0.0f);
+    }
+    std::printf("Hogwild: %.0f samples/s over %u threads\n",
+        epoch_ns ? total_samples * 1e9 / epoch_ns : 0.0, num_workers);
+}
+
+void ModelContext::train(const ModelTrainingDesc& desc) {
+    const Dataset* train_images = desc.train_images;
+    const Dataset* train_labels = desc.train_labels;
+    const Dataset* test_images = desc.test_images;
+    const Dataset* test_labels = desc.test_labels;
+
+    u32 num_examples = train_images->rows;
+    u32 num_tests = test_images->rows;
+
+    RingAllReduce* ring = desc.ring;
+    u32 world_size = ring ? ring->world_size() : 1;
+
+    u32 output_size = output->val.rows;
+    const char* bad_labels = !train_labels->valid_labels(output_size) ? "training"
+        : !test_labels->valid_labels(output_size) ? "test" : nullptr;
+    if (bad_labels != nullptr) {
+        std::fprintf(stderr, "Training stopped: %s labels are not class indices below %u\n", bad_labels, output_size);
+        return;
+    }
+    std::vector<u32> test_predictions(num_tests);
+    std::vector<f32> test_probs(static_cast<u64>(num_tests) * output_size);
+
+    // The whole minibatch goes through the graph at once, one sample per column
+    u32 prev_batch_size = batch_size;
+    set_batch_size(desc.batch_size);
+    if (desc.verbose) {
+        std::printf("Activation memory at batch size %u: %.1f KiB (%.1f KiB without buffer sharing)\n",
+            batch_size, activation_bytes() / 1024.0, unshared_activation_bytes() / 1024.0);
+    }
+
+    u32 num_threads = std::max(1u, std::min(desc.num_threads, desc.batch_size));
+    bool hogwild = desc.hogwild && !ring && num_threads > 1;
+    if (hogwild) {
+        num_threads = std::max(1u, std::min(desc.num_threads, num_examples / desc.batch_size));
+        hogwild = num_threads > 1;
+    }
+    if (num_threads > 1) {
+        ensure_workers(num_threads);
+    }
 
-            // Update parameters
+    // Shuffling and gathering happen on the loader's threads, one shard per
+    // replica, while the current batch computes. Hogwild workers each get a
+    // loader of their own over their own rows, and an optimizer of their own.
+    BatchLoaderDesc loader_desc;
+    loader_desc.batch_size = desc.batch_size;
+    loader_desc.num_shards = hogwild ? 1 : num_threads;
+    loader_desc.num_workers = desc.loader_threads;
+    loader_desc.shuffle_block = desc.shuffle_block;
+    loader_desc.sparse_images = compile_desc.sparse_input;
+    loader_desc.huge_pages = huge_pages;
+    if (ring) {
+        loader_desc.num_rows = num_examples / world_size;
+        loader_desc.first_row = ring->rank() * loader_desc.num_rows;
+    }
+    std::vector<std::unique_ptr<BatchLoader>> loaders;
+    std::vector<std::unique_ptr<Optimizer>> optimizers;
+    for (u32 w = 0; w < (hogwild ? num_threads : 1); w++) {
+        if (hogwild) {
+            loader_desc.num_rows = num_examples / num_threads;
+            loader_desc.first_row = w * loader_desc.num_rows;
+        }
+        loaders.push_back(std::make_unique<BatchLoader>(*train_images, *train_labels, loader_desc));
+        optimizers.push_back(Optimizer::create(desc.optimizer, param_slab().size()));
+    }
+    BatchLoader& loader = *loaders[0];
+    Optimizer* optimizer = optimizers[0].get();
+    u32 num_batches = loader.batches_per_epoch();
+
+    // Every process starts from rank 0's parameters
+    if (ring) {
+        Matrix params = param_slab();
+        if (!ring->broadcast(params.data, params.size(), 0)) {
+            std::fprintf(stderr, "Training stopped: parameter broadcast failed\n");
+            set_batch_size(prev_batch_size);
+            return;
+        }
+        sync_weight_copies();
+    }
+
+    // Gradient buckets in the order backprop finishes them: a parameter's
+    // gradient is final after the last backward step accumulating into it.
+    // Bucket bucket_after[i] goes out right after grad step i.
+    const std::vector<ModelStep>& steps = cost_prog.grad_steps;
+    std::vector<std::vector<RingAllReduce::Span>> buckets;
+    std::vector<u32> bucket_after(steps.size(), UINT32_MAX);
+    if (ring && num_threads == 1) {
+        std::vector<u32> last_step(num_vars(), UINT32_MAX);
+        for (u32 i = 0; i < steps.size(); i++) {
+            if (steps[i].kind != ModelStepKind::Backward) continue;
+            backward_uses(steps[i].var, [&](const ModelVar* var, ModelVarBuffer which) {
+                if (which == ModelVarBuffer::Grad && (var->flags & MV_FLAG_PARAMETER)) last_step[var->index] = i;
+            });
+        }
+
+        std::vector<RingAllReduce::Span> bucket;
+        u64 bucket_bytes = 0;
+        for (u32 i = 0; i < steps.size(); i++) {
             for (auto& var : all_vars) {
-                if (!(var->flags & MV_FLAG_PARAMETER)) continue;
+                if (last_step[var->index] != i) continue;
+                bucket.push_back({ var->grad.data, var->grad.size() });
+                bucket_bytes += var->grad.size() * sizeof(f32);
+            }
+            if (!bucket.empty() && (bucket_bytes >= desc.bucket_bytes || i + 1 == steps.size())) {
+                bucket_after[i] = static_cast<u32>(buckets.size());
+                buckets.push_back(std::move(bucket));
+                bucket.clear();
+                bucket_bytes = 0;
+            }
+        }
+    }
+    std::function<void(u32)> send_buckets;
+    if (!buckets.empty()) {
+        send_buckets = [&](u32 step) {
+            if (bucket_after[step] != UINT32_MAX) ring->start(buckets[bucket_after[step]]);
+        };
+    }
 
-                var->grad->scale(desc.learning_rate / desc.batch_size);
-                MatOps::sub(*var->val, *var->val, *var->grad);
+    for (u32 epoch = 0; epoch < desc.epochs; epoch++) {
+        if (hogwild) {
+            if (desc.verbose) std::printf("Epoch %2u / %2u\n", epoch + 1, desc.epochs);
+            hogwild_epoch(desc, loaders, optimizers);
+        }
+        for (u32 batch = 0; batch < (hogwild ? 0 : num_batches); batch++) {
+            u64 wait_start = profiler ? Profiler::now_ns() : 0;
+            const LoadedBatch& loaded = loader.next();
+            record_other(profiler, profile_track, "batch_wait", train_images->cols, loaded.size, wait_start, 0);
+
+            f32 batch_cost = compute_batch(loaded, send_buckets);
+            f32 avg_cost = batch_cost / static_cast<f32>(desc.batch_size);
+            Matrix grads = ((num_threads > 1) ? *replicas[0] : *this).grad_slab();
+
+            // Sum the gradients over all processes
+            if (ring) {
+                u64 reduce_start = profiler ? Profiler::now_ns() : 0;
+                if (buckets.empty()) ring->start({ { grads.data, grads.size() } });
+                bool reduced = ring->wait();
+                record_other(profiler, profile_track, "all_reduce_wait", 1, grads.cols, reduce_start, 0);
+                if (!reduced) {
+                    std::fprintf(stderr, "Training stopped: gradient all-reduce failed\n");
+                    set_batch_size(prev_batch_size);
+                    return;
+                }
             }
 
-            std::printf(
-                "Epoch %2u / %2u, Batch %4u / %4u, Average Cost: %.4f\r",
-                epoch + 1, desc.epochs,
-                batch + 1, num_batches, avg_cost
-            );
-            std::fflush(stdout);
+            // Update parameters: one fused pass over the whole slab
+            u64 update_start = profiler ? Profiler::now_ns() : 0;
+            Matrix params = param_slab();
+            optimizer->step(params, grads, desc.learning_rate, 1.0f / (desc.batch_size * world_size));
+            sync_weight_copies();
+            record_other(profiler, profile_track, "update", 1, params.cols, update_start,
+                (3 + 2 * optimizer->num_state_slabs()) * params.size() * sizeof(f32));
+
+            if (desc.verbose) {
+                std::printf(
+                    "Epoch %2u / %2u, Batch %4u / %4u, Average Cost: %.4f\r",
+                    epoch + 1, desc.epochs,
+                    batch + 1, num_batches, avg_cost
+                );
+                std::fflush(stdout);
+            }
         }
-        std::printf("\n");
+        if (desc.verbose && !hogwild) std::printf("\n");
 
         // Test accuracy
+        if (ring && ring->rank() != 0) continue;
+        predict(*test_images, test_predictions.data(), test_probs.data(), desc.num_threads);
+
         u32 num_correct = 0;
         f32 avg_cost = 0.0f;
         for (u32 i = 0; i < num_tests; i++) {
-            std::memcpy(
-                input->val->data.data(),
-                test_images->data.data() + i * input_size,
-                sizeof(f32) * input_size
-            );
+            u32 label = test_labels->label(i);
 
-            std::memcpy(
-                desired_output->val->data.data(),
-                test_labels->data.data() + i * output_size,
-                sizeof(f32) * output_size
-            );
-
-            compute_program(cost_prog);
-
-            avg_cost += cost->val->sum();
-            num_correct += (output->val->argmax() == desired_output->val->argmax()) ? 1 : 0;
+            avg_cost += -std::log(test_probs[static_cast<u64>(i) * output_size + label]);
+            num_correct += (test_predictions[i] == label) ? 1 : 0;
         }
 
         avg_cost /= static_cast<f32>(num_tests);
-        std::printf(
-            "Test Completed. Accuracy: %5u / %5u (%.1f%%), Average Cost: %.4f\n",
-            num_correct, num_tests,
-            static_cast<f32>(num_correct) / num_tests * 100.0f,
-            avg_cost
-        );
+        if (desc.verbose) {
+            std::printf(
+                "Test Completed. Accuracy: %5u / %5u (%.1f%%), Average Cost: %.4f\n",
+                num_correct, num_tests,
+                static_cast<f32>(num_correct) / num_tests * 100.0f,
+                avg_cost
+            );
+        }
     }
-}
 
+    set_batch_size(prev_batch_size);
+}
@@ -4,13 +4,23 @@
 #include <memory>
 #include <iostream>
 #include <fstream>
+#include <functional>
 #include <algorithm>
 #include <random>
 
 #include "Types.hpp"
+#include "Arena.hpp"
 #include "ModelVariables.hpp"
+#include "ModelCompileDesc.hpp"
+#include "SparseMatrix.hpp"
+#include "ThreadPool.hpp"
+
 class ModelContext {
 public:
+    // huge_pages asks the OS to back the parameter, gradient and activation
+    // arenas with transparent huge pages where supported
+    explicit ModelContext(bool huge_pages = false);
+
     std::vector<std::unique_ptr<ModelVar>> all_vars;
 
     ModelVar* input = nullptr;
@@ -21,8 +31,23 @@ public:
     ModelProgram forward_prog;
     ModelProgram cost_prog;
 
+    // Number of samples processed per graph pass; inputs are (features x batch_size)
+    u32 batch_size = 1;
+
     u32 num_vars() const { return static_cast<u32>(all_vars.size()); }
 
+    // Parameter values live in one contiguous 64-byte aligned slab and their
+    // gradients in another with the same layout; these return (1 x n) views
+    Matrix param_slab() const;
+    Matrix grad_slab() const;
+
+    // Activation bytes laid out for the current batch size, and what they
+    // would take if every value and gradient had its own buffer
+    u64 activation_bytes() const { return activation_arena.used(); }
+    u64 unshared_activation_bytes() const { return unshared_bytes; }
+    // Ops computed again during backprop, see ModelCompileDesc::recompute
+    u32 recomputed_ops() const;
+
     ModelVar* create_var(u32 rows, u32 cols, u32 flags);
     ModelVar* relu(ModelVar* input, u32 flags);
     ModelVar* softmax(ModelVar* input, u32 flags);
@@ -30,13 +55,145 @@ public:
     ModelVar* sub(ModelVar* a, ModelVar* b, u32 flags);
     ModelVar* matmul(ModelVar* a, ModelVar* b, u32 flags);
     ModelVar* cross_entropy(ModelVar* p, ModelVar* q, u32 flags);
+    // Per-sample loss of softmax(logits) against labels, a (1 x batch) row of
+    // class indices; the fused backward is softmax - onehot
+    ModelVar* softmax_cross_entropy(ModelVar* logits, ModelVar* labels, u32 flags);
 
-    void compile();
+    // Orders the forward and cost programs, builds the backprop schedule and,
+    // with desc.plan_memory, assigns activation buffers by liveness. The
+    // input and desired_output values are kept.
+    void compile(const ModelCompileDesc& desc = ModelCompileDesc());
+    const ModelCompileDesc& compile_options() const { return compile_desc; }
+    // With bf16_storage, refreshes the bf16 weight copies from the f32
+    // parameters; needed after writing parameters outside of train()
+    void sync_weight_copies();
+    // Whether feedforward() and predict() run a StaticModel, see
+    // ModelCompileDesc::static_kernels
+    bool uses_static_kernels() const { return static_forward != nullptr; }
+    // Bytes of the parameter copies the StaticModel keeps, 0 without one
+    u64 static_kernel_bytes() const;
+    void set_batch_size(u32 batch_size);
+    // With share_parameters the copy reads this context's parameter slab
+    // instead of copying it, and only owns its gradients and activations
+    std::unique_ptr<ModelContext> clone(bool share_parameters = false) const;
     void feedforward();
+    // Calls observe after each var is computed. With buffer sharing, a var's
+    // inputs are only guaranteed intact until the callback returns.
+    void feedforward(const std::function<void(const ModelVar*)>& observe);
+    // Cost forward pass and backprop over the batch already in input and
+    // desired_output. grad_slab() is cleared first and then holds gradients
+    // summed over the batch; returns the summed cost, NaN if a label fed to
+    // softmax_cross_entropy is not a class index.
+    f32 compute_gradients();
+    // Also calls step_done(i) right after cost_prog.grad_steps[i], e.g. to
+    // start sending the gradients it finished
+    f32 compute_gradients(const std::function<void(u32)>& step_done);
+
+    // Opt-in profiling: while set, every op of the forward and backward
+    // passes, batch gathers and parameter updates are timed into profiler;
+    // nullptr turns it off. This context records into track 0 and its
+    // data-parallel replicas into tracks 1..N.
+    void set_profiler(class Profiler* profiler);
+
+    // Checkpoints hold the graph (ops, flags, shapes, wiring) and the
+    // parameter slab; see ModelCheckpoint.hpp. load() maps the file and binds
+    // the parameters to it without copying. With writable_params the mapping
+    // is copy-on-write, so training can go on in memory; otherwise the
+    // parameters are read-only.
+    bool save(const char* path) const;
+    static std::unique_ptr<ModelContext> load(const char* path, bool writable_params = true, bool huge_pages = false);
+
+    // Forward-only copy of this model for serving: only the vars output
+    // depends on, no gradients, parameters copied into read-only memory
+    std::unique_ptr<class InferenceModel> freeze() const;
     void train(const struct ModelTrainingDesc& desc);
 
+    // Batched inference over every row of images (samples x features). Only
+    // forward_prog runs; rows are sharded across num_threads threads (0 = all
+    // hardware threads). The argmax class of each sample goes to out_labels[row]
+    // and, if out_probs is given, its output vector to out_probs[row * output rows].
+    void predict(const Matrix& images, u32* out_labels, f32* out_probs = nullptr, u32 num_threads = 0);
+    void predict(const class Dataset& images, u32* out_labels, f32* out_probs = nullptr, u32 num_threads = 0);
+
 private:
     ModelVar* unary_impl(ModelVar* input, u32 rows, u32 cols, u32 flags, ModelVarOp op);
     ModelVar* binary_impl(ModelVar* a, ModelVar* b, u32 rows, u32 cols, u32 flags, ModelVarOp op);
-    ModelProgram create_program(ModelVar* out_var);
+    ModelProgram create_program(ModelVar* out_var) const;
+    void bind_storage(ModelVar* var, u32 rows, u32 cols);
+    void fuse_ops();
+    void assign_storage();
+    void plan_buffers(const std::vector<ModelVar*>& order);
+    void plan_backprop();
+    bool is_bf16_buffer(u32 id) const;
+    u64 stored_bytes(u32 id) const;
+    bool is_activation_buffer(u32 id) const;
+    u64 pack_activations(std::vector<u32>& ids, std::vector<u32>& slot_of, std::vector<u64>& slot_bytes) const;
+    void layout_activations();
+    void match_static_forward();
+    void run_forward();
+    // Refreshes part of every bf16 weight copy: the slice [part, part + 1) of
+    // num_parts equal slices. The static model is left alone.
+    void sync_weight_copies(u32 part, u32 num_parts);
+
+    void ensure_workers(u32 num_threads);
+    template <typename Source>
+    void predict_impl(const Source& images, u32* out_labels, f32* out_probs, u32 num_threads);
+    template <typename Source>
+    void predict_range(const Source& images, u32 first, u32 count, u32* out_labels, f32* out_probs);
+    f32 compute_shard(const Matrix& images, const Matrix& labels, const SparseMatrix* sparse_images,
+        const std::function<void(u32)>& step_done);
+    f32 compute_batch(const struct LoadedBatch& batch, const std::function<void(u32)>& step_done);
+    // Intentionally racy: the workers read and update the shared parameter
+    // slab without synchronization, see ModelTrainingDesc::hogwild
+    void hogwild_epoch(const struct ModelTrainingDesc& desc, std::vector<std::unique_ptr<class BatchLoader>>& loaders,
+        std::vector<std::unique_ptr<class Optimizer>>& optimizers);
+
+    bool huge_pages;
+    Arena param_arena;
+    Arena grad_arena;
+    Arena activation_arena;
+    Arena weight_copy_arena;
+
+    // Liveness of each val, grad and aux buffer (var index * 3 + ModelVarBuffer)
+    // over the compiled timeline: forward order, then cost_prog.grad_steps
+    struct BufferLife {
+        u32 first = UINT32_MAX;
+        u32 last = 0;
+        // Steps in between where the value is dead, for a recomputed value:
+        // from its last forward use to its recompute
+        u32 gap_first = UINT32_MAX;
+        u32 gap_last = 0;
+        bool pinned = false;
+        // Buffers this one may overwrite in place, at its first step
+        std::vector<u32> in_place_of;
+    };
+    ModelCompileDesc compile_desc;
+    bool compiled = false;
+    std::vector<BufferLife> buffer_lives;
+    // cost_prog, then the vars only forward_prog needs
+    std::vector<ModelVar*> compiled_order;
+    u64 unshared_bytes = 0;
+
+    // Shared with the replicas, which read the same parameters
+    std::shared_ptr<class StaticModel> static_forward;
+    bool static_forward_shared = false;
+
+    // Parameters of a loaded checkpoint live in its mapping, not in param_arena
+    std::shared_ptr<class MappedFile> param_file;
+    bool param_file_writable = false;
+    f32* file_params = nullptr;
+    u64 file_param_count = 0;
+
+    // Data-parallel execution state: one graph replica per thread
+    std::unique_ptr<ThreadPool> pool;
+    std::vector<std::unique_ptr<ModelContext>> replicas;
+
+    // CSR copy of the input predict() builds, see ModelCompileDesc::sparse_input
+    SparseMatrix input_csr;
+    // Only quantized products read the input, as x: predict() hands them the
+    // rows of a u8 Dataset instead of gathering the batch, and builds no CSR
+    bool quantized_input = false;
+
+    class Profiler* profiler = nullptr;
+    u32 profile_track = 0;
 };
\ No newline at end of file
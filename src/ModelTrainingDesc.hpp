@@ -1,11 +1,49 @@
-#include "Matrix.hpp"
+#include "Dataset.hpp"
+#include "Optimizer.hpp"
+// Images are (samples x features). Labels are (samples x 1) class indices for
+// softmax_cross_entropy models, or (samples x classes) one-hot rows.
 struct ModelTrainingDesc {
-    Matrix* train_images = nullptr;
-    Matrix* train_labels = nullptr;
-    Matrix* test_images = nullptr;
-    Matrix* test_labels = nullptr;
+    const Dataset* train_images = nullptr;
+    const Dataset* train_labels = nullptr;
+    const Dataset* test_images = nullptr;
+    const Dataset* test_labels = nullptr;
 
     u32 epochs = 10;
     u32 batch_size = 50;
     f32 learning_rate = 0.01f;
+    // Its state starts from zero on every train() call
+    OptimizerDesc optimizer;
+
+    // Each minibatch is split across this many threads, each running its own
+    // replica of the graph; gradients are tree-reduced in a fixed order, so
+    // results are deterministic for a given thread count
+    u32 num_threads = 1;
+
+    // Hogwild: instead, each of the num_threads threads trains on its own
+    // slice of train_images, batch_size samples at a time with an optimizer
+    // of its own, and writes its updates straight into the shared parameters
+    // with no locking or reduction. Updates that collide may be lost, and
+    // results are not repeatable. These are plain, deliberately unsynchronized
+    // f32 accesses (C++14 has no atomic_ref), so ThreadSanitizer runs use
+    // tests/tsan.supp. Ignored with a ring.
+    bool hogwild = false;
+
+    // Background threads shuffling and gathering upcoming batches, and
+    // BatchLoaderDesc::shuffle_block (0 = a full shuffle every epoch)
+    u32 loader_threads = 1;
+    u32 shuffle_block = 0;
+
+    // Distributed data parallelism: with a connected ring, each of its
+    // world_size processes trains on its own equal shard of train_images,
+    // batch_size samples per process per step. Parameters start from rank
+    // 0's, and every step sums the gradients over all processes, so they
+    // stay identical everywhere. Gradients go out in buckets of at least
+    // bucket_bytes as backprop finishes them, overlapping the rest of the
+    // backward pass (with num_threads > 1, in one piece afterwards). Only
+    // rank 0 tests.
+    class RingAllReduce* ring = nullptr;
+    u32 bucket_bytes = 1 << 10;
+
+    // Progress and per-epoch test results are printed to stdout
+    bool verbose = true;
 };
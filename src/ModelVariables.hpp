@@ -12,6 +12,10 @@ enum ModelVarFlags : u32 {
     MV_FLAG_OUTPUT = (1 << 3),
     MV_FLAG_DESIRED_OUTPUT = (1 << 4),
     MV_FLAG_COST = (1 << 5),
+    // With ModelCompileDesc::recompute, the value is kept from the forward
+    // pass for backprop and ends a recomputed segment. The var is not fused
+    // away.
+    MV_FLAG_CHECKPOINT = (1 << 6),
 };
 
 enum class ModelVarOp : u32 {
@@ -27,32 +31,123 @@ enum class ModelVarOp : u32 {
     Sub,
     Matmul,
     CrossEntropy,
+    SoftmaxCrossEntropy,
+
+    // Produced by the fusion pass in compile(); inputs are W, x, bias[, residual]
+    FusedStart,
+    LinearBias,         // W x + bias
+    LinearBiasRelu,     // relu(W x + bias)
+    LinearBiasReluAdd,  // residual + relu(W x + bias)
 };
-constexpr u32 MODEL_VAR_MAX_INPUTS = 2;
+constexpr u32 MODEL_VAR_MAX_INPUTS = 4;
 
 inline u32 mv_num_inputs(ModelVarOp op) {
     if (op < ModelVarOp::UnaryStart) return 0;
     if (op < ModelVarOp::BinaryStart) return 1;
-    return 2;
+    if (op < ModelVarOp::FusedStart) return 2;
+    return op == ModelVarOp::LinearBiasReluAdd ? 4 : 3;
+}
+
+// Ops that keep a second (val-shaped) result for their backward pass
+inline bool mv_has_aux(ModelVarOp op) {
+    return op == ModelVarOp::LinearBiasReluAdd;
 }
 
+inline const char* mv_op_name(ModelVarOp op) {
+    switch (op) {
+    case ModelVarOp::Create: return "Create";
+    case ModelVarOp::Relu: return "Relu";
+    case ModelVarOp::Softmax: return "Softmax";
+    case ModelVarOp::Add: return "Add";
+    case ModelVarOp::Sub: return "Sub";
+    case ModelVarOp::Matmul: return "Matmul";
+    case ModelVarOp::CrossEntropy: return "CrossEntropy";
+    case ModelVarOp::SoftmaxCrossEntropy: return "SoftmaxCrossEntropy";
+    case ModelVarOp::LinearBias: return "LinearBias";
+    case ModelVarOp::LinearBiasRelu: return "LinearBiasRelu";
+    case ModelVarOp::LinearBiasReluAdd: return "LinearBiasReluAdd";
+    default: return "Null";
+    }
+}
+
+enum class ModelVarBuffer : u32 {
+    Val = 0,
+    Grad,
+    Aux,
+    Count,
+};
+
+// Element type a var's val and aux are stored in, see ModelCompileDesc::bf16_storage
+enum class ModelVarStorage : u32 {
+    F32 = 0,
+    BF16,
+};
+
 struct ModelVar;
+struct ByteRows;
+struct QuantizedLinear;
+struct SparseMatrix;
 
 struct ModelVar {
     u32 index = 0;
     u32 flags = 0;
 
-    std::unique_ptr<Matrix> val;
-    std::unique_ptr<Matrix> grad;
+    // Views into the owning ModelContext's arenas; grad is only bound when
+    // MV_FLAG_REQUIRES_GRAD is set, aux only for ops with mv_has_aux
+    Matrix val;
+    Matrix grad;
+    Matrix aux;
+
+    // With BF16 storage an activation lives in val_bf16 (and aux_bf16), and
+    // val/aux only carry its shape. A parameter keeps its f32 master in val
+    // and val_bf16 is the copy the forward and backward passes read.
+    ModelVarStorage storage = ModelVarStorage::F32;
+    MatrixBF16 val_bf16;
+    MatrixBF16 aux_bf16;
 
     ModelVarOp op = ModelVarOp::Null;
-    ModelVar* inputs[MODEL_VAR_MAX_INPUTS] = { nullptr, nullptr };
+    ModelVar* inputs[MODEL_VAR_MAX_INPUTS] = {};
+
+    // Set on Matmul/LinearBias* vars of a quantized InferenceModel: the
+    // product then runs on int8 weights instead of inputs[0]
+    std::shared_ptr<const QuantizedLinear> quant;
+
+    // Set on the input var while a CSR copy of val is at hand (see
+    // ModelCompileDesc::sparse_input); products reading it as x skip its zeros
+    const SparseMatrix* sparse = nullptr;
+
+    // Set on the input var while predict() leaves a u8 batch in its dataset
+    // rows; only quantized products read the input then, and val is unfilled
+    const ByteRows* byte_rows = nullptr;
+
+    Matrix& buffer(ModelVarBuffer which) {
+        switch (which) {
+        case ModelVarBuffer::Grad: return grad;
+        case ModelVarBuffer::Aux: return aux;
+        default: return val;
+        }
+    }
 };
 
 
 
+enum class ModelStepKind : u32 {
+    SeedGrad,   // grad = 1 on the cost
+    ClearGrad,  // grad = 0, right before the first accumulation into it
+    Backward,   // accumulates var's gradient into its inputs' gradients
+    Recompute,  // computes var's value again, see ModelCompileDesc::recompute
+};
+
+struct ModelStep {
+    ModelStepKind kind;
+    ModelVar* var;
+};
+
 struct ModelProgram {
+    // Forward order: every var comes after its inputs
     std::vector<ModelVar*> vars;
+    // Backprop schedule, only built for the cost program
+    std::vector<ModelStep> grad_steps;
 
     u32 size() const { return static_cast<u32>(vars.size()); }
 };
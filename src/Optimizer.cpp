@@ -0,0 +1,283 @@
+#include <cmath>
+
+#include "Cpu.hpp"
+#include "Arena.hpp"
+#include "Optimizer.hpp"
+
+#if MNIST_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    // Per-step constants, folded so the loops only do the update itself:
+    //   SGD       p = decay * p + alpha * g
+    //   Momentum  g' = scale * g + l2 * p;  v = mu * v + g'
+    //             p = p - lr * (k_v * v + k_g * g')   (k_v = 1, k_g = 0 unless Nesterov)
+    //   Adam      g' = scale * g + l2 * p;  m = b1 * m + (1 - b1) * g';  v = b2 * v + (1 - b2) * g'^2
+    //             p = decay * p - step * m / (sqrt(v * c2) + eps)
+    struct SgdArgs {
+        f32 alpha, decay;
+    };
+    struct MomentumArgs {
+        f32 scale, l2, mu, lr, k_v, k_g;
+    };
+    struct AdamArgs {
+        f32 scale, l2, b1, b2, step, c2, eps, decay;
+    };
+
+    // Each SIMD kernel returns how many leading elements it updated; the
+    // scalar loop does the rest
+    void sgd_scalar(f32* p, const f32* g, u64 i, u64 n, const SgdArgs& a) {
+        for (; i < n; i++) p[i] = a.decay * p[i] + a.alpha * g[i];
+    }
+
+    void momentum_scalar(f32* p, const f32* g, f32* v, u64 i, u64 n, const MomentumArgs& a) {
+        for (; i < n; i++) {
+            f32 grad = a.scale * g[i] + a.l2 * p[i];
+            f32 vel = a.mu * v[i] + grad;
+            v[i] = vel;
+            p[i] -= a.lr * (a.k_v * vel + a.k_g * grad);
+        }
+    }
+
+    void adam_scalar(f32* p, const f32* g, f32* m, f32* v, u64 i, u64 n, const AdamArgs& a) {
+        for (; i < n; i++) {
+            f32 grad = a.scale * g[i] + a.l2 * p[i];
+            f32 mi = a.b1 * m[i] + (1.0f - a.b1) * grad;
+            f32 vi = a.b2 * v[i] + (1.0f - a.b2) * grad * grad;
+            m[i] = mi;
+            v[i] = vi;
+            p[i] = a.decay * p[i] - a.step * mi / (std::sqrt(vi * a.c2) + a.eps);
+        }
+    }
+
+#if MNIST_X86_SIMD
+
+    MNIST_TARGET("avx512f")
+    u64 sgd_avx512(f32* p, const f32* g, u64 n, const SgdArgs& a) {
+        const __m512 alpha = _mm512_set1_ps(a.alpha);
+        const __m512 decay = _mm512_set1_ps(a.decay);
+        u64 i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m512 pv = _mm512_mul_ps(decay, _mm512_loadu_ps(p + i));
+            _mm512_storeu_ps(p + i, _mm512_fmadd_ps(alpha, _mm512_loadu_ps(g + i), pv));
+        }
+        return i;
+    }
+
+    MNIST_TARGET("avx512f")
+    u64 momentum_avx512(f32* p, const f32* g, f32* v, u64 n, const MomentumArgs& a) {
+        const __m512 scale = _mm512_set1_ps(a.scale);
+        const __m512 l2 = _mm512_set1_ps(a.l2);
+        const __m512 mu = _mm512_set1_ps(a.mu);
+        const __m512 neg_lr = _mm512_set1_ps(-a.lr);
+        const __m512 k_v = _mm512_set1_ps(a.k_v);
+        const __m512 k_g = _mm512_set1_ps(a.k_g);
+        u64 i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m512 pv = _mm512_loadu_ps(p + i);
+            __m512 grad = _mm512_fmadd_ps(scale, _mm512_loadu_ps(g + i), _mm512_mul_ps(l2, pv));
+            __m512 vel = _mm512_fmadd_ps(mu, _mm512_loadu_ps(v + i), grad);
+            _mm512_storeu_ps(v + i, vel);
+            __m512 d = _mm512_fmadd_ps(k_v, vel, _mm512_mul_ps(k_g, grad));
+            _mm512_storeu_ps(p + i, _mm512_fmadd_ps(neg_lr, d, pv));
+        }
+        return i;
+    }
+
+    MNIST_TARGET("avx512f")
+    u64 adam_avx512(f32* p, const f32* g, f32* m, f32* v, u64 n, const AdamArgs& a) {
+        const __m512 scale = _mm512_set1_ps(a.scale);
+        const __m512 l2 = _mm512_set1_ps(a.l2);
+        const __m512 b1 = _mm512_set1_ps(a.b1);
+        const __m512 b2 = _mm512_set1_ps(a.b2);
+        const __m512 one_b1 = _mm512_set1_ps(1.0f - a.b1);
+        const __m512 one_b2 = _mm512_set1_ps(1.0f - a.b2);
+        const __m512 step = _mm512_set1_ps(a.step);
+        const __m512 c2 = _mm512_set1_ps(a.c2);
+        const __m512 eps = _mm512_set1_ps(a.eps);
+        const __m512 decay = _mm512_set1_ps(a.decay);
+        u64 i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m512 pv = _mm512_loadu_ps(p + i);
+            __m512 grad = _mm512_fmadd_ps(scale, _mm512_loadu_ps(g + i), _mm512_mul_ps(l2, pv));
+            __m512 mi = _mm512_fmadd_ps(b1, _mm512_loadu_ps(m + i), _mm512_mul_ps(one_b1, grad));
+            __m512 vi = _mm512_fmadd_ps(b2, _mm512_loadu_ps(v + i), _mm512_mul_ps(one_b2, _mm512_mul_ps(grad, grad)));
+            _mm512_storeu_ps(m + i, mi);
+            _mm512_storeu_ps(v + i, vi);
+            __m512 denom = _mm512_add_ps(_mm512_sqrt_ps(_mm512_mul_ps(vi, c2)), eps);
+            __m512 update = _mm512_div_ps(_mm512_mul_ps(step, mi), denom);
+            _mm512_storeu_ps(p + i, _mm512_fmsub_ps(decay, pv, update));
+        }
+        return i;
+    }
+
+    MNIST_TARGET("avx2,fma")
+    u64 sgd_avx2(f32* p, const f32* g, u64 n, const SgdArgs& a) {
+        const __m256 alpha = _mm256_set1_ps(a.alpha);
+        const __m256 decay = _mm256_set1_ps(a.decay);
+        u64 i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256 pv = _mm256_mul_ps(decay, _mm256_loadu_ps(p + i));
+            _mm256_storeu_ps(p + i, _mm256_fmadd_ps(alpha, _mm256_loadu_ps(g + i), pv));
+        }
+        return i;
+    }
+
+    MNIST_TARGET("avx2,fma")
+    u64 momentum_avx2(f32* p, const f32* g, f32* v, u64 n, const MomentumArgs& a) {
+        const __m256 scale = _mm256_set1_ps(a.scale);
+        const __m256 l2 = _mm256_set1_ps(a.l2);
+        const __m256 mu = _mm256_set1_ps(a.mu);
+        const __m256 neg_lr = _mm256_set1_ps(-a.lr);
+        const __m256 k_v = _mm256_set1_ps(a.k_v);
+        const __m256 k_g = _mm256_set1_ps(a.k_g);
+        u64 i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256 pv = _mm256_loadu_ps(p + i);
+            __m256 grad = _mm256_fmadd_ps(scale, _mm256_loadu_ps(g + i), _mm256_mul_ps(l2, pv));
+            __m256 vel = _mm256_fmadd_ps(mu, _mm256_loadu_ps(v + i), grad);
+            _mm256_storeu_ps(v + i, vel);
+            __m256 d = _mm256_fmadd_ps(k_v, vel, _mm256_mul_ps(k_g, grad));
+            _mm256_storeu_ps(p + i, _mm256_fmadd_ps(neg_lr, d, pv));
+        }
+        return i;
+    }
+
+    MNIST_TARGET("avx2,fma")
+    u64 adam_avx2(f32* p, const f32* g, f32* m, f32* v, u64 n, const AdamArgs& a) {
+        const __m256 scale = _mm256_set1_ps(a.scale);
+        const __m256 l2 = _mm256_set1_ps(a.l2);
+        const __m256 b1 = _mm256_set1_ps(a.b1);
+        const __m256 b2 = _mm256_set1_ps(a.b2);
+        const __m256 one_b1 = _mm256_set1_ps(1.0f - a.b1);
+        const __m256 one_b2 = _mm256_set1_ps(1.0f - a.b2);
+        const __m256 step = _mm256_set1_ps(a.step);
+        const __m256 c2 = _mm256_set1_ps(a.c2);
+        const __m256 eps = _mm256_set1_ps(a.eps);
+        const __m256 decay = _mm256_set1_ps(a.decay);
+        u64 i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256 pv = _mm256_loadu_ps(p + i);
+            __m256 grad = _mm256_fmadd_ps(scale, _mm256_loadu_ps(g + i), _mm256_mul_ps(l2, pv));
+            __m256 mi = _mm256_fmadd_ps(b1, _mm256_loadu_ps(m + i), _mm256_mul_ps(one_b1, grad));
+            __m256 vi = _mm256_fmadd_ps(b2, _mm256_loadu_ps(v + i), _mm256_mul_ps(one_b2, _mm256_mul_ps(grad, grad)));
+            _mm256_storeu_ps(m + i, mi);
+            _mm256_storeu_ps(v + i, vi);
+            __m256 denom = _mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(vi, c2)), eps);
+            __m256 update = _mm256_div_ps(_mm256_mul_ps(step, mi), denom);
+            _mm256_storeu_ps(p + i, _mm256_fmsub_ps(decay, pv, update));
+        }
+        return i;
+    }
+
+#endif
+
+    class SgdOptimizer : public Optimizer {
+    public:
+        explicit SgdOptimizer(const OptimizerDesc& desc) : desc(desc) {}
+
+        u32 num_state_slabs() const override { return 0; }
+
+        void step(Matrix& params, const Matrix& grads, f32 learning_rate, f32 grad_scale) override {
+            SgdArgs a = { -learning_rate * grad_scale, 1.0f - learning_rate * desc.weight_decay };
+            u64 n = params.size();
+            u64 i = 0;
+#if MNIST_X86_SIMD
+            if (Cpu::has_avx512f()) i = sgd_avx512(params.data, grads.data, n, a);
+            else if (Cpu::has_avx2_fma()) i = sgd_avx2(params.data, grads.data, n, a);
+#endif
+            sgd_scalar(params.data, grads.data, i, n, a);
+        }
+
+    private:
+        OptimizerDesc desc;
+    };
+
+    // State slabs (velocity, moments) mirror the parameter slab's layout
+    class StatefulOptimizer : public Optimizer {
+    protected:
+        StatefulOptimizer(const OptimizerDesc& desc, u64 param_count, u32 num_slabs)
+            : desc(desc), state(num_slabs * (param_count * sizeof(f32) + Arena::ALIGNMENT)), num_slabs(num_slabs) {
+            for (u32 s = 0; s < num_slabs; s++) slabs[s] = state.push_f32(param_count);
+        }
+
+    public:
+        u32 num_state_slabs() const override { return num_slabs; }
+
+    protected:
+        OptimizerDesc desc;
+        Arena state;
+        u32 num_slabs;
+        f32* slabs[2] = {};
+    };
+
+    class MomentumOptimizer : public StatefulOptimizer {
+    public:
+        MomentumOptimizer(const OptimizerDesc& desc, u64 param_count)
+            : StatefulOptimizer(desc, param_count, 1) {}
+
+        void step(Matrix& params, const Matrix& grads, f32 learning_rate, f32 grad_scale) override {
+            MomentumArgs a = { grad_scale, desc.weight_decay, desc.momentum, learning_rate,
+                desc.nesterov ? desc.momentum : 1.0f, desc.nesterov ? 1.0f : 0.0f };
+            u64 n = params.size();
+            u64 i = 0;
+#if MNIST_X86_SIMD
+            if (Cpu::has_avx512f()) i = momentum_avx512(params.data, grads.data, slabs[0], n, a);
+            else if (Cpu::has_avx2_fma()) i = momentum_avx2(params.data, grads.data, slabs[0], n, a);
+#endif
+            momentum_scalar(params.data, grads.data, slabs[0], i, n, a);
+        }
+    };
+
+    class AdamOptimizer : public StatefulOptimizer {
+    public:
+        AdamOptimizer(const OptimizerDesc& desc, u64 param_count)
+            : StatefulOptimizer(desc, param_count, 2) {}
+
+        void step(Matrix& params, const Matrix& grads, f32 learning_rate, f32 grad_scale) override {
+            // Bias corrections for the zero-initialized moments
+            t++;
+            double c1 = 1.0 - std::pow(static_cast<double>(desc.beta1), static_cast<double>(t));
+            double c2 = 1.0 - std::pow(static_cast<double>(desc.beta2), static_cast<double>(t));
+
+            bool decoupled = desc.kind == OptimizerKind::AdamW;
+            AdamArgs a = { grad_scale, decoupled ? 0.0f : desc.weight_decay, desc.beta1, desc.beta2,
+                static_cast<f32>(learning_rate / c1), static_cast<f32>(1.0 / c2), desc.epsilon,
+                decoupled ? 1.0f - learning_rate * desc.weight_decay : 1.0f };
+            u64 n = params.size();
+            u64 i = 0;
+#if MNIST_X86_SIMD
+            if (Cpu::has_avx512f()) i = adam_avx512(params.data, grads.data, slabs[0], slabs[1], n, a);
+            else if (Cpu::has_avx2_fma()) i = adam_avx2(params.data, grads.data, slabs[0], slabs[1], n, a);
+#endif
+            adam_scalar(params.data, grads.data, slabs[0], slabs[1], i, n, a);
+        }
+
+    private:
+        u64 t = 0;
+    };
+
+} // namespace
+
+std::unique_ptr<Optimizer> Optimizer::create(const OptimizerDesc& desc, u64 param_count) {
+    switch (desc.kind) {
+    case OptimizerKind::Momentum:
+        return std::unique_ptr<Optimizer>(new MomentumOptimizer(desc, param_count));
+    case OptimizerKind::Adam:
+    case OptimizerKind::AdamW:
+        return std::unique_ptr<Optimizer>(new AdamOptimizer(desc, param_count));
+    default:
+        return std::unique_ptr<Optimizer>(new SgdOptimizer(desc));
+    }
+}
+
+const char* Optimizer::kind_name(OptimizerKind kind) {
+    switch (kind) {
+    case OptimizerKind::Momentum: return "momentum";
+    case OptimizerKind::Adam: return "adam";
+    case OptimizerKind::AdamW: return "adamw";
+    default: return "sgd";
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <memory>
+
+#include "Types.hpp"
+#include "Matrix.hpp"
+
+enum class OptimizerKind : u32 {
+    SGD = 0,
+    Momentum,   // heavy ball, or Nesterov with OptimizerDesc::nesterov
+    Adam,
+    AdamW,      // Adam with decoupled weight decay
+};
+
+// The learning rate is given per step (see ModelTrainingDesc); the rest lives here
+struct OptimizerDesc {
+    OptimizerKind kind = OptimizerKind::SGD;
+
+    f32 momentum = 0.9f;
+    bool nesterov = false;
+
+    f32 beta1 = 0.9f;
+    f32 beta2 = 0.999f;
+    f32 epsilon = 1e-8f;
+
+    // AdamW shrinks parameters by learning_rate * weight_decay each step; the
+    // others add weight_decay * param to the gradient (L2 regularization)
+    f32 weight_decay = 0.0f;
+};
+
+// Updates a parameter slab from the gradient slab with the same layout. Each
+// step is one fused pass: gradient, optimizer state and parameter are read
+// once and state and parameter written once, vectorized where the CPU allows.
+// State (velocity, moments) is zero at creation.
+class Optimizer {
+public:
+    static std::unique_ptr<Optimizer> create(const OptimizerDesc& desc, u64 param_count);
+    virtual ~Optimizer() = default;
+
+    // grads are multiplied by grad_scale before use, e.g. 1 / batch size for
+    // gradients summed over a batch
+    virtual void step(Matrix& params, const Matrix& grads, f32 learning_rate, f32 grad_scale) = 0;
+
+    // Parameter-sized slabs of state read and written by every step
+    virtual u32 num_state_slabs() const = 0;
+
+    static const char* kind_name(OptimizerKind kind);
+};
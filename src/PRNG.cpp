@@ -1,19 +1,438 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
+
 #include "PRNG.hpp"
+#include "Cpu.hpp"
+#include "VecMath.hpp"
+
+namespace {
+
+    constexpr u32 LANES = 8;
+    // Values generated per pass of a bulk fill
+    constexpr u32 CHUNK = 1024;
+    constexpr f32 TWO_M24 = 1.0f / 16777216.0f;
+
+    // Cephes sinf/cosf minimax coefficients on [-pi/4, pi/4]
+    constexpr f32 PI_2 = 1.57079632679f;
+    constexpr f32 SIN_P[3] = { -1.6666654611e-1f, 8.3321608736e-3f, -1.9515295891e-4f };
+    constexpr f32 COS_P[3] = { 4.166664568298827e-2f, -1.388731625493765e-3f, 2.443315711809948e-5f };
+
+    u64 splitmix64(u64& x) {
+        u64 z = (x += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    u64 rotl(u64 x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    // Eight xoshiro256** generators side by side, word w of lane l in s[w][l]
+    struct Lanes {
+        alignas(64) u64 s[4][LANES];
+
+        explicit Lanes(PRNG& seed_from) {
+            for (u32 l = 0; l < LANES; l++) {
+                u64 x = seed_from.next();
+                for (u32 w = 0; w < 4; w++) s[w][l] = splitmix64(x);
+            }
+        }
+    };
+
+    // blocks * LANES outputs, the top 32 bits of each, lane l of block b at
+    // out[b * LANES + l]
+    void lane_bits_scalar(Lanes& lanes, u32* out, u32 blocks) {
+        u64 (&s)[4][LANES] = lanes.s;
+        for (u32 b = 0; b < blocks; b++) {
+            for (u32 l = 0; l < LANES; l++) {
+                u64 result = rotl(s[1][l] * 5, 7) * 9;
+                u64 t = s[1][l] << 17;
+                s[2][l] ^= s[0][l];
+                s[3][l] ^= s[1][l];
+                s[1][l] ^= s[2][l];
+                s[0][l] ^= s[3][l];
+                s[2][l] ^= t;
+                s[3][l] = rotl(s[3][l], 45);
+                out[b * LANES + l] = static_cast<u32>(result >> 32);
+            }
+        }
+    }
+
+    f32 uniform_scalar(u32 bits, f32 lower, f32 range) {
+        return std::fma(static_cast<f32>(bits >> 8) * TWO_M24, range, lower);
+    }
+
+    // l = log(u1), t = u2 in turns: r cos(2 pi t) and r sin(2 pi t), r = sqrt(-2 l)
+    void box_muller_scalar(f32 l, f32 t, f32 mean, f32 stddev, f32& z0, f32& z1) {
+        f32 r = std::sqrt(-2.0f * l);
+        f32 t4 = t * 4.0f;
+        f32 q = std::nearbyint(t4);
+        f32 x = (t4 - q) * PI_2;
+        f32 x2 = x * x;
+
+        f32 p = std::fma(x2, SIN_P[2], SIN_P[1]);
+        p = std::fma(x2, p, SIN_P[0]);
+        f32 sn = std::fma(x * x2, p, x);
+        p = std::fma(x2, COS_P[2], COS_P[1]);
+        p = std::fma(x2, p, COS_P[0]);
+        f32 cs = std::fma(x2 * x2, p, std::fma(-0.5f, x2, 1.0f));
+
+        // Quadrant q: rotate by q quarter turns
+        u32 qi = static_cast<u32>(static_cast<i32>(q)) & 3;
+        f32 c = (qi & 1) ? sn : cs;
+        f32 s = (qi & 1) ? cs : sn;
+        if ((qi + 1) & 2) c = -c;
+        if (qi & 2) s = -s;
+        z0 = std::fma(r * c, stddev, mean);
+        z1 = std::fma(r * s, stddev, mean);
+    }
+
+#if MNIST_X86_SIMD
+
+    MNIST_TARGET("avx512f")
+    void lane_bits_avx512(Lanes& lanes, u32* out, u32 blocks) {
+        __m512i s0 = _mm512_load_si512(lanes.s[0]);
+        __m512i s1 = _mm512_load_si512(lanes.s[1]);
+        __m512i s2 = _mm512_load_si512(lanes.s[2]);
+        __m512i s3 = _mm512_load_si512(lanes.s[3]);
+        for (u32 b = 0; b < blocks; b++) {
+            // x * 5 and x * 9 as shifts and adds
+            __m512i r = _mm512_add_epi64(_mm512_slli_epi64(s1, 2), s1);
+            r = _mm512_rol_epi64(r, 7);
+            r = _mm512_add_epi64(_mm512_slli_epi64(r, 3), r);
+            __m512i t = _mm512_slli_epi64(s1, 17);
+            s2 = _mm512_xor_si512(s2, s0);
+            s3 = _mm512_xor_si512(s3, s1);
+            s1 = _mm512_xor_si512(s1, s2);
+            s0 = _mm512_xor_si512(s0, s3);
+            s2 = _mm512_xor_si512(s2, t);
+            s3 = _mm512_rol_epi64(s3, 45);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + b * LANES),
+                _mm512_cvtepi64_epi32(_mm512_srli_epi64(r, 32)));
+        }
+        _mm512_store_si512(lanes.s[0], s0);
+        _mm512_store_si512(lanes.s[1], s1);
+        _mm512_store_si512(lanes.s[2], s2);
+        _mm512_store_si512(lanes.s[3], s3);
+    }
+
+    MNIST_TARGET("avx2")
+    inline __m256i rotl_avx2(__m256i x, int k) {
+        return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k));
+    }
+
+    // Lanes 0-3 and 4-7 in two registers per word
+    MNIST_TARGET("avx2")
+    void lane_bits_avx2(Lanes& lanes, u32* out, u32 blocks) {
+        __m256i s[4][2];
+        for (u32 w = 0; w < 4; w++) {
+            for (u32 h = 0; h < 2; h++) {
+                s[w][h] = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.s[w] + 4 * h));
+            }
+        }
+        for (u32 b = 0; b < blocks; b++) {
+            __m256i r[2];
+            for (u32 h = 0; h < 2; h++) {
+                __m256i x = _mm256_add_epi64(_mm256_slli_epi64(s[1][h], 2), s[1][h]);
+                x = rotl_avx2(x, 7);
+                r[h] = _mm256_add_epi64(_mm256_slli_epi64(x, 3), x);
+                __m256i t = _mm256_slli_epi64(s[1][h], 17);
+                s[2][h] = _mm256_xor_si256(s[2][h], s[0][h]);
+                s[3][h] = _mm256_xor_si256(s[3][h], s[1][h]);
+                s[1][h] = _mm256_xor_si256(s[1][h], s[2][h]);
+                s[0][h] = _mm256_xor_si256(s[0][h], s[3][h]);
+                s[2][h] = _mm256_xor_si256(s[2][h], t);
+                s[3][h] = rotl_avx2(s[3][h], 45);
+            }
+            // High dwords of lanes 0, 1, 4, 5 | 2, 3, 6, 7, then back in order
+            __m256 hi = _mm256_shuffle_ps(_mm256_castsi256_ps(r[0]), _mm256_castsi256_ps(r[1]),
+                _MM_SHUFFLE(3, 1, 3, 1));
+            __m256i ordered = _mm256_permute4x64_epi64(_mm256_castps_si256(hi), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + b * LANES), ordered);
+        }
+        for (u32 w = 0; w < 4; w++) {
+            for (u32 h = 0; h < 2; h++) {
+                _mm256_store_si256(reinterpret_cast<__m256i*>(lanes.s[w] + 4 * h), s[w][h]);
+            }
+        }
+    }
+
+    MNIST_TARGET("avx512f")
+    void uniform_avx512(const u32* bits, f32* out, u32 n, f32 lower, f32 range) {
+        u32 i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m512i b = _mm512_srli_epi32(_mm512_loadu_si512(bits + i), 8);
+            __m512 u = _mm512_mul_ps(_mm512_cvtepi32_ps(b), _mm512_set1_ps(TWO_M24));
+            _mm512_storeu_ps(out + i, _mm512_fmadd_ps(u, _mm512_set1_ps(range), _mm512_set1_ps(lower)));
+        }
+        for (; i < n; i++) out[i] = uniform_scalar(bits[i], lower, range);
+    }
+
+    MNIST_TARGET("avx2,fma")
+    void uniform_avx2(const u32* bits, f32* out, u32 n, f32 lower, f32 range) {
+        u32 i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i b = _mm256_srli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(bits + i)), 8);
+            __m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(b), _mm256_set1_ps(TWO_M24));
+            _mm256_storeu_ps(out + i, _mm256_fmadd_ps(u, _mm256_set1_ps(range), _mm256_set1_ps(lower)));
+        }
+        for (; i < n; i++) out[i] = uniform_scalar(bits[i], lower, range);
+    }
+
+    MNIST_TARGET("avx512f")
+    void box_muller_avx512(const f32* logs, const f32* turns, f32* z0, f32* z1, u32 n, f32 mean, f32 stddev) {
+        u32 i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m512 r = _mm512_sqrt_ps(_mm512_mul_ps(_mm512_loadu_ps(logs + i), _mm512_set1_ps(-2.0f)));
+            __m512 t4 = _mm512_mul_ps(_mm512_loadu_ps(turns + i), _mm512_set1_ps(4.0f));
+            __m512 q = _mm512_roundscale_ps(t4, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            __m512 x = _mm512_mul_ps(_mm512_sub_ps(t4, q), _mm512_set1_ps(PI_2));
+            __m512 x2 = _mm512_mul_ps(x, x);
+
+            __m512 p = _mm512_fmadd_ps(x2, _mm512_set1_ps(SIN_P[2]), _mm512_set1_ps(SIN_P[1]));
+            p = _mm512_fmadd_ps(x2, p, _mm512_set1_ps(SIN_P[0]));
+            __m512 sn = _mm512_fmadd_ps(_mm512_mul_ps(x, x2), p, x);
+            p = _mm512_fmadd_ps(x2, _mm512_set1_ps(COS_P[2]), _mm512_set1_ps(COS_P[1]));
+            p = _mm512_fmadd_ps(x2, p, _mm512_set1_ps(COS_P[0]));
+            __m512 cs = _mm512_fmadd_ps(_mm512_mul_ps(x2, x2), p,
+                _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), x2, _mm512_set1_ps(1.0f)));
+
+            __m512i qi = _mm512_cvtps_epi32(q);
+            __mmask16 swap = _mm512_test_epi32_mask(qi, _mm512_set1_epi32(1));
+            __m512 c = _mm512_mask_mov_ps(cs, swap, sn);
+            __m512 s = _mm512_mask_mov_ps(sn, swap, cs);
+            __m512i c_sign = _mm512_slli_epi32(_mm512_and_si512(_mm512_add_epi32(qi, _mm512_set1_epi32(1)),
+                _mm512_set1_epi32(2)), 30);
+            __m512i s_sign = _mm512_slli_epi32(_mm512_and_si512(qi, _mm512_set1_epi32(2)), 30);
+            c = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(c), c_sign));
+            s = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(s), s_sign));
+
+            __m512 sd = _mm512_set1_ps(stddev);
+            __m512 mu = _mm512_set1_ps(mean);
+            _mm512_storeu_ps(z0 + i, _mm512_fmadd_ps(_mm512_mul_ps(r, c), sd, mu));
+            _mm512_storeu_ps(z1 + i, _mm512_fmadd_ps(_mm512_mul_ps(r, s), sd, mu));
+        }
+        for (; i < n; i++) box_muller_scalar(logs[i], turns[i], mean, stddev, z0[i], z1[i]);
+    }
+
+    MNIST_TARGET("avx2,fma")
+    void box_muller_avx2(const f32* logs, const f32* turns, f32* z0, f32* z1, u32 n, f32 mean, f32 stddev) {
+        u32 i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256 r = _mm256_sqrt_ps(_mm256_mul_ps(_mm256_loadu_ps(logs + i), _mm256_set1_ps(-2.0f)));
+            __m256 t4 = _mm256_mul_ps(_mm256_loadu_ps(turns + i), _mm256_set1_ps(4.0f));
+            __m256 q = _mm256_round_ps(t4, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            __m256 x = _mm256_mul_ps(_mm256_sub_ps(t4, q), _mm256_set1_ps(PI_2));
+            __m256 x2 = _mm256_mul_ps(x, x);
+
+            __m256 p = _mm256_fmadd_ps(x2, _mm256_set1_ps(SIN_P[2]), _mm256_set1_ps(SIN_P[1]));
+            p = _mm256_fmadd_ps(x2, p, _mm256_set1_ps(SIN_P[0]));
+            __m256 sn = _mm256_fmadd_ps(_mm256_mul_ps(x, x2), p, x);
+            p = _mm256_fmadd_ps(x2, _mm256_set1_ps(COS_P[2]), _mm256_set1_ps(COS_P[1]));
+            p = _mm256_fmadd_ps(x2, p, _mm256_set1_ps(COS_P[0]));
+            __m256 cs = _mm256_fmadd_ps(_mm256_mul_ps(x2, x2), p,
+                _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), x2, _mm256_set1_ps(1.0f)));
+
+            __m256i qi = _mm256_cvtps_epi32(q);
+            __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+                _mm256_and_si256(qi, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+            __m256 c = _mm256_blendv_ps(cs, sn, swap);
+            __m256 s = _mm256_blendv_ps(sn, cs, swap);
+            __m256i c_sign = _mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(qi, _mm256_set1_epi32(1)),
+                _mm256_set1_epi32(2)), 30);
+            __m256i s_sign = _mm256_slli_epi32(_mm256_and_si256(qi, _mm256_set1_epi32(2)), 30);
+            c = _mm256_xor_ps(c, _mm256_castsi256_ps(c_sign));
+            s = _mm256_xor_ps(s, _mm256_castsi256_ps(s_sign));
+
+            __m256 sd = _mm256_set1_ps(stddev);
+            __m256 mu = _mm256_set1_ps(mean);
+            _mm256_storeu_ps(z0 + i, _mm256_fmadd_ps(_mm256_mul_ps(r, c), sd, mu));
+            _mm256_storeu_ps(z1 + i, _mm256_fmadd_ps(_mm256_mul_ps(r, s), sd, mu));
+        }
+        for (; i < n; i++) box_muller_scalar(logs[i], turns[i], mean, stddev, z0[i], z1[i]);
+    }
+
+#endif
 
-// singleton instance
-PRNG& PRNG::instance() {
-    static PRNG prng;
-    return prng;
+    using FillIsa = PRNG::FillIsa;
+
+    FillIsa detect_fill_isa() {
+        if (Cpu::has_avx512f()) return FillIsa::AVX512;
+        if (Cpu::has_avx2_fma()) return FillIsa::AVX2;
+        return FillIsa::Scalar;
+    }
+
+    std::atomic<FillIsa>& active_fill_isa() {
+        static std::atomic<FillIsa> active{ detect_fill_isa() };
+        return active;
+    }
+
+    void lane_bits(FillIsa isa, Lanes& lanes, u32* out, u32 blocks) {
+#if MNIST_X86_SIMD
+        if (isa == FillIsa::AVX512) return lane_bits_avx512(lanes, out, blocks);
+        if (isa == FillIsa::AVX2) return lane_bits_avx2(lanes, out, blocks);
+#endif
+        lane_bits_scalar(lanes, out, blocks);
+    }
+
+    void uniform(FillIsa isa, const u32* bits, f32* out, u32 n, f32 lower, f32 range) {
+#if MNIST_X86_SIMD
+        if (isa == FillIsa::AVX512) return uniform_avx512(bits, out, n, lower, range);
+        if (isa == FillIsa::AVX2) return uniform_avx2(bits, out, n, lower, range);
+#endif
+        for (u32 i = 0; i < n; i++) out[i] = uniform_scalar(bits[i], lower, range);
+    }
+
+    void box_muller(FillIsa isa, const f32* logs, const f32* turns, f32* z0, f32* z1, u32 n,
+        f32 mean, f32 stddev) {
+#if MNIST_X86_SIMD
+        if (isa == FillIsa::AVX512) return box_muller_avx512(logs, turns, z0, z1, n, mean, stddev);
+        if (isa == FillIsa::AVX2) return box_muller_avx2(logs, turns, z0, z1, n, mean, stddev);
+#endif
+        for (u32 i = 0; i < n; i++) box_muller_scalar(logs[i], turns[i], mean, stddev, z0[i], z1[i]);
+    }
+
+    void apply_jump(u64 (&s)[4], const u64 (&poly)[4], PRNG& prng) {
+        u64 acc[4] = {};
+        for (u64 word : poly) {
+            for (int bit = 0; bit < 64; bit++) {
+                if (word & (1ull << bit)) {
+                    for (u32 w = 0; w < 4; w++) acc[w] ^= s[w];
+                }
+                prng.next();
+            }
+        }
+        for (u32 w = 0; w < 4; w++) s[w] = acc[w];
+    }
+
+    std::atomic<u64>& global_seed() {
+        static std::atomic<u64> seed{ (static_cast<u64>(std::random_device{}()) << 32) | std::random_device{}() };
+        return seed;
+    }
+
+    std::atomic<u32> seed_generation{ 0 };
+    std::atomic<u32> num_threads_seen{ 0 };
+
+    struct ThreadGenerator {
+        PRNG prng;
+        u32 ordinal = ~0u;
+        u32 generation = ~0u;
+    };
+
+} // namespace
+
+PRNG::PRNG(u64 seed) {
+    for (u64& word : s) word = splitmix64(seed);
+}
+
+u64 PRNG::next() {
+    u64 result = rotl(s[1] * 5, 7) * 9;
+    u64 t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+// Lemire's multiply-shift: the rare draws that would favour some values are
+// rejected
+u32 PRNG::below(u32 n) {
+    u64 m = static_cast<u64>(rand()) * n;
+    u32 low = static_cast<u32>(m);
+    if (low < n) {
+        u32 threshold = (0u - n) % n;
+        while (low < threshold) {
+            m = static_cast<u64>(rand()) * n;
+            low = static_cast<u32>(m);
+        }
+    }
+    return static_cast<u32>(m >> 32);
+}
+
+void PRNG::jump(u64 times) {
+    static const u64 JUMP[4] = { 0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull,
+        0xa9582618e03fc9aaull, 0x39abdc4529b1661cull };
+    for (u64 i = 0; i < times; i++) apply_jump(s, JUMP, *this);
+}
+
+void PRNG::long_jump() {
+    static const u64 LONG_JUMP[4] = { 0x76e15d3efefdcbbfull, 0xc5004e441c522fb3ull,
+        0x77710069854ee241ull, 0x39109bb02acbe635ull };
+    apply_jump(s, LONG_JUMP, *this);
+}
+
+void PRNG::fill_uniform(f32* out, u64 count, f32 lower, f32 upper) {
+    FillIsa isa = fill_isa();
+    Lanes lanes(*this);
+    alignas(64) u32 bits[CHUNK];
+    for (u64 first = 0; first < count; first += CHUNK) {
+        u32 n = static_cast<u32>(std::min<u64>(CHUNK, count - first));
+        lane_bits(isa, lanes, bits, (n + LANES - 1) / LANES);
+        uniform(isa, bits, out + first, n, lower, upper - lower);
+    }
 }
 
-// constructor
-PRNG::PRNG() : gen_(std::random_device{}()), dist_(0, std::numeric_limits<u32>::max()) {}
+void PRNG::fill_normal(f32* out, u64 count, f32 mean, f32 stddev) {
+    FillIsa isa = fill_isa();
+    Lanes lanes(*this);
+    alignas(64) u32 bits[CHUNK];
+    alignas(64) f32 logs[CHUNK / 2];
+    alignas(64) f32 turns[CHUNK / 2];
+    alignas(64) f32 z0[CHUNK / 2];
+    alignas(64) f32 z1[CHUNK / 2];
+    for (u64 first = 0; first < count; first += CHUNK) {
+        u32 n = static_cast<u32>(std::min<u64>(CHUNK, count - first));
+        u32 pairs = (n + 1) / 2;
+        lane_bits(isa, lanes, bits, (2 * pairs + LANES - 1) / LANES);
+
+        // u1 in (0, 1] so its log is finite, u2 in [0, 1) turns
+        for (u32 i = 0; i < pairs; i++) {
+            logs[i] = static_cast<f32>((bits[i] >> 8) + 1) * TWO_M24;
+            turns[i] = static_cast<f32>(bits[pairs + i] >> 8) * TWO_M24;
+        }
+        VecMath::log(logs, logs, pairs);
+        box_muller(isa, logs, turns, z0, z1, pairs, mean, stddev);
+
+        f32* dst = out + first;
+        for (u32 i = 0; i < n / 2; i++) {
+            dst[2 * i] = z0[i];
+            dst[2 * i + 1] = z1[i];
+        }
+        if (n & 1) dst[n - 1] = z0[pairs - 1];
+    }
+}
+
+PRNG::FillIsa PRNG::fill_isa() {
+    return active_fill_isa().load(std::memory_order_relaxed);
+}
+
+bool PRNG::set_fill_isa(FillIsa isa) {
+    bool supported = isa == FillIsa::Scalar || (isa == FillIsa::AVX2 && Cpu::has_avx2_fma())
+        || (isa == FillIsa::AVX512 && Cpu::has_avx512f());
+    if (!supported) return false;
+    active_fill_isa().store(isa, std::memory_order_relaxed);
+    return true;
+}
 
-// member functions
-u32 PRNG::rand() {
-    return dist_(gen_);
+PRNG& PRNG::for_thread() {
+    static thread_local ThreadGenerator current;
+    u32 generation = seed_generation.load(std::memory_order_acquire);
+    if (current.generation != generation) {
+        if (current.ordinal == ~0u) current.ordinal = num_threads_seen.fetch_add(1);
+        current.prng = PRNG(global_seed().load(std::memory_order_relaxed));
+        for (u32 i = 0; i < current.ordinal; i++) current.prng.long_jump();
+        current.generation = generation;
+    }
+    return current.prng;
 }
 
-f32 PRNG::randf() {
-    return static_cast<f32>(rand()) / static_cast<f32>(std::numeric_limits<u32>::max());
+void PRNG::set_seed(u64 seed) {
+    global_seed().store(seed, std::memory_order_relaxed);
+    seed_generation.fetch_add(1, std::memory_order_release);
 }
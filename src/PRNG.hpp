@@ -1,18 +1,57 @@
 #pragma once
 #include "Types.hpp"
-#include <random>
 
+// xoshiro256** (Blackman and Vigna): 256 bits of state, period 2^256 - 1,
+// a few shifts, rotates and adds per 64-bit output. A generator is a plain
+// value: the same seed gives the same numbers on every platform, and copies
+// are independent. jump() and long_jump() advance by 2^128 and 2^192 outputs,
+// splitting one seed into streams that never overlap in practice.
 class PRNG {
 public:
-    static PRNG& instance();
-    u32 rand();
-    f32 randf();
+    // The state is expanded from seed with splitmix64, so nearby seeds give
+    // unrelated streams
+    explicit PRNG(u64 seed = 0);
+
+    u64 next();
+    u32 rand() { return static_cast<u32>(next() >> 32); }
+    // Uniform in [0, 1), 24 random bits
+    f32 randf() { return static_cast<f32>(next() >> 40) * (1.0f / 16777216.0f); }
+    // Uniform in [0, n) without modulo bias; n > 0
+    u32 below(u32 n);
+
+    void jump(u64 times = 1);
+    void long_jump();
+
+    // Bulk fills, vectorized where the CPU allows. Eight lanes, seeded from
+    // this generator, each produce every eighth value; every ISA computes the
+    // same lanes with the same roundings, so the output only depends on the
+    // state. Either call advances this generator by eight outputs.
+    void fill_uniform(f32* out, u64 count, f32 lower = 0.0f, f32 upper = 1.0f);
+    // Box-Muller with polynomial sine and cosine; accurate to a few ulp
+    void fill_normal(f32* out, u64 count, f32 mean = 0.0f, f32 stddev = 1.0f);
+
+    // The bulk fills run the widest of these the CPU supports; set_fill_isa
+    // overrides it (e.g. to check they agree) and fails if the CPU lacks the
+    // instructions. Safe to call while other threads fill.
+    enum class FillIsa : u32 {
+        Scalar = 0,
+        AVX2,
+        AVX512,
+    };
+    static FillIsa fill_isa();
+    static bool set_fill_isa(FillIsa isa);
+
+    // The calling thread's generator. Thread k (in order of first use) gets
+    // the global seed's stream long-jumped k times, so threads never share
+    // numbers and need no locking.
+    static PRNG& for_thread();
+    // Reseeds every thread's generator, from its next use on. Until this is
+    // called the global seed comes from std::random_device.
+    static void set_seed(u64 seed);
 
 private:
-    PRNG();
-    std::mt19937 gen_;
-    std::uniform_int_distribution<u32> dist_;
+    u64 s[4];
 };
 
-inline u32 prng_rand() { return PRNG::instance().rand(); }
-inline f32 prng_randf() { return PRNG::instance().randf(); }
\ No newline at end of file
+inline u32 prng_rand() { return PRNG::for_thread().rand(); }
+inline f32 prng_randf() { return PRNG::for_thread().randf(); }
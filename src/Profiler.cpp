@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "Profiler.hpp"
+
+constexpr u32 Profiler::NO_VAR;
+
+namespace {
+
+    constexpr u32 PHASES = static_cast<u32>(ProfilePhase::Count);
+
+    const char* phase_name(ProfilePhase phase) {
+        switch (phase) {
+        case ProfilePhase::Forward: return "forward";
+        case ProfilePhase::Backward: return "backward";
+        case ProfilePhase::Recompute: return "recompute";
+        default: return "other";
+        }
+    }
+
+    void print_row(const char* label, const char* phase, u64 calls, u64 ns, u64 total_ns, u64 flops, u64 bytes) {
+        double seconds = ns * 1e-9;
+        std::printf("  %-34s %-9s %10llu %11.3f %6.1f%% %9.2f %9.2f\n",
+            label, phase, static_cast<unsigned long long>(calls), ns * 1e-6,
+            total_ns ? 100.0 * ns / total_ns : 0.0,
+            seconds > 0.0 ? flops / seconds * 1e-9 : 0.0,
+            seconds > 0.0 ? bytes / seconds * 1e-9 : 0.0);
+    }
+
+    void print_header(const char* title) {
+        std::printf("%s\n  %-34s %-9s %10s %11s %7s %9s %9s\n", title,
+            "", "phase", "calls", "total ms", "time", "GFLOP/s", "GB/s");
+    }
+
+} // namespace
+
+void Profiler::Totals::add(const ProfileEvent& event) {
+    name = event.name;
+    var = event.var;
+    phase = event.phase;
+    rows = event.rows;
+    calls++;
+    ns += event.duration_ns;
+    flops += event.flops;
+    bytes += event.bytes;
+}
+
+Profiler::Profiler(u64 max_trace_events)
+    : max_trace_events(max_trace_events), epoch_ns(now_ns()) {
+    ensure_tracks(1);
+}
+
+u64 Profiler::now_ns() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+}
+
+void Profiler::ensure_tracks(u32 count) {
+    if (tracks.size() < count) tracks.resize(count);
+}
+
+void Profiler::record(u32 track_index, const ProfileEvent& event) {
+    Track& track = tracks[track_index];
+
+    if (event.var != NO_VAR) {
+        u64 slot = static_cast<u64>(event.var) * PHASES + static_cast<u32>(event.phase);
+        if (slot >= track.var_totals.size()) track.var_totals.resize(slot + 1);
+        track.var_totals[slot].add(event);
+    } else {
+        auto it = std::find_if(track.other_totals.begin(), track.other_totals.end(), [&](const Totals& t) {
+            return t.phase == event.phase && std::strcmp(t.name, event.name) == 0;
+        });
+        if (it == track.other_totals.end()) {
+            track.other_totals.emplace_back();
+            it = track.other_totals.end() - 1;
+        }
+        it->add(event);
+    }
+
+    if (track.events.size() < max_trace_events) track.events.push_back(event);
+    else track.dropped_events++;
+}
+
+void Profiler::reset() {
+    for (Track& track : tracks) track = Track();
+    epoch_ns = now_ns();
+}
+
+std::vector<Profiler::Totals> Profiler::merged_totals() const {
+    // Replicas have the same vars, so per-var totals merge by slot
+    std::vector<Totals> merged;
+    std::vector<Totals> others;
+    for (const Track& track : tracks) {
+        if (merged.size() < track.var_totals.size()) merged.resize(track.var_totals.size());
+        for (size_t i = 0; i < track.var_totals.size(); i++) {
+            const Totals& t = track.var_totals[i];
+            if (t.calls == 0) continue;
+            Totals& m = merged[i];
+            u64 calls = m.calls;
+            m = Totals{ t.name, t.var, t.phase, t.rows,
+                calls + t.calls, m.ns + t.ns, m.flops + t.flops, m.bytes + t.bytes };
+        }
+        for (const Totals& t : track.other_totals) {
+            auto it = std::find_if(others.begin(), others.end(), [&](const Totals& o) {
+                return o.phase == t.phase && std::strcmp(o.name, t.name) == 0;
+            });
+            if (it == others.end()) {
+                others.push_back(t);
+            } else {
+                it->calls += t.calls;
+                it->ns += t.ns;
+                it->flops += t.flops;
+                it->bytes += t.bytes;
+            }
+        }
+    }
+
+    merged.erase(std::remove_if(merged.begin(), merged.end(), [](const Totals& t) { return t.calls == 0; }),
+        merged.end());
+    merged.insert(merged.end(), others.begin(), others.end());
+    return merged;
+}
+
+void Profiler::print_summary() const {
+    std::vector<Totals> totals = merged_totals();
+    auto by_time = [](const Totals& a, const Totals& b) { return a.ns > b.ns; };
+
+    u64 total_ns = 0;
+    for (const Totals& t : totals) total_ns += t.ns;
+
+    // Per op kind: vars with the same op and phase summed
+    std::vector<Totals> ops;
+    for (const Totals& t : totals) {
+        auto it = std::find_if(ops.begin(), ops.end(), [&](const Totals& o) {
+            return o.phase == t.phase && std::strcmp(o.name, t.name) == 0;
+        });
+        if (it == ops.end()) {
+            ops.push_back(t);
+        } else {
+            it->calls += t.calls;
+            it->ns += t.ns;
+            it->flops += t.flops;
+            it->bytes += t.bytes;
+        }
+    }
+    std::sort(ops.begin(), ops.end(), by_time);
+
+    print_header("Profile by op");
+    for (const Totals& t : ops) {
+        print_row(t.name, phase_name(t.phase), t.calls, t.ns, total_ns, t.flops, t.bytes);
+    }
+
+    std::sort(totals.begin(), totals.end(), by_time);
+    // Columns follow the batch size, so only rows identify a var's shape
+    print_header("Profile by var");
+    for (const Totals& t : totals) {
+        char label[64];
+        if (t.var == NO_VAR) {
+            std::snprintf(label, sizeof(label), "%s", t.name);
+        } else {
+            std::snprintf(label, sizeof(label), "#%u %s, %u rows", t.var, t.name, t.rows);
+        }
+        print_row(label, phase_name(t.phase), t.calls, t.ns, total_ns, t.flops, t.bytes);
+    }
+
+    u64 dropped = 0;
+    for (const Track& track : tracks) dropped += track.dropped_events;
+    std::printf("Total %.3f ms over %u track(s)", total_ns * 1e-6, num_tracks());
+    if (dropped > 0) {
+        std::printf(", %llu events past the trace limit", static_cast<unsigned long long>(dropped));
+    }
+    std::printf("\n");
+}
+
+bool Profiler::write_trace(const char* path) const {
+    std::FILE* file = std::fopen(path, "w");
+    if (file == nullptr) {
+        std::fprintf(stderr, "Failed to create file: %s\n", path);
+        return false;
+    }
+
+    // Complete ("X") events, timestamps in microseconds
+    std::fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    bool first = true;
+    for (u32 t = 0; t < num_tracks(); t++) {
+        std::fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %u, "
+            "\"args\": {\"name\": \"track %u\"}}", first ? "" : ",\n", t, t);
+        first = false;
+
+        for (const ProfileEvent& e : tracks[t].events) {
+            std::fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, "
+                "\"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+                e.name, phase_name(e.phase), t,
+                (e.start_ns - epoch_ns) * 1e-3, e.duration_ns * 1e-3);
+            if (e.var != NO_VAR) {
+                std::fprintf(file, "\"var\": %u, \"rows\": %u, \"cols\": %u, ", e.var, e.rows, e.cols);
+            }
+            std::fprintf(file, "\"flops\": %llu, \"bytes\": %llu}}",
+                static_cast<unsigned long long>(e.flops), static_cast<unsigned long long>(e.bytes));
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+
+    bool ok = std::ferror(file) == 0;
+    ok = (std::fclose(file) == 0) && ok;
+    return ok;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "Types.hpp"
+
+enum class ProfilePhase : u32 {
+    Forward = 0,
+    Backward,
+    Recompute,  // forward ops run again during backprop, see ModelCompileDesc::recompute
+    Other,      // batch gathers, gradient reduction, parameter updates
+    Count,
+};
+
+// One timed piece of work. name must outlive the profiler (op names and
+// string literals); var is the ModelVar index, or Profiler::NO_VAR.
+struct ProfileEvent {
+    const char* name;
+    u32 var;
+    ProfilePhase phase;
+    u32 rows;
+    u32 cols;
+    u64 start_ns;
+    u64 duration_ns;
+    u64 flops;
+    u64 bytes;
+};
+
+// Opt-in per-op timings for ModelContext passes, see
+// ModelContext::set_profiler. Every thread records into its own track, so
+// recording takes no locks. Totals per (var, phase) are kept for the whole
+// run; individual events, for the trace file, only for the first
+// max_trace_events of each track.
+class Profiler {
+public:
+    static constexpr u32 NO_VAR = 0xFFFFFFFFu;
+
+    explicit Profiler(u64 max_trace_events = 1u << 20);
+
+    static u64 now_ns();
+
+    // Tracks [0, count) exist afterwards. Not thread-safe: create every track
+    // before threads record into them.
+    void ensure_tracks(u32 count);
+    u32 num_tracks() const { return static_cast<u32>(tracks.size()); }
+
+    void record(u32 track, const ProfileEvent& event);
+    void reset();
+
+    // Table of time, calls, GFLOP/s and GB/s per op kind and per var, printed
+    // to stdout. Times are summed over tracks, i.e. CPU time, not wall time.
+    void print_summary() const;
+
+    // Chrome trace event format, loadable in chrome://tracing or Perfetto;
+    // one thread row per track
+    bool write_trace(const char* path) const;
+
+private:
+    struct Totals {
+        const char* name = nullptr;
+        u32 var = NO_VAR;
+        ProfilePhase phase = ProfilePhase::Other;
+        u32 rows = 0;
+        u64 calls = 0;
+        u64 ns = 0;
+        u64 flops = 0;
+        u64 bytes = 0;
+
+        void add(const ProfileEvent& event);
+    };
+
+    struct Track {
+        // Indexed by var * PHASES + phase
+        std::vector<Totals> var_totals;
+        // NO_VAR events, by name
+        std::vector<Totals> other_totals;
+        std::vector<ProfileEvent> events;
+        u64 dropped_events = 0;
+    };
+
+    std::vector<Totals> merged_totals() const;
+
+    u64 max_trace_events;
+    u64 epoch_ns;
+    std::vector<Track> tracks;
+};
@@ -0,0 +1,518 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Cpu.hpp"
+#include "QuantizedLinear.hpp"
+
+#if MNIST_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace Quant {
+
+namespace {
+
+    // x is quantized into [k / 4][padded batch][4] bytes: each 32-bit lane
+    // holds 4 consecutive k of one sample, which is what vpdpbusd (and
+    // maddubs + madd) reduce in one step. Weights are rows of padded_cols
+    // bytes, so a 32-bit broadcast of w[r][4q..4q+3] pairs with every lane.
+    // A kernel computes the i32 dots of ROWS weight rows x SAMPLES samples
+    // into tile[row * SAMPLES + sample].
+    using BlockFn = void (*)(const u8* x, u64 x_stride, u32 quads, const i8* w, u64 w_stride, i32* tile);
+
+    // Quantizes rows [4 * quad, 4 * quad + 4) of x (k x batch) into the
+    // packed layout, for samples [0, batch_end); the caller handles the rest
+    struct PackArgs {
+        const f32* x;
+        u32 batch;
+        f32 inv_scale;
+        f32 offset;
+        // activation_max + 0.5
+        f32 limit;
+        u8* xq;
+        u64 x_stride;
+    };
+    using PackFn = u32 (*)(const PackArgs& args, u32 quad);
+
+    // Quantizes the whole quads [0, quads) of rows into the packed layout,
+    // for samples [0, return value); the caller handles the rest. args.x is
+    // unused.
+    using PackRowsFn = u32 (*)(const ByteRows& rows, const PackArgs& args, u32 quads);
+
+    u8 quantize_one(f32 v, const PackArgs& args) {
+        // Clamped before the conversion, so truncating rounds to nearest
+        return static_cast<u8>(std::min(args.limit, std::max(0.0f, v * args.inv_scale + args.offset)));
+    }
+
+    u32 pack_scalar(const PackArgs&, u32) {
+        return 0;
+    }
+
+    u32 pack_rows_scalar(const ByteRows&, const PackArgs&, u32) {
+        return 0;
+    }
+
+    // What every stored byte quantizes to: its value as the gather computes
+    // it, then quantized as the SIMD packers do (fused multiply-add)
+    void quantize_table(const ByteRows& rows, const PackArgs& args, u8* table) {
+        for (u32 p = 0; p < 256; p++) {
+            f32 v = static_cast<f32>(p) * rows.scale + rows.offset;
+            table[p] = static_cast<u8>(std::min(args.limit, std::max(0.0f, std::fma(v, args.inv_scale, args.offset))));
+        }
+    }
+
+    i32 load_quad(const i8* w) {
+        i32 v;
+        std::memcpy(&v, w, sizeof(v));
+        return v;
+    }
+
+    void block_scalar_4x4(const u8* x, u64 x_stride, u32 quads, const i8* w, u64 w_stride, i32* tile) {
+        i32 acc[4][4] = {};
+        for (u32 q = 0; q < quads; q++) {
+            const u8* xs = x + q * x_stride;
+            for (u32 r = 0; r < 4; r++) {
+                const i8* wr = w + r * w_stride + q * 4;
+                for (u32 s = 0; s < 4; s++) {
+                    for (u32 j = 0; j < 4; j++) {
+                        acc[r][s] += static_cast<i32>(xs[s * 4 + j]) * wr[j];
+                    }
+                }
+            }
+        }
+        for (u32 r = 0; r < 4; r++) {
+            for (u32 s = 0; s < 4; s++) tile[r * 4 + s] = acc[r][s];
+        }
+    }
+
+#if MNIST_X86_SIMD
+
+    // maddubs multiplies u8 by s8 and adds adjacent pairs into s16, which
+    // cannot saturate for u7 inputs; madd with ones finishes the quad in s32
+    MNIST_TARGET("avx2")
+    void block_avx2_8x8(const u8* x, u64 x_stride, u32 quads, const i8* w, u64 w_stride, i32* tile) {
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i acc[8];
+        for (u32 r = 0; r < 8; r++) acc[r] = _mm256_setzero_si256();
+
+        for (u32 q = 0; q < quads; q++) {
+            __m256i xv = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + q * x_stride));
+#pragma GCC unroll 8
+            for (u32 r = 0; r < 8; r++) {
+                __m256i wv = _mm256_set1_epi32(load_quad(w + r * w_stride + q * 4));
+                acc[r] = _mm256_add_epi32(acc[r], _mm256_madd_epi16(_mm256_maddubs_epi16(xv, wv), ones));
+            }
+        }
+        for (u32 r = 0; r < 8; r++) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(tile + r * 8), acc[r]);
+        }
+    }
+
+    MNIST_TARGET("avx2,fma")
+    u32 pack_avx2(const PackArgs& args, u32 quad) {
+        const f32* rows = args.x + static_cast<u64>(quad) * 4 * args.batch;
+        u8* dst = args.xq + quad * args.x_stride;
+        __m256 scale = _mm256_set1_ps(args.inv_scale);
+        __m256 offset = _mm256_set1_ps(args.offset);
+        __m256 limit = _mm256_set1_ps(args.limit);
+        __m256 zero = _mm256_setzero_ps();
+
+        u32 b = 0;
+        for (; b + 8 <= args.batch; b += 8) {
+            __m256i word = _mm256_setzero_si256();
+            for (u32 j = 0; j < 4; j++) {
+                __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(rows + j * args.batch + b), scale, offset);
+                v = _mm256_min_ps(limit, _mm256_max_ps(zero, v));
+                word = _mm256_or_si256(word, _mm256_slli_epi32(_mm256_cvttps_epi32(v), 8 * j));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + b * 4), word);
+        }
+        return b;
+    }
+
+    // r[i] holds dword j of row i; afterwards r[j] holds dword j of every row
+    MNIST_TARGET("avx2")
+    void transpose_8x8(__m256i* r) {
+        __m256i t[8];
+        for (u32 i = 0; i < 8; i += 2) {
+            t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+            t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+        }
+        __m256i u[8];
+        for (u32 i = 0; i < 8; i += 4) {
+            u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+            u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+            u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+            u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+        }
+        for (u32 i = 0; i < 4; i++) {
+            r[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+            r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+        }
+    }
+
+    // Eight samples at a time: eight quads of each row are loaded and
+    // transposed, so one vector holds a quad of every sample, then each of
+    // its bytes is mapped to f32 as the gather would and quantized as above
+    MNIST_TARGET("avx2,fma")
+    u32 pack_rows_avx2(const ByteRows& rows, const PackArgs& args, u32 quads) {
+        __m256 value_scale = _mm256_set1_ps(rows.scale);
+        __m256 value_offset = _mm256_set1_ps(rows.offset);
+        __m256 scale = _mm256_set1_ps(args.inv_scale);
+        __m256 offset = _mm256_set1_ps(args.offset);
+        __m256 limit = _mm256_set1_ps(args.limit);
+        __m256 zero = _mm256_setzero_ps();
+        __m256i low_byte = _mm256_set1_epi32(0xff);
+        __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+        u32 b = 0;
+        for (; b + 8 <= args.batch; b += 8) {
+            const u8* src = rows.data + b * rows.stride;
+            for (u32 q0 = 0; q0 < quads; q0 += 8) {
+                u32 n = std::min(8u, quads - q0);
+                __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<i32>(n)), lane);
+                __m256i r[8];
+                for (u32 i = 0; i < 8; i++) {
+                    r[i] = _mm256_maskload_epi32(reinterpret_cast<const int*>(src + i * rows.stride + q0 * 4), mask);
+                }
+                transpose_8x8(r);
+
+                for (u32 i = 0; i < n; i++) {
+                    __m256i word = _mm256_setzero_si256();
+                    for (u32 j = 0; j < 4; j++) {
+                        __m256i stored = _mm256_and_si256(_mm256_srli_epi32(r[i], 8 * j), low_byte);
+                        __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(stored), value_scale), value_offset);
+                        v = _mm256_fmadd_ps(v, scale, offset);
+                        v = _mm256_min_ps(limit, _mm256_max_ps(zero, v));
+                        word = _mm256_or_si256(word, _mm256_slli_epi32(_mm256_cvttps_epi32(v), 8 * j));
+                    }
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(args.xq + (q0 + i) * args.x_stride + b * 4), word);
+                }
+            }
+        }
+        return b;
+    }
+
+    MNIST_TARGET("avx512f")
+    void transpose_16x16(__m512i* r) {
+        __m512i t[16];
+        for (u32 i = 0; i < 16; i += 2) {
+            t[i] = _mm512_unpacklo_epi32(r[i], r[i + 1]);
+            t[i + 1] = _mm512_unpackhi_epi32(r[i], r[i + 1]);
+        }
+        __m512i u[16];
+        for (u32 i = 0; i < 16; i += 4) {
+            u[i] = _mm512_unpacklo_epi64(t[i], t[i + 2]);
+            u[i + 1] = _mm512_unpackhi_epi64(t[i], t[i + 2]);
+            u[i + 2] = _mm512_unpacklo_epi64(t[i + 1], t[i + 3]);
+            u[i + 3] = _mm512_unpackhi_epi64(t[i + 1], t[i + 3]);
+        }
+        // u[4m + c] holds dwords c, c+4, c+8, c+12 (one per 128-bit lane) of
+        // rows 4m..4m+3; gather the lanes of four such groups
+        for (u32 c = 0; c < 4; c++) {
+            __m512i a0 = _mm512_shuffle_i32x4(u[c], u[c + 4], 0x88);
+            __m512i a1 = _mm512_shuffle_i32x4(u[c], u[c + 4], 0xdd);
+            __m512i b0 = _mm512_shuffle_i32x4(u[c + 8], u[c + 12], 0x88);
+            __m512i b1 = _mm512_shuffle_i32x4(u[c + 8], u[c + 12], 0xdd);
+            r[c] = _mm512_shuffle_i32x4(a0, b0, 0x88);
+            r[c + 4] = _mm512_shuffle_i32x4(a1, b1, 0x88);
+            r[c + 8] = _mm512_shuffle_i32x4(a0, b0, 0xdd);
+            r[c + 12] = _mm512_shuffle_i32x4(a1, b1, 0xdd);
+        }
+    }
+
+    MNIST_TARGET("avx512f")
+    u32 pack_rows_avx512(const ByteRows& rows, const PackArgs& args, u32 quads) {
+        __m512 value_scale = _mm512_set1_ps(rows.scale);
+        __m512 value_offset = _mm512_set1_ps(rows.offset);
+        __m512 scale = _mm512_set1_ps(args.inv_scale);
+        __m512 offset = _mm512_set1_ps(args.offset);
+        __m512 limit = _mm512_set1_ps(args.limit);
+        __m512 zero = _mm512_setzero_ps();
+        __m512i low_byte = _mm512_set1_epi32(0xff);
+
+        u32 b = 0;
+        for (; b + 16 <= args.batch; b += 16) {
+            const u8* src = rows.data + b * rows.stride;
+            for (u32 q0 = 0; q0 < quads; q0 += 16) {
+                u32 n = std::min(16u, quads - q0);
+                __mmask16 mask = static_cast<__mmask16>((1u << n) - 1);
+                __m512i r[16];
+                for (u32 i = 0; i < 16; i++) r[i] = _mm512_maskz_loadu_epi32(mask, src + i * rows.stride + q0 * 4);
+                transpose_16x16(r);
+
+                for (u32 i = 0; i < n; i++) {
+                    __m512i word = _mm512_setzero_si512();
+                    for (u32 j = 0; j < 4; j++) {
+                        __m512i stored = _mm512_and_si512(_mm512_srli_epi32(r[i], 8 * j), low_byte);
+                        __m512 v = _mm512_add_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(stored), value_scale), value_offset);
+                        v = _mm512_fmadd_ps(v, scale, offset);
+                        v = _mm512_min_ps(limit, _mm512_max_ps(zero, v));
+                        word = _mm512_or_si512(word, _mm512_slli_epi32(_mm512_cvttps_epi32(v), 8 * j));
+                    }
+                    _mm512_storeu_si512(args.xq + (q0 + i) * args.x_stride + b * 4, word);
+                }
+            }
+        }
+        return b;
+    }
+
+    // As pack_rows_avx512, with the bytes mapped through quantize_table by
+    // two 128-entry permutes, before the transpose
+    MNIST_TARGET("avx512f,avx512bw,avx512vbmi")
+    u32 pack_rows_avx512_vbmi(const ByteRows& rows, const PackArgs& args, u32 quads) {
+        alignas(64) u8 table[256];
+        quantize_table(rows, args, table);
+        __m512i low0 = _mm512_load_si512(table);
+        __m512i low1 = _mm512_load_si512(table + 64);
+        __m512i high0 = _mm512_load_si512(table + 128);
+        __m512i high1 = _mm512_load_si512(table + 192);
+
+        u32 b = 0;
+        for (; b + 16 <= args.batch; b += 16) {
+            const u8* src = rows.data + b * rows.stride;
+            for (u32 q0 = 0; q0 < quads; q0 += 16) {
+                u32 n = std::min(16u, quads - q0);
+                __mmask16 mask = static_cast<__mmask16>((1u << n) - 1);
+                __m512i r[16];
+                for (u32 i = 0; i < 16; i++) {
+                    __m512i stored = _mm512_maskz_loadu_epi32(mask, src + i * rows.stride + q0 * 4);
+                    __m512i low = _mm512_permutex2var_epi8(low0, stored, low1);
+                    __m512i high = _mm512_permutex2var_epi8(high0, stored, high1);
+                    r[i] = _mm512_mask_blend_epi8(_mm512_movepi8_mask(stored), low, high);
+                }
+                transpose_16x16(r);
+                for (u32 i = 0; i < n; i++) {
+                    _mm512_storeu_si512(args.xq + (q0 + i) * args.x_stride + b * 4, r[i]);
+                }
+            }
+        }
+        return b;
+    }
+
+    MNIST_TARGET("avx512f")
+    u32 pack_avx512(const PackArgs& args, u32 quad) {
+        const f32* rows = args.x + static_cast<u64>(quad) * 4 * args.batch;
+        u8* dst = args.xq + quad * args.x_stride;
+        __m512 scale = _mm512_set1_ps(args.inv_scale);
+        __m512 offset = _mm512_set1_ps(args.offset);
+        __m512 limit = _mm512_set1_ps(args.limit);
+        __m512 zero = _mm512_setzero_ps();
+
+        u32 b = 0;
+        for (; b + 16 <= args.batch; b += 16) {
+            __m512i word = _mm512_setzero_si512();
+            for (u32 j = 0; j < 4; j++) {
+                __m512 v = _mm512_fmadd_ps(_mm512_loadu_ps(rows + j * args.batch + b), scale, offset);
+                v = _mm512_min_ps(limit, _mm512_max_ps(zero, v));
+                word = _mm512_or_si512(word, _mm512_slli_epi32(_mm512_cvttps_epi32(v), 8 * j));
+            }
+            _mm512_storeu_si512(dst + b * 4, word);
+        }
+        return b;
+    }
+
+    MNIST_TARGET("avx512f,avx512bw,avx512vl,avx512vnni")
+    void block_avx512_vnni_16x16(const u8* x, u64 x_stride, u32 quads, const i8* w, u64 w_stride, i32* tile) {
+        __m512i acc[16];
+        for (u32 r = 0; r < 16; r++) acc[r] = _mm512_setzero_si512();
+
+        for (u32 q = 0; q < quads; q++) {
+            __m512i xv = _mm512_loadu_si512(x + q * x_stride);
+            // Unrolled so the accumulators stay in registers, updated in place
+#pragma GCC unroll 16
+            for (u32 r = 0; r < 16; r++) {
+                __m512i wv = _mm512_set1_epi32(load_quad(w + r * w_stride + q * 4));
+                acc[r] = _mm512_dpbusd_epi32(acc[r], xv, wv);
+            }
+        }
+        for (u32 r = 0; r < 16; r++) {
+            _mm512_storeu_si512(tile + r * 16, acc[r]);
+        }
+    }
+
+#endif
+
+    struct Kernel {
+        const char* name;
+        u32 rows;
+        u32 samples;
+        // Largest quantized activation the kernel takes without saturating
+        i32 activation_max;
+        BlockFn fn;
+        PackFn pack;
+        PackRowsFn pack_rows;
+    };
+
+    const Kernel& active_kernel() {
+        static const Kernel kernel = []() -> Kernel {
+#if MNIST_X86_SIMD
+            if (Cpu::has_avx512_vnni()) {
+                return { "avx512-vnni", 16, 16, 255, block_avx512_vnni_16x16, pack_avx512,
+                    Cpu::has_avx512_vbmi() ? pack_rows_avx512_vbmi : pack_rows_avx512 };
+            }
+            if (Cpu::has_avx2_fma()) return { "avx2", 8, 8, 127, block_avx2_8x8, pack_avx2, pack_rows_avx2 };
+#endif
+            return { "scalar", 4, 4, 127, block_scalar_4x4, pack_scalar, pack_rows_scalar };
+        }();
+        return kernel;
+    }
+
+    u32 round_up(u32 x, u32 align) {
+        return (x + align - 1) / align * align;
+    }
+
+    // Packed x for one call, [quads][padded batch][4] bytes. Only padding
+    // (samples past batch, k past cols) is zeroed; the packers write the rest.
+    u8* packed_input(u32 quads, u64 x_stride, u32 batch, u32 cols) {
+        thread_local std::vector<u8> xq;
+        xq.resize(quads * x_stride);
+        for (u32 quad = 0; quad < quads; quad++) {
+            u64 first = (4 * quad + 4 <= cols) ? static_cast<u64>(batch) * 4 : 0;
+            std::memset(xq.data() + quad * x_stride + first, 0, x_stride - first);
+        }
+        return xq.data();
+    }
+
+    PackArgs pack_args(const QuantizedLinear& q, const f32* x, u32 batch, u8* xq, u64 x_stride) {
+        return { x, batch, 1.0f / q.input_scale, static_cast<f32>(q.input_zero_point) + 0.5f,
+            static_cast<f32>(q.activation_max) + 0.5f, xq, x_stride };
+    }
+
+    // out = W x from the packed x, dequantized, plus bias
+    void multiply(const Kernel& kernel, const QuantizedLinear& q, const u8* xq, u64 x_stride, u32 batch,
+        Matrix& out, const Matrix* bias) {
+        thread_local std::vector<i32> tile;
+        tile.resize(static_cast<u64>(kernel.rows) * kernel.samples);
+        u32 quads = q.padded_cols / 4;
+
+        f32 zero_point = static_cast<f32>(q.input_zero_point);
+        for (u32 b0 = 0; b0 < batch; b0 += kernel.samples) {
+            u32 nb = std::min(kernel.samples, batch - b0);
+
+            for (u32 r0 = 0; r0 < q.rows; r0 += kernel.rows) {
+                kernel.fn(xq + static_cast<u64>(b0) * 4, x_stride, quads,
+                    q.weights.data() + static_cast<u64>(r0) * q.padded_cols, q.padded_cols, tile.data());
+
+                u32 nr = std::min(kernel.rows, q.rows - r0);
+                for (u32 i = 0; i < nr; i++) {
+                    u32 r = r0 + i;
+                    f32 scale = q.row_scales[r] * q.input_scale;
+                    f32 correction = zero_point * static_cast<f32>(q.row_sums[r]);
+                    f32 add = bias ? bias->data[r] : 0.0f;
+                    const i32* dots = tile.data() + i * kernel.samples;
+                    f32* dst = out.data + static_cast<u64>(r) * batch + b0;
+                    for (u32 j = 0; j < nb; j++) {
+                        dst[j] = (static_cast<f32>(dots[j]) - correction) * scale + add;
+                    }
+                }
+            }
+        }
+    }
+
+} // namespace
+
+QuantizedLinear quantize(const Matrix& w, f32 input_min, f32 input_max) {
+    QuantizedLinear q;
+    q.rows = w.rows;
+    q.cols = w.cols;
+    q.padded_cols = round_up(w.cols, K_ALIGN);
+
+    // Whole row blocks for every kernel; padding rows are zero
+    u32 padded_rows = round_up(w.rows, ROW_ALIGN);
+    q.weights.assign(static_cast<u64>(padded_rows) * q.padded_cols, 0);
+    q.row_scales.assign(padded_rows, 0.0f);
+    q.row_sums.assign(padded_rows, 0);
+
+    for (u32 r = 0; r < w.rows; r++) {
+        const f32* row = w.data + static_cast<u64>(r) * w.cols;
+        f32 max_abs = 0.0f;
+        for (u32 c = 0; c < w.cols; c++) {
+            max_abs = std::max(max_abs, std::fabs(row[c]));
+        }
+
+        f32 scale = (max_abs > 0.0f) ? max_abs / 127.0f : 1.0f;
+        i8* dst = q.weights.data() + static_cast<u64>(r) * q.padded_cols;
+        i32 sum = 0;
+        for (u32 c = 0; c < w.cols; c++) {
+            i32 v = static_cast<i32>(std::lround(row[c] / scale));
+            dst[c] = static_cast<i8>(std::min(127, std::max(-127, v)));
+            sum += dst[c];
+        }
+        q.row_scales[r] = scale;
+        q.row_sums[r] = sum;
+    }
+
+    input_min = std::min(input_min, 0.0f);
+    input_max = std::max(input_max, 0.0f);
+    f32 range = input_max - input_min;
+    q.activation_max = active_kernel().activation_max;
+    q.input_scale = (range > 0.0f) ? range / q.activation_max : 1.0f;
+    q.input_zero_point = std::min(q.activation_max,
+        std::max(0, static_cast<i32>(std::lround(-input_min / q.input_scale))));
+
+    return q;
+}
+
+bool linear(const QuantizedLinear& q, const Matrix& x, Matrix& out, const Matrix* bias) {
+    if (x.rows != q.cols || out.rows != q.rows || out.cols != x.cols) return false;
+    if (bias != nullptr && (bias->rows != q.rows || bias->cols != 1)) return false;
+
+    const Kernel& kernel = active_kernel();
+    u32 batch = x.cols;
+    u32 quads = q.padded_cols / 4;
+    u64 x_stride = static_cast<u64>(round_up(batch, kernel.samples)) * 4;
+    u8* xq = packed_input(quads, x_stride, batch, q.cols);
+
+    // Quantize and interleave: whole quads through the kernel's packer, then
+    // whatever it left (sample tail, k tail) one value at a time
+    PackArgs args = pack_args(q, x.data, batch, xq, x_stride);
+    for (u32 quad = 0; quad < quads; quad++) {
+        u32 done = (4 * quad + 4 <= q.cols) ? kernel.pack(args, quad) : 0;
+
+        for (u32 k = 4 * quad; k < std::min(4 * quad + 4, q.cols); k++) {
+            const f32* src = x.data + static_cast<u64>(k) * batch;
+            u8* dst = xq + quad * x_stride + (k % 4);
+            for (u32 b = done; b < batch; b++) {
+                dst[b * 4] = quantize_one(src[b], args);
+            }
+        }
+    }
+
+    multiply(kernel, q, xq, x_stride, batch, out, bias);
+    return true;
+}
+
+bool linear(const QuantizedLinear& q, const ByteRows& x, Matrix& out, const Matrix* bias) {
+    if (x.cols != q.cols || out.rows != q.rows || out.cols != x.count) return false;
+    if (bias != nullptr && (bias->rows != q.rows || bias->cols != 1)) return false;
+
+    const Kernel& kernel = active_kernel();
+    u32 batch = x.count;
+    u32 quads = q.padded_cols / 4;
+    u64 x_stride = static_cast<u64>(round_up(batch, kernel.samples)) * 4;
+    u8* xq = packed_input(quads, x_stride, batch, q.cols);
+
+    // Split as the Matrix form splits: whole quads of whole sample blocks
+    // through the packer, the sample tail and k tail one value at a time
+    PackArgs args = pack_args(q, nullptr, batch, xq, x_stride);
+    u32 whole_quads = q.cols / 4;
+    u32 done = kernel.pack_rows(x, args, whole_quads);
+    for (u32 b = 0; b < batch; b++) {
+        const u8* row = x.data + b * x.stride;
+        for (u32 k = (b < done) ? 4 * whole_quads : 0; k < q.cols; k++) {
+            f32 v = row[k] * x.scale + x.offset;
+            xq[(k / 4) * x_stride + b * 4 + (k % 4)] = quantize_one(v, args);
+        }
+    }
+
+    multiply(kernel, q, xq, x_stride, batch, out, bias);
+    return true;
+}
+
+const char* kernel_name() {
+    return active_kernel().name;
+}
+
+} // namespace Quant
@@ -0,0 +1,64 @@
+#pragma once
+#include <vector>
+
+#include "Types.hpp"
+#include "Matrix.hpp"
+
+// Int8 form of a W x product for post-training quantized inference. W gets
+// one symmetric s8 scale per output row; x is quantized on the fly to
+// 0..activation_max with a per-tensor scale and zero point from calibration.
+// vpdpbusd sums four u8 x s8 products straight into i32, so the VNNI kernel
+// takes full u8; the u8 x s8 pair sums of maddubs saturate at 16 bits, so
+// the other kernels keep activations to u7 (0..127).
+struct QuantizedLinear {
+    u32 rows = 0;
+    u32 cols = 0;
+    // cols rounded up to Quant::K_ALIGN; padding weights (and the padding
+    // rows up to Quant::ROW_ALIGN) are zero
+    u32 padded_cols = 0;
+
+    std::vector<i8> weights;
+    std::vector<f32> row_scales;
+    // Sum of each row's quantized weights, for the zero point correction
+    std::vector<i32> row_sums;
+
+    f32 input_scale = 1.0f;
+    i32 input_zero_point = 0;
+    // Of the kernel picked for this CPU, see Quant::kernel_name()
+    i32 activation_max = 127;
+
+    u64 bytes() const {
+        return weights.size() * sizeof(i8) + row_scales.size() * sizeof(f32) + row_sums.size() * sizeof(i32);
+    }
+};
+
+// Rows of a u8 Dataset standing in for x (cols x count): sample j is the
+// cols bytes at data + j * stride, each worth stored * scale + offset
+struct ByteRows {
+    const u8* data = nullptr;
+    u64 stride = 0;
+    u32 cols = 0;
+    u32 count = 0;
+    f32 scale = 1.0f;
+    f32 offset = 0.0f;
+};
+
+namespace Quant {
+
+    constexpr u32 K_ALIGN = 4;
+    constexpr u32 ROW_ALIGN = 16;
+
+    // input_min/input_max is the calibrated range of x; it is widened to
+    // include 0 so that zero (e.g. relu output) stays exact
+    QuantizedLinear quantize(const Matrix& w, f32 input_min, f32 input_max);
+
+    // out (rows x batch) = W x (+ bias broadcast over columns), overwriting out
+    bool linear(const QuantizedLinear& q, const Matrix& x, Matrix& out, const Matrix* bias);
+    // The same with x read straight from dataset rows, skipping the f32 batch:
+    // the result is what gathering them into x would give
+    bool linear(const QuantizedLinear& q, const ByteRows& x, Matrix& out, const Matrix* bias);
+
+    // Name of the i8 dot product kernel picked for this CPU
+    const char* kernel_name();
+
+} // namespace Quant
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "RingAllReduce.hpp"
+#include "Matrix.hpp"
+#include "Socket.hpp"
+
+#ifndef _WIN32
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    // Where rank listens: the socket file PREFIX.rank, port PORT + rank of
+    // the one host, or entry rank of a tcp:H0:P0,H1:P1,... list with one
+    // entry per rank
+    bool parse_address(const char* address, u32 rank, u32 world_size, Socket::Endpoint& out) {
+        std::string a(address);
+        size_t comma = a.find(',');
+        if (comma != std::string::npos) {
+            if (a.compare(0, 4, "tcp:") != 0) return false;
+            std::vector<std::string> entries;
+            for (size_t first = 4;; first = comma + 1, comma = a.find(',', first)) {
+                entries.push_back(a.substr(first, comma == std::string::npos ? std::string::npos : comma - first));
+                if (comma == std::string::npos) break;
+            }
+            if (entries.size() != world_size) return false;
+            return Socket::parse_address(("tcp:" + entries[rank]).c_str(), out);
+        }
+        if (!Socket::parse_address(address, out)) return false;
+        if (out.unix_socket) {
+            out.path += "." + std::to_string(rank);
+            return true;
+        }
+        out.port += rank;
+        return out.port < 65536;
+    }
+
+    int ms_left(Clock::time_point deadline) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        return static_cast<int>(std::max<long long>(0, left));
+    }
+
+    // Element range of chunk c when count elements are cut into n chunks
+    u64 chunk_begin(u64 count, u32 n, u32 c) {
+        return count * c / n;
+    }
+
+} // namespace
+
+std::unique_ptr<RingAllReduce> RingAllReduce::connect(const char* address, u32 rank, u32 world_size,
+    u32 timeout_ms) {
+    if (world_size == 0 || rank >= world_size) {
+        std::fprintf(stderr, "RingAllReduce: rank %u out of range for world size %u\n", rank, world_size);
+        return nullptr;
+    }
+    std::unique_ptr<RingAllReduce> ring(new RingAllReduce());
+    ring->rank_ = rank;
+    ring->world_size_ = world_size;
+    if (world_size == 1) return ring;
+
+    Socket::Endpoint self;
+    Socket::Endpoint next;
+    if (!parse_address(address, rank, world_size, self)
+        || !parse_address(address, (rank + 1) % world_size, world_size, next)) {
+        std::fprintf(stderr, "RingAllReduce: bad address %s (expected unix:PREFIX, tcp:HOST:PORT or "
+            "tcp:HOST0:PORT0,HOST1:PORT1,... with one entry per rank)\n", address);
+        return nullptr;
+    }
+
+    int listen_fd = Socket::listen_on(self, 1);
+    if (listen_fd < 0) {
+        std::perror("RingAllReduce: listen");
+        return nullptr;
+    }
+
+    // Connect forward first; a listening socket accepts into its backlog, so
+    // no rank waits on another's accept
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    while ((ring->next_fd = Socket::connect_to(next)) < 0 && Clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    pollfd pending = { listen_fd, POLLIN, 0 };
+    if (ring->next_fd >= 0 && poll(&pending, 1, ms_left(deadline)) == 1) {
+        ring->prev_fd = accept(listen_fd, nullptr, nullptr);
+    }
+    ::close(listen_fd);
+    if (self.unix_socket) ::unlink(self.path.c_str());
+    if (ring->next_fd < 0 || ring->prev_fd < 0) {
+        std::fprintf(stderr, "RingAllReduce: rank %u timed out connecting to its neighbours\n", rank);
+        return nullptr;
+    }
+
+    Socket::set_nonblocking(ring->next_fd);
+    Socket::set_nonblocking(ring->prev_fd);
+
+    // Both neighbours must agree on who they are
+    u32 hello[2] = { rank, world_size };
+    u32 peer[2] = {};
+    if (!ring->exchange(hello, sizeof(hello), peer, sizeof(peer))
+        || peer[0] != (rank + world_size - 1) % world_size || peer[1] != world_size) {
+        std::fprintf(stderr, "RingAllReduce: rank %u got a bad handshake from its previous rank\n", rank);
+        return nullptr;
+    }
+
+    ring->comm_thread = std::thread([r = ring.get()]() { r->comm_loop(); });
+    return ring;
+}
+
+RingAllReduce::~RingAllReduce() {
+    if (comm_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queue_cv.notify_all();
+        comm_thread.join();
+    }
+    if (next_fd >= 0) ::close(next_fd);
+    if (prev_fd >= 0) ::close(prev_fd);
+}
+
+// Sends to next and receives from prev at the same time: every rank does
+// both at once, so blocking on either could deadlock the ring
+bool RingAllReduce::exchange(const void* send_data, u64 send_bytes, void* recv_data, u64 recv_bytes) {
+    const u8* out = static_cast<const u8*>(send_data);
+    u8* in = static_cast<u8*>(recv_data);
+    while (send_bytes > 0 || recv_bytes > 0) {
+        pollfd fds[2];
+        nfds_t n = 0;
+        if (send_bytes > 0) fds[n++] = { next_fd, POLLOUT, 0 };
+        if (recv_bytes > 0) fds[n++] = { prev_fd, POLLIN, 0 };
+        // No timeout: a neighbour that exits closes its sockets, which ends
+        // this with an error, while a slow one (rank 0 testing) is waited for
+        int ready = poll(fds, n, -1);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready < 0) {
+            std::perror("RingAllReduce: poll");
+            return false;
+        }
+
+        for (nfds_t i = 0; i < n; i++) {
+            if (fds[i].revents == 0) continue;
+            if (fds[i].fd == next_fd && send_bytes > 0) {
+                ssize_t sent = ::send(next_fd, out, send_bytes, MSG_NOSIGNAL);
+                if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+                if (sent <= 0) {
+                    std::perror("RingAllReduce: send");
+                    return false;
+                }
+                out += sent;
+                send_bytes -= static_cast<u64>(sent);
+            } else if (recv_bytes > 0) {
+                ssize_t got = ::recv(prev_fd, in, recv_bytes, 0);
+                if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+                if (got <= 0) {
+                    if (got == 0) std::fprintf(stderr, "RingAllReduce: rank %u lost its previous rank\n", rank_);
+                    else std::perror("RingAllReduce: recv");
+                    return false;
+                }
+                in += got;
+                recv_bytes -= static_cast<u64>(got);
+            }
+        }
+    }
+    return true;
+}
+
+bool RingAllReduce::send_all(const void* data, u64 bytes) {
+    return exchange(data, bytes, nullptr, 0);
+}
+
+bool RingAllReduce::recv_all(void* data, u64 bytes) {
+    return exchange(nullptr, 0, data, bytes);
+}
+
+bool RingAllReduce::reduce_packed(f32* data, u64 count) {
+    u32 n = world_size_;
+    if (n == 1 || count == 0) return true;
+    scratch.resize(count / n + 1);
+
+    // Reduce-scatter: after step s, chunk (rank - s - 1) holds the sum over
+    // s + 2 ranks; after n - 1 steps this rank owns chunk rank + 1 in full
+    for (u32 s = 0; s + 1 < n; s++) {
+        u32 send_c = (rank_ + n - s) % n;
+        u32 recv_c = (rank_ + 2 * n - s - 1) % n;
+        u64 send_first = chunk_begin(count, n, send_c);
+        u64 recv_first = chunk_begin(count, n, recv_c);
+        u64 send_count = chunk_begin(count, n, send_c + 1) - send_first;
+        u64 recv_count = chunk_begin(count, n, recv_c + 1) - recv_first;
+        if (!exchange(data + send_first, send_count * sizeof(f32), scratch.data(), recv_count * sizeof(f32))) {
+            return false;
+        }
+        Matrix acc = Matrix::view(1, static_cast<u32>(recv_count), data + recv_first);
+        MatOps::add(acc, acc, Matrix::view(1, static_cast<u32>(recv_count), scratch.data()));
+    }
+
+    // All-gather: pass the finished chunks around the ring
+    for (u32 s = 0; s + 1 < n; s++) {
+        u32 send_c = (rank_ + 1 + n - s) % n;
+        u32 recv_c = (rank_ + n - s) % n;
+        u64 send_first = chunk_begin(count, n, send_c);
+        u64 recv_first = chunk_begin(count, n, recv_c);
+        u64 send_count = chunk_begin(count, n, send_c + 1) - send_first;
+        u64 recv_count = chunk_begin(count, n, recv_c + 1) - recv_first;
+        if (!exchange(data + send_first, send_count * sizeof(f32), data + recv_first, recv_count * sizeof(f32))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RingAllReduce::all_reduce(f32* data, u64 count) {
+    return reduce_packed(data, count);
+}
+
+bool RingAllReduce::all_reduce(const std::vector<Span>& spans) {
+    if (spans.size() == 1) return reduce_packed(spans[0].data, spans[0].count);
+
+    u64 total = 0;
+    for (const Span& s : spans) total += s.count;
+    packed.resize(total);
+    f32* p = packed.data();
+    for (const Span& s : spans) {
+        std::memcpy(p, s.data, s.count * sizeof(f32));
+        p += s.count;
+    }
+    if (!reduce_packed(packed.data(), total)) return false;
+    p = packed.data();
+    for (const Span& s : spans) {
+        std::memcpy(s.data, p, s.count * sizeof(f32));
+        p += s.count;
+    }
+    return true;
+}
+
+bool RingAllReduce::broadcast(f32* data, u64 count, u32 root) {
+    if (world_size_ == 1) return true;
+
+    // Down the ring from root in pieces, each rank forwarding one piece while
+    // the next arrives; the rank before root only receives
+    constexpr u64 PIECE = 1 << 14;
+    bool forwards = (rank_ + 1) % world_size_ != root;
+    for (u64 first = 0; first < count; first += PIECE) {
+        u64 bytes = std::min(PIECE, count - first) * sizeof(f32);
+        bool ok = rank_ == root ? send_all(data + first, bytes) : recv_all(data + first, bytes);
+        if (ok && rank_ != root && forwards) ok = send_all(data + first, bytes);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+void RingAllReduce::start(const std::vector<Span>& spans) {
+    if (world_size_ == 1) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(spans);
+        in_flight++;
+    }
+    queue_cv.notify_one();
+}
+
+bool RingAllReduce::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&]() { return in_flight == 0; });
+    bool ok = !failed;
+    failed = false;
+    return ok;
+}
+
+void RingAllReduce::comm_loop() {
+    for (;;) {
+        std::vector<Span> spans;
+        bool skip;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queue_cv.wait(lock, [&]() { return stopping || !queue.empty(); });
+            if (stopping) return;
+            spans = std::move(queue.front());
+            queue.pop_front();
+            // After a failure the ring is out of step; what is left is dropped
+            skip = failed;
+        }
+
+        bool ok = skip || all_reduce(spans);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!ok) failed = true;
+            in_flight--;
+        }
+        done_cv.notify_all();
+    }
+}
+
+#else
+
+std::unique_ptr<RingAllReduce> RingAllReduce::connect(const char*, u32 rank, u32 world_size, u32) {
+    if (world_size == 1 && rank == 0) return std::unique_ptr<RingAllReduce>(new RingAllReduce());
+    std::fprintf(stderr, "RingAllReduce: not supported on this platform\n");
+    return nullptr;
+}
+
+RingAllReduce::~RingAllReduce() {}
+bool RingAllReduce::all_reduce(f32*, u64) { return world_size_ == 1; }
+bool RingAllReduce::all_reduce(const std::vector<Span>&) { return world_size_ == 1; }
+bool RingAllReduce::broadcast(f32*, u64, u32) { return world_size_ == 1; }
+void RingAllReduce::start(const std::vector<Span>&) {}
+bool RingAllReduce::wait() { return true; }
+
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Types.hpp"
+
+// Sums f32 buffers across world_size processes connected in a ring, each
+// rank to the next over one socket and from the previous over another.
+// Ring all-reduce: a reduce-scatter and an all-gather of world_size chunks,
+// so every rank sends and receives 2 (N - 1) / N of the buffer whatever N
+// is. Every rank ends up with the same bits. All ranks must make the same
+// calls in the same order. POSIX only.
+class RingAllReduce {
+public:
+    // A piece of a buffer; the spans of one reduction are summed as if
+    // concatenated
+    struct Span {
+        f32* data;
+        u64 count;
+    };
+
+    // address is "unix:PREFIX", where rank r listens on the socket file
+    // PREFIX.r; "tcp:HOST:PORT", where all ranks run on HOST and rank r
+    // listens on PORT + r; or "tcp:HOST0:PORT0,HOST1:PORT1,..." with one
+    // entry per rank, where rank r listens on PORTr of every interface and
+    // rank r - 1 connects to HOSTr:PORTr. Waits up to timeout_ms for the
+    // neighbours to come up; nullptr on failure.
+    static std::unique_ptr<RingAllReduce> connect(const char* address, u32 rank, u32 world_size,
+        u32 timeout_ms = 30000);
+    ~RingAllReduce();
+
+    RingAllReduce(const RingAllReduce&) = delete;
+    RingAllReduce& operator=(const RingAllReduce&) = delete;
+
+    u32 rank() const { return rank_; }
+    u32 world_size() const { return world_size_; }
+
+    // Sums data over all ranks in place. These block, and must not run while
+    // start() reductions are queued.
+    bool all_reduce(f32* data, u64 count);
+    bool all_reduce(const std::vector<Span>& spans);
+    // Copies root's data to every other rank
+    bool broadcast(f32* data, u64 count, u32 root);
+
+    // Queues all_reduce(spans) on the communication thread and returns at
+    // once, so it can overlap computation. The spans must be left alone until
+    // wait(), which blocks until everything queued is done and returns false
+    // if any of it failed.
+    void start(const std::vector<Span>& spans);
+    bool wait();
+
+private:
+    RingAllReduce() = default;
+    bool exchange(const void* send_data, u64 send_bytes, void* recv_data, u64 recv_bytes);
+    bool send_all(const void* data, u64 bytes);
+    bool recv_all(void* data, u64 bytes);
+    bool reduce_packed(f32* data, u64 count);
+    void comm_loop();
+
+    u32 rank_ = 0;
+    u32 world_size_ = 1;
+    int next_fd = -1;   // sends to rank + 1
+    int prev_fd = -1;   // receives from rank - 1
+
+    std::vector<f32> scratch;
+    std::vector<f32> packed;
+
+    std::thread comm_thread;
+    std::mutex mutex;
+    std::condition_variable queue_cv;
+    std::condition_variable done_cv;
+    std::deque<std::vector<Span>> queue;
+    u32 in_flight = 0;
+    bool failed = false;
+    bool stopping = false;
+};
@@ -0,0 +1,184 @@
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "Socket.hpp"
+
+namespace Socket {
+
+    bool parse_address(const char* address, Endpoint& out) {
+        std::string a(address);
+        if (a.compare(0, 5, "unix:") == 0 && a.size() > 5) {
+            out.unix_socket = true;
+            out.path = a.substr(5);
+            return true;
+        }
+        if (a.compare(0, 4, "tcp:") == 0) {
+            size_t colon = a.rfind(':');
+            if (colon <= 4) return false;
+            out.unix_socket = false;
+            out.host = a.substr(4, colon - 4);
+            out.port = static_cast<u32>(std::atoi(a.c_str() + colon + 1));
+            return out.port > 0 && out.port < 65536;
+        }
+        return false;
+    }
+
+#ifndef _WIN32
+
+    namespace {
+
+        bool unix_address(const Endpoint& ep, sockaddr_un& addr) {
+            if (ep.path.size() >= sizeof(addr.sun_path)) {
+                errno = ENAMETOOLONG;
+                return false;
+            }
+            addr = {};
+            addr.sun_family = AF_UNIX;
+            std::strcpy(addr.sun_path, ep.path.c_str());
+            return true;
+        }
+
+        // Waits until fd is ready for events; false on a poll error
+        bool wait_for(int fd, short events) {
+            pollfd p = { fd, events, 0 };
+            while (poll(&p, 1, -1) < 0) {
+                if (errno != EINTR) return false;
+            }
+            return true;
+        }
+
+    } // namespace
+
+    int listen_on(const Endpoint& ep, u32 backlog, bool loopback_only) {
+        if (ep.unix_socket) {
+            sockaddr_un addr;
+            if (!unix_address(ep, addr)) return -1;
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0) return -1;
+            ::unlink(ep.path.c_str());
+            if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+                || listen(fd, static_cast<int>(backlog)) != 0) {
+                ::close(fd);
+                return -1;
+            }
+            return fd;
+        }
+
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(loopback_only ? INADDR_LOOPBACK : INADDR_ANY);
+        addr.sin_port = htons(static_cast<u16>(ep.port));
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+            || listen(fd, static_cast<int>(backlog)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    int connect_to(const Endpoint& ep) {
+        if (ep.unix_socket) {
+            sockaddr_un addr;
+            if (!unix_address(ep, addr)) return -1;
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0) return -1;
+            if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                ::close(fd);
+                return -1;
+            }
+            return fd;
+        }
+
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        std::string port = std::to_string(ep.port);
+        if (getaddrinfo(ep.host.c_str(), port.c_str(), &hints, &found) != 0) return -1;
+        int fd = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+        if (fd >= 0 && ::connect(fd, found->ai_addr, found->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(found);
+        if (fd >= 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        return fd;
+    }
+
+    int accept_on(int listen_fd) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) return -1;
+        set_nonblocking(fd);
+        // Fails harmlessly on a socket file
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return fd;
+    }
+
+    void set_nonblocking(int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    bool send_all(int fd, const void* data, u64 bytes) {
+        const u8* p = static_cast<const u8*>(data);
+        while (bytes > 0) {
+            ssize_t sent = ::send(fd, p, bytes, MSG_NOSIGNAL);
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (!wait_for(fd, POLLOUT)) return false;
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            p += sent;
+            bytes -= static_cast<u64>(sent);
+        }
+        return true;
+    }
+
+    bool recv_all(int fd, void* data, u64 bytes) {
+        u8* p = static_cast<u8*>(data);
+        while (bytes > 0) {
+            ssize_t got = ::recv(fd, p, bytes, 0);
+            if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (!wait_for(fd, POLLIN)) return false;
+                continue;
+            }
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            p += got;
+            bytes -= static_cast<u64>(got);
+        }
+        return true;
+    }
+
+#else
+
+    int listen_on(const Endpoint&, u32, bool) { return -1; }
+    int connect_to(const Endpoint&) { return -1; }
+    int accept_on(int) { return -1; }
+    void set_nonblocking(int) {}
+    bool send_all(int, const void*, u64) { return false; }
+    bool recv_all(int, void*, u64) { return false; }
+
+#endif
+
+} // namespace Socket
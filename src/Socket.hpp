@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+
+#include "Types.hpp"
+
+// Stream socket helpers shared by RingAllReduce and InferenceServer. Addresses
+// are "unix:PATH" for a socket file or "tcp:HOST:PORT". POSIX only; elsewhere
+// every call fails.
+namespace Socket {
+
+    struct Endpoint {
+        bool unix_socket = false;
+        std::string path;
+        std::string host;
+        u32 port = 0;
+    };
+
+    bool parse_address(const char* address, Endpoint& out);
+
+    // A listening socket, or -1. A socket file left by an earlier run is
+    // replaced. TCP listens on every interface, or only on 127.0.0.1 with
+    // loopback_only.
+    int listen_on(const Endpoint& ep, u32 backlog, bool loopback_only = false);
+    // One attempt, -1 if nobody is listening yet; TCP sockets get TCP_NODELAY
+    int connect_to(const Endpoint& ep);
+    // A pending connection on a listening socket as a nonblocking socket, or -1
+    int accept_on(int listen_fd);
+
+    void set_nonblocking(int fd);
+
+    // Blocking transfers of exactly bytes; the fd may be nonblocking. False on
+    // an error or when the peer closes the connection.
+    bool send_all(int fd, const void* data, u64 bytes);
+    bool recv_all(int fd, void* data, u64 bytes);
+
+} // namespace Socket
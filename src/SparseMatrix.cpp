@@ -0,0 +1,239 @@
+#include <algorithm>
+
+#include "Cpu.hpp"
+#include "SparseMatrix.hpp"
+
+#if MNIST_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    // Scratch rows are padded to whole AVX-512 vectors
+    constexpr u32 LANES = 16;
+
+    u32 padded(u32 n) {
+        return (n + LANES - 1) / LANES * LANES;
+    }
+
+    // Appends the nonzeros of a dense row; returns how many
+    u32 compress_row_scalar(const f32* row, u32 cols, u32* indices, f32* values) {
+        u32 count = 0;
+        for (u32 c = 0; c < cols; c++) {
+            if (row[c] != 0.0f) {
+                indices[count] = c;
+                values[count++] = row[c];
+            }
+        }
+        return count;
+    }
+
+    // Per nonzero (j, v): z[j] += v * w, rows of z width floats apart
+    void scatter_axpy_scalar(f32* z, u32 width, const f32* w, const u32* idx, const f32* val, u32 count) {
+        for (u32 i = 0; i < count; i++) {
+            f32* zj = z + static_cast<u64>(idx[i]) * width;
+            for (u32 r = 0; r < width; r++) zj[r] += val[i] * w[r];
+        }
+    }
+
+    // acc = sum over nonzeros (j, v) of v * g[j], rows of g width floats apart
+    void gather_dot_scalar(f32* acc, u32 width, const f32* g, const u32* idx, const f32* val, u32 count) {
+        for (u32 r = 0; r < width; r++) acc[r] = 0.0f;
+        for (u32 i = 0; i < count; i++) {
+            const f32* gj = g + static_cast<u64>(idx[i]) * width;
+            for (u32 r = 0; r < width; r++) acc[r] += val[i] * gj[r];
+        }
+    }
+
+#if MNIST_X86_SIMD
+
+    MNIST_TARGET("avx512f")
+    u32 compress_row_avx512(const f32* row, u32 cols, u32* indices, f32* values) {
+        u32 count = 0;
+        u32 c = 0;
+        __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        for (; c + 16 <= cols; c += 16) {
+            __m512 v = _mm512_loadu_ps(row + c);
+            __mmask16 nz = _mm512_cmp_ps_mask(v, _mm512_setzero_ps(), _CMP_NEQ_UQ);
+            _mm512_mask_compressstoreu_ps(values + count, nz, v);
+            _mm512_mask_compressstoreu_epi32(indices + count, nz, _mm512_add_epi32(lane, _mm512_set1_epi32(c)));
+            count += static_cast<u32>(__builtin_popcount(nz));
+        }
+        u32 tail = compress_row_scalar(row + c, cols - c, indices + count, values + count);
+        for (u32 i = 0; i < tail; i++) indices[count + i] += c;
+        return count + tail;
+    }
+
+    MNIST_TARGET("avx512f")
+    void scatter_axpy_avx512(f32* z, u32 width, const f32* w, const u32* idx, const f32* val, u32 count) {
+        for (u32 r = 0; r < width; r += 16) {
+            __m512 wv = _mm512_loadu_ps(w + r);
+            for (u32 i = 0; i < count; i++) {
+                f32* zj = z + static_cast<u64>(idx[i]) * width + r;
+                _mm512_storeu_ps(zj, _mm512_fmadd_ps(_mm512_set1_ps(val[i]), wv, _mm512_loadu_ps(zj)));
+            }
+        }
+    }
+
+    MNIST_TARGET("avx512f")
+    void gather_dot_avx512(f32* acc, u32 width, const f32* g, const u32* idx, const f32* val, u32 count) {
+        for (u32 r = 0; r < width; r += 16) {
+            __m512 sum = _mm512_setzero_ps();
+            for (u32 i = 0; i < count; i++) {
+                const f32* gj = g + static_cast<u64>(idx[i]) * width + r;
+                sum = _mm512_fmadd_ps(_mm512_set1_ps(val[i]), _mm512_loadu_ps(gj), sum);
+            }
+            _mm512_storeu_ps(acc + r, sum);
+        }
+    }
+
+    MNIST_TARGET("avx2,fma")
+    void scatter_axpy_avx2(f32* z, u32 width, const f32* w, const u32* idx, const f32* val, u32 count) {
+        for (u32 r = 0; r < width; r += 16) {
+            __m256 w0 = _mm256_loadu_ps(w + r);
+            __m256 w1 = _mm256_loadu_ps(w + r + 8);
+            for (u32 i = 0; i < count; i++) {
+                f32* zj = z + static_cast<u64>(idx[i]) * width + r;
+                __m256 v = _mm256_set1_ps(val[i]);
+                _mm256_storeu_ps(zj, _mm256_fmadd_ps(v, w0, _mm256_loadu_ps(zj)));
+                _mm256_storeu_ps(zj + 8, _mm256_fmadd_ps(v, w1, _mm256_loadu_ps(zj + 8)));
+            }
+        }
+    }
+
+    MNIST_TARGET("avx2,fma")
+    void gather_dot_avx2(f32* acc, u32 width, const f32* g, const u32* idx, const f32* val, u32 count) {
+        for (u32 r = 0; r < width; r += 16) {
+            __m256 s0 = _mm256_setzero_ps();
+            __m256 s1 = _mm256_setzero_ps();
+            for (u32 i = 0; i < count; i++) {
+                const f32* gj = g + static_cast<u64>(idx[i]) * width + r;
+                __m256 v = _mm256_set1_ps(val[i]);
+                s0 = _mm256_fmadd_ps(v, _mm256_loadu_ps(gj), s0);
+                s1 = _mm256_fmadd_ps(v, _mm256_loadu_ps(gj + 8), s1);
+            }
+            _mm256_storeu_ps(acc + r, s0);
+            _mm256_storeu_ps(acc + r + 8, s1);
+        }
+    }
+
+#endif
+
+    using CompressFn = u32 (*)(const f32*, u32, u32*, f32*);
+    using ScatterFn = void (*)(f32*, u32, const f32*, const u32*, const f32*, u32);
+    using GatherFn = void (*)(f32*, u32, const f32*, const u32*, const f32*, u32);
+
+    CompressFn compress_kernel() {
+#if MNIST_X86_SIMD
+        if (Cpu::has_avx512f()) return compress_row_avx512;
+#endif
+        return compress_row_scalar;
+    }
+
+    ScatterFn scatter_kernel() {
+#if MNIST_X86_SIMD
+        if (Cpu::has_avx512f()) return scatter_axpy_avx512;
+        if (Cpu::has_avx2_fma()) return scatter_axpy_avx2;
+#endif
+        return scatter_axpy_scalar;
+    }
+
+    GatherFn gather_kernel() {
+#if MNIST_X86_SIMD
+        if (Cpu::has_avx512f()) return gather_dot_avx512;
+        if (Cpu::has_avx2_fma()) return gather_dot_avx2;
+#endif
+        return gather_dot_scalar;
+    }
+
+} // namespace
+
+void SparseMatrix::assign(const Matrix& dense) {
+    rows = dense.rows;
+    cols = dense.cols;
+    // Sized for a fully dense matrix once, never shrunk
+    u64 size = dense.size();
+    if (col_indices.size() < size) {
+        col_indices.resize(size);
+        values.resize(size);
+    }
+    row_offsets.resize(static_cast<u64>(rows) + 1);
+
+    CompressFn compress = compress_kernel();
+    u32 count = 0;
+    row_offsets[0] = 0;
+    for (u32 r = 0; r < rows; r++) {
+        count += compress(dense.data + static_cast<u64>(r) * cols, cols,
+            col_indices.data() + count, values.data() + count);
+        row_offsets[r + 1] = count;
+    }
+}
+
+namespace MatOps {
+
+    // The product is accumulated transposed, (batch x padded out rows), so
+    // each nonzero updates one contiguous row; out is written from it once
+    template <typename TO, typename TW>
+    bool linear_sparse(MatrixT<TO>& out, const MatrixT<TW>& w, const SparseMatrix& x, const Matrix* bias) {
+        if (w.cols != x.rows || out.rows != w.rows || out.cols != x.cols) return false;
+        if (bias != nullptr && (bias->rows != w.rows || bias->cols != 1)) return false;
+
+        u32 width = padded(w.rows);
+        thread_local std::vector<f32> zt;
+        thread_local std::vector<f32> column;
+        zt.assign(static_cast<u64>(x.cols) * width, 0.0f);
+        column.assign(width, 0.0f);
+
+        ScatterFn scatter = scatter_kernel();
+        for (u32 k = 0; k < x.rows; k++) {
+            u32 begin = x.row_offsets[k];
+            u32 count = x.row_offsets[k + 1] - begin;
+            if (count == 0) continue;
+
+            for (u32 r = 0; r < w.rows; r++) column[r] = to_f32(w.at(r, k));
+            scatter(zt.data(), width, column.data(), x.col_indices.data() + begin, x.values.data() + begin, count);
+        }
+
+        for (u32 r = 0; r < out.rows; r++) {
+            f32 b = bias ? bias->data[r] : 0.0f;
+            TO* y = out.data + static_cast<u64>(r) * out.cols;
+            for (u32 j = 0; j < out.cols; j++) y[j] = from_f32<TO>(zt[static_cast<u64>(j) * width + r] + b);
+        }
+        return true;
+    }
+
+    bool mul_sparse_add_grad(Matrix& w_grad, const Matrix& grad, const SparseMatrix& x) {
+        if (w_grad.cols != x.rows || grad.rows != w_grad.rows || grad.cols != x.cols) return false;
+
+        // grad transposed, (batch x padded rows), so a nonzero reads one row
+        u32 width = padded(grad.rows);
+        thread_local std::vector<f32> gt;
+        thread_local std::vector<f32> acc;
+        gt.assign(static_cast<u64>(grad.cols) * width, 0.0f);
+        acc.resize(width);
+        for (u32 r = 0; r < grad.rows; r++) {
+            const f32* g = grad.data + static_cast<u64>(r) * grad.cols;
+            for (u32 j = 0; j < grad.cols; j++) gt[static_cast<u64>(j) * width + r] = g[j];
+        }
+
+        GatherFn gather = gather_kernel();
+        for (u32 k = 0; k < x.rows; k++) {
+            u32 begin = x.row_offsets[k];
+            u32 count = x.row_offsets[k + 1] - begin;
+            if (count == 0) continue;
+
+            gather(acc.data(), width, gt.data(), x.col_indices.data() + begin, x.values.data() + begin, count);
+            for (u32 r = 0; r < w_grad.rows; r++) w_grad.data[static_cast<u64>(r) * w_grad.cols + k] += acc[r];
+        }
+        return true;
+    }
+
+#define SPARSE_LINEAR(TO, TW) \
+    template bool linear_sparse(MatrixT<TO>&, const MatrixT<TW>&, const SparseMatrix&, const Matrix*);
+    SPARSE_LINEAR(f32, f32)
+    SPARSE_LINEAR(f32, bf16)
+    SPARSE_LINEAR(bf16, f32)
+    SPARSE_LINEAR(bf16, bf16)
+#undef SPARSE_LINEAR
+
+} // namespace MatOps
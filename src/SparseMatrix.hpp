@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+
+#include "Types.hpp"
+#include "Matrix.hpp"
+
+// Compressed sparse rows of an f32 matrix: the nonzeros of row r are
+// values[row_offsets[r] .. row_offsets[r + 1]], in columns col_indices[...].
+// For a (features x batch) input that is, per pixel, the samples where it
+// is lit. The vectors keep their capacity, so rebuilding a batch of the same
+// shape does not allocate.
+struct SparseMatrix {
+    u32 rows = 0;
+    u32 cols = 0;
+    std::vector<u32> row_offsets;
+    std::vector<u32> col_indices;
+    std::vector<f32> values;
+
+    // Rebuilds from the nonzeros of dense
+    void assign(const Matrix& dense);
+
+    u64 nonzeros() const { return row_offsets.empty() ? 0 : row_offsets[rows]; }
+    f32 density() const {
+        u64 size = static_cast<u64>(rows) * cols;
+        return size ? static_cast<f32>(nonzeros()) / static_cast<f32>(size) : 0.0f;
+    }
+};
+
+namespace MatOps {
+
+    // out = w x (+ bias per row) for a sparse x, w (out.rows x x.rows). The
+    // work is one axpy of a column of w per nonzero of x, so zero inputs
+    // cost nothing.
+    template <typename TO, typename TW>
+    bool linear_sparse(MatrixT<TO>& out, const MatrixT<TW>& w, const SparseMatrix& x, const Matrix* bias);
+
+    // w_grad += grad x^T for a sparse x: only the columns of w_grad whose
+    // input row has a nonzero are touched
+    bool mul_sparse_add_grad(Matrix& w_grad, const Matrix& grad, const SparseMatrix& x);
+
+} // namespace MatOps
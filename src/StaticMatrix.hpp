@@ -0,0 +1,196 @@
+#pragma once
+#include <cmath>
+#include <cstring>
+
+#include "Types.hpp"
+#include "Cpu.hpp"
+#include "Matrix.hpp"
+#include "VecMath.hpp"
+
+#if MNIST_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Matrix whose shape is part of its type. Kernels taking these (StaticOps)
+// have every loop over a layer dimension fixed at compile time, so the
+// compiler can unroll them and keep a tile's accumulators in registers.
+template <u32 R, u32 C>
+struct StaticMatrix {
+    static constexpr u32 rows = R;
+    static constexpr u32 cols = C;
+
+    // No alignas: StaticModels are heap-allocated with plain new, which does
+    // not honor over-alignment before C++17, and the kernels load unaligned
+    f32 data[R * C];
+
+    f32 at(u32 r, u32 c) const { return data[r * C + c]; }
+
+    bool copy_from(const Matrix& src) {
+        if (src.rows != R || src.cols != C) return false;
+        std::memcpy(data, src.data, sizeof(data));
+        return true;
+    }
+};
+
+enum class StaticEpilogue : u32 {
+    None,
+    Relu,
+    ReluResidual,   // residual + relu(...)
+};
+
+// Column tiles of the (features x batch) layout: x holds K rows of a tile's
+// columns, x_stride floats apart, and out gets R rows, out_stride apart.
+namespace StaticOps {
+
+    // Columns processed per call by the SIMD kernels
+    constexpr u32 TILE = 16;
+
+    template <StaticEpilogue E>
+    inline f32 epilogue(f32 v, const f32* residual) {
+        if (E == StaticEpilogue::None) return v;
+        v = v > 0.0f ? v : 0.0f;
+        return E == StaticEpilogue::ReluResidual ? v + *residual : v;
+    }
+
+    // out = epilogue(w x + b) over count columns, any count
+    template <u32 R, u32 K, StaticEpilogue E>
+    void linear(f32* out, u64 out_stride, const StaticMatrix<R, K>& w, const StaticMatrix<R, 1>& b,
+        const f32* x, u64 x_stride, const f32* residual, u64 residual_stride, u32 count) {
+        for (u32 r = 0; r < R; r++) {
+            for (u32 j = 0; j < count; j++) {
+                f32 acc = b.data[r];
+                for (u32 k = 0; k < K; k++) acc += w.data[r * K + k] * x[k * x_stride + j];
+                const f32* res = E == StaticEpilogue::ReluResidual ? residual + r * residual_stride + j : nullptr;
+                out[r * out_stride + j] = epilogue<E>(acc, res);
+            }
+        }
+    }
+
+    // Softmax down each of count columns
+    template <u32 R>
+    void softmax(f32* out, u64 out_stride, const f32* in, u64 in_stride, u32 count) {
+        for (u32 j = 0; j < count; j++) {
+            f32 max = in[j];
+            for (u32 r = 1; r < R; r++) max = std::fmax(max, in[r * in_stride + j]);
+
+            f32 e[R];
+            for (u32 r = 0; r < R; r++) e[r] = in[r * in_stride + j] - max;
+            VecMath::exp(e, e, R);
+            f32 sum = 0.0f;
+            for (u32 r = 0; r < R; r++) sum += e[r];
+            f32 inv = 1.0f / sum;
+            for (u32 r = 0; r < R; r++) out[r * out_stride + j] = e[r] * inv;
+        }
+    }
+
+#if MNIST_X86_SIMD
+
+    // One TILE-column tile: a vector accumulator per output row, R rows at a
+    // time for AVX-512 and up to 8 for AVX2 (16 registers)
+    template <u32 R, u32 K, StaticEpilogue E>
+    MNIST_TARGET("avx512f")
+    void linear_tile_avx512(f32* out, u64 out_stride, const StaticMatrix<R, K>& w, const StaticMatrix<R, 1>& b,
+        const f32* x, u64 x_stride, const f32* residual, u64 residual_stride) {
+        constexpr u32 RB = R < 16 ? R : 16;
+        for (u32 r0 = 0; r0 < R; r0 += RB) {
+            __m512 acc[RB];
+#pragma GCC unroll 16
+            for (u32 r = 0; r < RB; r++) acc[r] = _mm512_set1_ps(r0 + r < R ? b.data[r0 + r] : 0.0f);
+
+            for (u32 k = 0; k < K; k++) {
+                __m512 xv = _mm512_loadu_ps(x + k * x_stride);
+#pragma GCC unroll 16
+                for (u32 r = 0; r < RB; r++) {
+                    if (r0 + r < R) acc[r] = _mm512_fmadd_ps(_mm512_set1_ps(w.data[(r0 + r) * K + k]), xv, acc[r]);
+                }
+            }
+
+#pragma GCC unroll 16
+            for (u32 r = 0; r < RB; r++) {
+                if (r0 + r >= R) continue;
+                __m512 v = acc[r];
+                if (E != StaticEpilogue::None) v = _mm512_max_ps(v, _mm512_setzero_ps());
+                if (E == StaticEpilogue::ReluResidual) {
+                    v = _mm512_add_ps(v, _mm512_loadu_ps(residual + (r0 + r) * residual_stride));
+                }
+                _mm512_storeu_ps(out + (r0 + r) * out_stride, v);
+            }
+        }
+    }
+
+    // Two 8-column halves, so a tile covers TILE columns like the AVX-512 one
+    template <u32 R, u32 K, StaticEpilogue E>
+    MNIST_TARGET("avx2,fma")
+    void linear_tile_avx2(f32* out, u64 out_stride, const StaticMatrix<R, K>& w, const StaticMatrix<R, 1>& b,
+        const f32* x, u64 x_stride, const f32* residual, u64 residual_stride) {
+        constexpr u32 RB = R < 8 ? R : 8;
+        for (u32 half = 0; half < TILE; half += 8) {
+            for (u32 r0 = 0; r0 < R; r0 += RB) {
+                __m256 acc[RB];
+#pragma GCC unroll 8
+                for (u32 r = 0; r < RB; r++) acc[r] = _mm256_set1_ps(r0 + r < R ? b.data[r0 + r] : 0.0f);
+
+                for (u32 k = 0; k < K; k++) {
+                    __m256 xv = _mm256_loadu_ps(x + k * x_stride + half);
+#pragma GCC unroll 8
+                    for (u32 r = 0; r < RB; r++) {
+                        if (r0 + r < R) acc[r] = _mm256_fmadd_ps(_mm256_set1_ps(w.data[(r0 + r) * K + k]), xv, acc[r]);
+                    }
+                }
+
+#pragma GCC unroll 8
+                for (u32 r = 0; r < RB; r++) {
+                    if (r0 + r >= R) continue;
+                    __m256 v = acc[r];
+                    if (E != StaticEpilogue::None) v = _mm256_max_ps(v, _mm256_setzero_ps());
+                    if (E == StaticEpilogue::ReluResidual) {
+                        v = _mm256_add_ps(v, _mm256_loadu_ps(residual + (r0 + r) * residual_stride + half));
+                    }
+                    _mm256_storeu_ps(out + (r0 + r) * out_stride + half, v);
+                }
+            }
+        }
+    }
+
+    // Softmax down each column of a TILE-column tile, one vector per row
+    template <u32 R>
+    MNIST_TARGET("avx512f")
+    void softmax_tile_avx512(f32* out, u64 out_stride, const f32* in, u64 in_stride) {
+        __m512 v[R];
+        __m512 max = _mm512_loadu_ps(in);
+        for (u32 r = 0; r < R; r++) {
+            v[r] = _mm512_loadu_ps(in + r * in_stride);
+            max = _mm512_max_ps(max, v[r]);
+        }
+        __m512 sum = _mm512_setzero_ps();
+        for (u32 r = 0; r < R; r++) {
+            v[r] = VecMath::exp_avx512(_mm512_sub_ps(v[r], max));
+            sum = _mm512_add_ps(sum, v[r]);
+        }
+        __m512 inv = _mm512_div_ps(_mm512_set1_ps(1.0f), sum);
+        for (u32 r = 0; r < R; r++) _mm512_storeu_ps(out + r * out_stride, _mm512_mul_ps(v[r], inv));
+    }
+
+    template <u32 R>
+    MNIST_TARGET("avx2,fma")
+    void softmax_tile_avx2(f32* out, u64 out_stride, const f32* in, u64 in_stride) {
+        for (u32 half = 0; half < TILE; half += 8) {
+            __m256 v[R];
+            __m256 max = _mm256_loadu_ps(in + half);
+            for (u32 r = 0; r < R; r++) {
+                v[r] = _mm256_loadu_ps(in + r * in_stride + half);
+                max = _mm256_max_ps(max, v[r]);
+            }
+            __m256 sum = _mm256_setzero_ps();
+            for (u32 r = 0; r < R; r++) {
+                v[r] = VecMath::exp_avx2(_mm256_sub_ps(v[r], max));
+                sum = _mm256_add_ps(sum, v[r]);
+            }
+            __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f), sum);
+            for (u32 r = 0; r < R; r++) _mm256_storeu_ps(out + r * out_stride + half, _mm256_mul_ps(v[r], inv));
+        }
+    }
+
+#endif
+
+} // namespace StaticOps
@@ -0,0 +1,144 @@
+#include "StaticModel.hpp"
+#include "StaticMatrix.hpp"
+#include "ModelContext.hpp"
+
+namespace {
+
+    // LinearBiasRelu -> LinearBiasReluAdd (residual: the first layer) ->
+    // LinearBias -> Softmax, the fused form of create_mnist_model()
+    template <u32 In, u32 H, u32 Out>
+    class ResidualMlp : public StaticModel {
+    public:
+        ResidualMlp(const ModelVar* const (&params)[6]) {
+            for (u32 i = 0; i < 6; i++) this->params[i] = params[i];
+            refresh();
+        }
+
+        void refresh() override {
+            w0.copy_from(params[0]->val);
+            b0.copy_from(params[1]->val);
+            w1.copy_from(params[2]->val);
+            b1.copy_from(params[3]->val);
+            w2.copy_from(params[4]->val);
+            b2.copy_from(params[5]->val);
+        }
+
+        void forward(const Matrix& x, Matrix& out) const override {
+            u32 n = x.cols;
+            u32 j = 0;
+#if MNIST_X86_SIMD
+            if (Cpu::has_avx512f()) j = forward_avx512(x.data, out.data, n);
+            else if (Cpu::has_avx2_fma()) j = forward_avx2(x.data, out.data, n);
+#endif
+            if (j < n) forward_tile(x.data + j, out.data + j, n, n - j);
+        }
+
+        u64 flops_per_sample() const override {
+            return 2ull * (static_cast<u64>(In) * H + H * H + H * Out);
+        }
+
+        u64 weight_bytes() const override {
+            return sizeof(w0) + sizeof(b0) + sizeof(w1) + sizeof(b1) + sizeof(w2) + sizeof(b2);
+        }
+
+    private:
+        using Epi = StaticEpilogue;
+        static constexpr u32 TILE = StaticOps::TILE;
+
+        // Up to TILE columns starting at x and out, both n floats per row
+        void forward_tile(const f32* x, f32* out, u64 n, u32 count) const {
+            alignas(64) f32 h0[H * TILE];
+            alignas(64) f32 h1[H * TILE];
+            alignas(64) f32 logits[Out * TILE];
+            StaticOps::linear<H, In, Epi::Relu>(h0, TILE, w0, b0, x, n, nullptr, 0, count);
+            StaticOps::linear<H, H, Epi::ReluResidual>(h1, TILE, w1, b1, h0, TILE, h0, TILE, count);
+            StaticOps::linear<Out, H, Epi::None>(logits, TILE, w2, b2, h1, TILE, nullptr, 0, count);
+            StaticOps::softmax<Out>(out, n, logits, TILE, count);
+        }
+
+        // Each returns how many leading columns it did, whole tiles only
+#if MNIST_X86_SIMD
+        MNIST_TARGET("avx512f")
+        u32 forward_avx512(const f32* x, f32* out, u32 n) const {
+            alignas(64) f32 h0[H * TILE];
+            alignas(64) f32 h1[H * TILE];
+            alignas(64) f32 logits[Out * TILE];
+            u32 j = 0;
+            for (; j + TILE <= n; j += TILE) {
+                StaticOps::linear_tile_avx512<H, In, Epi::Relu>(h0, TILE, w0, b0, x + j, n, nullptr, 0);
+                StaticOps::linear_tile_avx512<H, H, Epi::ReluResidual>(h1, TILE, w1, b1, h0, TILE, h0, TILE);
+                StaticOps::linear_tile_avx512<Out, H, Epi::None>(logits, TILE, w2, b2, h1, TILE, nullptr, 0);
+                StaticOps::softmax_tile_avx512<Out>(out + j, n, logits, TILE);
+            }
+            return j;
+        }
+
+        MNIST_TARGET("avx2,fma")
+        u32 forward_avx2(const f32* x, f32* out, u32 n) const {
+            alignas(64) f32 h0[H * TILE];
+            alignas(64) f32 h1[H * TILE];
+            alignas(64) f32 logits[Out * TILE];
+            u32 j = 0;
+            for (; j + TILE <= n; j += TILE) {
+                StaticOps::linear_tile_avx2<H, In, Epi::Relu>(h0, TILE, w0, b0, x + j, n, nullptr, 0);
+                StaticOps::linear_tile_avx2<H, H, Epi::ReluResidual>(h1, TILE, w1, b1, h0, TILE, h0, TILE);
+                StaticOps::linear_tile_avx2<Out, H, Epi::None>(logits, TILE, w2, b2, h1, TILE, nullptr, 0);
+                StaticOps::softmax_tile_avx2<Out>(out + j, n, logits, TILE);
+            }
+            return j;
+        }
+#endif
+
+        // W0, b0, W1, b1, W2, b2
+        const ModelVar* params[6];
+
+        StaticMatrix<H, In> w0;
+        StaticMatrix<H, 1> b0;
+        StaticMatrix<H, H> w1;
+        StaticMatrix<H, 1> b1;
+        StaticMatrix<Out, H> w2;
+        StaticMatrix<Out, 1> b2;
+    };
+
+    bool is_param(const ModelVar* var, u32 rows, u32 cols) {
+        return var->op == ModelVarOp::Create && (var->flags & MV_FLAG_PARAMETER) &&
+            var->storage == ModelVarStorage::F32 && var->val.rows == rows && var->val.cols == cols;
+    }
+
+} // namespace
+
+std::unique_ptr<StaticModel> StaticModel::match(const ModelContext& model) {
+    std::vector<const ModelVar*> ops;
+    for (const ModelVar* var : model.forward_prog.vars) {
+        if (var->op != ModelVarOp::Create) ops.push_back(var);
+    }
+    if (ops.size() != 4 || !model.input || ops[3] != model.output) return nullptr;
+    for (const ModelVar* var : ops) {
+        if (var->quant || var->storage != ModelVarStorage::F32) return nullptr;
+    }
+
+    const ModelVar* l0 = ops[0];
+    const ModelVar* l1 = ops[1];
+    const ModelVar* l2 = ops[2];
+    if (l0->op != ModelVarOp::LinearBiasRelu || l0->inputs[1] != model.input) return nullptr;
+    if (l1->op != ModelVarOp::LinearBiasReluAdd || l1->inputs[1] != l0 || l1->inputs[3] != l0) return nullptr;
+    if (l2->op != ModelVarOp::LinearBias || l2->inputs[1] != l1) return nullptr;
+    if (ops[3]->op != ModelVarOp::Softmax || ops[3]->inputs[0] != l2) return nullptr;
+
+    const ModelVar* const params[6] = {
+        l0->inputs[0], l0->inputs[2], l1->inputs[0], l1->inputs[2], l2->inputs[0], l2->inputs[2],
+    };
+    u32 in = model.input->val.rows;
+    u32 h = l0->val.rows;
+    u32 out = l2->val.rows;
+
+    // One instantiation per supported (In, H, Out)
+    auto shaped = [&](u32 i, u32 hh, u32 o) {
+        return in == i && h == hh && out == o &&
+            is_param(params[0], hh, i) && is_param(params[1], hh, 1) &&
+            is_param(params[2], hh, hh) && is_param(params[3], hh, 1) &&
+            is_param(params[4], o, hh) && is_param(params[5], o, 1);
+    };
+    if (shaped(784, 16, 10)) return std::unique_ptr<StaticModel>(new ResidualMlp<784, 16, 10>(params));
+    return nullptr;
+}
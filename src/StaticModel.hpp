@@ -0,0 +1,35 @@
+#pragma once
+#include <memory>
+
+#include "Types.hpp"
+#include "Matrix.hpp"
+
+class ModelContext;
+
+// A whole forward program with its layer shapes fixed at compile time, see
+// ModelCompileDesc::static_kernels. The layers of a column tile run back to
+// back through StaticOps kernels, with the intermediate activations of the
+// tile on the stack instead of in activation buffers.
+class StaticModel {
+public:
+    virtual ~StaticModel() = default;
+
+    // The static implementation of model's forward program, if its compiled
+    // graph (fused, f32, not quantized) has one of the topologies
+    // instantiated in StaticModel.cpp; nullptr otherwise. Parameters are
+    // copied, see refresh().
+    static std::unique_ptr<StaticModel> match(const ModelContext& model);
+
+    // Copies the parameter values again, after they were written
+    virtual void refresh() = 0;
+
+    // x is (input rows x n) and out (output rows x n), as input->val and
+    // output->val of the graph. Safe to call from several threads at once.
+    virtual void forward(const Matrix& x, Matrix& out) const = 0;
+
+    // Multiply-adds (times 2) per sample
+    virtual u64 flops_per_sample() const = 0;
+
+    // Bytes of its own parameter copies
+    virtual u64 weight_bytes() const = 0;
+};
@@ -0,0 +1,74 @@
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(u32 num_threads) {
+    for (u32 i = 1; i < num_threads; i++) {
+        workers.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(u32 count, const std::function<void(u32)>& fn) {
+    if (count == 0) return;
+
+    if (workers.empty() || count == 1) {
+        for (u32 i = 0; i < count; i++) fn(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        job_count = count;
+        next_index = 0;
+        active = static_cast<u32>(workers.size());
+        generation++;
+    }
+    work_cv.notify_all();
+
+    drain();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [this]() { return active == 0; });
+    job = nullptr;
+}
+
+u32 ThreadPool::hardware_threads() {
+    u32 n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+void ThreadPool::worker_loop() {
+    u64 seen_generation = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [&]() { return stopping || generation != seen_generation; });
+            if (stopping) return;
+            seen_generation = generation;
+        }
+
+        drain();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--active == 0) {
+            done_cv.notify_one();
+        }
+    }
+}
+
+void ThreadPool::drain() {
+    for (u32 i = next_index++; i < job_count; i = next_index++) {
+        (*job)(i);
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Types.hpp"
+
+// Fixed-size pool for fork/join parallel loops. The calling thread takes part
+// in every run, so a pool of size N starts N - 1 worker threads.
+class ThreadPool {
+public:
+    explicit ThreadPool(u32 num_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    u32 size() const { return static_cast<u32>(workers.size()) + 1; }
+
+    // Calls fn(i) for every i in [0, count) and returns once all calls are done.
+    // Must not be called from inside a job of the same pool.
+    void run(u32 count, const std::function<void(u32)>& fn);
+
+    static u32 hardware_threads();
+
+private:
+    void worker_loop();
+    void drain();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+
+    const std::function<void(u32)>* job = nullptr;
+    u32 job_count = 0;
+    std::atomic<u32> next_index{ 0 };
+    u32 active = 0;
+    u64 generation = 0;
+    bool stopping = false;
+};
@@ -0,0 +1,114 @@
+#include <cstring>
+
+#include "VecMath.hpp"
+
+namespace VecMath {
+
+// Same steps as the vector forms, with std::fma so the roundings match
+f32 exp_scalar(f32 x) {
+    using namespace Detail;
+    if (x != x) return x;
+    f32 xc = std::fmin(std::fmax(x, EXP_MIN), EXP_MAX);
+    f32 n = std::nearbyint(xc * LOG2E);
+    f32 r = std::fma(-n, LN2_HI, xc);
+    r = std::fma(-n, LN2_LO, r);
+
+    f32 p = EXP_P[0];
+    for (u32 i = 1; i < 6; i++) p = std::fma(p, r, EXP_P[i]);
+    f32 y = std::fma(p, r * r, r) + 1.0f;
+    return std::ldexp(y, static_cast<int>(n));
+}
+
+f32 log_scalar(f32 x) {
+    using namespace Detail;
+    if (x != x || x < 0.0f) return NAN;
+    if (x == 0.0f) return -INFINITY;
+    if (x == INFINITY) return x;
+
+    f32 e = 0.0f;
+    if (x < 1.17549435e-38f) {
+        x *= 8388608.0f;
+        e = -23.0f;
+    }
+    u32 bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    e += static_cast<f32>(static_cast<i32>(bits >> 23) - 127);
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    f32 m;
+    std::memcpy(&m, &bits, sizeof(m));
+
+    if (m > SQRT2) {
+        m *= 0.5f;
+        e += 1.0f;
+    }
+    f32 f = m - 1.0f;
+    f32 z = f * f;
+
+    f32 p = LOG_P[0];
+    for (u32 i = 1; i < 9; i++) p = std::fma(p, f, LOG_P[i]);
+    f32 y = p * f * z;
+    y = std::fma(e, LN2_LO, y);
+    y = std::fma(-0.5f, z, y);
+    return std::fma(e, LN2_HI, f + y);
+}
+
+namespace {
+
+    // Each applies op to whole vectors, the tail included: it goes through a
+    // padded copy, so every element sees the same instruction sequence
+#if MNIST_X86_SIMD
+
+    template <typename Op>
+    MNIST_TARGET("avx512f")
+    void map_avx512(const f32* src, f32* dst, u64 count, Op op) {
+        u64 i = 0;
+        for (; i + 16 <= count; i += 16) {
+            _mm512_storeu_ps(dst + i, op(_mm512_loadu_ps(src + i)));
+        }
+        if (i < count) {
+            __mmask16 tail = static_cast<__mmask16>((1u << (count - i)) - 1);
+            _mm512_mask_storeu_ps(dst + i, tail, op(_mm512_maskz_loadu_ps(tail, src + i)));
+        }
+    }
+
+    template <typename Op>
+    MNIST_TARGET("avx2,fma")
+    void map_avx2(const f32* src, f32* dst, u64 count, Op op) {
+        u64 i = 0;
+        for (; i + 8 <= count; i += 8) {
+            _mm256_storeu_ps(dst + i, op(_mm256_loadu_ps(src + i)));
+        }
+        if (i < count) {
+            alignas(32) f32 buf[8] = {};
+            std::memcpy(buf, src + i, (count - i) * sizeof(f32));
+            _mm256_store_ps(buf, op(_mm256_load_ps(buf)));
+            std::memcpy(dst + i, buf, (count - i) * sizeof(f32));
+        }
+    }
+
+    struct ExpAvx512 { MNIST_TARGET("avx512f") __m512 operator()(__m512 x) const { return exp_avx512(x); } };
+    struct LogAvx512 { MNIST_TARGET("avx512f") __m512 operator()(__m512 x) const { return log_avx512(x); } };
+    struct ExpAvx2 { MNIST_TARGET("avx2,fma") __m256 operator()(__m256 x) const { return exp_avx2(x); } };
+    struct LogAvx2 { MNIST_TARGET("avx2,fma") __m256 operator()(__m256 x) const { return log_avx2(x); } };
+
+#endif
+
+} // namespace
+
+void exp(const f32* src, f32* dst, u64 count) {
+#if MNIST_X86_SIMD
+    if (Cpu::has_avx512f()) return map_avx512(src, dst, count, ExpAvx512());
+    if (Cpu::has_avx2_fma()) return map_avx2(src, dst, count, ExpAvx2());
+#endif
+    for (u64 i = 0; i < count; i++) dst[i] = exp_scalar(src[i]);
+}
+
+void log(const f32* src, f32* dst, u64 count) {
+#if MNIST_X86_SIMD
+    if (Cpu::has_avx512f()) return map_avx512(src, dst, count, LogAvx512());
+    if (Cpu::has_avx2_fma()) return map_avx2(src, dst, count, LogAvx2());
+#endif
+    for (u64 i = 0; i < count; i++) dst[i] = log_scalar(src[i]);
+}
+
+} // namespace VecMath
@@ -0,0 +1,169 @@
+#pragma once
+#include <cmath>
+
+#include "Types.hpp"
+#include "Cpu.hpp"
+
+#if MNIST_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Polynomial exp and log for f32 arrays, vectorized where the CPU allows.
+// Checked on every f32 input against the correctly rounded result:
+//   exp: within 1 ulp everywhere, subnormal results included; overflows to
+//        inf and underflows to 0 where the true result does.
+//   log: within 1 ulp for every positive input, subnormals included;
+//        log(+-0) = -inf, log(inf) = inf, negative inputs give NaN.
+// NaN in gives NaN out. Every ISA evaluates the same polynomials with the
+// same roundings, so a value does not depend on the kernel or lane.
+namespace VecMath {
+
+    // dst[i] = exp(src[i]) and log(src[i]); dst may be src
+    void exp(const f32* src, f32* dst, u64 count);
+    void log(const f32* src, f32* dst, u64 count);
+
+    // One value at a time, what exp() and log() run without AVX2
+    f32 exp_scalar(f32 x);
+    f32 log_scalar(f32 x);
+
+    namespace Detail {
+        // Cephes expf/logf: range reduction constants and minimax coefficients
+        constexpr f32 LOG2E = 1.44269504088896341f;
+        constexpr f32 LN2_HI = 0.693359375f;
+        constexpr f32 LN2_LO = -2.12194440e-4f;
+        // Past these exp is 0 / inf anyway; clamping keeps the exponent in range
+        constexpr f32 EXP_MIN = -104.0f;
+        constexpr f32 EXP_MAX = 89.0f;
+        constexpr f32 EXP_P[6] = { 1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+            4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f };
+        constexpr f32 LOG_P[9] = { 7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f,
+            -1.2420140846e-1f, 1.4249322787e-1f, -1.6668057665e-1f, 2.0000714765e-1f,
+            -2.4999993993e-1f, 3.3333331174e-1f };
+        constexpr f32 SQRT2 = 1.41421356237f;
+    } // namespace Detail
+
+    // The single-vector forms, for SIMD kernels elsewhere to inline
+    // (softmax tiles, future activations)
+#if MNIST_X86_SIMD
+
+    MNIST_TARGET("avx512f")
+    inline __m512 exp_avx512(__m512 x) {
+        using namespace Detail;
+        __m512 xc = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(EXP_MIN)), _mm512_set1_ps(EXP_MAX));
+        __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(xc, _mm512_set1_ps(LOG2E)),
+            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_HI), xc);
+        r = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_LO), r);
+
+        __m512 p = _mm512_set1_ps(EXP_P[0]);
+        for (u32 i = 1; i < 6; i++) p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P[i]));
+        __m512 y = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), r);
+        y = _mm512_add_ps(y, _mm512_set1_ps(1.0f));
+
+        // y * 2^n, rounding once into the subnormals
+        y = _mm512_scalef_ps(y, n);
+        __mmask16 nan = _mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q);
+        return _mm512_mask_mov_ps(y, nan, x);
+    }
+
+    MNIST_TARGET("avx512f")
+    inline __m512 log_avx512(__m512 x) {
+        using namespace Detail;
+        // Subnormals are scaled into the normal range first
+        __mmask16 tiny = _mm512_cmp_ps_mask(x, _mm512_set1_ps(1.17549435e-38f), _CMP_LT_OQ);
+        __m512 xs = _mm512_mask_mul_ps(x, tiny, x, _mm512_set1_ps(8388608.0f));
+        __m512i bits = _mm512_castps_si512(xs);
+        __m512i ei = _mm512_sub_epi32(_mm512_srli_epi32(bits, 23), _mm512_set1_epi32(127));
+        __m512 e = _mm512_cvtepi32_ps(ei);
+        e = _mm512_mask_sub_ps(e, tiny, e, _mm512_set1_ps(23.0f));
+        __m512 m = _mm512_castsi512_ps(_mm512_or_si512(
+            _mm512_and_si512(bits, _mm512_set1_epi32(0x007FFFFF)), _mm512_set1_epi32(0x3F800000)));
+
+        // m in [sqrt(2)/2, sqrt(2)), f = m - 1
+        __mmask16 big = _mm512_cmp_ps_mask(m, _mm512_set1_ps(SQRT2), _CMP_GT_OQ);
+        m = _mm512_mask_mul_ps(m, big, m, _mm512_set1_ps(0.5f));
+        e = _mm512_mask_add_ps(e, big, e, _mm512_set1_ps(1.0f));
+        __m512 f = _mm512_sub_ps(m, _mm512_set1_ps(1.0f));
+        __m512 z = _mm512_mul_ps(f, f);
+
+        __m512 p = _mm512_set1_ps(LOG_P[0]);
+        for (u32 i = 1; i < 9; i++) p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(LOG_P[i]));
+        __m512 y = _mm512_mul_ps(_mm512_mul_ps(p, f), z);
+        y = _mm512_fmadd_ps(e, _mm512_set1_ps(LN2_LO), y);
+        y = _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), z, y);
+        __m512 result = _mm512_add_ps(f, y);
+        result = _mm512_fmadd_ps(e, _mm512_set1_ps(LN2_HI), result);
+
+        // 0 -> -inf, inf -> inf, negative and NaN -> NaN
+        __mmask16 zero = _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_EQ_OQ);
+        __mmask16 inf = _mm512_cmp_ps_mask(x, _mm512_set1_ps(INFINITY), _CMP_EQ_OQ);
+        __mmask16 invalid = _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_NGE_UQ);
+        result = _mm512_mask_mov_ps(result, zero, _mm512_set1_ps(-INFINITY));
+        result = _mm512_mask_mov_ps(result, inf, x);
+        return _mm512_mask_mov_ps(result, invalid, _mm512_set1_ps(NAN));
+    }
+
+    MNIST_TARGET("avx2,fma")
+    inline __m256 exp_avx2(__m256 x) {
+        using namespace Detail;
+        __m256 xc = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_MIN)), _mm256_set1_ps(EXP_MAX));
+        __m256 n = _mm256_round_ps(_mm256_mul_ps(xc, _mm256_set1_ps(LOG2E)),
+            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_HI), xc);
+        r = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_LO), r);
+
+        __m256 p = _mm256_set1_ps(EXP_P[0]);
+        for (u32 i = 1; i < 6; i++) p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P[i]));
+        __m256 y = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r);
+        y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+
+        // y * 2^n as y * 2^(n/2) * 2^(n - n/2): both factors are normal floats
+        // over the clamped range and only the last product rounds
+        __m256i ni = _mm256_cvtps_epi32(n);
+        __m256i n1 = _mm256_srai_epi32(ni, 1);
+        __m256i n2 = _mm256_sub_epi32(ni, n1);
+        __m256 s1 = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(n1, _mm256_set1_epi32(127)), 23));
+        __m256 s2 = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(n2, _mm256_set1_epi32(127)), 23));
+        y = _mm256_mul_ps(_mm256_mul_ps(y, s1), s2);
+
+        __m256 nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+        return _mm256_blendv_ps(y, x, nan);
+    }
+
+    MNIST_TARGET("avx2,fma")
+    inline __m256 log_avx2(__m256 x) {
+        using namespace Detail;
+        __m256 tiny = _mm256_cmp_ps(x, _mm256_set1_ps(1.17549435e-38f), _CMP_LT_OQ);
+        __m256 xs = _mm256_blendv_ps(x, _mm256_mul_ps(x, _mm256_set1_ps(8388608.0f)), tiny);
+        __m256i bits = _mm256_castps_si256(xs);
+        __m256i ei = _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127));
+        __m256 e = _mm256_cvtepi32_ps(ei);
+        e = _mm256_sub_ps(e, _mm256_and_ps(tiny, _mm256_set1_ps(23.0f)));
+        __m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+            _mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000)));
+
+        __m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(SQRT2), _CMP_GT_OQ);
+        m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+        e = _mm256_add_ps(e, _mm256_and_ps(big, _mm256_set1_ps(1.0f)));
+        __m256 f = _mm256_sub_ps(m, _mm256_set1_ps(1.0f));
+        __m256 z = _mm256_mul_ps(f, f);
+
+        __m256 p = _mm256_set1_ps(LOG_P[0]);
+        for (u32 i = 1; i < 9; i++) p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(LOG_P[i]));
+        __m256 y = _mm256_mul_ps(_mm256_mul_ps(p, f), z);
+        y = _mm256_fmadd_ps(e, _mm256_set1_ps(LN2_LO), y);
+        y = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, y);
+        __m256 result = _mm256_add_ps(f, y);
+        result = _mm256_fmadd_ps(e, _mm256_set1_ps(LN2_HI), result);
+
+        __m256 zero = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_EQ_OQ);
+        __m256 inf = _mm256_cmp_ps(x, _mm256_set1_ps(INFINITY), _CMP_EQ_OQ);
+        __m256 invalid = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_NGE_UQ);
+        result = _mm256_blendv_ps(result, _mm256_set1_ps(-INFINITY), zero);
+        result = _mm256_blendv_ps(result, x, inf);
+        return _mm256_blendv_ps(result, _mm256_set1_ps(NAN), invalid);
+    }
+
+#endif
+
+} // namespace VecMath
@@ -1,6 +1,9 @@
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cmath>
+#include <csignal>
+#include <cstdlib>
 #include <cstring>
 #include <vector>
 #include <memory>
@@ -8,24 +11,35 @@
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <thread>
 
 
 #include "Types.hpp"
 #include "Matrix.hpp"
+#include "Dataset.hpp"
 #include "ModelContext.hpp"
+#include "MnistModel.hpp"
+#include "InferenceModel.hpp"
+#include "QuantizedLinear.hpp"
 #include "ModelVariables.hpp"
 #include "PRNG.hpp"
+#include "Profiler.hpp"
+#include "Optimizer.hpp"
 #include "ModelTrainingDesc.hpp"
+#include "ThreadPool.hpp"
+#include "RingAllReduce.hpp"
+#include "InferenceServer.hpp"
 
 
 // ============================================================================
 // Utilities
 // ============================================================================
 
-void draw_mnist_digit(const f32* data) {
+void draw_mnist_digit(const Dataset& images, u32 row) {
     for (u32 y = 0; y < 28; y++) {
         for (u32 x = 0; x < 28; x++) {
-            f32 num = data[x + y * 28];
+            f32 num = images.value(row, x + y * 28);
             u32 col = 232 + static_cast<u32>(num * 23);
             std::printf("\x1b[48;5;%um  ", col);
         }
@@ -34,110 +48,307 @@ void draw_mnist_digit(const f32* data) {
     std::printf("\x1b[0m");
 }
 
-void create_mnist_model(ModelContext& model) {
-    ModelVar* input = model.create_var(784, 1, MV_FLAG_INPUT);
+// Opens name.mnds, converting it from the raw f32 name.mat written by
+// mnist_download.py on first use. Pixels are stored as u8 with a 1/255 scale.
+std::unique_ptr<Dataset> open_mnist_dataset(const char* name, u32 rows, u32 cols, f32 scale) {
+    std::string path = std::string(name) + ".mnds";
+    std::string mat_path = std::string(name) + ".mat";
 
-    ModelVar* W0 = model.create_var(16, 784, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
-    ModelVar* W1 = model.create_var(16, 16, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
-    ModelVar* W2 = model.create_var(10, 16, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
-
-    f32 bound0 = std::sqrt(6.0f / (784 + 16));
-    f32 bound1 = std::sqrt(6.0f / (16 + 16));
-    f32 bound2 = std::sqrt(6.0f / (16 + 10));
-    W0->val->fill_rand(-bound0, bound0);
-    W1->val->fill_rand(-bound1, bound1);
-    W2->val->fill_rand(-bound2, bound2);
+    if (!std::ifstream(path).good()) {
+        std::printf("Converting %s to %s\n", mat_path.c_str(), path.c_str());
+        if (!Dataset::convert_mat(mat_path.c_str(), path.c_str(), rows, cols, DatasetType::U8, scale, 0.0f)) {
+            return nullptr;
+        }
+    }
+    return Dataset::open(path.c_str());
+}
 
-    ModelVar* b0 = model.create_var(16, 1, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
-    ModelVar* b1 = model.create_var(16, 1, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
-    ModelVar* b2 = model.create_var(10, 1, MV_FLAG_REQUIRES_GRAD | MV_FLAG_PARAMETER);
+// ============================================================================
+// Main
+// ============================================================================
 
-    ModelVar* z0_a = model.matmul(W0, input, 0);
-    ModelVar* z0_b = model.add(z0_a, b0, 0);
-    ModelVar* a0 = model.relu(z0_b, 0);
+// Test accuracy and single-core throughput of a serving model
+void report_inference(const char* name, InferenceModel& model, const Dataset& images, const Dataset& labels) {
+    std::vector<u32> predictions(images.rows);
 
-    ModelVar* z1_a = model.matmul(W1, a0, 0);
-    ModelVar* z1_b = model.add(z1_a, b1, 0);
-    ModelVar* z1_c = model.relu(z1_b, 0);
-    ModelVar* a1 = model.add(a0, z1_c, 0);
+    auto start = std::chrono::steady_clock::now();
+    model.predict(images, predictions.data(), nullptr, 1);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
 
-    ModelVar* z2_a = model.matmul(W2, a1, 0);
-    ModelVar* z2_b = model.add(z2_a, b2, 0);
-    ModelVar* output = model.softmax(z2_b, MV_FLAG_OUTPUT);
+    u32 num_correct = 0;
+    for (u32 i = 0; i < images.rows; i++) {
+        num_correct += (predictions[i] == labels.label(i)) ? 1 : 0;
+    }
+    std::printf("%-6s accuracy %5u / %5u (%.2f%%), %8.0f images/s per core, weights %.1f KiB\n",
+        name, num_correct, images.rows, static_cast<f32>(num_correct) / images.rows * 100.0f,
+        images.rows / elapsed.count(), model.weight_bytes() / 1024.0);
+}
 
-    ModelVar* y = model.create_var(10, 1, MV_FLAG_DESIRED_OUTPUT);
+volatile std::sig_atomic_t stop_serving = 0;
 
-    model.cross_entropy(y, output, MV_FLAG_COST);
+void on_stop_signal(int) {
+    stop_serving = 1;
 }
 
-// ============================================================================
-// Main
-// ============================================================================
+// Serves model until SIGINT or SIGTERM, with latency and throughput every
+// few seconds while requests come in
+int serve(const InferenceModel& model, const char* address, const InferenceServerDesc& desc) {
+    auto server = InferenceServer::start(model, address, desc);
+    if (!server) {
+        return 1;
+    }
+    std::signal(SIGINT, on_stop_signal);
+    std::signal(SIGTERM, on_stop_signal);
+    std::printf("Serving on %s: batches of up to %u, at most %u us wait (Ctrl-C stops)\n",
+        address, desc.max_batch, desc.max_wait_us);
+    std::fflush(stdout);
+
+    auto last_report = std::chrono::steady_clock::now();
+    while (!stop_serving) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (std::chrono::steady_clock::now() - last_report < std::chrono::seconds(5)) continue;
+        last_report = std::chrono::steady_clock::now();
+
+        InferenceServerStats stats = server->take_stats();
+        if (stats.requests == 0) continue;
+        std::printf("%8llu requests, %8.0f requests/s, %5.1f per batch, latency p50 %u us, p99 %u us, max %u us\n",
+            static_cast<unsigned long long>(stats.requests), stats.requests / stats.seconds,
+            static_cast<double>(stats.requests) / stats.batches, stats.p50_us, stats.p99_us, stats.max_us);
+        std::fflush(stdout);
+    }
+    std::printf("Stopped serving\n");
+    return 0;
+}
 
-int main() {
-    auto train_images = Matrix::load(60000, 784, "train_images.mat");
-    auto test_images = Matrix::load(10000, 784, "test_images.mat");
-    auto train_labels = Matrix::create(60000, 10);
-    auto test_labels = Matrix::create(10000, 10);
+bool parse_optimizer(const char* name, OptimizerDesc& desc) {
+    desc = OptimizerDesc();
+    if (std::strcmp(name, "sgd") == 0) {
+        desc.kind = OptimizerKind::SGD;
+    } else if (std::strcmp(name, "momentum") == 0) {
+        desc.kind = OptimizerKind::Momentum;
+    } else if (std::strcmp(name, "nesterov") == 0) {
+        desc.kind = OptimizerKind::Momentum;
+        desc.nesterov = true;
+    } else if (std::strcmp(name, "adam") == 0) {
+        desc.kind = OptimizerKind::Adam;
+    } else if (std::strcmp(name, "adamw") == 0) {
+        desc.kind = OptimizerKind::AdamW;
+        desc.weight_decay = 0.01f;
+    } else {
+        return false;
+    }
+    return true;
+}
 
-    {
-        auto train_labels_file = Matrix::load(60000, 1, "train_labels.mat");
-        auto test_labels_file = Matrix::load(10000, 1, "test_labels.mat");
+void print_usage() {
+    std::printf(
+        "Usage: mnist [--save FILE] [--load FILE] [--bf16] [--static] [--profile FILE]\n"
+        "             [--optimizer sgd|momentum|nesterov|adam|adamw] [--lr RATE]\n"
+        "             [--hogwild] [--ring ADDRESS --rank R --world-size N]\n"
+        "             [--serve ADDRESS [--max-batch N] [--max-wait-us US]] [--seed N]\n"
+        "  --save FILE     write a checkpoint after training\n"
+        "  --load FILE     skip training and serve a saved checkpoint\n"
+        "  --bf16          train with bf16 activations and weight copies\n"
+        "  --static        run inference on shape-specialized kernels (f32 only)\n"
+        "  --profile FILE  time every op during training, print a summary and\n"
+        "                  write a Chrome trace (chrome://tracing, Perfetto)\n"
+        "  --optimizer     parameter update rule (default sgd)\n"
+        "  --lr RATE       learning rate (default 0.01, 0.001 for adam and adamw)\n"
+        "  --hogwild       train asynchronously, each thread updating the shared\n"
+        "                  parameters without locks\n"
+        "  --ring ADDRESS  train as rank R of N processes summing gradients over a\n"
+        "                  socket ring, unix:PREFIX, tcp:HOST:PORT on one host or\n"
+        "                  tcp:HOST0:PORT0,HOST1:PORT1,... one per rank; only\n"
+        "                  rank 0 tests, saves and serves\n"
+        "  --serve ADDRESS after testing, answer requests on unix:PATH or\n"
+        "                  tcp:HOST:PORT (loopback), batching them up to N at a\n"
+        "                  time (default 64), waiting at most US (default 200)\n"
+        "  --seed N        seed initialization and shuffling, for repeatable runs\n"
+    );
+}
 
-        for (u32 i = 0; i < 60000; i++) {
-            u32 num = static_cast<u32>(train_labels_file->data[i]);
-            train_labels->data[i * 10 + num] = 1.0f;
+int main(int argc, char** argv) {
+    const char* save_path = nullptr;
+    const char* load_path = nullptr;
+    const char* profile_path = nullptr;
+    bool bf16_storage = false;
+    bool static_kernels = false;
+    bool hogwild = false;
+    OptimizerDesc optimizer;
+    f32 learning_rate = 0.0f;
+    const char* ring_address = nullptr;
+    u32 rank = 0;
+    u32 world_size = 1;
+    const char* serve_address = nullptr;
+    InferenceServerDesc server_desc;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            load_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--bf16") == 0) {
+            bf16_storage = true;
+        } else if (std::strcmp(argv[i], "--static") == 0) {
+            static_kernels = true;
+        } else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--optimizer") == 0 && i + 1 < argc) {
+            if (!parse_optimizer(argv[++i], optimizer)) {
+                print_usage();
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--lr") == 0 && i + 1 < argc) {
+            learning_rate = static_cast<f32>(std::atof(argv[++i]));
+        } else if (std::strcmp(argv[i], "--hogwild") == 0) {
+            hogwild = true;
+        } else if (std::strcmp(argv[i], "--ring") == 0 && i + 1 < argc) {
+            ring_address = argv[++i];
+        } else if (std::strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_address = argv[++i];
+        } else if (std::strcmp(argv[i], "--max-batch") == 0 && i + 1 < argc) {
+            server_desc.max_batch = static_cast<u32>(std::max(1, std::atoi(argv[++i])));
+        } else if (std::strcmp(argv[i], "--max-wait-us") == 0 && i + 1 < argc) {
+            server_desc.max_wait_us = static_cast<u32>(std::max(0, std::atoi(argv[++i])));
+        } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            PRNG::set_seed(std::strtoull(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--rank") == 0 && i + 1 < argc) {
+            rank = static_cast<u32>(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--world-size") == 0 && i + 1 < argc) {
+            world_size = static_cast<u32>(std::atoi(argv[++i]));
+        } else {
+            print_usage();
+            return 1;
         }
+    }
 
-        for (u32 i = 0; i < 10000; i++) {
-            u32 num = static_cast<u32>(test_labels_file->data[i]);
-            test_labels->data[i * 10 + num] = 1.0f;
-        }
+    auto train_images = open_mnist_dataset("train_images", 60000, 784, 1.0f / 255.0f);
+    auto test_images = open_mnist_dataset("test_images", 10000, 784, 1.0f / 255.0f);
+    auto train_labels = open_mnist_dataset("train_labels", 60000, 1, 1.0f);
+    auto test_labels = open_mnist_dataset("test_labels", 10000, 1, 1.0f);
+    if (!train_images || !test_images || !train_labels || !test_labels) {
+        return 1;
     }
 
-    draw_mnist_digit(test_images->data.data());
-    for (u32 i = 0; i < 10; i++) {
-        std::printf("%.0f ", test_labels->data[i]);
+    if (ring_address != nullptr && load_path != nullptr) {
+        print_usage();
+        return 1;
     }
-    std::printf("\n\n");
 
-    ModelContext model;
-    create_mnist_model(model);
-    model.compile();
+    std::unique_ptr<InferenceModel> inference;
+    const char* precision = "f32";
+
+    if (load_path != nullptr) {
+        auto start = std::chrono::steady_clock::now();
+        inference = InferenceModel::load(load_path);
+        if (!inference) {
+            return 1;
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::printf("Loaded %s in %.2f ms\n", load_path, elapsed.count());
+    } else {
+        std::unique_ptr<RingAllReduce> ring;
+        if (ring_address != nullptr) {
+            ring = RingAllReduce::connect(ring_address, rank, world_size);
+            if (!ring) {
+                return 1;
+            }
+            std::printf("Rank %u of %u connected\n", rank, world_size);
+        }
+        bool leader = rank == 0;
+
+        if (leader) {
+            draw_mnist_digit(*test_images, 0);
+            std::printf("Label: %u\n\n", test_labels->label(0));
+        }
+
+        ModelContext model;
+        create_mnist_model(model);
+        ModelCompileDesc compile_desc;
+        compile_desc.bf16_storage = bf16_storage;
+        compile_desc.static_kernels = static_kernels;
+        model.compile(compile_desc);
+        if (bf16_storage) precision = "bf16";
+        if (model.uses_static_kernels()) precision = "static";
+
+        if (leader) {
+            test_images->copy_rows_to_columns(model.input->val, 0, 1);
+            model.feedforward();
+
+            std::printf("Pre-training output: ");
+            for (u32 i = 0; i < 10; i++) {
+                std::printf("%.2f ", model.output->val.data[i]);
+            }
+            std::printf("\n");
+        }
+
+        ModelTrainingDesc training_desc;
+        training_desc.train_images = train_images.get();
+        training_desc.train_labels = train_labels.get();
+        training_desc.test_images = test_images.get();
+        training_desc.test_labels = test_labels.get();
+        training_desc.epochs = 10;
+        training_desc.batch_size = 50;
+        training_desc.optimizer = optimizer;
+        training_desc.learning_rate = learning_rate;
+        if (learning_rate <= 0.0f) {
+            bool adam = optimizer.kind == OptimizerKind::Adam || optimizer.kind == OptimizerKind::AdamW;
+            training_desc.learning_rate = adam ? 0.001f : 0.01f;
+        }
+        // Processes on one machine split its cores
+        training_desc.num_threads = std::max(1u, ThreadPool::hardware_threads() / world_size);
+        training_desc.hogwild = hogwild;
+        training_desc.ring = ring.get();
+        training_desc.verbose = leader;
+
+        Profiler profiler;
+        if (profile_path != nullptr && leader) model.set_profiler(&profiler);
+
+        model.train(training_desc);
+        if (!leader) {
+            return 0;
+        }
 
-    std::memcpy(model.input->val->data.data(), test_images->data.data(), sizeof(f32) * 784);
-    model.feedforward();
+        if (profile_path != nullptr) {
+            model.set_profiler(nullptr);
+            profiler.print_summary();
+            if (!profiler.write_trace(profile_path)) {
+                return 1;
+            }
+            std::printf("Wrote trace to %s\n", profile_path);
+        }
+
+        if (save_path != nullptr) {
+            if (!model.save(save_path)) {
+                return 1;
+            }
+            std::printf("Saved checkpoint to %s\n", save_path);
+        }
 
-    std::printf("Pre-training output: ");
-    for (u32 i = 0; i < 10; i++) {
-        std::printf("%.2f ", model.output->val->data[i]);
+        // Serving copy: forward graph only, read-only parameters
+        inference = model.freeze();
     }
-    std::printf("\n");
 
-    ModelTrainingDesc training_desc;
-    training_desc.train_images = train_images.get();
-    training_desc.train_labels = train_labels.get();
-    training_desc.test_images = test_images.get();
-    training_desc.test_labels = test_labels.get();
-    training_desc.epochs = 10;
-    training_desc.batch_size = 50;
-    training_desc.learning_rate = 0.01f;
+    std::printf("Inference model: %.1f KiB\n", inference->memory_bytes() / 1024.0);
 
-    model.train(training_desc);
+    // Post-training int8 copy, calibrated on training images
+    auto quantized = inference->quantized(*train_images, 1000);
+    std::printf("Int8 kernel: %s\n", Quant::kernel_name());
+    report_inference(precision, *inference, *test_images, *test_labels);
+    report_inference("int8", *quantized, *test_images, *test_labels);
+    std::printf("\n");
 
+    if (serve_address != nullptr) {
+        return serve(*inference, serve_address, server_desc);
+    }
 
     const u32 num_test = 10;
 
+    Matrix sample(test_images->cols, 1);
     for (u32 n = 0; n < num_test; n++) {
-        const f32* img_data = test_images->data.data() + n * 784;
-        draw_mnist_digit(img_data);
-
-        std::memcpy(model.input->val->data.data(), img_data, sizeof(f32) * 784);
-        model.feedforward();
-
-        u64 pred = model.output->val->argmax();
+        draw_mnist_digit(*test_images, n);
 
-        std::printf("     Test image %u predicted: %llu\n\n", n, pred);
+        test_images->copy_rows_to_columns(sample, n, 1);
+        std::printf("     Test image %u predicted: %u\n\n", n, inference->predict_label(sample.data));
     }
     std::printf("\n\n");
 
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Types.hpp"
+#include "Dataset.hpp"
+#include "PRNG.hpp"
+
+// Minimal test harness: CHECK reports a failure and carries on, and main
+// returns test::exit_code() so CTest sees any failure.
+
+namespace test {
+
+    inline u32& failures() {
+        static u32 count = 0;
+        return count;
+    }
+
+    inline int exit_code() {
+        if (failures() != 0) {
+            std::fprintf(stderr, "%u check(s) failed\n", failures());
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Scratch files named after the process, removed when the owning scope ends
+    class TempFiles {
+    public:
+        TempFiles() = default;
+        TempFiles(const TempFiles&) = delete;
+        TempFiles& operator=(const TempFiles&) = delete;
+        ~TempFiles() {
+            for (const std::string& file : files) std::remove(file.c_str());
+        }
+
+        std::string path(const std::string& name) {
+            const char* dir = std::getenv("TMPDIR");
+            std::string file = std::string(dir && *dir ? dir : "/tmp") + "/mnist_test_"
+                + std::to_string(getpid()) + "_" + name;
+            files.push_back(file);
+            return file;
+        }
+
+    private:
+        std::vector<std::string> files;
+    };
+
+    inline bool write_file(const std::string& path, const void* data, u64 size) {
+        std::ofstream out(path, std::ios::binary);
+        out.write(static_cast<const char*>(data), size);
+        return out.good();
+    }
+
+    // (rows x cols) dataset converted from a raw .mat, like the MNIST files.
+    // Images are about 80% zeros; labels are class indices below 10.
+    inline std::unique_ptr<Dataset> synthetic_dataset(TempFiles& files, const char* name,
+        u32 rows, u32 cols, bool labels, PRNG& prng) {
+        std::vector<f32> values(static_cast<u64>(rows) * cols);
+        for (f32& v : values) {
+            if (labels) v = static_cast<f32>(prng.below(10));
+            else v = prng.randf() < 0.2f ? prng.randf() : 0.0f;
+        }
+
+        std::string mat_path = files.path(std::string(name) + ".mat");
+        std::string path = files.path(std::string(name) + ".mnds");
+        if (!write_file(mat_path, values.data(), values.size() * sizeof(f32))) return nullptr;
+
+        f32 scale = labels ? 1.0f : 1.0f / 255.0f;
+        if (!Dataset::convert_mat(mat_path.c_str(), path.c_str(), rows, cols, DatasetType::U8, scale, 0.0f)) {
+            return nullptr;
+        }
+        return Dataset::open(path.c_str());
+    }
+
+} // namespace test
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            test::failures()++;                                                      \
+        }                                                                            \
+    } while (0)
@@ -0,0 +1,147 @@
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "TestUtil.hpp"
+#include "InferenceModel.hpp"
+#include "ModelCheckpoint.hpp"
+#include "ModelContext.hpp"
+#include "MnistModel.hpp"
+
+// Checkpoints round-trip, and load() rejects files whose header or var
+// records disagree with the graph they describe instead of running kernels
+// on the shapes they claim.
+
+namespace {
+
+    std::vector<char> read_file(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    CheckpointHeader header_of(const std::vector<char>& bytes) {
+        CheckpointHeader header;
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        return header;
+    }
+
+    CheckpointVar* record(std::vector<char>& bytes, u32 index) {
+        return reinterpret_cast<CheckpointVar*>(bytes.data() + header_of(bytes).vars_offset) + index;
+    }
+
+    bool loads(test::TempFiles& files, const std::vector<char>& bytes) {
+        std::string path = files.path("corrupt.ckpt");
+        test::write_file(path, bytes.data(), bytes.size());
+        return ModelContext::load(path.c_str()) != nullptr;
+    }
+
+    u32 first_var(const ModelContext& model, ModelVarOp op) {
+        for (auto& var : model.all_vars) {
+            if (var->op == op) return var->index;
+        }
+        return CHECKPOINT_NONE;
+    }
+
+    // The loaded parameters are the saved bits, and a model served from the
+    // file predicts exactly like one frozen from memory
+    void check_round_trip(const ModelContext& model, const std::string& path) {
+        auto loaded = ModelContext::load(path.c_str());
+        CHECK(loaded != nullptr);
+        if (!loaded) return;
+        Matrix saved = model.param_slab();
+        Matrix restored = loaded->param_slab();
+        CHECK(restored.size() == saved.size());
+        CHECK(restored.size() == saved.size()
+            && std::memcmp(restored.data, saved.data, saved.size() * sizeof(f32)) == 0);
+
+        constexpr u32 BATCH = 37;
+        PRNG prng(4);
+        std::vector<f32> images(BATCH * 784);
+        for (f32& v : images) v = prng.randf();
+        Matrix batch = Matrix::view(BATCH, 784, images.data());
+
+        auto served = InferenceModel::load(path.c_str());
+        auto frozen = model.freeze();
+        CHECK(served != nullptr && frozen != nullptr);
+        if (!served || !frozen) return;
+        std::vector<u32> served_labels(BATCH), frozen_labels(BATCH);
+        std::vector<f32> served_probs(BATCH * 10), frozen_probs(BATCH * 10);
+        served->predict(batch, served_labels.data(), served_probs.data(), 1);
+        frozen->predict(batch, frozen_labels.data(), frozen_probs.data(), 1);
+        CHECK(served_labels == frozen_labels);
+        CHECK(std::memcmp(served_probs.data(), frozen_probs.data(), served_probs.size() * sizeof(f32)) == 0);
+    }
+
+} // namespace
+
+int main() {
+    PRNG::set_seed(3);
+    test::TempFiles files;
+
+    ModelContext model;
+    create_mnist_model(model);
+    model.compile();
+    std::string path = files.path("model.ckpt");
+    CHECK(model.save(path.c_str()));
+
+    const std::vector<char> good = read_file(path);
+    CHECK(good.size() >= sizeof(CheckpointHeader));
+    if (test::failures() != 0) return test::exit_code();
+    CHECK(loads(files, good));
+    check_round_trip(model, path);
+
+    u32 linear = first_var(model, ModelVarOp::LinearBiasRelu);
+    CHECK(linear != CHECKPOINT_NONE);
+    if (test::failures() != 0) return test::exit_code();
+    u32 param = model.all_vars[linear]->inputs[0]->index;
+
+    {
+        // A product whose shape does not follow from its inputs
+        std::vector<char> bytes = good;
+        record(bytes, linear)->rows += 1;
+        CHECK(!loads(files, bytes));
+    }
+    {
+        // Inputs that cannot be multiplied
+        std::vector<char> bytes = good;
+        record(bytes, param)->cols -= 1;
+        CHECK(!loads(files, bytes));
+    }
+    {
+        // A parameter whose bytes wrap around past the end of the slab
+        std::vector<char> bytes = good;
+        record(bytes, param)->param_offset = ~0ull & ~static_cast<u64>(Arena::ALIGNMENT - 1);
+        CHECK(!loads(files, bytes));
+    }
+    {
+        // Offsets that overflow when the sizes are added
+        std::vector<char> bytes = good;
+        CheckpointHeader header = header_of(bytes);
+        header.params_offset = ~0ull & ~static_cast<u64>(CHECKPOINT_ALIGNMENT - 1);
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        CHECK(!loads(files, bytes));
+
+        bytes = good;
+        header = header_of(bytes);
+        header.vars_offset = ~0ull - 16;
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        CHECK(!loads(files, bytes));
+    }
+    {
+        // An input var that is not the batch size wide
+        std::vector<char> bytes = good;
+        record(bytes, model.input->index)->cols += 1;
+        CHECK(!loads(files, bytes));
+    }
+    {
+        // A role pointing at a var without its flag
+        std::vector<char> bytes = good;
+        CheckpointHeader header = header_of(bytes);
+        header.cost = header.input;
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        CHECK(!loads(files, bytes));
+    }
+
+    return test::exit_code();
+}
@@ -0,0 +1,105 @@
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "TestUtil.hpp"
+#include "Dataset.hpp"
+#include "Matrix.hpp"
+
+// Dataset::open accepts what convert_mat writes and rejects headers whose
+// sizes or offsets would put rows outside the file; valid_labels() rejects
+// labels that are not class indices; Matrix::load reports missing and short
+// files instead of handing back zeros.
+
+namespace {
+
+    constexpr u32 ROWS = 5;
+    constexpr u32 COLS = 3;
+
+    std::vector<u8> dataset_file(DatasetType dtype, u32 rows, u32 cols, u64 data_offset, u64 data_bytes) {
+        DatasetHeader header = {};
+        std::memcpy(header.magic, "MNDS", 4);
+        header.version = Dataset::VERSION;
+        header.dtype = dtype;
+        header.rows = rows;
+        header.cols = cols;
+        header.scale = 1.0f;
+        header.data_offset = data_offset;
+
+        std::vector<u8> bytes(data_offset + data_bytes, 0);
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        return bytes;
+    }
+
+    bool opens(test::TempFiles& files, const std::vector<u8>& bytes) {
+        std::string path = files.path("dataset.mnds");
+        test::write_file(path, bytes.data(), bytes.size());
+        return Dataset::open(path.c_str()) != nullptr;
+    }
+
+} // namespace
+
+int main() {
+    test::TempFiles files;
+
+    // Round trip through convert_mat
+    std::vector<f32> values(ROWS * COLS);
+    for (u32 i = 0; i < ROWS * COLS; i++) values[i] = static_cast<f32>(i);
+    std::string mat_path = files.path("values.mat");
+    std::string path = files.path("values.mnds");
+    CHECK(test::write_file(mat_path, values.data(), values.size() * sizeof(f32)));
+    CHECK(Dataset::convert_mat(mat_path.c_str(), path.c_str(), ROWS, COLS, DatasetType::F32, 1.0f, 0.0f));
+    auto dataset = Dataset::open(path.c_str());
+    CHECK(dataset != nullptr);
+    if (dataset) {
+        CHECK(dataset->rows == ROWS && dataset->cols == COLS);
+        CHECK(dataset->value(ROWS - 1, COLS - 1) == values.back());
+    }
+
+    const u64 header_size = sizeof(DatasetHeader);
+    CHECK(opens(files, dataset_file(DatasetType::F32, ROWS, COLS, header_size, ROWS * COLS * 4)));
+    CHECK(opens(files, dataset_file(DatasetType::U8, ROWS, COLS, header_size + 1, ROWS * COLS)));
+
+    // One byte short
+    CHECK(!opens(files, dataset_file(DatasetType::F32, ROWS, COLS, header_size, ROWS * COLS * 4 - 1)));
+    // rows * row_bytes is 2^64, which wraps to 0
+    CHECK(!opens(files, dataset_file(DatasetType::F32, 1u << 31, 1u << 31, header_size, 0)));
+    // Data starting past the end of the file
+    {
+        std::vector<u8> bytes = dataset_file(DatasetType::U8, 0, COLS, header_size, 0);
+        DatasetHeader header;
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        header.data_offset = ~0ull;
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        CHECK(!opens(files, bytes));
+    }
+    // f32 rows that are not 4-byte aligned
+    CHECK(!opens(files, dataset_file(DatasetType::F32, ROWS, COLS, header_size + 2, ROWS * COLS * 4)));
+
+    // Label sets: class indices below the class count, or one-hot rows
+    if (dataset) {
+        CHECK(dataset->valid_labels(COLS));
+        CHECK(!dataset->valid_labels(COLS + 1));
+    }
+    {
+        const f32 bad[] = { -1.0f, 2.5f, NAN, 10.0f };
+        for (f32 label : bad) {
+            std::vector<f32> labels = { 0.0f, 9.0f, label };
+            std::string labels_mat = files.path("labels.mat");
+            std::string labels_path = files.path("labels.mnds");
+            CHECK(test::write_file(labels_mat, labels.data(), labels.size() * sizeof(f32)));
+            CHECK(Dataset::convert_mat(labels_mat.c_str(), labels_path.c_str(), 3, 1, DatasetType::F32, 1.0f, 0.0f));
+            auto label_set = Dataset::open(labels_path.c_str());
+            CHECK(label_set && !label_set->valid_labels(10));
+        }
+    }
+
+    // Matrix::load
+    auto loaded = Matrix::load(ROWS, COLS, mat_path.c_str());
+    CHECK(loaded != nullptr);
+    if (loaded) CHECK(loaded->at(ROWS - 1, COLS - 1) == values.back());
+    CHECK(Matrix::load(ROWS + 1, COLS, mat_path.c_str()) == nullptr);
+    CHECK(Matrix::load(ROWS, COLS, files.path("missing.mat").c_str()) == nullptr);
+
+    return test::exit_code();
+}
@@ -0,0 +1,127 @@
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "TestUtil.hpp"
+#include "Gemm.hpp"
+
+// sgemm on every kernel the CPU runs, in all four transpose modes, against a
+// naive double precision product. Sizes of 1 take the small-matrix path, 3
+// and 17 leave partial micro-tiles, and 257 spills one past a KC block and
+// past a whole number of MC panels. Operands are stored with padded strides
+// and C starts non-zero, since sgemm accumulates.
+
+namespace {
+
+    const u32 SIZES[] = { 1, 3, 17, 257 };
+    constexpr u32 PAD = 5;
+
+    // Element (i, j) of op(X) for X stored row-major with row stride ld
+    f32 element(const std::vector<f32>& x, u64 ld, bool transpose, u32 i, u32 j) {
+        return transpose ? x[static_cast<u64>(j) * ld + i] : x[static_cast<u64>(i) * ld + j];
+    }
+
+    struct Case {
+        bool ta, tb;
+        u32 m, n, k;
+        u64 lda, ldb, ldc;
+        std::vector<f32> a, b, c;
+        std::vector<double> expected;   // C + op(A) op(B)
+        std::vector<double> bound;      // rounding allowance per element of C
+    };
+
+    Case make_case(bool ta, bool tb, u32 m, u32 n, u32 k, PRNG& prng) {
+        Case t;
+        t.ta = ta;
+        t.tb = tb;
+        t.m = m;
+        t.n = n;
+        t.k = k;
+        // op(A) is m x k, stored k x m when transposed; likewise B
+        u32 a_rows = ta ? k : m, a_cols = ta ? m : k;
+        u32 b_rows = tb ? n : k, b_cols = tb ? k : n;
+        t.lda = a_cols + PAD;
+        t.ldb = b_cols + PAD;
+        t.ldc = n + PAD;
+        t.a.resize(static_cast<u64>(a_rows) * t.lda);
+        t.b.resize(static_cast<u64>(b_rows) * t.ldb);
+        t.c.resize(static_cast<u64>(m) * t.ldc);
+        for (f32& x : t.a) x = prng.randf() * 2.0f - 1.0f;
+        for (f32& x : t.b) x = prng.randf() * 2.0f - 1.0f;
+        for (f32& x : t.c) x = prng.randf() * 2.0f - 1.0f;
+
+        t.expected.resize(static_cast<u64>(m) * n);
+        t.bound.resize(static_cast<u64>(m) * n);
+        for (u32 i = 0; i < m; i++) {
+            for (u32 j = 0; j < n; j++) {
+                double c0 = t.c[static_cast<u64>(i) * t.ldc + j];
+                double sum = c0;
+                double abs_sum = std::fabs(c0);
+                for (u32 p = 0; p < k; p++) {
+                    double prod = static_cast<double>(element(t.a, t.lda, ta, i, p)) * element(t.b, t.ldb, tb, p, j);
+                    sum += prod;
+                    abs_sum += std::fabs(prod);
+                }
+                t.expected[static_cast<u64>(i) * n + j] = sum;
+                // Any f32 summation order is within k + 1 roundings of this
+                t.bound[static_cast<u64>(i) * n + j] = (k + 1) * static_cast<double>(FLT_EPSILON) * abs_sum;
+            }
+        }
+        return t;
+    }
+
+    // Runs sgemm on a copy of C; false on a wrong element or a write to padding
+    bool matches(const Case& t) {
+        std::vector<f32> c = t.c;
+        Gemm::sgemm(t.ta, t.tb, t.m, t.n, t.k, t.a.data(), t.lda, t.b.data(), t.ldb, c.data(), t.ldc);
+        for (u32 i = 0; i < t.m; i++) {
+            for (u32 j = 0; j < t.ldc; j++) {
+                u64 at = static_cast<u64>(i) * t.ldc + j;
+                if (j >= t.n) {
+                    if (c[at] != t.c[at]) return false;
+                    continue;
+                }
+                u64 e = static_cast<u64>(i) * t.n + j;
+                if (!(std::fabs(c[at] - t.expected[e]) <= t.bound[e])) return false;
+            }
+        }
+        return true;
+    }
+
+} // namespace
+
+int main() {
+    PRNG prng(5);
+    std::vector<Case> cases;
+    for (u32 mode = 0; mode < 4; mode++) {
+        for (u32 m : SIZES) {
+            for (u32 n : SIZES) {
+                for (u32 k : SIZES) cases.push_back(make_case(mode & 1, mode & 2, m, n, k, prng));
+            }
+        }
+    }
+
+    const Gemm::Isa detected = Gemm::isa();
+    const Gemm::Isa isas[] = { Gemm::Isa::Scalar, Gemm::Isa::SSE, Gemm::Isa::AVX2, Gemm::Isa::AVX512 };
+    for (Gemm::Isa isa : isas) {
+        if (!Gemm::set_isa(isa)) {
+            std::printf("%-7s not supported, skipped\n", Gemm::isa_name(isa));
+            continue;
+        }
+        CHECK(Gemm::isa() == isa);
+        u32 failed = 0;
+        for (const Case& t : cases) {
+            if (matches(t)) continue;
+            if (failed++ < 4) {
+                std::fprintf(stderr, "%s: transpose %d%d, m %u n %u k %u wrong\n",
+                    Gemm::isa_name(isa), t.ta, t.tb, t.m, t.n, t.k);
+            }
+        }
+        std::printf("%-7s %zu products, %u wrong\n", Gemm::isa_name(isa), cases.size(), failed);
+        CHECK(failed == 0);
+    }
+    CHECK(Gemm::set_isa(detected));
+
+    return test::exit_code();
+}
@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "TestUtil.hpp"
+#include "ModelContext.hpp"
+#include "ModelTrainingDesc.hpp"
+#include "MnistModel.hpp"
+#include "SparseMatrix.hpp"
+
+// Every compile option computes the gradients of the unfused, unplanned
+// graph, and training gives the same parameters whatever the thread count
+// or input path. With bf16 storage the options agree with each other; a
+// rounded activation can flip a relu, so against f32 only the overall
+// (L2) error is bounded.
+
+namespace {
+
+    constexpr u32 BATCH_SIZE = 37;
+    constexpr f32 F32_TOLERANCE = 1e-4f;
+    constexpr f32 BF16_L2_TOLERANCE = 0.1f;
+
+    struct Result {
+        f32 cost = 0.0f;
+        std::vector<Matrix> grads;   // per parameter, in creation order
+    };
+
+    // Images about 80% zeros like MNIST digits, so the sparse path is taken
+    void fill_batch(ModelContext& model) {
+        model.set_batch_size(BATCH_SIZE);
+        PRNG prng(11);
+        Matrix& x = model.input->val;
+        for (u64 i = 0; i < x.size(); i++) {
+            x.data[i] = prng.randf() < 0.2f ? prng.randf() : 0.0f;
+        }
+        for (u32 c = 0; c < BATCH_SIZE; c++) {
+            model.desired_output->val.data[c] = static_cast<f32>(prng.below(10));
+        }
+    }
+
+    Result gradients(const ModelContext& base, const ModelCompileDesc& desc, bool sparse) {
+        auto model = base.clone();
+        model->compile(desc);
+        fill_batch(*model);
+
+        SparseMatrix csr;
+        if (sparse) {
+            csr.assign(model->input->val);
+            model->input->sparse = &csr;
+        }
+        // The option is in effect, not silently ignored
+        CHECK(desc.recompute == (model->recomputed_ops() > 0));
+
+        Result result;
+        result.cost = model->compute_gradients();
+        model->input->sparse = nullptr;
+
+        for (auto& var : model->all_vars) {
+            if (var->flags & MV_FLAG_PARAMETER) result.grads.push_back(var->grad);
+        }
+        return result;
+    }
+
+    // Largest difference relative to the largest reference value
+    f32 relative_diff(const Matrix& expected, const Matrix& actual) {
+        if (expected.rows != actual.rows || expected.cols != actual.cols) return INFINITY;
+        f32 scale = 0.0f;
+        f32 diff = 0.0f;
+        for (u64 i = 0; i < expected.size(); i++) {
+            scale = std::max(scale, std::fabs(expected.data[i]));
+            diff = std::max(diff, std::fabs(expected.data[i] - actual.data[i]));
+        }
+        return scale > 0.0f ? diff / scale : diff;
+    }
+
+    // Norm of the difference relative to the norm of the reference
+    f32 relative_l2(const Matrix& expected, const Matrix& actual) {
+        if (expected.rows != actual.rows || expected.cols != actual.cols) return INFINITY;
+        double norm = 0.0;
+        double diff = 0.0;
+        for (u64 i = 0; i < expected.size(); i++) {
+            double e = expected.data[i];
+            double d = e - actual.data[i];
+            norm += e * e;
+            diff += d * d;
+        }
+        return static_cast<f32>(norm > 0.0 ? std::sqrt(diff / norm) : std::sqrt(diff));
+    }
+
+    void check_same(const char* name, const Result& expected, const Result& actual, f32 tolerance) {
+        f32 worst = std::fabs(expected.cost - actual.cost) / std::max(1.0f, std::fabs(expected.cost));
+        CHECK(expected.grads.size() == actual.grads.size());
+        for (u64 i = 0; i < std::min(expected.grads.size(), actual.grads.size()); i++) {
+            worst = std::max(worst, relative_diff(expected.grads[i], actual.grads[i]));
+        }
+        std::printf("%-28s max relative difference %.2e\n", name, worst);
+        CHECK(worst <= tolerance);
+    }
+
+    std::unique_ptr<ModelContext> trained(const ModelContext& base, const ModelCompileDesc& compile_desc,
+        ModelTrainingDesc desc, u32 num_threads) {
+        auto model = base.clone();
+        model->compile(compile_desc);
+        desc.num_threads = num_threads;
+        // The loader's shuffle is seeded from the calling thread's stream
+        PRNG::set_seed(12);
+        model->train(desc);
+        return model;
+    }
+
+} // namespace
+
+int main() {
+    PRNG::set_seed(10);
+    ModelContext base;
+    create_mnist_model(base);
+
+    ModelCompileDesc reference_desc;
+    reference_desc.fuse_ops = false;
+    reference_desc.plan_memory = false;
+    reference_desc.sparse_input = false;
+    Result reference = gradients(base, reference_desc, false);
+
+    struct Config {
+        const char* name;
+        bool fuse_ops;
+        bool plan_memory;
+        bool recompute;
+        u64 activation_budget;
+        bool bf16_storage;
+        bool sparse;
+    };
+    const Config configs[] = {
+        { "fused", true, false, false, 0, false, false },
+        { "planned", false, true, false, 0, false, false },
+        { "fused+planned", true, true, false, 0, false, false },
+        { "sparse input", true, true, false, 0, false, true },
+        { "recompute", true, true, true, 0, false, false },
+        { "recompute, budget", true, true, true, 16 << 10, false, false },
+        { "recompute, sparse input", true, true, true, 0, false, true },
+        { "bf16, sparse input", true, true, false, 0, true, true },
+        { "bf16, recompute", true, true, true, 0, true, false },
+        { "bf16, recompute, sparse", true, true, true, 0, true, true },
+    };
+    ModelCompileDesc bf16_desc;
+    bf16_desc.bf16_storage = true;
+    bf16_desc.sparse_input = false;
+    Result bf16_reference = gradients(base, bf16_desc, false);
+    f32 bf16_error = 0.0f;
+    for (u64 i = 0; i < reference.grads.size(); i++) {
+        bf16_error = std::max(bf16_error, relative_l2(reference.grads[i], bf16_reference.grads[i]));
+    }
+    std::printf("%-28s max relative L2 error %.2e\n", "bf16 against f32", bf16_error);
+    CHECK(bf16_error <= BF16_L2_TOLERANCE);
+
+    for (const Config& config : configs) {
+        ModelCompileDesc desc;
+        desc.fuse_ops = config.fuse_ops;
+        desc.plan_memory = config.plan_memory;
+        desc.recompute = config.recompute;
+        desc.activation_budget = config.activation_budget;
+        desc.bf16_storage = config.bf16_storage;
+        desc.sparse_input = config.sparse;
+        Result result = gradients(base, desc, config.sparse);
+        check_same(config.name, config.bf16_storage ? bf16_reference : reference, result, F32_TOLERANCE);
+    }
+
+    // A label that is not a class index makes the cost NaN; the next valid
+    // batch is computed afresh
+    for (f32 label : { -1.0f, 2.5f, NAN, 10.0f }) {
+        auto model = base.clone();
+        model->compile();
+        fill_batch(*model);
+        f32 good = model->desired_output->val.data[0];
+        model->desired_output->val.data[0] = label;
+        CHECK(std::isnan(model->compute_gradients()));
+        model->desired_output->val.data[0] = good;
+        CHECK(std::isfinite(model->compute_gradients()));
+    }
+
+    // A few steps of training: data-parallel replicas and the sparse input
+    // path end where one thread on dense input does
+    PRNG prng(13);
+    test::TempFiles files;
+    auto train_images = test::synthetic_dataset(files, "train_images", 640, 784, false, prng);
+    auto train_labels = test::synthetic_dataset(files, "train_labels", 640, 1, true, prng);
+    CHECK(train_images && train_labels);
+    if (test::failures() != 0) return test::exit_code();
+
+    ModelTrainingDesc train_desc;
+    train_desc.train_images = train_images.get();
+    train_desc.train_labels = train_labels.get();
+    train_desc.test_images = train_images.get();
+    train_desc.test_labels = train_labels.get();
+    train_desc.epochs = 2;
+    train_desc.batch_size = 64;
+    train_desc.learning_rate = 0.05f;
+    train_desc.verbose = false;
+
+    ModelCompileDesc dense_desc;
+    dense_desc.sparse_input = false;
+    auto expected = trained(base, dense_desc, train_desc, 1);
+    Matrix expected_params = expected->param_slab();
+    CHECK(relative_diff(base.param_slab(), expected_params) > F32_TOLERANCE);
+
+    struct Run {
+        const char* name;
+        bool sparse;
+        u32 threads;
+    };
+    const Run runs[] = {
+        { "train, 4 threads", false, 4 },
+        { "train, sparse input", true, 1 },
+        { "train, sparse, 3 threads", true, 3 },
+    };
+    for (const Run& run : runs) {
+        ModelCompileDesc desc;
+        desc.sparse_input = run.sparse;
+        auto model = trained(base, desc, train_desc, run.threads);
+        f32 diff = relative_diff(expected_params, model->param_slab());
+        std::printf("%-28s max relative difference %.2e\n", run.name, diff);
+        CHECK(diff <= F32_TOLERANCE);
+    }
+
+    return test::exit_code();
+}
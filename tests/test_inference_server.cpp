@@ -0,0 +1,157 @@
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "TestUtil.hpp"
+#include "InferenceModel.hpp"
+#include "InferenceServer.hpp"
+#include "MnistModel.hpp"
+#include "Socket.hpp"
+
+// The server's answers match direct prediction; a client that stops reading
+// does not hold up others on the same worker; requests split across writes
+// are put back together; a client that shuts down its sending side still
+// gets every response it is owed.
+
+namespace {
+
+    constexpr u32 INPUT_SIZE = 784;
+    constexpr u32 OUTPUT_SIZE = 10;
+    constexpr u32 REQUEST_BYTES = 4 * (1 + INPUT_SIZE);
+    constexpr u32 RESPONSE_BYTES = 4 * (2 + OUTPUT_SIZE);
+    constexpr int TIMEOUT_MS = 10000;
+
+    std::vector<u8> make_request(u32 id, const f32* sample) {
+        std::vector<u8> request(REQUEST_BYTES);
+        std::memcpy(request.data(), &id, sizeof(u32));
+        std::memcpy(request.data() + 4, sample, INPUT_SIZE * sizeof(f32));
+        return request;
+    }
+
+    // Like Socket::recv_all, but gives up after TIMEOUT_MS without data
+    bool recv_within(int fd, void* data, u64 bytes) {
+        u8* p = static_cast<u8*>(data);
+        while (bytes > 0) {
+            pollfd pfd = { fd, POLLIN, 0 };
+            int ready = poll(&pfd, 1, TIMEOUT_MS);
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready <= 0) return false;
+            ssize_t got = ::recv(fd, p, bytes, 0);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            p += got;
+            bytes -= static_cast<u64>(got);
+        }
+        return true;
+    }
+
+    // Reads count responses and checks them against the expected labels
+    void check_responses(int fd, u32 count, const std::vector<u32>& expected) {
+        std::vector<u8> response(RESPONSE_BYTES);
+        std::vector<bool> seen(expected.size(), false);
+        for (u32 i = 0; i < count; i++) {
+            bool got = recv_within(fd, response.data(), response.size());
+            CHECK(got);
+            if (!got) return;
+            u32 id;
+            u32 label;
+            std::memcpy(&id, response.data(), sizeof(u32));
+            std::memcpy(&label, response.data() + 4, sizeof(u32));
+            CHECK(id < expected.size() && !seen[id]);
+            if (id >= expected.size()) continue;
+            seen[id] = true;
+            CHECK(label == expected[id]);
+        }
+    }
+
+} // namespace
+
+int main() {
+    PRNG::set_seed(4);
+    PRNG prng(5);
+    test::TempFiles files;
+
+    ModelContext trained;
+    create_mnist_model(trained);
+    trained.compile();
+    std::unique_ptr<InferenceModel> model = trained.freeze();
+
+    constexpr u32 NUM_SAMPLES = 64;
+    Matrix samples(NUM_SAMPLES, INPUT_SIZE);
+    samples.fill_rand(0.0f, 1.0f);
+    std::vector<u32> expected(NUM_SAMPLES);
+    model->predict(samples, expected.data(), nullptr, 1);
+
+    // One worker, so a worker blocked on any client would stall the rest
+    std::string path = files.path("server.sock");
+    std::string address = "unix:" + path;
+    InferenceServerDesc desc;
+    desc.num_workers = 1;
+    desc.max_wait_us = 0;
+    auto server = InferenceServer::start(*model, address.c_str(), desc);
+    CHECK(server != nullptr);
+    if (!server) return test::exit_code();
+
+    Socket::Endpoint ep;
+    Socket::parse_address(address.c_str(), ep);
+
+    // A client that keeps sending and never reads, until the server stops
+    // reading from it
+    int stalled = Socket::connect_to(ep);
+    CHECK(stalled >= 0);
+    Socket::set_nonblocking(stalled);
+    u32 stalled_sent = 0;
+    auto stall_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TIMEOUT_MS);
+    while (std::chrono::steady_clock::now() < stall_deadline) {
+        std::vector<u8> request = make_request(stalled_sent % NUM_SAMPLES, samples.data + (stalled_sent % NUM_SAMPLES) * INPUT_SIZE);
+        u64 offset = 0;
+        while (offset < request.size()) {
+            ssize_t sent = ::send(stalled, request.data() + offset, request.size() - offset, MSG_NOSIGNAL);
+            if (sent > 0) {
+                offset += static_cast<u64>(sent);
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) continue;
+            pollfd pfd = { stalled, POLLOUT, 0 };
+            if (poll(&pfd, 1, 500) <= 0) break;
+        }
+        if (offset < request.size()) break;
+        stalled_sent++;
+    }
+    CHECK(stalled_sent * static_cast<u64>(RESPONSE_BYTES) > (1u << 20));
+
+    // Others are still answered, including a request sent in pieces
+    int client = Socket::connect_to(ep);
+    CHECK(client >= 0);
+    for (u32 id = 0; id < NUM_SAMPLES; id++) {
+        std::vector<u8> request = make_request(id, samples.data + id * INPUT_SIZE);
+        if (id == 0) {
+            CHECK(Socket::send_all(client, request.data(), 100));
+            usleep(20000);
+            CHECK(Socket::send_all(client, request.data() + 100, request.size() - 100));
+        } else {
+            CHECK(Socket::send_all(client, request.data(), request.size()));
+        }
+    }
+    check_responses(client, NUM_SAMPLES, expected);
+
+    // After a half-close every queued response still arrives
+    for (u32 id = 0; id < NUM_SAMPLES; id++) {
+        std::vector<u8> request = make_request(id, samples.data + id * INPUT_SIZE);
+        CHECK(Socket::send_all(client, request.data(), request.size()));
+    }
+    ::shutdown(client, SHUT_WR);
+    check_responses(client, NUM_SAMPLES, expected);
+    u8 extra;
+    CHECK(!recv_within(client, &extra, 1));
+
+    ::close(client);
+    ::close(stalled);
+    server.reset();
+    return test::exit_code();
+}
@@ -0,0 +1,103 @@
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "TestUtil.hpp"
+#include "Optimizer.hpp"
+
+// Every optimizer against a double precision reference written from the
+// textbook update rules rather than the folded per-step constants. The
+// parameter count is not a multiple of 16, so both the SIMD body and the
+// scalar tail run, and weight decay is on so the L2 and decoupled forms are
+// both covered.
+
+namespace {
+
+    constexpr u32 PARAM_COUNT = 37;
+    constexpr u32 STEPS = 5;
+    constexpr f32 GRAD_SCALE = 1.0f / 32.0f;
+    // Parameters start within 0.25 of zero, where an f32 ulp is 3e-8
+    constexpr double TOLERANCE = 4e-8;
+
+    struct Reference {
+        OptimizerDesc desc;
+        std::vector<double> p, m, v;
+        u32 t = 0;
+
+        Reference(const OptimizerDesc& desc, const std::vector<f32>& params)
+            : desc(desc), p(params.begin(), params.end()), m(params.size()), v(params.size()) {}
+
+        void step(const std::vector<f32>& grads, double lr) {
+            t++;
+            double wd = desc.weight_decay;
+            double b1 = desc.beta1;
+            double b2 = desc.beta2;
+            for (u64 i = 0; i < p.size(); i++) {
+                double g = static_cast<double>(GRAD_SCALE) * grads[i];
+                switch (desc.kind) {
+                case OptimizerKind::SGD:
+                    p[i] -= lr * (g + wd * p[i]);
+                    break;
+                case OptimizerKind::Momentum:
+                    g += wd * p[i];
+                    m[i] = desc.momentum * m[i] + g;
+                    p[i] -= lr * (desc.nesterov ? g + desc.momentum * m[i] : m[i]);
+                    break;
+                case OptimizerKind::Adam:
+                case OptimizerKind::AdamW: {
+                    bool decoupled = desc.kind == OptimizerKind::AdamW;
+                    if (!decoupled) g += wd * p[i];
+                    m[i] = b1 * m[i] + (1.0 - b1) * g;
+                    v[i] = b2 * v[i] + (1.0 - b2) * g * g;
+                    double m_hat = m[i] / (1.0 - std::pow(b1, t));
+                    double v_hat = v[i] / (1.0 - std::pow(b2, t));
+                    if (decoupled) p[i] -= lr * wd * p[i];
+                    p[i] -= lr * m_hat / (std::sqrt(v_hat) + desc.epsilon);
+                    break;
+                }
+                }
+            }
+        }
+    };
+
+    void check(const char* name, OptimizerDesc desc, f32 lr, double tolerance = TOLERANCE) {
+        desc.weight_decay = 0.01f;
+        PRNG prng(7);
+        std::vector<f32> params(PARAM_COUNT);
+        for (f32& x : params) x = 0.5f * prng.randf() - 0.25f;
+        Reference ref(desc, params);
+
+        auto opt = Optimizer::create(desc, PARAM_COUNT);
+        Matrix p = Matrix::view(1, PARAM_COUNT, params.data());
+        std::vector<f32> grads(PARAM_COUNT);
+        double max_err = 0.0;
+        for (u32 s = 0; s < STEPS; s++) {
+            for (f32& g : grads) g = 32.0f * (prng.randf() - 0.5f);
+            opt->step(p, Matrix::view(1, PARAM_COUNT, grads.data()), lr, GRAD_SCALE);
+            ref.step(grads, lr);
+            for (u32 i = 0; i < PARAM_COUNT; i++) max_err = std::fmax(max_err, std::fabs(params[i] - ref.p[i]));
+        }
+        std::printf("%-9s max error %.3g\n", name, max_err);
+        CHECK(max_err <= tolerance);
+    }
+
+} // namespace
+
+int main() {
+    // SGD folds the decay into one f32 factor, 1 - lr * weight_decay, whose
+    // rounding (up to 3e-8 relative) compounds over the steps
+    OptimizerDesc desc;
+    check("sgd", desc, 0.01f, 1e-7);
+
+    desc.kind = OptimizerKind::Momentum;
+    check("momentum", desc, 0.01f);
+    desc.nesterov = true;
+    check("nesterov", desc, 0.01f);
+
+    desc.kind = OptimizerKind::Adam;
+    check("adam", desc, 0.001f);
+    desc.kind = OptimizerKind::AdamW;
+    check("adamw", desc, 0.001f);
+
+    return test::exit_code();
+}
@@ -0,0 +1,228 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "TestUtil.hpp"
+#include "PRNG.hpp"
+
+// PRNG against a transcription of the reference splitmix64 and xoshiro256**
+// (with its jump functions), the distributions of below(), fill_uniform()
+// and fill_normal(), and the bulk fills being bit-identical on every ISA the
+// CPU runs, for counts that end in each kernel's scalar tail.
+
+namespace {
+
+    struct Reference {
+        u64 s[4];
+
+        static u64 splitmix64(u64& x) {
+            u64 z = (x += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        static u64 rotl(u64 x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        explicit Reference(u64 seed) {
+            for (u64& word : s) word = splitmix64(seed);
+        }
+
+        Reference(u64 a, u64 b, u64 c, u64 d) : s{ a, b, c, d } {}
+
+        u64 next() {
+            u64 result = rotl(s[1] * 5, 7) * 9;
+            u64 t = s[1] << 17;
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = rotl(s[3], 45);
+            return result;
+        }
+
+        void jump(const u64 (&poly)[4]) {
+            u64 acc[4] = {};
+            for (u32 i = 0; i < 4; i++) {
+                for (u32 b = 0; b < 64; b++) {
+                    if (poly[i] & (1ull << b)) {
+                        for (u32 w = 0; w < 4; w++) acc[w] ^= s[w];
+                    }
+                    next();
+                }
+            }
+            std::memcpy(s, acc, sizeof(s));
+        }
+    };
+
+    constexpr u64 JUMP[4] = { 0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull,
+        0xa9582618e03fc9aaull, 0x39abdc4529b1661cull };
+    constexpr u64 LONG_JUMP[4] = { 0x76e15d3efefdcbbfull, 0xc5004e441c522fb3ull,
+        0x77710069854ee241ull, 0x39109bb02acbe635ull };
+
+    bool same_stream(PRNG a, Reference b, u32 count) {
+        for (u32 i = 0; i < count; i++) {
+            if (a.next() != b.next()) return false;
+        }
+        return true;
+    }
+
+    void check_outputs() {
+        // Published first outputs of splitmix64 from 0 and of xoshiro256**
+        // from the state { 1, 2, 3, 4 }
+        u64 x = 0;
+        CHECK(Reference::splitmix64(x) == 0xE220A8397B1DCDAFull);
+        Reference small(1, 2, 3, 4);
+        CHECK(small.next() == 11520);
+        CHECK(small.next() == 0);
+
+        for (u64 seed : { 0ull, 1ull, 42ull, ~0ull }) CHECK(same_stream(PRNG(seed), Reference(seed), 1000));
+
+        // The narrower outputs take the top bits
+        PRNG a(5);
+        Reference b(5);
+        CHECK(a.rand() == static_cast<u32>(b.next() >> 32));
+        CHECK(a.randf() == static_cast<f32>(b.next() >> 40) / 16777216.0f);
+    }
+
+    void check_jumps() {
+        PRNG a(9);
+        Reference b(9);
+        a.jump();
+        b.jump(JUMP);
+        CHECK(same_stream(a, b, 100));
+
+        a = PRNG(9);
+        b = Reference(9);
+        a.jump(3);
+        for (u32 i = 0; i < 3; i++) b.jump(JUMP);
+        CHECK(same_stream(a, b, 100));
+
+        a = PRNG(9);
+        b = Reference(9);
+        a.long_jump();
+        b.jump(LONG_JUMP);
+        CHECK(same_stream(a, b, 100));
+
+        // A jump is a fixed advance, so it commutes with next()
+        PRNG c(11);
+        PRNG d(11);
+        c.next();
+        c.jump();
+        d.jump();
+        d.next();
+        for (u32 i = 0; i < 100; i++) CHECK(c.next() == d.next());
+
+        // Jumped and long-jumped streams differ from the original
+        PRNG e(11);
+        PRNG f = e;
+        PRNG g = e;
+        f.jump();
+        g.long_jump();
+        u64 first = e.next();
+        CHECK(f.next() != first && g.next() != first);
+    }
+
+    void check_below() {
+        PRNG prng(13);
+        for (u32 n : { 1u, 2u, 3u, 10u, 1000u, 0x80000001u, 0xFFFFFFFFu }) {
+            bool in_range = true;
+            for (u32 i = 0; i < 10000; i++) in_range = in_range && prng.below(n) < n;
+            CHECK(in_range);
+        }
+
+        // Every value of a small range, each about equally often
+        constexpr u32 N = 10;
+        constexpr u32 DRAWS = 100000;
+        u32 counts[N] = {};
+        for (u32 i = 0; i < DRAWS; i++) counts[prng.below(N)]++;
+        for (u32 c : counts) CHECK(std::fabs(static_cast<double>(c) - DRAWS / N) < 5 * std::sqrt(DRAWS / N));
+    }
+
+    void moments(const std::vector<f32>& v, double& mean, double& var) {
+        mean = 0.0;
+        for (f32 x : v) mean += x;
+        mean /= v.size();
+        var = 0.0;
+        for (f32 x : v) var += (x - mean) * (x - mean);
+        var /= v.size() - 1;
+    }
+
+    // Means within five standard errors, variances within 2%
+    void check_distributions() {
+        constexpr u32 COUNT = 1 << 20;
+        std::vector<f32> v(COUNT);
+        double mean, var;
+        PRNG prng(17);
+
+        prng.fill_uniform(v.data(), COUNT, -2.0f, 3.0f);
+        bool in_range = true;
+        for (f32 x : v) in_range = in_range && x >= -2.0f && x < 3.0f;
+        CHECK(in_range);
+        moments(v, mean, var);
+        CHECK(std::fabs(mean - 0.5) < 5 * std::sqrt(25.0 / 12 / COUNT));
+        CHECK(std::fabs(var / (25.0 / 12) - 1) < 0.02);
+
+        prng.fill_normal(v.data(), COUNT, 1.0f, 2.0f);
+        bool finite = true;
+        for (f32 x : v) finite = finite && std::isfinite(x);
+        CHECK(finite);
+        moments(v, mean, var);
+        CHECK(std::fabs(mean - 1.0) < 5 * 2.0 / std::sqrt(COUNT));
+        CHECK(std::fabs(var / 4.0 - 1) < 0.02);
+
+        for (u32 i = 0; i < COUNT; i++) v[i] = prng.randf();
+        moments(v, mean, var);
+        CHECK(std::fabs(mean - 0.5) < 5 * std::sqrt(1.0 / 12 / COUNT));
+        CHECK(std::fabs(var * 12 - 1) < 0.02);
+    }
+
+    // Each ISA fills from copies of one generator; counts end inside a SIMD
+    // vector, inside a lane block and past a chunk
+    void check_isas() {
+        const PRNG::FillIsa detected = PRNG::fill_isa();
+        const PRNG::FillIsa isas[] = { PRNG::FillIsa::Scalar, PRNG::FillIsa::AVX2, PRNG::FillIsa::AVX512 };
+        const char* names[] = { "scalar", "avx2", "avx512" };
+        const PRNG seed(19);
+
+        for (u64 count : { 1ull, 7ull, 9ull, 17ull, 23ull, 1023ull, 1025ull, 3001ull }) {
+            std::vector<f32> uniform_ref, normal_ref;
+            u64 next_ref = 0;
+            for (u32 k = 0; k < 3; k++) {
+                if (!PRNG::set_fill_isa(isas[k])) {
+                    if (count == 1) std::printf("%s: not supported, skipped\n", names[k]);
+                    continue;
+                }
+                PRNG prng = seed;
+                std::vector<f32> uniform(count), normal(count);
+                prng.fill_uniform(uniform.data(), count, -1.0f, 3.0f);
+                prng.fill_normal(normal.data(), count, 0.5f, 1.5f);
+                u64 next = prng.next();
+                if (uniform_ref.empty()) {
+                    uniform_ref = uniform;
+                    normal_ref = normal;
+                    next_ref = next;
+                    continue;
+                }
+                CHECK(std::memcmp(uniform.data(), uniform_ref.data(), count * sizeof(f32)) == 0);
+                CHECK(std::memcmp(normal.data(), normal_ref.data(), count * sizeof(f32)) == 0);
+                CHECK(next == next_ref);
+            }
+        }
+        CHECK(PRNG::set_fill_isa(detected));
+    }
+
+} // namespace
+
+int main() {
+    check_outputs();
+    check_jumps();
+    check_below();
+    check_distributions();
+    check_isas();
+    return test::exit_code();
+}
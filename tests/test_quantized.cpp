@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "TestUtil.hpp"
+#include "InferenceModel.hpp"
+#include "ModelContext.hpp"
+#include "ModelTrainingDesc.hpp"
+#include "MnistModel.hpp"
+#include "QuantizedLinear.hpp"
+
+// The int8 model of a trained network stays close to the f32 one: output
+// probabilities within a few hundredths, and nearly every label the same.
+// Products fed straight from u8 dataset rows give exactly what they give on
+// the gathered f32 batch.
+
+namespace {
+
+    constexpr u32 NUM_SAMPLES = 1000;
+    constexpr f32 MAX_PROB_DIFF = 0.05f;
+    constexpr f32 MIN_AGREEMENT = 0.97f;
+
+    bool same_bits(const Matrix& a, const Matrix& b) {
+        return a.size() == b.size() && std::memcmp(a.data, b.data, a.size() * sizeof(f32)) == 0;
+    }
+
+    // Odd shapes: a k tail (cols % 4), a sample tail and a partial row block
+    void check_byte_rows(PRNG& prng) {
+        constexpr u32 ROWS = 21;
+        constexpr u32 COLS = 83;
+        constexpr u32 STRIDE = 90;
+        Matrix w(ROWS, COLS);
+        Matrix bias(ROWS, 1);
+        for (u64 i = 0; i < w.size(); i++) w.data[i] = prng.randf() - 0.5f;
+        for (u32 r = 0; r < ROWS; r++) bias.data[r] = prng.randf();
+
+        for (u32 batch : { 1u, 16u, 37u, 300u }) {
+            std::vector<u8> stored(static_cast<u64>(batch) * STRIDE);
+            for (u8& v : stored) v = static_cast<u8>(prng.below(256));
+            ByteRows rows;
+            rows.data = stored.data();
+            rows.stride = STRIDE;
+            rows.cols = COLS;
+            rows.count = batch;
+            rows.scale = 1.0f / 255.0f;
+
+            Matrix x(COLS, batch);
+            for (u32 b = 0; b < batch; b++) {
+                for (u32 k = 0; k < COLS; k++) x.at(k, b) = stored[b * STRIDE + k] * rows.scale + rows.offset;
+            }
+            QuantizedLinear q = Quant::quantize(w, 0.0f, 0.8f);
+            Matrix expected(ROWS, batch);
+            Matrix actual(ROWS, batch);
+            CHECK(Quant::linear(q, x, expected, &bias));
+            CHECK(Quant::linear(q, rows, actual, &bias));
+            CHECK(same_bits(expected, actual));
+        }
+    }
+
+} // namespace
+
+int main() {
+    PRNG::set_seed(20);
+    PRNG prng(21);
+    test::TempFiles files;
+    auto images = test::synthetic_dataset(files, "images", NUM_SAMPLES, 784, false, prng);
+    auto labels = test::synthetic_dataset(files, "labels", NUM_SAMPLES, 1, true, prng);
+    CHECK(images && labels);
+    if (test::failures() != 0) return test::exit_code();
+
+    ModelContext model;
+    create_mnist_model(model);
+    model.compile();
+    ModelTrainingDesc desc;
+    desc.train_images = images.get();
+    desc.train_labels = labels.get();
+    desc.test_images = images.get();
+    desc.test_labels = labels.get();
+    desc.epochs = 2;
+    desc.verbose = false;
+    model.train(desc);
+
+    auto frozen = model.freeze();
+    auto quantized = frozen->quantized(*images);
+    CHECK(frozen && quantized && quantized->is_quantized());
+    if (test::failures() != 0) return test::exit_code();
+    CHECK(quantized->weight_bytes() < frozen->weight_bytes());
+    // No f32 copy of a quantized W stays resident: past the weights the
+    // forward pass reads, both models hold the same activations
+    CHECK(quantized->memory_bytes() - quantized->weight_bytes()
+        == frozen->memory_bytes() - frozen->weight_bytes());
+
+    u32 out = frozen->output_size();
+    std::vector<u32> expected(NUM_SAMPLES);
+    std::vector<u32> actual(NUM_SAMPLES);
+    std::vector<f32> expected_probs(static_cast<u64>(NUM_SAMPLES) * out);
+    std::vector<f32> actual_probs(static_cast<u64>(NUM_SAMPLES) * out);
+    frozen->predict(*images, expected.data(), expected_probs.data(), 1);
+    quantized->predict(*images, actual.data(), actual_probs.data(), 1);
+
+    f32 max_diff = 0.0f;
+    for (u64 i = 0; i < expected_probs.size(); i++) {
+        max_diff = std::max(max_diff, std::fabs(expected_probs[i] - actual_probs[i]));
+    }
+    u32 agree = 0;
+    for (u32 i = 0; i < NUM_SAMPLES; i++) agree += expected[i] == actual[i];
+    f32 agreement = static_cast<f32>(agree) / NUM_SAMPLES;
+    std::printf("int8: max probability difference %.4f, %.1f%% of labels agree\n", max_diff, agreement * 100.0f);
+    CHECK(max_diff <= MAX_PROB_DIFF);
+    CHECK(agreement >= MIN_AGREEMENT);
+
+    // The Dataset is u8, so predict() left the batches in its rows; the
+    // same images as an f32 matrix go through the gathered batch
+    Matrix image_rows(NUM_SAMPLES, 784);
+    for (u32 r = 0; r < NUM_SAMPLES; r++) {
+        for (u32 c = 0; c < 784; c++) image_rows.at(r, c) = images->value(r, c);
+    }
+    std::vector<u32> gathered(NUM_SAMPLES);
+    std::vector<f32> gathered_probs(actual_probs.size());
+    quantized->predict(image_rows, gathered.data(), gathered_probs.data(), 1);
+    CHECK(gathered == actual);
+    CHECK(gathered_probs == actual_probs);
+    check_byte_rows(prng);
+
+    // The single-sample path gives what the batched one does
+    std::vector<f32> sample(784);
+    for (u32 c = 0; c < 784; c++) sample[c] = images->value(7, c);
+    CHECK(quantized->predict_label(sample.data()) == actual[7]);
+
+    // Quantizing again keeps the int8 products as they are
+    auto again = quantized->quantized(*images);
+    CHECK(again && again->weight_bytes() == quantized->weight_bytes());
+    if (again) {
+        std::vector<u32> again_labels(NUM_SAMPLES);
+        again->predict(*images, again_labels.data(), nullptr, 1);
+        CHECK(again_labels == actual);
+    }
+
+    return test::exit_code();
+}
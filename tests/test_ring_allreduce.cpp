@@ -0,0 +1,187 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "TestUtil.hpp"
+#include "ModelContext.hpp"
+#include "ModelTrainingDesc.hpp"
+#include "MnistModel.hpp"
+#include "RingAllReduce.hpp"
+
+// Forks WORLD_SIZE ranks that connect over a Unix socket ring. Each rank
+// checks its own sums and broadcasts and exits with its failure count; after
+// one epoch of data-parallel training each writes its parameter slab, which
+// the parent compares byte for byte.
+
+namespace {
+
+    constexpr u32 WORLD_SIZE = 3;
+    constexpr u32 NUM_TRAIN = 600;
+    constexpr u32 NUM_TEST = 100;
+
+    // Small integers, so sums over ranks are exact in any order
+    f32 value(u32 rank, u64 i) {
+        return static_cast<f32>((i * 7 + rank * 3) % 11) - 5.0f;
+    }
+
+    f32 sum_over_ranks(u64 i) {
+        f32 sum = 0.0f;
+        for (u32 r = 0; r < WORLD_SIZE; r++) sum += value(r, i);
+        return sum;
+    }
+
+    void fill(std::vector<f32>& data, u32 rank, u64 offset = 0) {
+        for (u64 i = 0; i < data.size(); i++) data[i] = value(rank, offset + i);
+    }
+
+    bool all_summed(const std::vector<f32>& data, u64 offset = 0) {
+        for (u64 i = 0; i < data.size(); i++) {
+            if (data[i] != sum_over_ranks(offset + i)) return false;
+        }
+        return true;
+    }
+
+    void check_all_reduce(RingAllReduce& ring) {
+        // Fewer elements than ranks leaves some chunks empty; 1001 splits unevenly
+        for (u64 count : { 1ull, 2ull, 1001ull }) {
+            std::vector<f32> data(count);
+            fill(data, ring.rank());
+            CHECK(ring.all_reduce(data.data(), count));
+            CHECK(all_summed(data));
+        }
+
+        // Spans of one reduction are summed as if concatenated
+        std::vector<f32> a(5), b(300), c(64);
+        fill(a, ring.rank(), 0);
+        fill(b, ring.rank(), 5);
+        fill(c, ring.rank(), 305);
+        CHECK(ring.all_reduce({ { a.data(), a.size() }, { b.data(), b.size() }, { c.data(), c.size() } }));
+        CHECK(all_summed(a, 0) && all_summed(b, 5) && all_summed(c, 305));
+    }
+
+    void check_broadcast(RingAllReduce& ring) {
+        // More than one forwarded piece, from every root
+        constexpr u64 COUNT = 40000;
+        for (u32 root = 0; root < WORLD_SIZE; root++) {
+            std::vector<f32> data(COUNT, -1.0f);
+            if (ring.rank() == root) fill(data, root);
+            CHECK(ring.broadcast(data.data(), COUNT, root));
+            bool same = true;
+            for (u64 i = 0; i < COUNT; i++) same = same && data[i] == value(root, i);
+            CHECK(same);
+        }
+    }
+
+    // Several multi-span buckets in flight on the communication thread at once
+    void check_queued(RingAllReduce& ring) {
+        constexpr u32 BUCKETS = 4;
+        std::vector<std::vector<f32>> parts(BUCKETS * 2);
+        for (u32 p = 0; p < parts.size(); p++) {
+            parts[p].resize(17 + p * 129);
+            fill(parts[p], ring.rank(), p * 1000);
+        }
+        for (u32 b = 0; b < BUCKETS; b++) {
+            std::vector<f32>& x = parts[2 * b];
+            std::vector<f32>& y = parts[2 * b + 1];
+            ring.start({ { x.data(), x.size() }, { y.data(), y.size() } });
+        }
+        CHECK(ring.wait());
+        for (u32 p = 0; p < parts.size(); p++) CHECK(all_summed(parts[p], p * 1000));
+    }
+
+    // Each rank starts from different weights; rank 0's are broadcast and the
+    // summed gradients keep every rank's in step
+    void train_epoch(RingAllReduce& ring, ModelTrainingDesc desc, const std::string& slab_path) {
+        PRNG::set_seed(10 + ring.rank());
+        ModelContext model;
+        create_mnist_model(model);
+        model.compile();
+        desc.ring = &ring;
+        model.train(desc);
+
+        Matrix slab = model.param_slab();
+        CHECK(test::write_file(slab_path, slab.data, slab.size() * sizeof(f32)));
+    }
+
+    int run_rank(u32 rank, const std::string& address, const ModelTrainingDesc& desc,
+        const std::string& slab_path) {
+        auto ring = RingAllReduce::connect(address.c_str(), rank, WORLD_SIZE, 10000);
+        CHECK(ring != nullptr);
+        if (ring) {
+            CHECK(ring->rank() == rank && ring->world_size() == WORLD_SIZE);
+            check_all_reduce(*ring);
+            check_broadcast(*ring);
+            check_queued(*ring);
+            train_epoch(*ring, desc, slab_path);
+        }
+        return test::exit_code();
+    }
+
+    std::vector<u8> read_file(const std::string& path) {
+        std::vector<u8> bytes;
+        FILE* f = std::fopen(path.c_str(), "rb");
+        if (!f) return bytes;
+        u8 buf[1 << 12];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) bytes.insert(bytes.end(), buf, buf + n);
+        std::fclose(f);
+        return bytes;
+    }
+
+} // namespace
+
+int main() {
+    // A tcp: list needs one entry per rank
+    CHECK(RingAllReduce::connect("tcp:127.0.0.1:1,127.0.0.1:2", 0, WORLD_SIZE, 0) == nullptr);
+
+    PRNG prng(2);
+    test::TempFiles files;
+    auto train_images = test::synthetic_dataset(files, "train_images", NUM_TRAIN, 784, false, prng);
+    auto train_labels = test::synthetic_dataset(files, "train_labels", NUM_TRAIN, 1, true, prng);
+    auto test_images = test::synthetic_dataset(files, "test_images", NUM_TEST, 784, false, prng);
+    auto test_labels = test::synthetic_dataset(files, "test_labels", NUM_TEST, 1, true, prng);
+    CHECK(train_images && train_labels && test_images && test_labels);
+    if (test::failures() != 0) return test::exit_code();
+
+    ModelTrainingDesc desc;
+    desc.train_images = train_images.get();
+    desc.train_labels = train_labels.get();
+    desc.test_images = test_images.get();
+    desc.test_labels = test_labels.get();
+    desc.epochs = 1;
+    desc.batch_size = 32;
+    desc.verbose = false;
+
+    // Socket files are PREFIX.rank and are removed once connected
+    std::string address = "unix:" + files.path("ring");
+    std::vector<std::string> slab_paths;
+    for (u32 r = 0; r < WORLD_SIZE; r++) slab_paths.push_back(files.path("slab" + std::to_string(r)));
+
+    std::fflush(nullptr);
+    std::vector<pid_t> pids;
+    for (u32 r = 0; r < WORLD_SIZE; r++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int code = run_rank(r, address, desc, slab_paths[r]);
+            std::fflush(nullptr);
+            _exit(code);
+        }
+        CHECK(pid > 0);
+        if (pid > 0) pids.push_back(pid);
+    }
+    for (pid_t pid : pids) {
+        int status = 0;
+        CHECK(waitpid(pid, &status, 0) == pid);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    std::vector<u8> slab0 = read_file(slab_paths[0]);
+    CHECK(!slab0.empty());
+    for (u32 r = 1; r < WORLD_SIZE; r++) CHECK(read_file(slab_paths[r]) == slab0);
+
+    return test::exit_code();
+}
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <cmath>
+
+#include "TestUtil.hpp"
+#include "ModelContext.hpp"
+#include "MnistModel.hpp"
+
+// compile() with static kernels keeps what the caller put in the input and
+// label vars, and the static forward pass matches the graph's.
+
+namespace {
+
+    constexpr u32 BATCH_SIZE = 21;
+
+    void fill_batch(ModelContext& model, u32 seed) {
+        model.set_batch_size(BATCH_SIZE);
+        PRNG prng(seed);
+        prng.fill_uniform(model.input->val.data, model.input->val.size());
+        for (u32 c = 0; c < BATCH_SIZE; c++) {
+            model.desired_output->val.data[c] = static_cast<f32>(prng.below(10));
+        }
+    }
+
+    bool same(const Matrix& a, const Matrix& b) {
+        return a.rows == b.rows && a.cols == b.cols && std::equal(a.data, a.data + a.size(), b.data);
+    }
+
+} // namespace
+
+int main() {
+    PRNG::set_seed(6);
+
+    ModelContext reference;
+    create_mnist_model(reference);
+    auto model = reference.clone();
+    reference.compile();
+
+    fill_batch(*model, 7);
+    Matrix input = model->input->val;
+    Matrix labels = model->desired_output->val;
+
+    ModelCompileDesc desc;
+    desc.static_kernels = true;
+    model->compile(desc);
+    CHECK(model->uses_static_kernels());
+    CHECK(model->batch_size == BATCH_SIZE);
+    CHECK(same(model->input->val, input));
+    CHECK(same(model->desired_output->val, labels));
+
+    // Compiling again, now fused, keeps them too
+    model->compile(desc);
+    CHECK(same(model->input->val, input));
+
+    fill_batch(reference, 7);
+    reference.feedforward();
+    model->feedforward();
+    const Matrix& expected = reference.output->val;
+    const Matrix& actual = model->output->val;
+    CHECK(expected.rows == actual.rows && expected.cols == actual.cols);
+    f32 max_diff = 0.0f;
+    for (u64 i = 0; i < expected.size(); i++) {
+        max_diff = std::max(max_diff, std::fabs(expected.data[i] - actual.data[i]));
+    }
+    CHECK(max_diff <= 1e-5f);
+
+    return test::exit_code();
+}
@@ -0,0 +1,117 @@
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "TestUtil.hpp"
+#include "ModelContext.hpp"
+#include "ModelTrainingDesc.hpp"
+#include "MnistModel.hpp"
+
+// Multi-epoch training with more threads than predict() uses on the test set
+// (one per PREDICT_BATCH_SIZE rows): the end-of-epoch evaluation must leave
+// the replicas of the next epoch intact.
+
+namespace {
+
+    constexpr u32 NUM_TRAIN = 2000;
+    constexpr u32 NUM_TEST = 300;
+    constexpr u32 NUM_THREADS = 8;
+
+    bool all_finite(const Matrix& m) {
+        for (u64 i = 0; i < m.size(); i++) {
+            if (!std::isfinite(m.data[i])) return false;
+        }
+        return true;
+    }
+
+    void train_and_check(const ModelTrainingDesc& base, bool hogwild, bool bf16_storage) {
+        ModelContext model;
+        create_mnist_model(model);
+        ModelCompileDesc compile_desc;
+        compile_desc.bf16_storage = bf16_storage;
+        model.compile(compile_desc);
+
+        ModelTrainingDesc desc = base;
+        desc.hogwild = hogwild;
+        model.train(desc);
+        CHECK(all_finite(model.param_slab()));
+
+        // Every thread count, before and after another round of training
+        std::vector<u32> labels(NUM_TEST);
+        for (u32 threads = 1; threads <= NUM_THREADS; threads++) {
+            model.predict(*desc.test_images, labels.data(), nullptr, threads);
+            for (u32 label : labels) CHECK(label < 10);
+        }
+        model.train(desc);
+        CHECK(all_finite(model.param_slab()));
+    }
+
+    // Replicas built under bf16 storage must not outlive a recompile to f32:
+    // afterwards several threads predict and train exactly like a fresh model
+    void recompile_and_check(const ModelTrainingDesc& base) {
+        constexpr u32 THREADS = 3;
+        ModelContext model;
+        create_mnist_model(model);
+        ModelCompileDesc bf16_desc;
+        bf16_desc.bf16_storage = true;
+        model.compile(bf16_desc);
+
+        ModelTrainingDesc desc = base;
+        desc.epochs = 1;
+        desc.num_threads = THREADS;
+        model.train(desc);
+        model.compile();
+
+        std::vector<u32> labels(NUM_TEST);
+        std::vector<f32> probs_one(NUM_TEST * 10);
+        std::vector<f32> probs_many(NUM_TEST * 10);
+        model.predict(*desc.test_images, labels.data(), probs_one.data(), 1);
+        model.predict(*desc.test_images, labels.data(), probs_many.data(), THREADS);
+        f32 max_diff = 0.0f;
+        for (u32 i = 0; i < NUM_TEST * 10; i++) {
+            max_diff = std::fmax(max_diff, std::fabs(probs_one[i] - probs_many[i]));
+        }
+        CHECK(max_diff == 0.0f);
+
+        auto fresh = model.clone();
+        PRNG::set_seed(3);
+        model.train(desc);
+        PRNG::set_seed(3);
+        fresh->train(desc);
+        Matrix trained = model.param_slab();
+        Matrix expected = fresh->param_slab();
+        CHECK(trained.size() == expected.size());
+        CHECK(std::memcmp(trained.data, expected.data, trained.size() * sizeof(f32)) == 0);
+    }
+
+} // namespace
+
+int main() {
+    PRNG::set_seed(1);
+    PRNG prng(2);
+    test::TempFiles files;
+    auto train_images = test::synthetic_dataset(files, "train_images", NUM_TRAIN, 784, false, prng);
+    auto train_labels = test::synthetic_dataset(files, "train_labels", NUM_TRAIN, 1, true, prng);
+    auto test_images = test::synthetic_dataset(files, "test_images", NUM_TEST, 784, false, prng);
+    auto test_labels = test::synthetic_dataset(files, "test_labels", NUM_TEST, 1, true, prng);
+    CHECK(train_images && train_labels && test_images && test_labels);
+    if (test::failures() != 0) return test::exit_code();
+
+    ModelTrainingDesc desc;
+    desc.train_images = train_images.get();
+    desc.train_labels = train_labels.get();
+    desc.test_images = test_images.get();
+    desc.test_labels = test_labels.get();
+    desc.epochs = 3;
+    desc.batch_size = 64;
+    desc.num_threads = NUM_THREADS;
+    desc.verbose = false;
+
+    train_and_check(desc, false, false);
+    train_and_check(desc, false, true);
+    train_and_check(desc, true, false);
+    train_and_check(desc, true, true);
+    recompile_and_check(desc);
+
+    return test::exit_code();
+}
@@ -0,0 +1,216 @@
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "TestUtil.hpp"
+#include "VecMath.hpp"
+
+// VecMath exp and log against the correctly rounded result (double
+// precision std::exp and std::log), for the scalar form and every SIMD form
+// the CPU runs: at most 1 ulp over a sweep of all f32 bit patterns, the
+// special values (zeros, subnormals, infinities, NaN, overflow, underflow)
+// as documented, and every form bit-identical to the scalar one.
+
+namespace {
+
+    // Every STRIDE-th bit pattern, both signs; the stride is odd so every
+    // exponent and a spread of mantissas are hit
+    constexpr u32 STRIDE = 1021;
+
+    using Kernel = void (*)(const f32* src, f32* dst, u64 count);
+
+    struct Form {
+        const char* name;
+        Kernel exp;
+        Kernel log;
+    };
+
+    f32 from_bits(u32 bits) {
+        f32 x;
+        std::memcpy(&x, &bits, sizeof(x));
+        return x;
+    }
+
+    u32 to_bits(f32 x) {
+        u32 bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        return bits;
+    }
+
+    void exp_scalar_array(const f32* src, f32* dst, u64 count) {
+        for (u64 i = 0; i < count; i++) dst[i] = VecMath::exp_scalar(src[i]);
+    }
+
+    void log_scalar_array(const f32* src, f32* dst, u64 count) {
+        for (u64 i = 0; i < count; i++) dst[i] = VecMath::log_scalar(src[i]);
+    }
+
+#if MNIST_X86_SIMD
+    // Whole vectors and then the tail one value at a time, each in lane 0 of
+    // an otherwise zero vector
+#define VECMATH_TEST_MAP(name, isa, lanes, loadu, storeu, op)           \
+    MNIST_TARGET(isa) void name(const f32* src, f32* dst, u64 count) {   \
+        u64 i = 0;                                                        \
+        for (; i + lanes <= count; i += lanes) {                          \
+            storeu(dst + i, VecMath::op(loadu(src + i)));                 \
+        }                                                                 \
+        for (; i < count; i++) {                                          \
+            f32 buf[lanes] = {};                                          \
+            buf[0] = src[i];                                              \
+            storeu(buf, VecMath::op(loadu(buf)));                         \
+            dst[i] = buf[0];                                              \
+        }                                                                 \
+    }
+
+    VECMATH_TEST_MAP(exp_avx2_array, "avx2,fma", 8, _mm256_loadu_ps, _mm256_storeu_ps, exp_avx2)
+    VECMATH_TEST_MAP(log_avx2_array, "avx2,fma", 8, _mm256_loadu_ps, _mm256_storeu_ps, log_avx2)
+    VECMATH_TEST_MAP(exp_avx512_array, "avx512f", 16, _mm512_loadu_ps, _mm512_storeu_ps, exp_avx512)
+    VECMATH_TEST_MAP(log_avx512_array, "avx512f", 16, _mm512_loadu_ps, _mm512_storeu_ps, log_avx512)
+#undef VECMATH_TEST_MAP
+#endif
+
+    // Position of x among the f32 values in order, -0 and +0 together
+    i64 ordinal(f32 x) {
+        i64 bits = to_bits(x) & 0x7FFFFFFF;
+        return (to_bits(x) >> 31) ? -bits : bits;
+    }
+
+    // How many f32 values y is away from the correctly rounded result of
+    // exact; infinities count as the values past FLT_MAX
+    u64 ulp_error(f32 y, double exact) {
+        if (std::isnan(y)) return UINT64_MAX;
+        i64 diff = ordinal(y) - ordinal(static_cast<f32>(exact));
+        return static_cast<u64>(diff < 0 ? -diff : diff);
+    }
+
+    // Max ulp error of kernel over xs; where the exact result is NaN the
+    // kernel's must be too
+    u64 max_ulp(Kernel kernel, double (*reference)(double), const std::vector<f32>& xs, std::vector<f32>& ys,
+        f32& worst_x) {
+        kernel(xs.data(), ys.data(), xs.size());
+        u64 worst = 0;
+        for (u64 i = 0; i < xs.size(); i++) {
+            double exact = reference(static_cast<double>(xs[i]));
+            if (std::isnan(exact)) {
+                if (!std::isnan(ys[i])) return UINT64_MAX;
+                continue;
+            }
+            u64 err = ulp_error(ys[i], exact);
+            if (err > worst) {
+                worst = err;
+                worst_x = xs[i];
+            }
+        }
+        return worst;
+    }
+
+    bool same_bits(f32 a, f32 b) {
+        return (std::isnan(a) && std::isnan(b)) || to_bits(a) == to_bits(b);
+    }
+
+    void check_specials(const Form& form) {
+        struct Case {
+            f32 x;
+            f32 exp;
+            f32 log;
+        };
+        const f32 denorm_min = from_bits(1);
+        const Case cases[] = {
+            { 0.0f, 1.0f, -INFINITY },
+            { -0.0f, 1.0f, -INFINITY },
+            { 1.0f, std::exp(1.0f), 0.0f },
+            { INFINITY, INFINITY, INFINITY },
+            { -INFINITY, 0.0f, NAN },
+            { NAN, NAN, NAN },
+            { -1.0f, std::exp(-1.0f), NAN },
+            { -denorm_min, 1.0f, NAN },
+            { 89.0f, INFINITY, std::log(89.0f) },
+            { 1000.0f, INFINITY, std::log(1000.0f) },
+            { -104.0f, 0.0f, NAN },
+            { -1000.0f, 0.0f, NAN },
+            { denorm_min, 1.0f, static_cast<f32>(std::log(static_cast<double>(denorm_min))) },
+            { FLT_MAX, INFINITY, static_cast<f32>(std::log(static_cast<double>(FLT_MAX))) },
+        };
+        for (const Case& c : cases) {
+            f32 e;
+            f32 l;
+            form.exp(&c.x, &e, 1);
+            form.log(&c.x, &l, 1);
+            bool exp_ok = std::isnan(c.exp) ? std::isnan(e) : ulp_error(e, c.exp) <= 1;
+            bool log_ok = std::isnan(c.log) ? std::isnan(l) : ulp_error(l, c.log) <= 1;
+            if (!exp_ok || !log_ok) {
+                std::fprintf(stderr, "%s: x = %g gives exp %g (want %g), log %g (want %g)\n",
+                    form.name, c.x, e, c.exp, l, c.log);
+            }
+            CHECK(exp_ok);
+            CHECK(log_ok);
+        }
+
+        // Just past the overflow and underflow thresholds
+        f32 big = std::nextafter(std::log(FLT_MAX), INFINITY);
+        f32 e;
+        form.exp(&big, &e, 1);
+        CHECK(std::isinf(e) && e > 0.0f);
+        f32 small = -104.0f;
+        form.exp(&small, &e, 1);
+        CHECK(e == 0.0f);
+    }
+
+} // namespace
+
+int main() {
+    std::vector<f32> xs;
+    for (u64 bits = 0; bits <= 0xFFFFFFFFull; bits += STRIDE) {
+        xs.push_back(from_bits(static_cast<u32>(bits)));
+    }
+    // Exponent and mantissa boundaries, subnormals included
+    for (u32 e = 0; e < 256; e++) {
+        for (u32 m : { 0u, 1u, 0x3504F3u, 0x3504F4u, 0x7FFFFFu }) {
+            xs.push_back(from_bits(e << 23 | m));
+            xs.push_back(from_bits(0x80000000u | e << 23 | m));
+        }
+    }
+
+    std::vector<Form> forms = { { "scalar", exp_scalar_array, log_scalar_array } };
+#if MNIST_X86_SIMD
+    if (Cpu::has_avx2_fma()) {
+        forms.push_back({ "avx2", exp_avx2_array, log_avx2_array });
+    }
+    if (Cpu::has_avx512f()) {
+        forms.push_back({ "avx512", exp_avx512_array, log_avx512_array });
+    }
+#endif
+    // The dispatching entry points, whatever they picked
+    forms.push_back({ "dispatch", VecMath::exp, VecMath::log });
+
+    std::vector<f32> reference_exp(xs.size());
+    std::vector<f32> reference_log(xs.size());
+    exp_scalar_array(xs.data(), reference_exp.data(), xs.size());
+    log_scalar_array(xs.data(), reference_log.data(), xs.size());
+
+    std::vector<f32> ys(xs.size());
+    for (const Form& form : forms) {
+        f32 worst_exp_x = 0.0f;
+        f32 worst_log_x = 0.0f;
+        u64 exp_ulp = max_ulp(form.exp, [](double x) { return std::exp(x); }, xs, ys, worst_exp_x);
+        u64 exp_mismatches = 0;
+        for (u64 i = 0; i < xs.size(); i++) exp_mismatches += !same_bits(ys[i], reference_exp[i]);
+        u64 log_ulp = max_ulp(form.log, [](double x) { return std::log(x); }, xs, ys, worst_log_x);
+        u64 log_mismatches = 0;
+        for (u64 i = 0; i < xs.size(); i++) log_mismatches += !same_bits(ys[i], reference_log[i]);
+
+        std::printf("%-8s exp: %llu ulp (x = %g), log: %llu ulp (x = %g), %llu/%llu differ from scalar\n",
+            form.name, static_cast<unsigned long long>(exp_ulp), worst_exp_x,
+            static_cast<unsigned long long>(log_ulp), worst_log_x,
+            static_cast<unsigned long long>(exp_mismatches), static_cast<unsigned long long>(log_mismatches));
+        CHECK(exp_ulp <= 1);
+        CHECK(log_ulp <= 1);
+        CHECK(exp_mismatches == 0);
+        CHECK(log_mismatches == 0);
+        check_specials(form);
+    }
+
+    return test::exit_code();
+}